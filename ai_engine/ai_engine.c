@@ -4,30 +4,344 @@
  * This file implements the AI engine functionality for NexOS.
  */
 
+#define _GNU_SOURCE
 #include "ai_engine.h"
 #include "../memory/memory.h"
 #include "../scheduler/scheduler.h"
 #include "../io/io.h"
 #include "../security/security.h"
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 /* AI models */
 static ai_model_t models[6] = {0}; /* One for each AI_MODEL_* type */
 
+/* Snapshot file of model state and history, a fixed layout mapped whole */
+#define AI_SNAPSHOT_MAGIC 0x3153584EU /* "NXS1" */
+
+/* Largest model image a snapshot keeps */
+#define AI_SNAPSHOT_IMAGE_MAX 2048
+
+typedef struct {
+    uint32_t model_size;           /* 0 if no model */
+    uint32_t version;
+    uint64_t last_updated;
+    uint64_t inference_count;
+    float accuracy;
+    alignas(8) uint8_t image[AI_SNAPSHOT_IMAGE_MAX];
+} ai_snapshot_model_t;
+
+typedef struct {
+    uint32_t magic;                /* AI_SNAPSHOT_MAGIC */
+    uint32_t size;                 /* sizeof(ai_snapshot_t), the layout's version */
+    uint32_t valid;                /* 1 once saved, 0 while being saved */
+    uint32_t next_patch_id;
+    uint32_t history_next;
+    optimization_history_t history;
+    ai_snapshot_model_t models[6];
+} ai_snapshot_t;
+
 /* AI engine state */
 static struct {
     bool initialized;
     uint64_t last_collection_time;
     uint64_t last_analysis_time;
     uint64_t last_learning_time;
-    performance_metrics_t last_metrics;
-    uint32_t process_profile_count;
-    process_ai_profile_t* process_profiles;
     optimization_history_t history;
-} ai_state = {0};
+    uint32_t history_next;         /* Entry of history written next */
+    uint32_t history_learned;      /* Entries before it are folded into the models' accuracy */
+    uint32_t next_patch_id;
+    
+    /* Process profiles by PID slot (pid 0 if unused), their features and
+       the scheduler model's scores as structure of arrays */
+    pthread_mutex_t lock;          /* Guards the models and profiles */
+    process_ai_profile_t process_profiles[MAX_PROCESSES];
+    alignas(64) int8_t profile_features[AI_MODEL_INPUTS][MAX_PROCESSES];
+    alignas(64) float profile_scores[AI_MODEL_MAX_OUTPUTS][MAX_PROCESSES];
+    
+    /* Latest collected metrics, under a sequence lock: the sequence is odd
+       while a collector writes them and 0 until the first collection */
+    pthread_mutex_t metrics_lock;  /* Serializes collectors */
+    _Atomic uint32_t metrics_sequence;
+    performance_metrics_t last_metrics;
+    _Atomic(ai_request_source_t) request_source;
+    ai_snapshot_t* snapshot;       /* Mapped snapshot file, NULL if none */
+} ai_state = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .metrics_lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+/* Tuning patch: a patch descriptor whose code is a tuning action and whose
+   original code is the action undoing it, filled in when it is applied */
+typedef struct {
+    patch_descriptor_t descriptor;
+    tuning_action_t action;
+    tuning_action_t inverse;
+    uint32_t suggestion_id;
+} tuning_patch_t;
+
+/**
+ * Current monotonic time in milliseconds
+ */
+static uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000ULL + (uint64_t)ts.tv_nsec / 1000000ULL;
+}
+
+/**
+ * Quantize a value from 0 to 1 into a feature
+ */
+static int8_t quantize_feature(float value) {
+    if (!(value > 0.0f)) {
+        return 0;
+    }
+    return value >= 1.0f ? INT8_MAX : (int8_t)(value * INT8_MAX + 0.5f);
+}
+
+/**
+ * Round to the nearest integer
+ */
+static int32_t round_score(float value) {
+    return (int32_t)(value < 0.0f ? value - 0.5f : value + 0.5f);
+}
+
+/**
+ * Build the default scheduler model
+ *
+ * Two hidden units ramp from 0 to 127 as the CPU and the I/O intensity
+ * rise from 0.8 to 0.93. CPU-bound processes are moved a level down and
+ * get time slices of up to 20 ms, I/O-bound ones a level up with slices
+ * down to 5 ms; balanced processes keep their priority and 10 ms.
+ */
+static void* build_default_scheduler_model(uint32_t* size) {
+    *size = ai_model_image_size(8, AI_SCHED_OUTPUTS);
+    uint8_t* image = memory_allocate(*size);
+    if (!image) {
+        return NULL;
+    }
+    memset(image, 0, *size);
+    
+    ai_model_header_t* header = (ai_model_header_t*)image;
+    header->magic = AI_MODEL_MAGIC;
+    header->hidden = 8;
+    header->outputs = AI_SCHED_OUTPUTS;
+    header->hidden_shift = 0;
+    header->output_scale[AI_SCHED_OUTPUT_PRIORITY_DELTA] = 1.0f / 127.0f;
+    header->output_scale[AI_SCHED_OUTPUT_TIME_SLICE] = 5.0f / 127.0f;
+    
+    ai_network_t network;
+    ai_network_parse(image, *size, &network);
+    int8_t* hidden_weights = (int8_t*)network.hidden_weights;
+    int32_t* hidden_biases = (int32_t*)network.hidden_biases;
+    int8_t* output_weights = (int8_t*)network.output_weights;
+    int32_t* output_biases = (int32_t*)network.output_biases;
+    
+    /* Hidden unit 0: CPU-bound, 1: I/O-bound (8 steps per 0.8 step) */
+    hidden_weights[0 * AI_MODEL_INPUTS + AI_FEATURE_CPU_INTENSITY] = 8;
+    hidden_biases[0] = -8 * 102;
+    hidden_weights[1 * AI_MODEL_INPUTS + AI_FEATURE_IO_INTENSITY] = 8;
+    hidden_biases[1] = -8 * 102;
+    
+    /* Priority delta from -1 to 1 */
+    output_weights[AI_SCHED_OUTPUT_PRIORITY_DELTA * 8 + 0] = 1;
+    output_weights[AI_SCHED_OUTPUT_PRIORITY_DELTA * 8 + 1] = -1;
+    
+    /* Time slice of 10 ms, up to 20 when CPU-bound and down to 5 when I/O-bound */
+    output_weights[AI_SCHED_OUTPUT_TIME_SLICE * 8 + 0] = 2;
+    output_weights[AI_SCHED_OUTPUT_TIME_SLICE * 8 + 1] = -1;
+    output_biases[AI_SCHED_OUTPUT_TIME_SLICE] = 254;
+    
+    return image;
+}
+
+/**
+ * Publish collected metrics
+ *
+ * Readers copy the metrics without taking the lock and retry if the
+ * sequence changed meanwhile, so they never see a half-written set.
+ */
+static void publish_metrics(const performance_metrics_t* metrics) {
+    pthread_mutex_lock(&ai_state.metrics_lock);
+    
+    uint32_t sequence = atomic_load_explicit(&ai_state.metrics_sequence, memory_order_relaxed);
+    atomic_store_explicit(&ai_state.metrics_sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    
+    memcpy(&ai_state.last_metrics, metrics, sizeof(performance_metrics_t));
+    
+    atomic_store_explicit(&ai_state.metrics_sequence, sequence + 2, memory_order_release);
+    
+    pthread_mutex_unlock(&ai_state.metrics_lock);
+}
+
+/**
+ * Set the snapshot file
+ *
+ * The file is created if missing and mapped shared, so saving is a copy
+ * into the mapping. Reading it is left to the engine's initialization.
+ * An existing file is used only if its header names it a snapshot of this
+ * layout; any other file is refused with ERROR_INVALID_PARAMETER and left
+ * as it is.
+ */
+error_code_t ai_engine_set_snapshot(const char* path) {
+    if (ai_state.initialized) {
+        return ERROR_RESOURCE_BUSY;
+    }
+    
+    if (ai_state.snapshot) {
+        munmap(ai_state.snapshot, sizeof(ai_snapshot_t));
+        ai_state.snapshot = NULL;
+    }
+    if (!path) {
+        return ERROR_NONE;
+    }
+    
+    /* Only a file created here is sized; an existing one must already be a snapshot */
+    bool created = true;
+    int fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0 && errno == EEXIST) {
+        created = false;
+        fd = open(path, O_RDWR | O_CLOEXEC);
+    }
+    if (fd < 0) {
+        return errno == EACCES ? ERROR_PERMISSION_DENIED : ERROR_INVALID_PARAMETER;
+    }
+    
+    error_code_t err = ERROR_NONE;
+    if (created) {
+        if (ftruncate(fd, sizeof(ai_snapshot_t)) != 0) {
+            unlink(path);
+            err = ERROR_UNKNOWN;
+        }
+    } else {
+        struct stat st;
+        uint32_t header[2];
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size != (off_t)sizeof(ai_snapshot_t) ||
+            pread(fd, header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+            header[0] != AI_SNAPSHOT_MAGIC || header[1] != sizeof(ai_snapshot_t)) {
+            err = ERROR_INVALID_PARAMETER;
+        }
+    }
+    if (err != ERROR_NONE) {
+        close(fd);
+        return err;
+    }
+    
+    void* map = mmap(NULL, sizeof(ai_snapshot_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        if (created) {
+            unlink(path);
+        }
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    
+    /* A new file is a snapshot with nothing saved yet */
+    ai_state.snapshot = (ai_snapshot_t*)map;
+    if (created) {
+        ai_state.snapshot->magic = AI_SNAPSHOT_MAGIC;
+        ai_state.snapshot->size = sizeof(ai_snapshot_t);
+        ai_state.snapshot->valid = 0;
+    }
+    return ERROR_NONE;
+}
+
+/**
+ * Start from the snapshot, if the file holds a valid one
+ *
+ * Models go through ai_engine_load_model, so a damaged image is skipped
+ * and the engine falls back to its built-in model.
+ */
+static void snapshot_load(void) {
+    const ai_snapshot_t* snapshot = ai_state.snapshot;
+    if (!snapshot || snapshot->magic != AI_SNAPSHOT_MAGIC || snapshot->size != sizeof(ai_snapshot_t) ||
+        snapshot->valid != 1 || snapshot->history.entry_count > 100) {
+        return;
+    }
+    
+    memcpy(&ai_state.history, &snapshot->history, sizeof(optimization_history_t));
+    ai_state.history_next = snapshot->history_next;
+    ai_state.history_learned = snapshot->history_next; /* Saved accuracy has them */
+    if (snapshot->next_patch_id != 0) {
+        ai_state.next_patch_id = snapshot->next_patch_id;
+    }
+    
+    for (int i = 0; i < 6; i++) {
+        const ai_snapshot_model_t* saved = &snapshot->models[i];
+        if (saved->model_size == 0 || saved->model_size > AI_SNAPSHOT_IMAGE_MAX ||
+            ai_engine_load_model((ai_model_type_t)i, (void*)saved->image, saved->model_size) != ERROR_NONE) {
+            continue;
+        }
+        models[i].version = saved->version;
+        models[i].last_updated = saved->last_updated;
+        models[i].inference_count = saved->inference_count;
+        models[i].accuracy = saved->accuracy;
+    }
+}
+
+/**
+ * Save model state and history to the snapshot file
+ *
+ * The valid flag is cleared first and set last, so if the process dies
+ * midway the next start finds no saved state rather than a torn one. The
+ * pages are written back asynchronously; after a system crash a snapshot
+ * may mix two saves, each part of which still loads.
+ */
+error_code_t ai_engine_save_snapshot(void) {
+    if (!ai_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    ai_snapshot_t* snapshot = ai_state.snapshot;
+    if (!snapshot) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    pthread_mutex_lock(&ai_state.lock);
+    snapshot->valid = 0;
+    atomic_signal_fence(memory_order_seq_cst);
+    
+    snapshot->next_patch_id = ai_state.next_patch_id;
+    snapshot->history_next = ai_state.history_next;
+    memcpy(&snapshot->history, &ai_state.history, sizeof(optimization_history_t));
+    
+    for (int i = 0; i < 6; i++) {
+        ai_snapshot_model_t* saved = &snapshot->models[i];
+        if (!models[i].model_data || models[i].model_size > AI_SNAPSHOT_IMAGE_MAX) {
+            saved->model_size = 0;
+            continue;
+        }
+        memcpy(saved->image, models[i].model_data, models[i].model_size);
+        saved->model_size = models[i].model_size;
+        saved->version = models[i].version;
+        saved->last_updated = models[i].last_updated;
+        saved->inference_count = models[i].inference_count;
+        saved->accuracy = models[i].accuracy;
+    }
+    
+    atomic_signal_fence(memory_order_seq_cst);
+    snapshot->valid = 1;
+    pthread_mutex_unlock(&ai_state.lock);
+    
+    msync(snapshot, sizeof(ai_snapshot_t), MS_ASYNC);
+    return ERROR_NONE;
+}
 
 /**
  * Initialize AI engine
+ *
+ * Process profiles and their features are static storage, zero until
+ * first used, so initializing touches none of them. The models and
+ * history come from the snapshot file when it holds one.
  */
 error_code_t ai_engine_init(void) {
     if (ai_state.initialized) {
@@ -50,39 +364,23 @@ error_code_t ai_engine_init(void) {
     ai_state.last_collection_time = 0;
     ai_state.last_analysis_time = 0;
     ai_state.last_learning_time = 0;
-    memset(&ai_state.last_metrics, 0, sizeof(performance_metrics_t));
-    ai_state.process_profile_count = 0;
-    ai_state.process_profiles = NULL;
     memset(&ai_state.history, 0, sizeof(optimization_history_t));
-    
-    /* Allocate memory for process profiles */
-    ai_state.process_profiles = (process_ai_profile_t*)memory_allocate(
-        sizeof(process_ai_profile_t) * MAX_PROCESSES);
-    if (!ai_state.process_profiles) {
-        ai_state.initialized = false;
-        return ERROR_MEMORY_ALLOCATION;
-    }
-    
-    /* Load initial AI models (minimal versions) */
-    /* In a real implementation, these would be loaded from storage */
-    /* For now, we'll create placeholder models */
-    for (int i = 0; i < 6; i++) {
-        models[i].model_data = memory_allocate(1024); /* Minimal model size */
-        if (!models[i].model_data) {
-            /* Clean up previously allocated models */
-            for (int j = 0; j < i; j++) {
-                memory_free(models[j].model_data);
-            }
-            memory_free(ai_state.process_profiles);
+    ai_state.history_next = 0;
+    ai_state.history_learned = 0;
+    ai_state.next_patch_id = 1;
+    snapshot_load();
+    
+    /* Without a saved one, the scheduler model starts out as the built-in
+       one; the others stay empty until loaded */
+    if (!models[AI_MODEL_SCHEDULER].model_data) {
+        uint32_t size;
+        models[AI_MODEL_SCHEDULER].model_data = build_default_scheduler_model(&size);
+        if (!models[AI_MODEL_SCHEDULER].model_data) {
             ai_state.initialized = false;
             return ERROR_MEMORY_ALLOCATION;
         }
-        models[i].model_size = 1024;
-        models[i].version = 1;
-        models[i].last_updated = 0;
-        
-        /* Initialize model data with placeholder values */
-        memset(models[i].model_data, 0, 1024);
+        models[AI_MODEL_SCHEDULER].model_size = size;
+        models[AI_MODEL_SCHEDULER].version = 1;
     }
     
     return ERROR_NONE;
@@ -90,6 +388,10 @@ error_code_t ai_engine_init(void) {
 
 /**
  * Load AI model
+ *
+ * The data is a model image (see inference.h); the scheduler model needs
+ * at least AI_SCHED_OUTPUTS outputs. An invalid image leaves the current
+ * model in place.
  */
 error_code_t ai_engine_load_model(ai_model_type_t type, void* model_data, uint32_t model_size) {
     if (!ai_state.initialized) {
@@ -100,59 +402,73 @@ error_code_t ai_engine_load_model(ai_model_type_t type, void* model_data, uint32
         return ERROR_INVALID_PARAMETER;
     }
     
-    /* Free existing model if any */
-    if (models[type].model_data) {
-        memory_free(models[type].model_data);
+    /* Copy model data, aligned for the layers */
+    void* data = memory_allocate(model_size);
+    if (!data) {
+        return ERROR_MEMORY_ALLOCATION;
     }
+    memcpy(data, model_data, model_size);
     
-    /* Allocate memory for new model */
-    models[type].model_data = memory_allocate(model_size);
-    if (!models[type].model_data) {
-        return ERROR_MEMORY_ALLOCATION;
+    ai_network_t network;
+    if (ai_network_parse(data, model_size, &network) != ERROR_NONE ||
+        (type == AI_MODEL_SCHEDULER && network.header->outputs < AI_SCHED_OUTPUTS)) {
+        memory_free(data);
+        return ERROR_INVALID_PARAMETER;
     }
     
-    /* Copy model data */
-    memcpy(models[type].model_data, model_data, model_size);
+    /* Replace existing model if any */
+    pthread_mutex_lock(&ai_state.lock);
+    if (models[type].model_data) {
+        memory_free(models[type].model_data);
+    }
+    models[type].model_data = data;
     models[type].model_size = model_size;
     models[type].version++;
     models[type].last_updated = ai_state.last_collection_time;
     models[type].inference_count = 0;
     models[type].accuracy = 0.0f; /* Will be updated after first inference */
+    pthread_mutex_unlock(&ai_state.lock);
     
     return ERROR_NONE;
 }
 
 /**
  * Create process AI profile
+ *
+ * Profiles are stored at the slot of their process's PID in the kernel's
+ * process table, which the process holds until it terminates.
  */
 error_code_t ai_engine_create_process_profile(process_t* process) {
     if (!ai_state.initialized) {
         return ERROR_NOT_IMPLEMENTED;
     }
     
-    if (!process) {
+    if (!process || process->pid == 0) {
         return ERROR_INVALID_PARAMETER;
     }
     
-    /* Check if we've reached the maximum number of profiles */
-    if (ai_state.process_profile_count >= MAX_PROCESSES) {
-        return ERROR_RESOURCE_BUSY;
-    }
-    
     /* Initialize process profile */
-    process_ai_profile_t* profile = &ai_state.process_profiles[ai_state.process_profile_count++];
+    uint32_t slot = PROCESS_SLOT(process->pid);
+    process_ai_profile_t* profile = &ai_state.process_profiles[slot];
+    
+    pthread_mutex_lock(&ai_state.lock);
     profile->pid = process->pid;
     profile->creation_time = process->creation_time;
     profile->cpu_time = 0;
     profile->memory_usage = 0;
     profile->priority_changes = 0;
     profile->io_operations = 0;
-    profile->cpu_intensity = 0.0f;
-    profile->memory_intensity = 0.0f;
-    profile->io_intensity = 0.0f;
+    profile->priority = process->priority;
     profile->optimal_priority = process->priority;
     profile->optimal_time_slice = 10; /* Default time slice in milliseconds */
     
+    for (uint32_t i = 0; i < AI_MODEL_INPUTS; i++) {
+        ai_state.profile_features[i][slot] = 0;
+    }
+    ai_state.profile_features[AI_FEATURE_PRIORITY][slot] =
+        quantize_feature((float)process->priority / (MAX_PRIORITY_LEVELS - 1));
+    pthread_mutex_unlock(&ai_state.lock);
+    
     /* Attach profile to process */
     process->ai_profile = profile;
     
@@ -160,9 +476,9 @@ error_code_t ai_engine_create_process_profile(process_t* process) {
 }
 
 /**
- * Update process AI profile
+ * Destroy process AI profile
  */
-error_code_t ai_engine_update_process_profile(process_t* process) {
+error_code_t ai_engine_destroy_process_profile(process_t* process) {
     if (!ai_state.initialized) {
         return ERROR_NOT_IMPLEMENTED;
     }
@@ -172,42 +488,117 @@ error_code_t ai_engine_update_process_profile(process_t* process) {
     }
     
     process_ai_profile_t* profile = (process_ai_profile_t*)process->ai_profile;
+    pthread_mutex_lock(&ai_state.lock);
+    if (profile->pid == process->pid) {
+        profile->pid = 0;
+    }
+    pthread_mutex_unlock(&ai_state.lock);
+    process->ai_profile = NULL;
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Refresh a profile and its features from its process
+ */
+static void profile_refresh(process_ai_profile_t* profile, const process_t* process) {
+    uint32_t slot = PROCESS_SLOT(profile->pid);
     
     /* Update profile with current process statistics */
     profile->cpu_time = process->cpu_time;
+    profile->priority = process->priority;
     
     /* Calculate intensities based on recent behavior */
-    /* In a real implementation, this would use more sophisticated analysis */
-    profile->cpu_intensity = (float)process->cpu_time / (ai_state.last_collection_time - profile->creation_time);
-    
-    /* Determine optimal priority based on process behavior */
-    if (profile->cpu_intensity > 0.8f) {
-        /* CPU-bound process, lower priority (higher number) */
-        profile->optimal_priority = (process->priority < MAX_PRIORITY_LEVELS - 1) ? 
-                                   process->priority + 1 : process->priority;
-    } else if (profile->io_intensity > 0.8f) {
-        /* I/O-bound process, higher priority (lower number) */
-        profile->optimal_priority = (process->priority > 0) ? 
-                                   process->priority - 1 : process->priority;
-    }
-    
-    /* Determine optimal time slice based on process behavior */
-    if (profile->cpu_intensity > 0.8f) {
-        /* CPU-bound process, longer time slice */
-        profile->optimal_time_slice = 20;
-    } else if (profile->io_intensity > 0.8f) {
-        /* I/O-bound process, shorter time slice */
-        profile->optimal_time_slice = 5;
-    } else {
-        /* Balanced process, default time slice */
-        profile->optimal_time_slice = 10;
+    uint64_t lifetime = ai_state.last_collection_time > profile->creation_time ?
+                        ai_state.last_collection_time - profile->creation_time : 0;
+    float cpu_intensity = lifetime ? (float)process->cpu_time / (float)lifetime : 0.0f;
+    
+    ai_state.profile_features[AI_FEATURE_CPU_INTENSITY][slot] = quantize_feature(cpu_intensity);
+    ai_state.profile_features[AI_FEATURE_PRIORITY][slot] =
+        quantize_feature((float)process->priority / (MAX_PRIORITY_LEVELS - 1));
+}
+
+/**
+ * Update process AI profile
+ *
+ * Refreshes the profile's features; the optimal priority and time slice
+ * follow at the next ai_engine_score_profiles.
+ */
+error_code_t ai_engine_update_process_profile(process_t* process) {
+    if (!ai_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
     }
     
+    if (!process || !process->ai_profile) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    pthread_mutex_lock(&ai_state.lock);
+    profile_refresh((process_ai_profile_t*)process->ai_profile, process);
+    pthread_mutex_unlock(&ai_state.lock);
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Score every process profile with the scheduler model
+ *
+ * Refreshes the features of live profiles, runs the model once over the
+ * whole feature table, unused slots included, and sets each live
+ * profile's optimal priority and time slice from its scores.
+ */
+error_code_t ai_engine_score_profiles(void) {
+    if (!ai_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    pthread_mutex_lock(&ai_state.lock);
+    
+    ai_network_t network;
+    ai_model_t* model = &models[AI_MODEL_SCHEDULER];
+    if (!model->model_data ||
+        ai_network_parse(model->model_data, model->model_size, &network) != ERROR_NONE) {
+        pthread_mutex_unlock(&ai_state.lock);
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    for (uint32_t slot = 0; slot < MAX_PROCESSES; slot++) {
+        process_ai_profile_t* profile = &ai_state.process_profiles[slot];
+        process_t* process = profile->pid ? process_find(profile->pid) : NULL;
+        if (process) {
+            profile_refresh(profile, process);
+        }
+    }
+    
+    ai_network_run(&network, &ai_state.profile_features[0][0], MAX_PROCESSES, MAX_PROCESSES,
+                   &ai_state.profile_scores[0][0]);
+    model->inference_count++;
+    
+    for (uint32_t slot = 0; slot < MAX_PROCESSES; slot++) {
+        process_ai_profile_t* profile = &ai_state.process_profiles[slot];
+        if (!profile->pid) {
+            continue;
+        }
+    
+        int32_t priority = profile->priority +
+                           round_score(ai_state.profile_scores[AI_SCHED_OUTPUT_PRIORITY_DELTA][slot]);
+        int32_t time_slice = round_score(ai_state.profile_scores[AI_SCHED_OUTPUT_TIME_SLICE][slot]);
+    
+        profile->optimal_priority = (uint8_t)(priority < 0 ? 0 :
+                                              priority >= MAX_PRIORITY_LEVELS ? MAX_PRIORITY_LEVELS - 1 :
+                                              priority);
+        profile->optimal_time_slice = (uint32_t)(time_slice < 1 ? 1 : time_slice);
+    }
+    
+    pthread_mutex_unlock(&ai_state.lock);
     return ERROR_NONE;
 }
 
 /**
  * Collect performance metrics
+ *
+ * Fills metrics from every subsystem and publishes them as the latest set
+ * for ai_engine_get_metrics.
  */
 error_code_t ai_engine_collect_metrics(performance_metrics_t* metrics) {
     if (!ai_state.initialized) {
@@ -218,6 +609,8 @@ error_code_t ai_engine_collect_metrics(performance_metrics_t* metrics) {
         return ERROR_INVALID_PARAMETER;
     }
     
+    metrics->uptime = monotonic_ms();
+    
     /* Collect memory metrics */
     memory_metrics_t memory_metrics;
     error_code_t err = memory_get_metrics(&memory_metrics);
@@ -244,17 +637,120 @@ error_code_t ai_engine_collect_metrics(performance_metrics_t* metrics) {
         metrics->io_operations = io_metrics.completed_requests;
     }
     
+    /* Collect the application's request totals */
+    metrics->requests = 0;
+    metrics->request_latency = 0;
+    ai_request_source_t source = atomic_load_explicit(&ai_state.request_source, memory_order_acquire);
+    if (source) {
+        source(&metrics->requests, &metrics->request_latency);
+    }
+    
     /* Update collection timestamp */
     ai_state.last_collection_time = metrics->uptime;
     
     /* Store metrics for future reference */
-    memcpy(&ai_state.last_metrics, metrics, sizeof(performance_metrics_t));
+    publish_metrics(metrics);
     
     return ERROR_NONE;
 }
 
+/**
+ * Set the source of the request totals in collected metrics
+ *
+ * The source is called on every collection, from the collecting thread,
+ * and reports the requests the application has completed so far and
+ * their total latency; the self-evolution loop measures its trials by
+ * them.
+ */
+error_code_t ai_engine_set_request_source(ai_request_source_t source) {
+    atomic_store_explicit(&ai_state.request_source, source, memory_order_release);
+    return ERROR_NONE;
+}
+
+/**
+ * Get the latest collected metrics
+ *
+ * Copies a consistent set without blocking collectors; fails with
+ * ERROR_RESOURCE_BUSY until metrics have been collected once.
+ */
+error_code_t ai_engine_get_metrics(performance_metrics_t* metrics) {
+    if (!ai_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    if (!metrics) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    uint32_t before;
+    uint32_t after;
+    do {
+        before = atomic_load_explicit(&ai_state.metrics_sequence, memory_order_acquire);
+        if (before == 0) {
+            return ERROR_RESOURCE_BUSY;
+        }
+    
+        memcpy(metrics, &ai_state.last_metrics, sizeof(performance_metrics_t));
+    
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&ai_state.metrics_sequence, memory_order_relaxed);
+    } while ((before & 1) || before != after);
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Add a suggestion setting a tunable
+ *
+ * Returns false if its tuning action could not be allocated.
+ */
+static bool suggest(optimization_suggestion_t* suggestions, uint32_t* count, uint32_t id,
+                    const char* description, float expected_improvement, uint32_t confidence,
+                    tunable_t tunable, uint64_t value) {
+    tuning_action_t* action = (tuning_action_t*)memory_allocate(sizeof(tuning_action_t));
+    if (!action) {
+        return false;
+    }
+    action->tunable = tunable;
+    action->value = value;
+    action->previous = 0;
+    
+    optimization_suggestion_t* suggestion = &suggestions[(*count)++];
+    suggestion->id = id;
+    strcpy(suggestion->description, description);
+    suggestion->expected_improvement = expected_improvement;
+    suggestion->confidence = confidence;
+    suggestion->optimization_data = action;
+    suggestion->data_size = sizeof(tuning_action_t);
+    return true;
+}
+
+/**
+ * Get the mean time slice the scheduler model found for live processes
+ * (0 if none was scored)
+ */
+static uint32_t profile_time_slice(void) {
+    uint64_t total = 0;
+    uint32_t count = 0;
+    
+    pthread_mutex_lock(&ai_state.lock);
+    for (uint32_t slot = 0; slot < MAX_PROCESSES; slot++) {
+        const process_ai_profile_t* profile = &ai_state.process_profiles[slot];
+        if (profile->pid != 0 && profile->optimal_time_slice != 0) {
+            total += profile->optimal_time_slice;
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&ai_state.lock);
+    
+    return count ? (uint32_t)((total + count / 2) / count) : 0;
+}
+
 /**
  * Analyze performance metrics
+ *
+ * Every suggestion carries a tuning action for one tunable; the
+ * self-evolution loop trials it and keeps it only if it measurably helps.
  */
 error_code_t ai_engine_analyze_performance(performance_metrics_t* metrics, void** suggestions) {
     if (!ai_state.initialized) {
@@ -265,76 +761,99 @@ error_code_t ai_engine_analyze_performance(performance_metrics_t* metrics, void*
         return ERROR_INVALID_PARAMETER;
     }
     
-    /* Allocate memory for suggestions */
+    /* Allocate memory for suggestions (a zero ID ends the list) */
     optimization_suggestion_t* opt_suggestions = (optimization_suggestion_t*)memory_allocate(
         sizeof(optimization_suggestion_t) * 10); /* Up to 10 suggestions */
     if (!opt_suggestions) {
         return ERROR_MEMORY_ALLOCATION;
     }
+    memset(opt_suggestions, 0, sizeof(optimization_suggestion_t) * 10);
     
     uint32_t suggestion_count = 0;
     
+    /* Re-score process profiles against the new metrics */
+    ai_engine_score_profiles();
+    
     /* Analyze memory metrics */
-    if (metrics->memory.fragmentation_ratio > 0.5f) {
-        /* High memory fragmentation, suggest defragmentation */
-        optimization_suggestion_t* suggestion = &opt_suggestions[suggestion_count++];
-        suggestion->id = 1;
-        strcpy(suggestion->description, "Memory defragmentation recommended");
-        suggestion->expected_improvement = 0.3f;
-        suggestion->confidence = 80;
-        suggestion->optimization_data = NULL;
-        suggestion->data_size = 0;
-    }
-    
-    /* Analyze scheduler metrics */
-    if (metrics->scheduler.average_wait_time > 100.0f) {
-        /* High wait time, suggest scheduler optimization */
-        optimization_suggestion_t* suggestion = &opt_suggestions[suggestion_count++];
-        suggestion->id = 2;
-        strcpy(suggestion->description, "Scheduler time slice adjustment recommended");
-        suggestion->expected_improvement = 0.2f;
-        suggestion->confidence = 70;
-        
-        /* Create optimization data */
-        uint32_t* opt_data = (uint32_t*)memory_allocate(sizeof(uint32_t));
-        if (opt_data) {
-            *opt_data = 5; /* Suggested new time slice */
-            suggestion->optimization_data = opt_data;
-            suggestion->data_size = sizeof(uint32_t);
-        } else {
-            suggestion->optimization_data = NULL;
-            suggestion->data_size = 0;
+    if (metrics->memory.fragmentation_ratio > 0.5f && metrics->memory.cached_memory > 0) {
+        /* High memory fragmentation, suggest keeping fewer empty slabs */
+        suggest(opt_suggestions, &suggestion_count, AI_SUGGEST_CACHE_SIZE,
+                "Slab cache reduction recommended", 0.3f, 80,
+                TUNABLE_CACHE_SIZE, metrics->memory.cached_memory / 2);
+    }
+    
+    /* Analyze scheduler metrics: move to the time slice the scheduler model
+       found for the live processes, and to a shorter one while threads
+       wait long */
+    uint32_t slice = scheduler_get_time_slice();
+    if (slice > 0) {
+        uint32_t suggested = profile_time_slice();
+        if (suggested == 0) {
+            suggested = slice;
+        }
+        if (metrics->scheduler.average_wait_time > 100.0f && suggested > slice / 2) {
+            suggested = slice / 2 > 1 ? slice / 2 : 1;
+        }
+        if (suggested != slice) {
+            suggest(opt_suggestions, &suggestion_count, AI_SUGGEST_TIME_SLICE,
+                    "Scheduler time slice adjustment recommended", 0.2f, 70,
+                    TUNABLE_TIME_SLICE, suggested);
         }
     }
     
     /* Analyze I/O metrics */
     if (metrics->io_operations > 1000 && metrics->scheduler.cpu_utilization < 0.5f) {
         /* High I/O operations and low CPU utilization, suggest I/O optimization */
-        optimization_suggestion_t* suggestion = &opt_suggestions[suggestion_count++];
-        suggestion->id = 3;
-        strcpy(suggestion->description, "I/O scheduling policy adjustment recommended");
-        suggestion->expected_improvement = 0.25f;
-        suggestion->confidence = 65;
-        suggestion->optimization_data = NULL;
-        suggestion->data_size = 0;
+        if (io_get_scheduling_policy() != IO_SCHED_ADAPTIVE) {
+            suggest(opt_suggestions, &suggestion_count, AI_SUGGEST_IO_POLICY,
+                    "I/O scheduling policy adjustment recommended", 0.25f, 65,
+                    TUNABLE_IO_POLICY, IO_SCHED_ADAPTIVE);
+        }
+    
+        uint32_t readahead = io_get_readahead();
+        if (readahead < IO_READAHEAD_MAX) {
+            suggest(opt_suggestions, &suggestion_count, AI_SUGGEST_READAHEAD,
+                    "Wider readahead window recommended", 0.1f, 60,
+                    TUNABLE_READAHEAD, readahead * 2 < IO_READAHEAD_MAX ? readahead * 2 : IO_READAHEAD_MAX);
+        }
+    
+        uint32_t cpus = scheduler_get_cpu_count();
+        if (io_ring_get_workers() == 0 && cpus > 0) {
+            suggest(opt_suggestions, &suggestion_count, AI_SUGGEST_IO_WORKERS,
+                    "Async I/O worker limit recommended", 0.1f, 60,
+                    TUNABLE_IO_WORKERS, 2 * cpus);
+        }
     }
     
     /* Update analysis timestamp */
     ai_state.last_analysis_time = metrics->uptime;
     
-    /* Update model accuracy based on previous suggestions */
-    for (int i = 0; i < 6; i++) {
-        /* In a real implementation, this would compare predicted vs. actual improvements */
-        models[i].accuracy = 0.7f + (float)i / 60.0f; /* Placeholder accuracy */
-        models[i].inference_count++;
-    }
-    
     *suggestions = opt_suggestions;
     return ERROR_NONE;
 }
 
+/**
+ * Get the patch target module owning a tunable
+ */
+static uint32_t tunable_module(uint32_t tunable) {
+    switch (tunable) {
+        case TUNABLE_TIME_SLICE:
+            return PATCH_MODULE_SCHEDULER;
+    
+        case TUNABLE_CACHE_SIZE:
+            return PATCH_MODULE_MEMORY;
+    
+        default:
+            return PATCH_MODULE_DRIVER;
+    }
+}
+
 /**
  * Generate optimization patches
+ *
+ * Each patch is a patch_descriptor_t whose code is the tuning action of a
+ * suggestion (see self_evolution_apply_patch); the sizes that follow the
+ * patch pointers are those of the descriptors.
  */
 error_code_t ai_engine_generate_patches(void* suggestions, void** patches, uint32_t* patch_count) {
     if (!ai_state.initialized) {
@@ -353,9 +872,9 @@ error_code_t ai_engine_generate_patches(void* suggestions, void** patches, uint3
         suggestion_count++;
     }
     
+    *patches = NULL;
+    *patch_count = 0;
     if (suggestion_count == 0) {
-        *patches = NULL;
-        *patch_count = 0;
         return ERROR_NONE;
     }
     
@@ -373,75 +892,49 @@ error_code_t ai_engine_generate_patches(void* suggestions, void** patches, uint3
     /* Generate patches for each suggestion */
     for (uint32_t i = 0; i < suggestion_count; i++) {
         optimization_suggestion_t* suggestion = &opt_suggestions[i];
-        
-        /* Skip low-confidence suggestions */
-        if (suggestion->confidence < 60) {
+    
+        /* Skip low-confidence suggestions and those without a tuning action */
+        if (suggestion->confidence < 60 || !suggestion->optimization_data ||
+            suggestion->data_size != sizeof(tuning_action_t)) {
             continue;
         }
-        
-        /* Generate patch based on suggestion type */
-        switch (suggestion->id) {
-            case 1: /* Memory defragmentation */
-                {
-                    /* Create a patch that calls memory_defragment() */
-                    uint8_t* patch = (uint8_t*)memory_allocate(16);
-                    if (!patch) {
-                        continue;
-                    }
-                    
-                    /* In a real implementation, this would be actual machine code */
-                    /* For now, we'll use a placeholder */
-                    memset(patch, 0xCC, 16); /* Fill with breakpoint instructions */
-                    patch[0] = 0xE8; /* CALL instruction */
-                    
-                    patch_array[valid_patch_count] = patch;
-                    patch_sizes[valid_patch_count] = 16;
-                    valid_patch_count++;
-                }
-                break;
-                
-            case 2: /* Scheduler time slice adjustment */
-                {
-                    /* Create a patch that calls scheduler_set_time_slice() */
-                    uint8_t* patch = (uint8_t*)memory_allocate(16);
-                    if (!patch) {
-                        continue;
-                    }
-                    
-                    /* In a real implementation, this would be actual machine code */
-                    /* For now, we'll use a placeholder */
-                    memset(patch, 0xCC, 16); /* Fill with breakpoint instructions */
-                    patch[0] = 0xE8; /* CALL instruction */
-                    
-                    patch_array[valid_patch_count] = patch;
-                    patch_sizes[valid_patch_count] = 16;
-                    valid_patch_count++;
-                }
-                break;
-                
-            case 3: /* I/O scheduling policy adjustment */
-                {
-                    /* Create a patch that calls io_set_scheduling_policy() */
-                    uint8_t* patch = (uint8_t*)memory_allocate(16);
-                    if (!patch) {
-                        continue;
-                    }
-                    
-                    /* In a real implementation, this would be actual machine code */
-                    /* For now, we'll use a placeholder */
-                    memset(patch, 0xCC, 16); /* Fill with breakpoint instructions */
-                    patch[0] = 0xE8; /* CALL instruction */
-                    
-                    patch_array[valid_patch_count] = patch;
-                    patch_sizes[valid_patch_count] = 16;
-                    valid_patch_count++;
-                }
-                break;
-                
-            default:
-                /* Unknown suggestion type, skip */
-                break;
+    
+        tuning_patch_t* patch = (tuning_patch_t*)memory_allocate(sizeof(tuning_patch_t));
+        if (!patch) {
+            continue;
         }
+        memset(patch, 0, sizeof(tuning_patch_t));
+    
+        patch->action = *(const tuning_action_t*)suggestion->optimization_data;
+        patch->suggestion_id = suggestion->id;
+    
+        patch_descriptor_t* descriptor = &patch->descriptor;
+        descriptor->id = ai_state.next_patch_id++;
+        descriptor->size = sizeof(tuning_action_t);
+        descriptor->timestamp = ai_state.last_analysis_time;
+        descriptor->target_module = tunable_module(patch->action.tunable);
+        descriptor->target_offset = patch->action.tunable;
+        descriptor->original_size = sizeof(tuning_action_t);
+        descriptor->original_code = &patch->inverse;
+        descriptor->patch_code = &patch->action;
+        if (security_seal_patch(descriptor) != ERROR_NONE) {
+            memory_free(patch);
+            continue;
+        }
+    
+        patch_array[valid_patch_count] = patch;
+        patch_sizes[valid_patch_count] = sizeof(patch_descriptor_t);
+        valid_patch_count++;
+    }
+    
+    if (valid_patch_count == 0) {
+        memory_free(patch_array);
+        return ERROR_NONE;
+    }
+    
+    /* Keep the sizes right after the pointers in use */
+    if (valid_patch_count < suggestion_count) {
+        memmove(patch_array + valid_patch_count, patch_sizes, sizeof(uint32_t) * valid_patch_count);
     }
     
     *patches = patch_array;
@@ -528,18 +1021,18 @@ error_code_t ai_engine_update_optimization_history(optimization_history_t* histo
                 break;
             }
         }
-        
+    
         if (suggestion_id == 0) {
             continue;
         }
-        
+    
         /* Add to history */
         uint32_t entry_index = history->entry_count % 100;
         history->entries[entry_index].timestamp = ai_state.last_analysis_time;
         history->entries[entry_index].suggestion_id = suggestion_id;
         history->entries[entry_index].actual_improvement = 0.0f; /* Will be updated later */
         history->entries[entry_index].reverted = false;
-        
+    
         if (history->entry_count < 100) {
             history->entry_count++;
         }
@@ -561,7 +1054,40 @@ error_code_t ai_engine_get_optimization_history(optimization_history_t* history)
     }
     
     /* Copy history */
+    pthread_mutex_lock(&ai_state.lock);
     memcpy(history, &ai_state.history, sizeof(optimization_history_t));
+    pthread_mutex_unlock(&ai_state.lock);
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Record the outcome of trialling a patch
+ *
+ * improvement is the measured relative improvement (negative for a
+ * regression); reverted tells whether the patch was rolled back.
+ */
+error_code_t ai_engine_record_trial(void* patch, float improvement, bool reverted) {
+    if (!ai_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    if (!patch) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    const tuning_patch_t* trial = (const tuning_patch_t*)patch;
+    
+    pthread_mutex_lock(&ai_state.lock);
+    uint32_t entry_index = ai_state.history_next++ % 100;
+    ai_state.history.entries[entry_index].timestamp = monotonic_ms();
+    ai_state.history.entries[entry_index].suggestion_id = trial->suggestion_id;
+    ai_state.history.entries[entry_index].actual_improvement = improvement;
+    ai_state.history.entries[entry_index].reverted = reverted;
+    if (ai_state.history.entry_count < 100) {
+        ai_state.history.entry_count++;
+    }
+    pthread_mutex_unlock(&ai_state.lock);
     
     return ERROR_NONE;
 }
@@ -574,39 +1100,44 @@ error_code_t ai_engine_learn_from_history(void) {
         return ERROR_NOT_IMPLEMENTED;
     }
     
-    /* Update model based on optimization history */
-    for (uint32_t i = 0; i < ai_state.history.entry_count; i++) {
+    /* Fold the trials recorded since the last call into the models, each
+       once (older ones than the history keeps are lost) */
+    pthread_mutex_lock(&ai_state.lock);
+    uint32_t first = ai_state.history_learned;
+    if (ai_state.history_next - first > 100) {
+        first = ai_state.history_next - 100;
+    }
+    for (uint32_t i = first; i != ai_state.history_next; i++) {
         uint32_t entry_index = i % 100;
         uint32_t suggestion_id = ai_state.history.entries[entry_index].suggestion_id;
-        float actual_improvement = ai_state.history.entries[entry_index].actual_improvement;
         bool reverted = ai_state.history.entries[entry_index].reverted;
-        
+    
         /* Determine which model to update based on suggestion ID */
         ai_model_type_t model_type;
         switch (suggestion_id) {
-            case 1: /* Memory defragmentation */
+            case AI_SUGGEST_CACHE_SIZE:
                 model_type = AI_MODEL_MEMORY;
                 break;
-                
-            case 2: /* Scheduler time slice adjustment */
+    
+            case AI_SUGGEST_TIME_SLICE:
                 model_type = AI_MODEL_SCHEDULER;
                 break;
-                
-            case 3: /* I/O scheduling policy adjustment */
+    
+            case AI_SUGGEST_IO_POLICY:
+            case AI_SUGGEST_READAHEAD:
+            case AI_SUGGEST_IO_WORKERS:
                 model_type = AI_MODEL_PERFORMANCE;
                 break;
-                
+    
             default:
                 continue; /* Unknown suggestion type, skip */
         }
-        
-        /* Update model accuracy based on actual improvement */
-        if (!reverted) {
-            models[model_type].accuracy = 0.9f * models[model_type].accuracy + 0.1f * actual_improvement;
-        } else {
-            models[model_type].accuracy = 0.9f * models[model_type].accuracy;
-        }
+    
+        /* Accuracy is the model's recent rate of suggestions kept after trial */
+        models[model_type].accuracy = 0.9f * models[model_type].accuracy + (reverted ? 0.0f : 0.1f);
     }
+    ai_state.history_learned = ai_state.history_next;
+    pthread_mutex_unlock(&ai_state.lock);
     
     /* Update learning timestamp */
     ai_state.last_learning_time = ai_state.last_collection_time;
@@ -12,6 +12,7 @@
 #include "../kernel/kernel.h"
 #include "../memory/memory.h"
 #include "../scheduler/scheduler.h"
+#include "inference.h"
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -45,9 +46,21 @@ typedef struct {
     float power_usage;                 /* Power usage in watts */
     uint32_t error_count;              /* Number of errors */
     uint64_t uptime;                   /* System uptime in milliseconds */
+    uint64_t requests;                 /* Application requests completed */
+    uint64_t request_latency;          /* Total latency of those requests in nanoseconds */
 } performance_metrics_t;
 
-/* Optimization suggestion */
+/* Source of the application's request totals (see performance_metrics_t) */
+typedef void (*ai_request_source_t)(uint64_t* requests, uint64_t* latency_ns);
+
+/* Suggestion IDs */
+#define AI_SUGGEST_CACHE_SIZE 1            /* Resize the allocator's slab cache */
+#define AI_SUGGEST_TIME_SLICE 2            /* Change the scheduler time slice */
+#define AI_SUGGEST_IO_POLICY 3             /* Change the I/O scheduling policy */
+#define AI_SUGGEST_READAHEAD 4             /* Widen the starting readahead window */
+#define AI_SUGGEST_IO_WORKERS 5            /* Limit the async I/O workers */
+
+/* Optimization suggestion (optimization_data is a tuning_action_t) */
 typedef struct {
     uint32_t id;                       /* Suggestion ID */
     char description[256];             /* Description of the suggestion */
@@ -63,12 +76,29 @@ typedef struct {
     struct {
         uint64_t timestamp;            /* Timestamp of optimization */
         uint32_t suggestion_id;        /* ID of applied suggestion */
-        float actual_improvement;      /* Actual improvement (0-1) */
+        float actual_improvement;      /* Measured improvement (negative for a regression) */
         bool reverted;                 /* Whether optimization was reverted */
     } entries[100];                    /* Circular buffer of history entries */
 } optimization_history_t;
 
-/* Process AI profile */
+/* Features of a process profile, the inputs of the scheduler model
+   (quantized: 0 to 127 spans 0 to 1) */
+typedef enum {
+    AI_FEATURE_CPU_INTENSITY,          /* Share of its lifetime spent on a CPU */
+    AI_FEATURE_MEMORY_INTENSITY,       /* Memory intensity */
+    AI_FEATURE_IO_INTENSITY,           /* I/O intensity */
+    AI_FEATURE_PRIORITY,               /* Priority over the lowest level */
+    AI_FEATURE_COUNT
+} ai_feature_t;
+
+_Static_assert(AI_FEATURE_COUNT <= AI_MODEL_INPUTS, "too many profile features");
+
+/* Outputs of the scheduler model */
+#define AI_SCHED_OUTPUT_PRIORITY_DELTA 0   /* Levels to move the priority by */
+#define AI_SCHED_OUTPUT_TIME_SLICE 1       /* Time slice in milliseconds */
+#define AI_SCHED_OUTPUTS 2
+
+/* Process AI profile (features are kept apart, one column per feature) */
 typedef struct {
     uint32_t pid;                      /* Process ID */
     uint64_t creation_time;            /* Creation timestamp */
@@ -76,9 +106,7 @@ typedef struct {
     uint64_t memory_usage;             /* Average memory usage */
     uint32_t priority_changes;         /* Number of priority changes */
     uint32_t io_operations;            /* Number of I/O operations */
-    float cpu_intensity;               /* CPU intensity (0-1) */
-    float memory_intensity;            /* Memory intensity (0-1) */
-    float io_intensity;                /* I/O intensity (0-1) */
+    uint8_t priority;                  /* Priority at the last update */
     uint8_t optimal_priority;          /* AI-determined optimal priority */
     uint32_t optimal_time_slice;       /* AI-determined optimal time slice */
 } process_ai_profile_t;
@@ -86,6 +114,15 @@ typedef struct {
 /* Initialize AI engine */
 error_code_t ai_engine_init(void);
 
+/* Keep model state and history in a snapshot file, which the engine
+   starts from if it holds a valid snapshot (set before initializing the
+   engine, NULL for none; a missing file is created, an existing one that
+   is not a snapshot is refused) */
+error_code_t ai_engine_set_snapshot(const char* path);
+
+/* Save model state and history to the snapshot file */
+error_code_t ai_engine_save_snapshot(void);
+
 /* Load AI model */
 error_code_t ai_engine_load_model(ai_model_type_t type, void* model_data, uint32_t model_size);
 
@@ -95,12 +132,25 @@ error_code_t ai_engine_update_model(ai_model_type_t type, void* model_data, uint
 /* Create process AI profile */
 error_code_t ai_engine_create_process_profile(process_t* process);
 
+/* Destroy process AI profile */
+error_code_t ai_engine_destroy_process_profile(process_t* process);
+
 /* Update process AI profile */
 error_code_t ai_engine_update_process_profile(process_t* process);
 
+/* Score every process profile with the scheduler model */
+error_code_t ai_engine_score_profiles(void);
+
 /* Collect performance metrics */
 error_code_t ai_engine_collect_metrics(performance_metrics_t* metrics);
 
+/* Set the source of the request totals in collected metrics (NULL for
+   none; may be set before initializing the engine) */
+error_code_t ai_engine_set_request_source(ai_request_source_t source);
+
+/* Get the latest collected metrics (a consistent copy) */
+error_code_t ai_engine_get_metrics(performance_metrics_t* metrics);
+
 /* Analyze performance metrics */
 error_code_t ai_engine_analyze_performance(performance_metrics_t* metrics, void** suggestions);
 
@@ -117,6 +167,9 @@ error_code_t ai_engine_free_patches(void* patches, uint32_t patch_count);
 error_code_t ai_engine_update_optimization_history(optimization_history_t* history, 
                                                  void* suggestions, void* patches, uint32_t patch_count);
 
+/* Record the measured outcome of a patch's trial */
+error_code_t ai_engine_record_trial(void* patch, float improvement, bool reverted);
+
 /* Get optimization history */
 error_code_t ai_engine_get_optimization_history(optimization_history_t* history);
 
@@ -0,0 +1,235 @@
+/**
+ * NexOS AI Engine - Quantized Inference
+ *
+ * This file implements model parsing and the batched int8 kernels (see
+ * inference.h).
+ */
+
+#include "inference.h"
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_AVX2_KERNEL 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAVE_NEON_KERNEL 1
+#endif
+
+/* Dot products of n weights with AI_INFERENCE_BLOCK columns of n rows
+   (row i of column k at rows[i * row_stride + k]), plus a bias; n is even */
+typedef void (*dot_kernel_t)(const int8_t* rows, uint32_t row_stride, const int8_t* weights,
+                             uint32_t n, int32_t bias, int32_t* out);
+
+static void dot_portable(const int8_t* rows, uint32_t row_stride, const int8_t* weights,
+                         uint32_t n, int32_t bias, int32_t* out) {
+    for (uint32_t k = 0; k < AI_INFERENCE_BLOCK; k++) {
+        out[k] = bias;
+    }
+    
+    for (uint32_t i = 0; i < n; i++) {
+        const int8_t* row = rows + (size_t)i * row_stride;
+        int32_t weight = weights[i];
+        for (uint32_t k = 0; k < AI_INFERENCE_BLOCK; k++) {
+            out[k] += weight * row[k];
+        }
+    }
+}
+
+#ifdef HAVE_AVX2_KERNEL
+/**
+ * AVX2 kernel
+ *
+ * Interleaves two rows widened to 16 bits and multiplies them with the
+ * matching pair of weights in one madd, which leaves the columns of each
+ * 128-bit lane split over two accumulators.
+ */
+__attribute__((target("avx2")))
+static void dot_avx2(const int8_t* rows, uint32_t row_stride, const int8_t* weights,
+                     uint32_t n, int32_t bias, int32_t* out) {
+    __m256i low = _mm256_setzero_si256();
+    __m256i high = _mm256_setzero_si256();
+    
+    for (uint32_t i = 0; i < n; i += 2) {
+        const int8_t* row = rows + (size_t)i * row_stride;
+        __m256i a = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)row));
+        __m256i b = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(row + row_stride)));
+        __m256i pair = _mm256_set1_epi32((int32_t)((uint32_t)(uint16_t)weights[i] |
+                                                   ((uint32_t)(uint16_t)weights[i + 1] << 16)));
+    
+        low = _mm256_add_epi32(low, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), pair));
+        high = _mm256_add_epi32(high, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), pair));
+    }
+    
+    /* low holds columns 0-3 and 8-11, high 4-7 and 12-15 */
+    __m256i offset = _mm256_set1_epi32(bias);
+    __m256i first = _mm256_permute2x128_si256(low, high, 0x20);
+    __m256i second = _mm256_permute2x128_si256(low, high, 0x31);
+    _mm256_storeu_si256((__m256i*)out, _mm256_add_epi32(first, offset));
+    _mm256_storeu_si256((__m256i*)(out + 8), _mm256_add_epi32(second, offset));
+}
+#endif
+
+#ifdef HAVE_NEON_KERNEL
+/**
+ * NEON kernel: widening multiply-accumulate of each row into four
+ * accumulators of four columns
+ */
+static void dot_neon(const int8_t* rows, uint32_t row_stride, const int8_t* weights,
+                     uint32_t n, int32_t bias, int32_t* out) {
+    int32x4_t acc0 = vdupq_n_s32(bias);
+    int32x4_t acc1 = acc0;
+    int32x4_t acc2 = acc0;
+    int32x4_t acc3 = acc0;
+    
+    for (uint32_t i = 0; i < n; i++) {
+        const int8_t* row = rows + (size_t)i * row_stride;
+        int16x8_t low = vmovl_s8(vld1_s8(row));
+        int16x8_t high = vmovl_s8(vld1_s8(row + 8));
+        int16_t weight = weights[i];
+    
+        acc0 = vmlal_n_s16(acc0, vget_low_s16(low), weight);
+        acc1 = vmlal_n_s16(acc1, vget_high_s16(low), weight);
+        acc2 = vmlal_n_s16(acc2, vget_low_s16(high), weight);
+        acc3 = vmlal_n_s16(acc3, vget_high_s16(high), weight);
+    }
+    
+    vst1q_s32(out, acc0);
+    vst1q_s32(out + 4, acc1);
+    vst1q_s32(out + 8, acc2);
+    vst1q_s32(out + 12, acc3);
+}
+#endif
+
+/**
+ * Pick the kernel for the running CPU
+ */
+static dot_kernel_t select_kernel(void) {
+#if defined(HAVE_AVX2_KERNEL)
+    if (__builtin_cpu_supports("avx2")) {
+        return dot_avx2;
+    }
+#elif defined(HAVE_NEON_KERNEL)
+    return dot_neon;
+#endif
+    return dot_portable;
+}
+
+/**
+ * Get the size of a model image
+ */
+uint32_t ai_model_image_size(uint32_t hidden, uint32_t outputs) {
+    uint32_t output_inputs = hidden ? hidden : AI_MODEL_INPUTS;
+    return (uint32_t)sizeof(ai_model_header_t) +
+           hidden * (AI_MODEL_INPUTS + (uint32_t)sizeof(int32_t)) +
+           outputs * (output_inputs + (uint32_t)sizeof(int32_t));
+}
+
+/**
+ * Check a model image and resolve its layers
+ *
+ * Hidden units come in multiples of 8, which keeps every layer's biases
+ * aligned and the kernels' rows even.
+ */
+error_code_t ai_network_parse(const void* image, uint32_t size, ai_network_t* network) {
+    if (!image || !network || size < sizeof(ai_model_header_t) || ((uintptr_t)image & 3)) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    const ai_model_header_t* header = image;
+    if (header->magic != AI_MODEL_MAGIC ||
+        header->hidden % 8 != 0 || header->hidden > AI_MODEL_MAX_HIDDEN ||
+        header->outputs == 0 || header->outputs > AI_MODEL_MAX_OUTPUTS ||
+        header->hidden_shift > 31 ||
+        size != ai_model_image_size(header->hidden, header->outputs)) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    const uint8_t* layer = (const uint8_t*)(header + 1);
+    network->header = header;
+    network->hidden_weights = NULL;
+    network->hidden_biases = NULL;
+    network->output_inputs = AI_MODEL_INPUTS;
+    
+    if (header->hidden) {
+        network->hidden_weights = (const int8_t*)layer;
+        layer += header->hidden * AI_MODEL_INPUTS;
+        network->hidden_biases = (const int32_t*)layer;
+        layer += header->hidden * sizeof(int32_t);
+        network->output_inputs = header->hidden;
+    }
+    
+    network->output_weights = (const int8_t*)layer;
+    layer += header->outputs * network->output_inputs;
+    network->output_biases = (const int32_t*)layer;
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Run a network over one block of items
+ *
+ * Hidden activations stay in a block-wide buffer in the same row layout,
+ * so the output layer runs on the same kernel. Only the first width
+ * outputs are stored.
+ */
+static void run_block(const ai_network_t* network, dot_kernel_t dot, const int8_t* inputs,
+                      uint32_t stride, float* outputs, uint32_t output_stride, uint32_t width) {
+    const ai_model_header_t* header = network->header;
+    int8_t hidden[AI_MODEL_MAX_HIDDEN * AI_INFERENCE_BLOCK];
+    int32_t acc[AI_INFERENCE_BLOCK];
+    
+    if (network->hidden_weights) {
+        for (uint32_t h = 0; h < header->hidden; h++) {
+            dot(inputs, stride, network->hidden_weights + h * AI_MODEL_INPUTS, AI_MODEL_INPUTS,
+                network->hidden_biases[h], acc);
+    
+            /* ReLU, requantized to int8 */
+            for (uint32_t k = 0; k < AI_INFERENCE_BLOCK; k++) {
+                int32_t value = acc[k] > 0 ? acc[k] >> header->hidden_shift : 0;
+                hidden[h * AI_INFERENCE_BLOCK + k] = (int8_t)(value > INT8_MAX ? INT8_MAX : value);
+            }
+        }
+        inputs = hidden;
+        stride = AI_INFERENCE_BLOCK;
+    }
+    
+    for (uint32_t o = 0; o < header->outputs; o++) {
+        dot(inputs, stride, network->output_weights + o * network->output_inputs,
+            network->output_inputs, network->output_biases[o], acc);
+    
+        float* row = outputs + (size_t)o * output_stride;
+        for (uint32_t k = 0; k < width; k++) {
+            row[k] = (float)acc[k] * header->output_scale[o];
+        }
+    }
+}
+
+/**
+ * Run a network over count items
+ *
+ * Items past the last full block are copied into a zero-padded block.
+ */
+void ai_network_run(const ai_network_t* network, const int8_t* inputs, uint32_t stride,
+                    uint32_t count, float* outputs) {
+    if (!network || !inputs || !outputs || count > stride) {
+        return;
+    }
+    
+    dot_kernel_t dot = select_kernel();
+    uint32_t full = count - count % AI_INFERENCE_BLOCK;
+    
+    for (uint32_t item = 0; item < full; item += AI_INFERENCE_BLOCK) {
+        run_block(network, dot, inputs + item, stride, outputs + item, stride, AI_INFERENCE_BLOCK);
+    }
+    
+    if (full < count) {
+        int8_t tail[AI_MODEL_INPUTS * AI_INFERENCE_BLOCK];
+        memset(tail, 0, sizeof(tail));
+        for (uint32_t i = 0; i < AI_MODEL_INPUTS; i++) {
+            memcpy(&tail[i * AI_INFERENCE_BLOCK], inputs + (size_t)i * stride + full, count - full);
+        }
+        run_block(network, dot, tail, AI_INFERENCE_BLOCK, outputs + full, stride, count - full);
+    }
+}
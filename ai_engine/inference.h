@@ -0,0 +1,73 @@
+/**
+ * NexOS AI Engine - Quantized Inference
+ *
+ * Models are small int8 networks: a linear layer over AI_MODEL_INPUTS
+ * features, or a hidden ReLU layer followed by a linear one. Inputs and
+ * hidden activations are int8 and weights int8, accumulated in int32;
+ * hidden accumulators are shifted right into int8 and outputs scaled to
+ * floats, one scale per output.
+ *
+ * Inference runs over inputs stored as structure of arrays, one row per
+ * input holding that input for every item, and computes 16 items at a
+ * time with AVX2 on x86-64 CPUs that have it, NEON on ARM, and portable
+ * code elsewhere, so scoring a table is a handful of calls per 16 items.
+ *
+ * A model image, as passed to ai_engine_load_model, is an
+ * ai_model_header_t followed by the layers, each its int8 weights (one
+ * row of inputs per unit) and then its int32 biases:
+ *
+ *   hidden layer (if hidden > 0): weights[hidden][AI_MODEL_INPUTS], biases[hidden]
+ *   output layer:                 weights[outputs][hidden or AI_MODEL_INPUTS], biases[outputs]
+ */
+
+#ifndef NEXOS_AI_ENGINE_INFERENCE_H
+#define NEXOS_AI_ENGINE_INFERENCE_H
+
+#include "../kernel/kernel.h"
+#include <stdint.h>
+
+/* Model image magic ("NXQ1") */
+#define AI_MODEL_MAGIC 0x3151584EU
+
+/* Inputs of every model (unused ones are zero) */
+#define AI_MODEL_INPUTS 8
+
+/* Limits of a model image */
+#define AI_MODEL_MAX_HIDDEN 64
+#define AI_MODEL_MAX_OUTPUTS 8
+
+/* Items computed by one kernel call */
+#define AI_INFERENCE_BLOCK 16
+
+/* Model image header */
+typedef struct {
+    uint32_t magic;            /* AI_MODEL_MAGIC */
+    uint8_t hidden;            /* Hidden units, a multiple of 8 (0 for a linear model) */
+    uint8_t outputs;           /* Output units (1 to AI_MODEL_MAX_OUTPUTS) */
+    uint8_t hidden_shift;      /* Right shift from hidden accumulators to int8 */
+    uint8_t reserved;
+    float output_scale[AI_MODEL_MAX_OUTPUTS]; /* Value of one output accumulator step */
+} ai_model_header_t;
+
+/* Model image resolved into its layers */
+typedef struct {
+    const ai_model_header_t* header;
+    const int8_t* hidden_weights;  /* NULL for a linear model */
+    const int32_t* hidden_biases;
+    const int8_t* output_weights;
+    const int32_t* output_biases;
+    uint32_t output_inputs;        /* Inputs of the output layer */
+} ai_network_t;
+
+/* Size in bytes of a model image */
+uint32_t ai_model_image_size(uint32_t hidden, uint32_t outputs);
+
+/* Check a model image and resolve its layers (image must be 4-byte aligned) */
+error_code_t ai_network_parse(const void* image, uint32_t size, ai_network_t* network);
+
+/* Run a network over count items: inputs[i * stride + item] is input i of
+   an item, and output o of an item goes to outputs[o * stride + item] */
+void ai_network_run(const ai_network_t* network, const int8_t* inputs, uint32_t stride,
+                    uint32_t count, float* outputs);
+
+#endif /* NEXOS_AI_ENGINE_INFERENCE_H */
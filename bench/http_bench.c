@@ -0,0 +1,808 @@
+/**
+ * NexOS HTTP Benchmark
+ *
+ * Multi-threaded HTTP/1.1 load generator for the NexOS web servers. Each
+ * thread drives its share of the connections from its own epoll loop,
+ * optionally keeping connections alive and pipelining several requests per
+ * connection. Request paths are drawn from a weighted mix so that static
+ * files of different sizes can be exercised together.
+ *
+ * Results are printed as a summary and, with -o, appended as one JSON
+ * object per line so successive runs can be compared for regressions.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define MAX_PATHS 32
+#define MAX_PIPELINE 64
+#define RECV_BUFFER_SIZE (64 * 1024)
+#define MAX_EVENTS 256
+
+/* Latency histogram: 64 linear sub-buckets per power of two of nanoseconds */
+#define HIST_SUB_BITS 6
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+/* Weighted request path */
+typedef struct {
+    char path[256];
+    uint32_t weight;
+} bench_path_t;
+
+/* Benchmark configuration */
+typedef struct {
+    const char* host;
+    const char* port;
+    uint32_t connections;              /* Concurrent connections across all threads */
+    uint32_t threads;
+    uint32_t duration;                 /* Measured run time in seconds */
+    uint32_t pipeline;                 /* Requests in flight per connection */
+    bool keep_alive;
+    bench_path_t paths[MAX_PATHS];
+    uint32_t path_count;
+    uint32_t total_weight;
+    const char* label;                 /* Name recorded with the results */
+    const char* output;                /* JSON Lines file to append to, or NULL */
+    long server_pid;                   /* Server process to sample syscalls from (0 = none) */
+    struct addrinfo* address;
+} bench_config_t;
+
+/* Response parser states */
+typedef enum {
+    RESPONSE_HEAD,                     /* Reading status line and headers */
+    RESPONSE_BODY,                     /* Skipping a body of known length */
+    RESPONSE_BODY_UNTIL_CLOSE          /* Skipping a body delimited by connection close */
+} response_state_t;
+
+/* Client connection */
+typedef struct {
+    int fd;
+    char out[MAX_PIPELINE * 320];      /* Requests not yet written */
+    size_t out_length;
+    size_t out_sent;
+    uint64_t sent_at[MAX_PIPELINE];    /* Send time of each outstanding request (ring) */
+    uint32_t sent_head;
+    uint32_t outstanding;
+    response_state_t state;
+    char head[8192];                   /* Partial response head */
+    size_t head_length;
+    uint64_t body_remaining;
+    bool server_closes;                /* Response carried Connection: close */
+} bench_connection_t;
+
+/* Per-thread state and counters */
+typedef struct {
+    const bench_config_t* config;
+    pthread_t thread;
+    uint32_t connection_count;
+    bench_connection_t* connections;
+    int epoll_fd;
+    uint64_t random;                   /* xorshift64 state */
+    char buffer[RECV_BUFFER_SIZE];
+    uint64_t deadline;                 /* End of the measured interval (monotonic ns) */
+    uint64_t requests;                 /* Completed requests */
+    uint64_t bytes;                    /* Response bytes received */
+    uint64_t errors;                   /* Connect, socket and protocol errors */
+    uint64_t status_errors;            /* Responses with a 4xx/5xx status */
+    uint64_t connects;                 /* Connections opened */
+    uint64_t syscalls;                 /* System calls issued by this thread */
+    uint64_t histogram[HIST_BUCKETS];
+    uint64_t latency_max;
+} bench_thread_t;
+
+/**
+ * Get monotonic time in nanoseconds
+ */
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Map a latency to its histogram bucket
+ */
+static uint32_t histogram_index(uint64_t value) {
+    if (value < HIST_SUB_COUNT) {
+        return (uint32_t)value;
+    }
+    
+    uint32_t shift = (uint32_t)(63 - __builtin_clzll(value)) - HIST_SUB_BITS;
+    return ((shift + 1) << HIST_SUB_BITS) + (uint32_t)((value >> shift) & (HIST_SUB_COUNT - 1));
+}
+
+/**
+ * Get the midpoint of a histogram bucket
+ */
+static uint64_t histogram_value(uint32_t index) {
+    if (index < HIST_SUB_COUNT) {
+        return index;
+    }
+    
+    uint32_t shift = (index >> HIST_SUB_BITS) - 1;
+    uint64_t low = ((uint64_t)HIST_SUB_COUNT + (index & (HIST_SUB_COUNT - 1))) << shift;
+    return low + ((1ULL << shift) >> 1);
+}
+
+/**
+ * Get the latency below which a fraction of requests completed
+ */
+static uint64_t histogram_percentile(const uint64_t* histogram, uint64_t total, double fraction) {
+    uint64_t target = (uint64_t)((double)total * fraction);
+    uint64_t seen = 0;
+    
+    if (target >= total) {
+        target = total > 0 ? total - 1 : 0;
+    }
+    
+    for (uint32_t i = 0; i < HIST_BUCKETS; i++) {
+        seen += histogram[i];
+        if (seen > target) {
+            return histogram_value(i);
+        }
+    }
+    
+    return 0;
+}
+
+/**
+ * Pick a request path according to the configured weights
+ */
+static const char* pick_path(bench_thread_t* thread) {
+    const bench_config_t* config = thread->config;
+    
+    thread->random ^= thread->random << 13;
+    thread->random ^= thread->random >> 7;
+    thread->random ^= thread->random << 17;
+    
+    uint32_t ticket = (uint32_t)(thread->random % config->total_weight);
+    for (uint32_t i = 0; i < config->path_count; i++) {
+        if (ticket < config->paths[i].weight) {
+            return config->paths[i].path;
+        }
+        ticket -= config->paths[i].weight;
+    }
+    
+    return config->paths[0].path;
+}
+
+/**
+ * Queue requests until the connection has a full pipeline in flight
+ */
+static void fill_pipeline(bench_thread_t* thread, bench_connection_t* conn) {
+    const bench_config_t* config = thread->config;
+    uint32_t depth = config->keep_alive ? config->pipeline : 1;
+    uint64_t now = monotonic_ns();
+    
+    /* Compact the output buffer before appending */
+    if (conn->out_sent > 0) {
+        memmove(conn->out, conn->out + conn->out_sent, conn->out_length - conn->out_sent);
+        conn->out_length -= conn->out_sent;
+        conn->out_sent = 0;
+    }
+    
+    while (conn->outstanding < depth) {
+        int length = snprintf(conn->out + conn->out_length, sizeof(conn->out) - conn->out_length,
+                              "GET %s HTTP/1.1\r\nHost: %s\r\nUser-Agent: nexos-bench\r\n%s\r\n",
+                              pick_path(thread), config->host,
+                              config->keep_alive ? "" : "Connection: close\r\n");
+        if (length < 0 || (size_t)length >= sizeof(conn->out) - conn->out_length) {
+            break;
+        }
+    
+        conn->out_length += (size_t)length;
+        conn->sent_at[(conn->sent_head + conn->outstanding) % MAX_PIPELINE] = now;
+        conn->outstanding++;
+    }
+}
+
+/**
+ * Write queued requests until done or the socket is full
+ *
+ * Returns false on a socket error.
+ */
+static bool flush_requests(bench_thread_t* thread, bench_connection_t* conn) {
+    while (conn->out_sent < conn->out_length) {
+        thread->syscalls++;
+        ssize_t n = send(conn->fd, conn->out + conn->out_sent, conn->out_length - conn->out_sent,
+                         MSG_NOSIGNAL);
+        if (n < 0) {
+            return errno == EAGAIN || errno == EINTR;
+        }
+        conn->out_sent += (size_t)n;
+    }
+    
+    return true;
+}
+
+/**
+ * Open a non-blocking connection and queue its first requests
+ *
+ * Returns false if the connection could not be started.
+ */
+static bool open_connection(bench_thread_t* thread, bench_connection_t* conn) {
+    const struct addrinfo* address = thread->config->address;
+    
+    memset(conn, 0, sizeof(bench_connection_t));
+    
+    thread->syscalls += 4;
+    conn->fd = socket(address->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (conn->fd < 0) {
+        return false;
+    }
+    
+    int one = 1;
+    setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    
+    if (connect(conn->fd, address->ai_addr, address->ai_addrlen) < 0 && errno != EINPROGRESS) {
+        close(conn->fd);
+        conn->fd = -1;
+        return false;
+    }
+    
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP;
+    ev.data.ptr = conn;
+    if (epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD, conn->fd, &ev) < 0) {
+        close(conn->fd);
+        conn->fd = -1;
+        return false;
+    }
+    
+    thread->connects++;
+    fill_pipeline(thread, conn);
+    return true;
+}
+
+/**
+ * Close a connection and, while the run lasts, open a replacement
+ */
+static void reopen_connection(bench_thread_t* thread, bench_connection_t* conn) {
+    if (conn->fd >= 0) {
+        thread->syscalls++;
+        close(conn->fd);
+        conn->fd = -1;
+    }
+    
+    if (monotonic_ns() < thread->deadline && !open_connection(thread, conn)) {
+        thread->errors++;
+    }
+}
+
+/**
+ * Record a completed response
+ */
+static void complete_response(bench_thread_t* thread, bench_connection_t* conn) {
+    uint64_t latency = monotonic_ns() - conn->sent_at[conn->sent_head];
+    
+    conn->sent_head = (conn->sent_head + 1) % MAX_PIPELINE;
+    conn->outstanding--;
+    conn->state = RESPONSE_HEAD;
+    conn->head_length = 0;
+    
+    thread->requests++;
+    thread->histogram[histogram_index(latency)]++;
+    if (latency > thread->latency_max) {
+        thread->latency_max = latency;
+    }
+}
+
+/**
+ * Parse a complete response head
+ *
+ * Returns false if the head is malformed.
+ */
+static bool parse_head(bench_thread_t* thread, bench_connection_t* conn) {
+    conn->head[conn->head_length] = '\0';
+    
+    int status;
+    if (sscanf(conn->head, "HTTP/1.%*d %d", &status) != 1) {
+        return false;
+    }
+    if (status >= 400) {
+        thread->status_errors++;
+    }
+    
+    bool has_length = false;
+    conn->body_remaining = 0;
+    conn->server_closes = false;
+    for (char* line = strstr(conn->head, "\r\n"); line; line = strstr(line, "\r\n")) {
+        line += 2;
+        if (strncasecmp(line, "Content-Length:", 15) == 0) {
+            conn->body_remaining = strtoull(line + 15, NULL, 10);
+            has_length = true;
+        } else if (strncasecmp(line, "Connection:", 11) == 0) {
+            const char* value = line + 11;
+            while (*value == ' ' || *value == '\t') value++;
+            conn->server_closes = strncasecmp(value, "close", 5) == 0;
+        }
+    }
+    
+    /* Responses without a body never have one, whatever Content-Length says */
+    bool bodiless = status == 204 || status == 304 || (status >= 100 && status < 200);
+    if (bodiless) {
+        conn->body_remaining = 0;
+    }
+    
+    if (conn->body_remaining > 0) {
+        conn->state = RESPONSE_BODY;
+    } else if (!has_length && !bodiless) {
+        conn->state = RESPONSE_BODY_UNTIL_CLOSE;
+    } else {
+        complete_response(thread, conn);
+    }
+    
+    return true;
+}
+
+/**
+ * Consume received bytes, completing responses as they finish
+ *
+ * Returns false on a protocol error.
+ */
+static bool consume_bytes(bench_thread_t* thread, bench_connection_t* conn, const char* data, size_t length) {
+    while (length > 0) {
+        if (conn->state == RESPONSE_BODY_UNTIL_CLOSE) {
+            return true;
+        }
+    
+        if (conn->state == RESPONSE_BODY) {
+            size_t take = length < conn->body_remaining ? length : (size_t)conn->body_remaining;
+            conn->body_remaining -= take;
+            data += take;
+            length -= take;
+            if (conn->body_remaining == 0) {
+                complete_response(thread, conn);
+            }
+            continue;
+        }
+    
+        if (conn->outstanding == 0) {
+            /* Bytes without a request */
+            return false;
+        }
+    
+        /* Accumulate the head until the blank line */
+        size_t take = sizeof(conn->head) - 1 - conn->head_length;
+        if (take == 0) {
+            return false;
+        }
+        if (take > length) {
+            take = length;
+        }
+        memcpy(conn->head + conn->head_length, data, take);
+    
+        size_t search = conn->head_length > 3 ? conn->head_length - 3 : 0;
+        conn->head_length += take;
+        conn->head[conn->head_length] = '\0';
+        char* end = strstr(conn->head + search, "\r\n\r\n");
+        if (!end) {
+            data += take;
+            length -= take;
+            continue;
+        }
+    
+        /* Hand bytes past the head back to the loop */
+        size_t head_end = (size_t)(end - conn->head) + 4;
+        size_t used = take - (conn->head_length - head_end);
+        conn->head_length = head_end;
+        data += used;
+        length -= used;
+        if (!parse_head(thread, conn)) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+/**
+ * Handle readiness on a connection
+ */
+static void handle_event(bench_thread_t* thread, bench_connection_t* conn, uint32_t events) {
+    if (events & EPOLLERR) {
+        thread->errors++;
+        reopen_connection(thread, conn);
+        return;
+    }
+    
+    if (!flush_requests(thread, conn)) {
+        thread->errors++;
+        reopen_connection(thread, conn);
+        return;
+    }
+    
+    for (;;) {
+        thread->syscalls++;
+        ssize_t n = recv(conn->fd, thread->buffer, sizeof(thread->buffer), 0);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                break;
+            }
+            thread->errors++;
+            reopen_connection(thread, conn);
+            return;
+        }
+    
+        if (n == 0) {
+            /* Server closed: the end of a close-delimited body, or an error */
+            if (conn->state == RESPONSE_BODY_UNTIL_CLOSE) {
+                complete_response(thread, conn);
+            } else if (conn->outstanding > 0 && !conn->server_closes) {
+                thread->errors++;
+            }
+            reopen_connection(thread, conn);
+            return;
+        }
+    
+        thread->bytes += (uint64_t)n;
+        if (!consume_bytes(thread, conn, thread->buffer, (size_t)n)) {
+            thread->errors++;
+            reopen_connection(thread, conn);
+            return;
+        }
+    
+        if (conn->outstanding == 0) {
+            if (!thread->config->keep_alive || conn->server_closes) {
+                reopen_connection(thread, conn);
+                return;
+            }
+            if (monotonic_ns() >= thread->deadline) {
+                return;
+            }
+        }
+    
+        /* Keep the pipeline full */
+        if (thread->config->keep_alive && !conn->server_closes && monotonic_ns() < thread->deadline) {
+            fill_pipeline(thread, conn);
+            if (!flush_requests(thread, conn)) {
+                thread->errors++;
+                reopen_connection(thread, conn);
+                return;
+            }
+        }
+    }
+}
+
+/**
+ * Thread entry point: drive this thread's connections until the deadline
+ */
+static void* bench_thread_main(void* arg) {
+    bench_thread_t* thread = arg;
+    struct epoll_event events[MAX_EVENTS];
+    
+    for (uint32_t i = 0; i < thread->connection_count; i++) {
+        thread->connections[i].fd = -1;
+        if (!open_connection(thread, &thread->connections[i])) {
+            thread->errors++;
+        }
+    }
+    
+    for (;;) {
+        uint64_t now = monotonic_ns();
+        if (now >= thread->deadline) {
+            break;
+        }
+    
+        int timeout = (int)((thread->deadline - now) / 1000000) + 1;
+        thread->syscalls++;
+        int count = epoll_wait(thread->epoll_fd, events, MAX_EVENTS, timeout);
+        for (int i = 0; i < count; i++) {
+            handle_event(thread, events[i].data.ptr, events[i].events);
+        }
+    }
+    
+    for (uint32_t i = 0; i < thread->connection_count; i++) {
+        if (thread->connections[i].fd >= 0) {
+            close(thread->connections[i].fd);
+        }
+    }
+    
+    return NULL;
+}
+
+/**
+ * Read the read- and write-class syscall counters of a process
+ *
+ * Returns false if /proc/<pid>/io is not readable.
+ */
+static bool read_process_syscalls(long pid, uint64_t* count) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%ld/io", pid);
+    
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        return false;
+    }
+    
+    char line[128];
+    unsigned long long value;
+    *count = 0;
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "syscr: %llu", &value) == 1 || sscanf(line, "syscw: %llu", &value) == 1) {
+            *count += value;
+        }
+    }
+    
+    fclose(file);
+    return true;
+}
+
+/**
+ * Parse a "path[:weight],..." mix
+ *
+ * Returns false if the mix is malformed.
+ */
+static bool parse_paths(bench_config_t* config, const char* mix) {
+    config->path_count = 0;
+    config->total_weight = 0;
+    
+    while (*mix) {
+        if (config->path_count == MAX_PATHS) {
+            return false;
+        }
+    
+        bench_path_t* entry = &config->paths[config->path_count];
+        size_t length = strcspn(mix, ",:");
+        if (length == 0 || length >= sizeof(entry->path) || mix[0] != '/') {
+            return false;
+        }
+        memcpy(entry->path, mix, length);
+        entry->path[length] = '\0';
+        mix += length;
+    
+        entry->weight = 1;
+        if (*mix == ':') {
+            char* end;
+            entry->weight = (uint32_t)strtoul(mix + 1, &end, 10);
+            if (end == mix + 1 || entry->weight == 0) {
+                return false;
+            }
+            mix = end;
+        }
+        if (*mix == ',') {
+            mix++;
+        } else if (*mix) {
+            return false;
+        }
+    
+        config->total_weight += entry->weight;
+        config->path_count++;
+    }
+    
+    return config->path_count > 0;
+}
+
+/**
+ * Print usage
+ */
+static void usage(const char* program) {
+    printf("Usage: %s [options]\n", program);
+    printf("Options:\n");
+    printf("  -H, --host HOST        Server address (default: 127.0.0.1)\n");
+    printf("  -p, --port PORT        Server port (default: 8080)\n");
+    printf("  -c, --connections N    Concurrent connections (default: 64)\n");
+    printf("  -t, --threads N        Load generator threads (default: 4)\n");
+    printf("  -d, --duration SEC     Run time in seconds (default: 10)\n");
+    printf("  -P, --pipeline N       Requests in flight per connection (default: 1)\n");
+    printf("  -K, --no-keepalive     Open a new connection for every request\n");
+    printf("  -u, --urls MIX         Paths with weights, e.g. /a.bin:3,/b.bin:1 (default: /)\n");
+    printf("  -l, --label NAME       Name recorded with the results\n");
+    printf("  -o, --output FILE      Append results to FILE as a JSON line\n");
+    printf("  -s, --server-pid PID   Sample the server's read/write syscalls from /proc\n");
+    printf("  -h, --help             Show this help message\n");
+}
+
+/**
+ * Main function
+ */
+int main(int argc, char* argv[]) {
+    bench_config_t config = {
+        .host = "127.0.0.1",
+        .port = "8080",
+        .connections = 64,
+        .threads = 4,
+        .duration = 10,
+        .pipeline = 1,
+        .keep_alive = true,
+        .label = "bench"
+    };
+    const char* mix = "/";
+    
+    /* Parse command line arguments */
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+    
+        if (strcmp(arg, "-K") == 0 || strcmp(arg, "--no-keepalive") == 0) {
+            config.keep_alive = false;
+            continue;
+        }
+        if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+            usage(argv[0]);
+            return 0;
+        }
+        if (!value) {
+            usage(argv[0]);
+            return 1;
+        }
+    
+        i++;
+        if (strcmp(arg, "-H") == 0 || strcmp(arg, "--host") == 0) {
+            config.host = value;
+        } else if (strcmp(arg, "-p") == 0 || strcmp(arg, "--port") == 0) {
+            config.port = value;
+        } else if (strcmp(arg, "-c") == 0 || strcmp(arg, "--connections") == 0) {
+            config.connections = (uint32_t)atoi(value);
+        } else if (strcmp(arg, "-t") == 0 || strcmp(arg, "--threads") == 0) {
+            config.threads = (uint32_t)atoi(value);
+        } else if (strcmp(arg, "-d") == 0 || strcmp(arg, "--duration") == 0) {
+            config.duration = (uint32_t)atoi(value);
+        } else if (strcmp(arg, "-P") == 0 || strcmp(arg, "--pipeline") == 0) {
+            config.pipeline = (uint32_t)atoi(value);
+        } else if (strcmp(arg, "-u") == 0 || strcmp(arg, "--urls") == 0) {
+            mix = value;
+        } else if (strcmp(arg, "-l") == 0 || strcmp(arg, "--label") == 0) {
+            config.label = value;
+        } else if (strcmp(arg, "-o") == 0 || strcmp(arg, "--output") == 0) {
+            config.output = value;
+        } else if (strcmp(arg, "-s") == 0 || strcmp(arg, "--server-pid") == 0) {
+            config.server_pid = atol(value);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    
+    if (!parse_paths(&config, mix)) {
+        fprintf(stderr, "Invalid URL mix: %s\n", mix);
+        return 1;
+    }
+    if (config.connections == 0 || config.threads == 0 || config.duration == 0 ||
+        config.pipeline == 0 || config.pipeline > MAX_PIPELINE) {
+        fprintf(stderr, "Connections, threads and duration must be positive; pipeline 1-%d\n", MAX_PIPELINE);
+        return 1;
+    }
+    if (config.threads > config.connections) {
+        config.threads = config.connections;
+    }
+    
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    int gai = getaddrinfo(config.host, config.port, &hints, &config.address);
+    if (gai != 0) {
+        fprintf(stderr, "Cannot resolve %s:%s: %s\n", config.host, config.port, gai_strerror(gai));
+        return 1;
+    }
+    
+    signal(SIGPIPE, SIG_IGN);
+    
+    bench_thread_t* threads = calloc(config.threads, sizeof(bench_thread_t));
+    bench_connection_t* connections = calloc(config.connections, sizeof(bench_connection_t));
+    if (!threads || !connections) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    
+    uint64_t server_before = 0;
+    bool server_sampled = config.server_pid > 0 && read_process_syscalls(config.server_pid, &server_before);
+    
+    /* Split connections evenly across threads */
+    uint64_t start = monotonic_ns();
+    uint64_t deadline = start + (uint64_t)config.duration * 1000000000ULL;
+    uint32_t assigned = 0;
+    for (uint32_t i = 0; i < config.threads; i++) {
+        bench_thread_t* thread = &threads[i];
+        thread->config = &config;
+        thread->connection_count = config.connections / config.threads +
+                                   (i < config.connections % config.threads ? 1 : 0);
+        thread->connections = connections + assigned;
+        assigned += thread->connection_count;
+        thread->random = 0x9E3779B97F4A7C15ULL * (i + 1);
+        thread->deadline = deadline;
+        thread->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (thread->epoll_fd < 0 || pthread_create(&thread->thread, NULL, bench_thread_main, thread) != 0) {
+            fprintf(stderr, "Cannot start thread %u\n", i);
+            return 1;
+        }
+    }
+    
+    /* Merge per-thread results */
+    static uint64_t histogram[HIST_BUCKETS];
+    uint64_t requests = 0, bytes = 0, errors = 0, status_errors = 0, connects = 0, syscalls = 0;
+    uint64_t latency_max = 0;
+    double latency_sum = 0;
+    for (uint32_t i = 0; i < config.threads; i++) {
+        bench_thread_t* thread = &threads[i];
+        pthread_join(thread->thread, NULL);
+        close(thread->epoll_fd);
+    
+        requests += thread->requests;
+        bytes += thread->bytes;
+        errors += thread->errors;
+        status_errors += thread->status_errors;
+        connects += thread->connects;
+        syscalls += thread->syscalls;
+        if (thread->latency_max > latency_max) {
+            latency_max = thread->latency_max;
+        }
+        for (uint32_t j = 0; j < HIST_BUCKETS; j++) {
+            histogram[j] += thread->histogram[j];
+            latency_sum += (double)thread->histogram[j] * (double)histogram_value(j);
+        }
+    }
+    double elapsed = (double)(monotonic_ns() - start) / 1e9;
+    
+    uint64_t server_after = 0;
+    server_sampled = server_sampled && read_process_syscalls(config.server_pid, &server_after);
+    
+    double rate = (double)requests / elapsed;
+    double mean = requests > 0 ? latency_sum / (double)requests / 1000.0 : 0;
+    double p50 = (double)histogram_percentile(histogram, requests, 0.50) / 1000.0;
+    double p90 = (double)histogram_percentile(histogram, requests, 0.90) / 1000.0;
+    double p99 = (double)histogram_percentile(histogram, requests, 0.99) / 1000.0;
+    double p999 = (double)histogram_percentile(histogram, requests, 0.999) / 1000.0;
+    double client_syscalls = requests > 0 ? (double)syscalls / (double)requests : 0;
+    double server_syscalls = server_sampled && requests > 0 ?
+                             (double)(server_after - server_before) / (double)requests : -1;
+    
+    printf("%s: %u connections, %u threads, keep-alive %s, pipeline %u, %.1fs\n",
+           config.label, config.connections, config.threads, config.keep_alive ? "on" : "off",
+           config.keep_alive ? config.pipeline : 1, elapsed);
+    printf("  requests:  %llu (%.0f/s), %.1f MB/s, %llu connections\n",
+           (unsigned long long)requests, rate, (double)bytes / elapsed / 1e6, (unsigned long long)connects);
+    printf("  errors:    %llu socket/protocol, %llu 4xx/5xx\n",
+           (unsigned long long)errors, (unsigned long long)status_errors);
+    printf("  latency:   mean %.1fus  p50 %.1fus  p90 %.1fus  p99 %.1fus  p99.9 %.1fus  max %.1fus\n",
+           mean, p50, p90, p99, p999, (double)latency_max / 1000.0);
+    printf("  syscalls:  %.2f client/request", client_syscalls);
+    if (server_syscalls >= 0) {
+        printf(", %.2f server read+write/request", server_syscalls);
+    }
+    printf("\n");
+    
+    if (config.output) {
+        FILE* file = fopen(config.output, "a");
+        if (!file) {
+            fprintf(stderr, "Cannot open %s: %s\n", config.output, strerror(errno));
+            return 1;
+        }
+    
+        fprintf(file, "{\"label\":\"%s\",\"connections\":%u,\"threads\":%u,\"keep_alive\":%s,"
+                      "\"pipeline\":%u,\"urls\":\"%s\",\"duration_s\":%.3f,\"requests\":%llu,"
+                      "\"requests_per_sec\":%.1f,\"bytes\":%llu,\"connects\":%llu,\"errors\":%llu,"
+                      "\"status_errors\":%llu,\"latency_us\":{\"mean\":%.1f,\"p50\":%.1f,\"p90\":%.1f,"
+                      "\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f},\"client_syscalls_per_request\":%.3f",
+                config.label, config.connections, config.threads, config.keep_alive ? "true" : "false",
+                config.keep_alive ? config.pipeline : 1, mix, elapsed, (unsigned long long)requests, rate,
+                (unsigned long long)bytes, (unsigned long long)connects, (unsigned long long)errors,
+                (unsigned long long)status_errors, mean, p50, p90, p99, p999,
+                (double)latency_max / 1000.0, client_syscalls);
+        if (server_syscalls >= 0) {
+            fprintf(file, ",\"server_rw_syscalls_per_request\":%.3f", server_syscalls);
+        }
+        fprintf(file, "}\n");
+        fclose(file);
+    }
+    
+    freeaddrinfo(config.address);
+    free(connections);
+    free(threads);
+    return errors > 0 && requests == 0 ? 1 : 0;
+}
@@ -0,0 +1,90 @@
+#!/bin/sh
+# NexOS web server benchmark driver (invoked by `make bench`)
+#
+# Usage: bench/run.sh BENCH NEXOS_WEBSERVER [SIMPLE_WEBSERVER]
+#
+# Builds a webroot with a static file size mix, starts each server in turn
+# and runs the scenarios below against it. Results are appended to
+# $BENCH_OUTPUT as JSON lines, one per server and scenario.
+#
+# Tunables (environment): BENCH_DURATION, BENCH_CONNECTIONS, BENCH_THREADS,
+# BENCH_PIPELINE, BENCH_DIR, BENCH_OUTPUT, BENCH_PORT.
+
+set -e
+
+BENCH=$1
+NEXOS=$2
+SIMPLE=$3
+
+if [ -z "$BENCH" ] || [ -z "$NEXOS" ]; then
+    echo "Usage: $0 BENCH NEXOS_WEBSERVER [SIMPLE_WEBSERVER]" >&2
+    exit 1
+fi
+
+DURATION=${BENCH_DURATION:-10}
+CONNECTIONS=${BENCH_CONNECTIONS:-64}
+THREADS=${BENCH_THREADS:-4}
+PIPELINE=${BENCH_PIPELINE:-16}
+DIR=${BENCH_DIR:-build/bench}
+OUTPUT=${BENCH_OUTPUT:-$DIR/results.jsonl}
+PORT=${BENCH_PORT:-18080}
+
+ROOT=$DIR/webroot
+SMALL=/static/1k.html
+MIX=/static/1k.html:60,/static/16k.css:25,/static/256k.js:10,/static/4m.bin:5
+
+# Static file size mix
+mkdir -p "$ROOT/static"
+for spec in 1k.html:1 16k.css:16 256k.js:256 4m.bin:4096; do
+    name=${spec%%:*}
+    kib=${spec##*:}
+    if [ ! -f "$ROOT/static/$name" ]; then
+        head -c $((kib * 1024)) /dev/urandom | od -An -tx1 | head -c $((kib * 1024)) > "$ROOT/static/$name"
+    fi
+done
+cp -f webroot/index.html "$ROOT/index.html" 2>/dev/null || echo "<html></html>" > "$ROOT/index.html"
+
+SERVER_PID=
+
+stop_server() {
+    if [ -n "$SERVER_PID" ]; then
+        kill "$SERVER_PID" 2>/dev/null || true
+        wait "$SERVER_PID" 2>/dev/null || true
+        SERVER_PID=
+    fi
+}
+trap stop_server EXIT INT TERM
+
+# run_server NAME COMMAND...
+run_server() {
+    name=$1
+    shift
+    "$@" > "$DIR/$name.log" 2>&1 &
+    SERVER_PID=$!
+
+    # Wait for the listener
+    tries=0
+    while ! "$BENCH" -p "$PORT" -c 1 -t 1 -d 1 -u / > /dev/null 2>&1; do
+        tries=$((tries + 1))
+        if [ $tries -ge 10 ] || ! kill -0 "$SERVER_PID" 2>/dev/null; then
+            echo "$name did not start, see $DIR/$name.log" >&2
+            stop_server
+            return 1
+        fi
+        sleep 1
+    done
+
+    common="-p $PORT -t $THREADS -d $DURATION -s $SERVER_PID -o $OUTPUT"
+    "$BENCH" $common -c "$CONNECTIONS" -u "$SMALL" -l "$name/keepalive-small"
+    "$BENCH" $common -c "$CONNECTIONS" -u "$MIX" -l "$name/keepalive-mix"
+    "$BENCH" $common -c "$CONNECTIONS" -u "$SMALL" -K -l "$name/close-small"
+    "$BENCH" $common -c "$CONNECTIONS" -u "$SMALL" -P "$PIPELINE" -l "$name/pipeline-small"
+
+    stop_server
+}
+
+echo "Writing results to $OUTPUT"
+run_server nexos "$NEXOS" -p "$PORT" -r "$ROOT"
+if [ -n "$SIMPLE" ]; then
+    run_server simple "$SIMPLE" -p "$PORT" -r "$ROOT"
+fi
@@ -0,0 +1,478 @@
+/**
+ * NexOS I/O Subsystem - Files
+ *
+ * This file implements the file_t interface (io_open, io_read, io_write,
+ * io_seek). Regular files of at least IO_FILE_MAP_MIN bytes opened
+ * read-only are memory mapped and read with a copy out of the page cache;
+ * everything else goes through pread and pwrite at the file position,
+ * except streams (sockets, pipes and terminals), which have none and go
+ * through read and write. A stream opened without O_NONBLOCK is switched
+ * to non-blocking underneath, so a read or write that has to wait parks
+ * the calling scheduler thread (io_wait_ready) instead of its CPU.
+ *
+ * Reads drive the kernel's readahead: once IO_READAHEAD_TRIGGER reads in a
+ * row continue where the previous one ended, the file is advised as
+ * sequential and a readahead window ahead of the position is requested,
+ * starting at the window set by io_set_readahead and doubling up to
+ * IO_READAHEAD_MAX each time the reader catches up with it. Runs of
+ * IO_READAHEAD_TRIGGER random reads turn readahead off. Every change of
+ * advice or window counts as a prefetch adjustment.
+ *
+ * A mapped file that is truncated while it is read raises SIGBUS, as for
+ * any shared mapping; files replaced by rename are unaffected.
+ */
+
+#define _GNU_SOURCE
+#include "io.h"
+#include "stats.h"
+#include "wait.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+
+/* Consecutive sequential (or random) reads that change the advice */
+#define IO_READAHEAD_TRIGGER 2
+
+/* Readahead advice in effect */
+typedef enum {
+    ADVICE_NORMAL,
+    ADVICE_SEQUENTIAL,
+    ADVICE_RANDOM
+} advice_t;
+
+/* State behind file_t.private_data */
+typedef struct {
+    int fd;
+    bool owns_fd;              /* io_close closes fd */
+    bool stream;               /* Socket, pipe or terminal: read and write, no position */
+    bool park;                 /* Made non-blocking here: wait when it would block */
+    uint8_t* map;              /* Mapping of the whole file (NULL = pread) */
+    uint64_t size;             /* File size when mapped */
+    uint64_t next_offset;      /* Where a sequential read would start */
+    uint32_t sequential_reads; /* Reads in the current sequential run */
+    uint32_t random_reads;     /* Reads in the current random run */
+    uint64_t window;           /* Readahead window */
+    uint64_t advised_end;      /* End of the range requested so far */
+    advice_t advice;
+} file_state_t;
+
+static _Atomic uint32_t next_file_id = 1;
+
+/* Starting readahead window */
+static _Atomic uint32_t readahead_window = IO_READAHEAD_MIN;
+
+/**
+ * Translate an errno value to an error code
+ */
+static error_code_t status_from_errno(int error) {
+    switch (error) {
+        case EAGAIN:
+            return ERROR_TIMEOUT;
+        case EINVAL:
+        case EBADF:
+        case EFAULT:
+        case ENOENT:
+        case ENOTDIR:
+        case EISDIR:
+            return ERROR_INVALID_PARAMETER;
+        case ENOMEM:
+            return ERROR_MEMORY_ALLOCATION;
+        case EPERM:
+        case EACCES:
+            return ERROR_PERMISSION_DENIED;
+        default:
+            return ERROR_RESOURCE_BUSY;
+    }
+}
+
+/**
+ * Account a prefetch adjustment
+ */
+static void count_adjustment(void) {
+    io_stats_shard_t* shard = io_stats_shard();
+    if (shard) {
+        io_stats_add(shard, IO_STAT_PREFETCH_ADJUSTMENTS, 1);
+    }
+}
+
+/**
+ * Apply readahead advice to the whole file
+ */
+static void advise_file(file_state_t* state, advice_t advice) {
+    static const int map_advice[] = { MADV_NORMAL, MADV_SEQUENTIAL, MADV_RANDOM };
+    static const int fd_advice[] = { POSIX_FADV_NORMAL, POSIX_FADV_SEQUENTIAL, POSIX_FADV_RANDOM };
+    
+    if (state->map) {
+        madvise(state->map, state->size, map_advice[advice]);
+    } else {
+        posix_fadvise(state->fd, 0, 0, fd_advice[advice]);
+    }
+    
+    state->advice = advice;
+    count_adjustment();
+}
+
+/**
+ * Ask the kernel to read [start, end) ahead
+ */
+static void prefetch(file_state_t* state, uint64_t start, uint64_t end) {
+    if (state->map) {
+        if (end > state->size) {
+            end = state->size;
+        }
+        if (start >= end) {
+            return;
+        }
+    
+        /* madvise needs a page-aligned start */
+        uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+        uint64_t aligned = start & ~(page - 1);
+        madvise(state->map + aligned, end - aligned, MADV_WILLNEED);
+    } else {
+        posix_fadvise(state->fd, (off_t)start, (off_t)(end - start), POSIX_FADV_WILLNEED);
+    }
+}
+
+/**
+ * Track the access pattern of a read of size bytes at offset
+ */
+static void track_read(file_state_t* state, uint64_t offset, uint32_t size) {
+    bool sequential = offset == state->next_offset;
+    uint64_t end = offset + size;
+    state->next_offset = end;
+    
+    if (!sequential) {
+        state->sequential_reads = 0;
+        state->random_reads++;
+    
+        /* Readahead beyond a random read only wastes the page cache */
+        if (state->advice == ADVICE_SEQUENTIAL ||
+            (state->advice == ADVICE_NORMAL && state->random_reads >= IO_READAHEAD_TRIGGER)) {
+            advise_file(state, state->advice == ADVICE_SEQUENTIAL ? ADVICE_NORMAL : ADVICE_RANDOM);
+            state->window = atomic_load_explicit(&readahead_window, memory_order_relaxed);
+            state->advised_end = 0;
+        }
+        return;
+    }
+    
+    state->random_reads = 0;
+    if (++state->sequential_reads < IO_READAHEAD_TRIGGER) {
+        return;
+    }
+    
+    if (state->advice != ADVICE_SEQUENTIAL) {
+        advise_file(state, ADVICE_SEQUENTIAL);
+    }
+    
+    /* Start the next window once half of the current one is consumed */
+    if (end + state->window / 2 < state->advised_end) {
+        return;
+    }
+    
+    if (state->advised_end > offset && state->window < IO_READAHEAD_MAX) {
+        state->window *= 2;
+        count_adjustment();
+    }
+    
+    uint64_t start = state->advised_end > end ? state->advised_end : end;
+    state->advised_end = end + state->window;
+    prefetch(state, start, state->advised_end);
+}
+
+/**
+ * Whether to retry a failed read or write, after waiting for the
+ * descriptor if it only failed for being made non-blocking here
+ */
+static bool should_retry(file_state_t* state, uint32_t events) {
+    if (errno == EINTR) {
+        return true;
+    }
+    if (errno != EAGAIN || !state->park) {
+        return false;
+    }
+    if (io_wait_ready(state->fd, events) != ERROR_NONE) {
+        errno = EAGAIN;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Wrap a descriptor in a file
+ */
+static error_code_t file_create(int fd, bool owns_fd, uint32_t flags, uint32_t mode, file_t** file) {
+    file_t* result = calloc(1, sizeof(file_t) + sizeof(file_state_t));
+    if (!result) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    
+    file_state_t* state = (file_state_t*)(result + 1);
+    state->fd = fd;
+    state->owns_fd = owns_fd;
+    state->window = atomic_load_explicit(&readahead_window, memory_order_relaxed);
+    state->advice = ADVICE_NORMAL;
+    
+    struct stat st;
+    bool known = fstat(fd, &st) == 0;
+    
+    /* Map read-mostly files; anything else is read with pread */
+    if (known && (flags & O_ACCMODE) == O_RDONLY && S_ISREG(st.st_mode) &&
+        st.st_size >= IO_FILE_MAP_MIN && (uint64_t)st.st_size <= SIZE_MAX) {
+        void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED) {
+            state->map = map;
+            state->size = (uint64_t)st.st_size;
+        }
+    }
+    
+    /* Blocking streams of our own wait in io_wait_ready; attached
+       descriptors may be shared, so their mode is left alone */
+    state->stream = known && (S_ISSOCK(st.st_mode) || S_ISFIFO(st.st_mode) || S_ISCHR(st.st_mode));
+    if (state->stream && owns_fd && !(flags & O_NONBLOCK)) {
+        int status = fcntl(fd, F_GETFL);
+        state->park = status >= 0 && fcntl(fd, F_SETFL, status | O_NONBLOCK) == 0;
+    }
+    
+    result->id = atomic_fetch_add_explicit(&next_file_id, 1, memory_order_relaxed);
+    result->pid = (uint32_t)getpid();
+    result->flags = flags;
+    result->mode = mode;
+    result->private_data = state;
+    
+    *file = result;
+    return ERROR_NONE;
+}
+
+/**
+ * Open file
+ *
+ * flags and mode are those of open(2); O_CLOEXEC is always added.
+ */
+error_code_t io_open(const char* path, uint32_t flags, uint32_t mode, file_t** file) {
+    if (!path || !file) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    int fd = open(path, (int)flags | O_CLOEXEC, (mode_t)mode);
+    if (fd < 0) {
+        return status_from_errno(errno);
+    }
+    
+    error_code_t err = file_create(fd, true, flags, mode, file);
+    if (err != ERROR_NONE) {
+        close(fd);
+    }
+    
+    return err;
+}
+
+/**
+ * Wrap an open descriptor
+ *
+ * flags are the open(2) flags fd was opened with. io_close leaves fd open.
+ */
+error_code_t io_attach_file(int fd, uint32_t flags, file_t** file) {
+    if (fd < 0 || !file) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    return file_create(fd, false, flags, 0, file);
+}
+
+/**
+ * Close file
+ */
+error_code_t io_close(file_t* file) {
+    if (!file) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    file_state_t* state = file->private_data;
+    error_code_t err = ERROR_NONE;
+    
+    if (state->map) {
+        munmap(state->map, state->size);
+    }
+    if (state->owns_fd) {
+        io_wait_forget(state->fd);
+        if (close(state->fd) < 0) {
+            err = status_from_errno(errno);
+        }
+    }
+    
+    free(file);
+    return err;
+}
+
+/**
+ * Read from file
+ *
+ * Reads at the file position and advances it. *bytes_read is 0 at the end
+ * of the file.
+ */
+error_code_t io_read(file_t* file, void* buffer, uint32_t size, uint32_t* bytes_read) {
+    if (!file || !buffer || !bytes_read) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    file_state_t* state = file->private_data;
+    uint64_t offset = file->position;
+    uint64_t start = io_stats_sample_start();
+    uint32_t count;
+    
+    if (state->map) {
+        uint64_t available = offset < state->size ? state->size - offset : 0;
+        count = available < size ? (uint32_t)available : size;
+        memcpy(buffer, state->map + offset, count);
+    } else {
+        ssize_t result;
+        do {
+            result = state->stream ? read(state->fd, buffer, size) :
+                                     pread(state->fd, buffer, size, (off_t)offset);
+        } while (result < 0 && should_retry(state, IO_EVENT_READ));
+    
+        if (result < 0) {
+            *bytes_read = 0;
+            return status_from_errno(errno);
+        }
+        count = (uint32_t)result;
+    }
+    
+    io_stats_record(false, count, start);
+    if (count > 0 && !state->stream) {
+        track_read(state, offset, count);
+    }
+    
+    file->position = offset + count;
+    *bytes_read = count;
+    return ERROR_NONE;
+}
+
+/**
+ * Write to file
+ *
+ * Writes at the file position (at the end for O_APPEND) and advances it.
+ */
+error_code_t io_write(file_t* file, const void* buffer, uint32_t size, uint32_t* bytes_written) {
+    if (!file || !buffer || !bytes_written) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    file_state_t* state = file->private_data;
+    uint64_t start = io_stats_sample_start();
+    ssize_t result;
+    
+    do {
+        if ((file->flags & O_APPEND) || state->stream) {
+            result = write(state->fd, buffer, size);
+        } else {
+            result = pwrite(state->fd, buffer, size, (off_t)file->position);
+        }
+    } while (result < 0 && should_retry(state, IO_EVENT_WRITE));
+    
+    if (result < 0) {
+        *bytes_written = 0;
+        return status_from_errno(errno);
+    }
+    
+    io_stats_record(true, (uint64_t)result, start);
+    
+    if ((file->flags & O_APPEND) && !state->stream) {
+        off_t end = lseek(state->fd, 0, SEEK_CUR);
+        file->position = end >= 0 ? (uint64_t)end : file->position + (uint64_t)result;
+    } else {
+        file->position += (uint64_t)result;
+    }
+    
+    *bytes_written = (uint32_t)result;
+    return ERROR_NONE;
+}
+
+/**
+ * Seek in file
+ *
+ * whence is SEEK_SET, SEEK_CUR or SEEK_END.
+ */
+error_code_t io_seek(file_t* file, int64_t offset, uint32_t whence) {
+    if (!file) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    file_state_t* state = file->private_data;
+    int64_t base;
+    
+    switch (whence) {
+        case SEEK_SET:
+            base = 0;
+            break;
+        case SEEK_CUR:
+            base = (int64_t)file->position;
+            break;
+        case SEEK_END: {
+            if (state->map) {
+                base = (int64_t)state->size;
+                break;
+            }
+            struct stat st;
+            if (fstat(state->fd, &st) < 0) {
+                return status_from_errno(errno);
+            }
+            base = (int64_t)st.st_size;
+            break;
+        }
+        default:
+            return ERROR_INVALID_PARAMETER;
+    }
+    
+    if ((offset < 0 && base + offset < 0) || (offset > 0 && base > INT64_MAX - offset)) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    file->position = (uint64_t)(base + offset);
+    return ERROR_NONE;
+}
+
+/**
+ * I/O control
+ *
+ * Passes request and arg to ioctl(2) on the file's descriptor.
+ */
+error_code_t io_ioctl(file_t* file, uint32_t request, void* arg) {
+    if (!file) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    file_state_t* state = file->private_data;
+    if (ioctl(state->fd, (unsigned long)request, arg) < 0) {
+        return status_from_errno(errno);
+    }
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Set the starting readahead window of sequential reads
+ *
+ * Files already read sequentially keep their window until a random read
+ * resets it.
+ */
+error_code_t io_set_readahead(uint32_t bytes) {
+    if (bytes < (uint32_t)sysconf(_SC_PAGESIZE) || bytes > IO_READAHEAD_MAX) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    atomic_store_explicit(&readahead_window, bytes, memory_order_relaxed);
+    return ERROR_NONE;
+}
+
+/**
+ * Get the starting readahead window of sequential reads
+ */
+uint32_t io_get_readahead(void) {
+    return atomic_load_explicit(&readahead_window, memory_order_relaxed);
+}
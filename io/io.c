@@ -1,4 +1,8 @@
+#define _GNU_SOURCE
 #include "io.h"
+#include "sched.h"
+#include "stats.h"
+#include "wait.h"
 #include "../memory/memory.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -9,16 +13,40 @@
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/* Shortest window over which io_get_metrics recomputes rates */
+#define METRICS_MIN_WINDOW_NS 10000000ULL
+
+/* Queue depth below which reordering requests gains nothing */
+#define ADAPTIVE_MIN_DEPTH 2
+
+/* Share of requests (percent) carrying deadlines or priorities that makes
+   the adaptive policy switch to deadline or priority scheduling */
+#define ADAPTIVE_DEADLINE_SHARE 25
+#define ADAPTIVE_PRIORITY_SHARE 25
 
 /* I/O subsystem state */
 static struct {
     bool initialized;
     io_metrics_t metrics;
     io_scheduling_policy_t policy;
+    _Atomic io_scheduling_policy_t active_policy; /* Policy applied by the request rings */
+    io_optimization_t optimization;
+    io_sched_stats_t optimized_stats; /* Scheduler statistics at the last io_optimize */
     uint32_t next_request_id;
-    uint32_t next_device_id;
-    uint32_t next_file_id;
-} io_state = {0};
+    pthread_mutex_t lock;              /* Guards metrics, the rate window and the device table */
+    io_stats_snapshot_t window;        /* Counters at the start of the rate window */
+    device_t* devices[IO_MAX_DEVICES]; /* Registered devices, devices[id - 1] */
+    io_statistics_t device_stats[IO_MAX_DEVICES];
+    uint64_t device_base[IO_MAX_DEVICES][IO_DEVICE_STAT_COUNT]; /* Device counters at registration */
+} io_state = {
+    .lock = PTHREAD_MUTEX_INITIALIZER
+};
 
 /**
  * Initialize I/O subsystem
@@ -33,19 +61,69 @@ error_code_t io_init(void) {
     /* Initialize I/O state */
     io_state.initialized = true;
     io_state.policy = IO_SCHED_FIFO;
+    atomic_store_explicit(&io_state.active_policy, IO_SCHED_FIFO, memory_order_relaxed);
     io_state.next_request_id = 1;
-    io_state.next_device_id = 1;
-    io_state.next_file_id = 1;
     
     /* Initialize metrics */
     memset(&io_state.metrics, 0, sizeof(io_metrics_t));
+    io_stats_snapshot(&io_state.window);
     
     printf("I/O subsystem initialized successfully\n");
     return ERROR_NONE;
 }
 
+/**
+ * Recompute rates and latencies over the window ending at now
+ */
+static void update_window(const io_stats_snapshot_t* now, uint64_t elapsed_ns, double ns_per_tick) {
+    const io_stats_snapshot_t* start = &io_state.window;
+    io_statistics_t* global = &io_state.metrics.global;
+    double seconds = (double)elapsed_ns / 1e9;
+    
+    uint64_t operations = now->values[IO_STAT_OPERATIONS] - start->values[IO_STAT_OPERATIONS];
+    uint64_t requests = now->values[IO_STAT_COMPLETED] - start->values[IO_STAT_COMPLETED];
+    uint64_t submitted = now->values[IO_STAT_SUBMITTED] - start->values[IO_STAT_SUBMITTED];
+    uint64_t depth_sum = now->values[IO_STAT_DEPTH_SUM] - start->values[IO_STAT_DEPTH_SUM];
+    uint64_t sampled = now->values[IO_STAT_SAMPLED_OPS] - start->values[IO_STAT_SAMPLED_OPS];
+    uint64_t syscalls = operations > requests ? operations - requests : 0;
+    
+    /* Ring request latencies are exact; system calls are extrapolated
+       from the timed sample */
+    double busy_ns = (double)(now->values[IO_STAT_LATENCY_NS] - start->values[IO_STAT_LATENCY_NS]);
+    if (sampled > 0) {
+        double ticks = (double)(now->values[IO_STAT_SAMPLED_TICKS] - start->values[IO_STAT_SAMPLED_TICKS]);
+        busy_ns += ticks * ns_per_tick / (double)sampled * (double)syscalls;
+    }
+    
+    global->read_throughput = (float)((now->values[IO_STAT_READ_BYTES] - start->values[IO_STAT_READ_BYTES]) / seconds);
+    global->write_throughput = (float)((now->values[IO_STAT_WRITE_BYTES] - start->values[IO_STAT_WRITE_BYTES]) / seconds);
+    global->average_latency = operations > 0 ? (float)(busy_ns / (double)operations / 1e6) : 0.0f;
+    global->queue_depth = submitted > 0 ? (uint32_t)((depth_sum + submitted / 2) / submitted) : 0;
+    global->io_wait_time += (uint64_t)busy_ns;
+    
+    /* Share of the window with I/O outstanding (overlapping I/O saturates) */
+    double utilization = busy_ns / (double)elapsed_ns;
+    io_state.metrics.io_utilization = (float)(utilization > 1.0 ? 1.0 : utilization);
+    
+    for (uint32_t d = 0; d < IO_MAX_DEVICES; d++) {
+        const uint64_t* counters = now->devices[d];
+        const uint64_t* previous = start->devices[d];
+        io_statistics_t* device = &io_state.device_stats[d];
+        uint64_t completed = counters[IO_DEVICE_STAT_COMPLETED] - previous[IO_DEVICE_STAT_COMPLETED];
+        uint64_t latency = counters[IO_DEVICE_STAT_LATENCY_NS] - previous[IO_DEVICE_STAT_LATENCY_NS];
+    
+        device->read_throughput = (float)((counters[IO_DEVICE_STAT_READ_BYTES] - previous[IO_DEVICE_STAT_READ_BYTES]) / seconds);
+        device->write_throughput = (float)((counters[IO_DEVICE_STAT_WRITE_BYTES] - previous[IO_DEVICE_STAT_WRITE_BYTES]) / seconds);
+        device->average_latency = completed > 0 ? (float)((double)latency / (double)completed / 1e6) : 0.0f;
+    }
+}
+
 /**
  * Get I/O metrics
+ *
+ * Counters are cumulative. Throughput, latency, queue depth and
+ * utilization cover the window since the previous call (windows shorter
+ * than METRICS_MIN_WINDOW_NS keep the previous values).
  */
 error_code_t io_get_metrics(io_metrics_t* metrics) {
     if (!io_state.initialized) {
@@ -56,12 +134,165 @@ error_code_t io_get_metrics(io_metrics_t* metrics) {
         return ERROR_INVALID_PARAMETER;
     }
     
-    /* Copy metrics */
+    io_stats_snapshot_t now;
+    io_stats_snapshot(&now);
+    double ns_per_tick = io_stats_ns_per_tick();
+    
+    pthread_mutex_lock(&io_state.lock);
+    
+    io_statistics_t* global = &io_state.metrics.global;
+    global->read_count = now.values[IO_STAT_READS];
+    global->write_count = now.values[IO_STAT_WRITES];
+    global->read_bytes = now.values[IO_STAT_READ_BYTES];
+    global->write_bytes = now.values[IO_STAT_WRITE_BYTES];
+    io_state.metrics.pending_requests = (uint32_t)(now.values[IO_STAT_SUBMITTED] - now.values[IO_STAT_COMPLETED]);
+    io_state.metrics.completed_requests = (uint32_t)now.values[IO_STAT_OPERATIONS];
+    
+    for (uint32_t d = 0; d < IO_MAX_DEVICES; d++) {
+        const uint64_t* counters = now.devices[d];
+        const uint64_t* base = io_state.device_base[d];
+        io_statistics_t* device = &io_state.device_stats[d];
+    
+        device->read_count = counters[IO_DEVICE_STAT_READS] - base[IO_DEVICE_STAT_READS];
+        device->write_count = counters[IO_DEVICE_STAT_WRITES] - base[IO_DEVICE_STAT_WRITES];
+        device->read_bytes = counters[IO_DEVICE_STAT_READ_BYTES] - base[IO_DEVICE_STAT_READ_BYTES];
+        device->write_bytes = counters[IO_DEVICE_STAT_WRITE_BYTES] - base[IO_DEVICE_STAT_WRITE_BYTES];
+        device->io_wait_time = counters[IO_DEVICE_STAT_LATENCY_NS] - base[IO_DEVICE_STAT_LATENCY_NS];
+    }
+    
+    uint64_t elapsed = now.time_ns - io_state.window.time_ns;
+    if (elapsed >= METRICS_MIN_WINDOW_NS) {
+        update_window(&now, elapsed, ns_per_tick);
+        io_state.window = now;
+    }
+    
+    /* Copy metrics; devices points at the subsystem's table */
     memcpy(metrics, &io_state.metrics, sizeof(io_metrics_t));
+    metrics->devices = io_state.device_stats;
+    
+    pthread_mutex_unlock(&io_state.lock);
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Register device
+ *
+ * Assigns device->id, which also indexes the device's entry in
+ * io_metrics_t.devices.
+ */
+error_code_t io_register_device(device_t* device) {
+    if (!io_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    if (!device) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    io_stats_snapshot_t snapshot;
+    io_stats_snapshot(&snapshot);
+    
+    pthread_mutex_lock(&io_state.lock);
+    
+    uint32_t slot = IO_MAX_DEVICES;
+    for (uint32_t i = IO_MAX_DEVICES; i-- > 0;) {
+        if (io_state.devices[i] == device) {
+            pthread_mutex_unlock(&io_state.lock);
+            return ERROR_INVALID_PARAMETER;
+        }
+        if (!io_state.devices[i]) {
+            slot = i;
+        }
+    }
+    
+    if (slot == IO_MAX_DEVICES) {
+        pthread_mutex_unlock(&io_state.lock);
+        return ERROR_RESOURCE_BUSY;
+    }
+    
+    /* Statistics of a reused slot start from zero */
+    memcpy(io_state.device_base[slot], snapshot.devices[slot], sizeof(io_state.device_base[slot]));
+    memcpy(io_state.window.devices[slot], snapshot.devices[slot], sizeof(io_state.window.devices[slot]));
+    memset(&io_state.device_stats[slot], 0, sizeof(io_statistics_t));
+    
+    io_state.devices[slot] = device;
+    device->id = slot + 1;
+    device->present = true;
+    if (device->id > io_state.metrics.device_count) {
+        io_state.metrics.device_count = device->id;
+    }
+    
+    pthread_mutex_unlock(&io_state.lock);
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Unregister device
+ */
+error_code_t io_unregister_device(uint32_t device_id) {
+    if (!io_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    pthread_mutex_lock(&io_state.lock);
+    
+    if (device_id == 0 || device_id > IO_MAX_DEVICES || !io_state.devices[device_id - 1]) {
+        pthread_mutex_unlock(&io_state.lock);
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    io_state.devices[device_id - 1]->present = false;
+    io_state.devices[device_id - 1] = NULL;
+    
+    uint32_t count = IO_MAX_DEVICES;
+    while (count > 0 && !io_state.devices[count - 1]) {
+        count--;
+    }
+    io_state.metrics.device_count = count;
+    
+    pthread_mutex_unlock(&io_state.lock);
     
     return ERROR_NONE;
 }
 
+/**
+ * Find device by ID
+ */
+device_t* io_find_device(uint32_t device_id) {
+    if (device_id == 0 || device_id > IO_MAX_DEVICES) {
+        return NULL;
+    }
+    
+    pthread_mutex_lock(&io_state.lock);
+    device_t* device = io_state.devices[device_id - 1];
+    pthread_mutex_unlock(&io_state.lock);
+    
+    return device;
+}
+
+/**
+ * Find device by name
+ */
+device_t* io_find_device_by_name(const char* name) {
+    if (!name) {
+        return NULL;
+    }
+    
+    device_t* device = NULL;
+    
+    pthread_mutex_lock(&io_state.lock);
+    for (uint32_t i = 0; i < IO_MAX_DEVICES && !device; i++) {
+        if (io_state.devices[i] && strncmp(io_state.devices[i]->name, name, sizeof(io_state.devices[i]->name)) == 0) {
+            device = io_state.devices[i];
+        }
+    }
+    pthread_mutex_unlock(&io_state.lock);
+    
+    return device;
+}
+
 /**
  * Create a TCP server socket
  */
@@ -87,6 +318,12 @@ error_code_t io_create_server_socket(uint16_t port, int* server_fd) {
         return ERROR_RESOURCE_BUSY;
     }
     
+    /* Allow one listening socket per worker on the same port */
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        close(fd);
+        return ERROR_RESOURCE_BUSY;
+    }
+    
     /* Set non-blocking mode */
     int flags = fcntl(fd, F_GETFL, 0);
     fcntl(fd, F_SETFL, flags | O_NONBLOCK);
@@ -140,10 +377,6 @@ error_code_t io_accept_connection(int server_fd, int* client_fd) {
     int flags = fcntl(fd, F_GETFL, 0);
     fcntl(fd, F_SETFL, flags | O_NONBLOCK);
     
-    /* Update metrics */
-    io_state.metrics.global.io_wait_time = 0;
-    io_state.metrics.pending_requests++;
-    
     *client_fd = fd;
     return ERROR_NONE;
 }
@@ -151,7 +384,7 @@ error_code_t io_accept_connection(int server_fd, int* client_fd) {
 /**
  * Read data from a file descriptor
  */
-error_code_t io_read(int fd, void* buffer, uint32_t size, uint32_t* bytes_read) {
+error_code_t io_read_socket(int fd, void* buffer, uint32_t size, uint32_t* bytes_read) {
     if (!io_state.initialized) {
         return ERROR_NOT_IMPLEMENTED;
     }
@@ -161,6 +394,7 @@ error_code_t io_read(int fd, void* buffer, uint32_t size, uint32_t* bytes_read)
     }
     
     /* Read data */
+    uint64_t start = io_stats_sample_start();
     ssize_t result = read(fd, buffer, size);
     
     if (result < 0) {
@@ -172,8 +406,7 @@ error_code_t io_read(int fd, void* buffer, uint32_t size, uint32_t* bytes_read)
     }
     
     /* Update metrics */
-    io_state.metrics.global.read_count++;
-    io_state.metrics.global.read_bytes += result;
+    io_stats_record(false, (uint64_t)result, start);
     
     *bytes_read = (uint32_t)result;
     return ERROR_NONE;
@@ -182,7 +415,7 @@ error_code_t io_read(int fd, void* buffer, uint32_t size, uint32_t* bytes_read)
 /**
  * Write data to a file descriptor
  */
-error_code_t io_write(int fd, const void* buffer, uint32_t size, uint32_t* bytes_written) {
+error_code_t io_write_socket(int fd, const void* buffer, uint32_t size, uint32_t* bytes_written) {
     if (!io_state.initialized) {
         return ERROR_NOT_IMPLEMENTED;
     }
@@ -192,6 +425,7 @@ error_code_t io_write(int fd, const void* buffer, uint32_t size, uint32_t* bytes
     }
     
     /* Write data */
+    uint64_t start = io_stats_sample_start();
     ssize_t result = write(fd, buffer, size);
     
     if (result < 0) {
@@ -203,55 +437,269 @@ error_code_t io_write(int fd, const void* buffer, uint32_t size, uint32_t* bytes
     }
     
     /* Update metrics */
-    io_state.metrics.global.write_count++;
-    io_state.metrics.global.write_bytes += result;
+    io_stats_record(true, (uint64_t)result, start);
     
     *bytes_written = (uint32_t)result;
     return ERROR_NONE;
 }
 
+/**
+ * Write several buffers to a socket with a single system call
+ *
+ * With IO_WRITE_MORE the data is held back so that it can share TCP
+ * segments with whatever is written next (e.g. a sendfile body).
+ */
+error_code_t io_writev(int fd, const io_vector_t* vectors, uint32_t count, uint32_t flags, uint32_t* bytes_written) {
+    if (!io_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    if (!vectors || count == 0 || count > IOV_MAX || !bytes_written) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    struct iovec iov[count];
+    for (uint32_t i = 0; i < count; i++) {
+        iov[i].iov_base = (void*)vectors[i].base;
+        iov[i].iov_len = vectors[i].length;
+    }
+    
+    struct msghdr msg = {0};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+    
+    /* Write data */
+    uint64_t start = io_stats_sample_start();
+    ssize_t result = sendmsg(fd, &msg, MSG_NOSIGNAL | ((flags & IO_WRITE_MORE) ? MSG_MORE : 0));
+    
+    if (result < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            *bytes_written = 0;
+            return ERROR_TIMEOUT;
+        }
+        return ERROR_RESOURCE_BUSY;
+    }
+    
+    /* Update metrics */
+    io_stats_record(true, (uint64_t)result, start);
+    
+    *bytes_written = (uint32_t)result;
+    return ERROR_NONE;
+}
+
+/**
+ * Send file contents to a socket without copying through user space
+ *
+ * Advances *offset by the number of bytes sent. Returns ERROR_TIMEOUT if
+ * the socket is non-blocking and full.
+ */
+error_code_t io_sendfile(int out_fd, int in_fd, uint64_t* offset, uint32_t size, uint32_t* bytes_sent) {
+    if (!io_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    if (!offset || !bytes_sent) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    /* Send data */
+    off_t file_offset = (off_t)*offset;
+    uint64_t start = io_stats_sample_start();
+    ssize_t result = sendfile(out_fd, in_fd, &file_offset, size);
+    
+    if (result < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            *bytes_sent = 0;
+            return ERROR_TIMEOUT;
+        }
+        return ERROR_RESOURCE_BUSY;
+    }
+    
+    /* File shrank underneath us */
+    if (result == 0 && size > 0) {
+        *bytes_sent = 0;
+        return ERROR_RESOURCE_BUSY;
+    }
+    
+    /* Update metrics */
+    io_stats_record(true, (uint64_t)result, start);
+    
+    *offset = (uint64_t)file_offset;
+    *bytes_sent = (uint32_t)result;
+    return ERROR_NONE;
+}
+
 /**
  * Close a file descriptor
  */
-error_code_t io_close(int fd) {
+error_code_t io_close_socket(int fd) {
     if (!io_state.initialized) {
         return ERROR_NOT_IMPLEMENTED;
     }
     
     /* Close file descriptor */
+    io_wait_forget(fd);
     if (close(fd) < 0) {
         return ERROR_RESOURCE_BUSY;
     }
     
-    /* Update metrics */
-    io_state.metrics.pending_requests--;
-    io_state.metrics.completed_requests++;
+    return ERROR_NONE;
+}
+
+/**
+ * Get the optimization history
+ */
+error_code_t io_get_optimization(io_optimization_t* optimization) {
+    if (!io_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    if (!optimization) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    io_stats_snapshot_t snapshot;
+    io_stats_snapshot(&snapshot);
+    
+    *optimization = io_state.optimization;
+    optimization->prefetch_adjustments = (uint32_t)snapshot.values[IO_STAT_PREFETCH_ADJUSTMENTS];
     
     return ERROR_NONE;
 }
 
+/**
+ * Switch the policy applied by the request rings
+ */
+static void set_active_policy(io_scheduling_policy_t policy) {
+    if (atomic_exchange_explicit(&io_state.active_policy, policy, memory_order_relaxed) != policy) {
+        io_state.optimization.policy_changes++;
+    }
+}
+
 /**
  * Set I/O scheduling policy
+ *
+ * IO_SCHED_ADAPTIVE keeps the current policy until io_optimize picks one
+ * from the observed request mix.
  */
 error_code_t io_set_scheduling_policy(io_scheduling_policy_t policy) {
     if (!io_state.initialized) {
         return ERROR_NOT_IMPLEMENTED;
     }
     
+    if (policy > IO_SCHED_ADAPTIVE) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
     io_state.policy = policy;
+    if (policy != IO_SCHED_ADAPTIVE) {
+        set_active_policy(policy);
+    }
+    io_sched_get_statistics(&io_state.optimized_stats);
     return ERROR_NONE;
 }
 
+/**
+ * Get the scheduling policy applied to submitted requests
+ *
+ * Never IO_SCHED_ADAPTIVE: under the adaptive policy this is the policy
+ * last chosen by io_optimize.
+ */
+io_scheduling_policy_t io_get_scheduling_policy(void) {
+    return atomic_load_explicit(&io_state.active_policy, memory_order_relaxed);
+}
+
 /**
  * Optimize I/O subsystem
+ *
+ * Under IO_SCHED_ADAPTIVE, picks the policy for the requests seen since
+ * the previous call: FIFO while queues stay shallow, deadline ordering
+ * when enough requests carry deadlines, priority ordering when enough
+ * carry priorities.
  */
 error_code_t io_optimize(void) {
     if (!io_state.initialized) {
         return ERROR_NOT_IMPLEMENTED;
     }
     
-    /* In a real implementation, this would analyze I/O patterns and optimize accordingly */
-    /* For now, we'll just return success */
+    io_sched_stats_t stats;
+    io_sched_get_statistics(&stats);
+    
+    uint64_t submitted = stats.submitted - io_state.optimized_stats.submitted;
+    uint64_t depth_sum = stats.depth_sum - io_state.optimized_stats.depth_sum;
+    uint64_t deadlines = stats.deadline_requests - io_state.optimized_stats.deadline_requests;
+    uint64_t priorities = stats.prioritized_requests - io_state.optimized_stats.prioritized_requests;
+    
+    /* Nothing to learn from an idle window */
+    if (io_state.policy != IO_SCHED_ADAPTIVE || submitted == 0) {
+        return ERROR_NONE;
+    }
+    
+    io_scheduling_policy_t policy = IO_SCHED_FIFO;
+    if (depth_sum >= submitted * ADAPTIVE_MIN_DEPTH) {
+        if (deadlines * 100 >= submitted * ADAPTIVE_DEADLINE_SHARE) {
+            policy = IO_SCHED_DEADLINE;
+        } else if (priorities * 100 >= submitted * ADAPTIVE_PRIORITY_SHARE) {
+            policy = IO_SCHED_PRIORITY;
+        }
+    }
+    
+    set_active_policy(policy);
+    io_state.optimized_stats = stats;
     
     return ERROR_NONE;
-}
\ No newline at end of file
+}
+
+/**
+ * Apply a tuning action
+ *
+ * Takes a tuning_action_t setting TUNABLE_IO_POLICY, TUNABLE_READAHEAD or
+ * TUNABLE_IO_WORKERS and reports the value it replaced.
+ */
+error_code_t io_apply_optimization(void* optimization_data) {
+    if (!io_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    tuning_action_t* action = optimization_data;
+    if (!action || action->value > UINT32_MAX) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    uint64_t previous;
+    error_code_t err;
+    
+    switch (action->tunable) {
+        case TUNABLE_IO_POLICY:
+            previous = io_state.policy;
+            err = io_set_scheduling_policy((io_scheduling_policy_t)action->value);
+            break;
+    
+        case TUNABLE_READAHEAD:
+            previous = io_get_readahead();
+            err = io_set_readahead((uint32_t)action->value);
+            if (err == ERROR_NONE && previous != action->value) {
+                io_stats_shard_t* shard = io_stats_shard();
+                if (shard) {
+                    io_stats_add(shard, IO_STAT_PREFETCH_ADJUSTMENTS, 1);
+                }
+            }
+            break;
+    
+        case TUNABLE_IO_WORKERS:
+            previous = io_ring_get_workers();
+            err = io_ring_set_workers((uint32_t)action->value);
+            if (err == ERROR_NONE && previous != action->value) {
+                io_state.optimization.queue_adjustments++;
+            }
+            break;
+    
+        default:
+            return ERROR_INVALID_PARAMETER;
+    }
+    
+    if (err == ERROR_NONE) {
+        action->previous = previous;
+    }
+    return err;
+}
@@ -12,6 +12,7 @@
 #include "../kernel/kernel.h"
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 /* I/O operation types */
 typedef enum {
@@ -21,7 +22,10 @@ typedef enum {
     IO_OP_IOCTL,               /* I/O control operation */
     IO_OP_OPEN,                /* Open operation */
     IO_OP_CLOSE,               /* Close operation */
-    IO_OP_FLUSH                /* Flush operation */
+    IO_OP_FLUSH,               /* Flush operation */
+    IO_OP_ACCEPT,              /* Accept a connection on a listening socket */
+    IO_OP_RECV,                /* Receive from a socket */
+    IO_OP_SEND                 /* Send on a socket */
 } io_operation_t;
 
 /* I/O scheduling policies */
@@ -32,6 +36,9 @@ typedef enum {
     IO_SCHED_ADAPTIVE          /* AI-adaptive scheduling */
 } io_scheduling_policy_t;
 
+/* Maximum number of registered devices */
+#define IO_MAX_DEVICES 32
+
 /* Device types */
 typedef enum {
     DEVICE_TYPE_BLOCK,         /* Block device */
@@ -42,7 +49,7 @@ typedef enum {
 
 /* Device descriptor */
 typedef struct {
-    uint32_t id;               /* Device ID */
+    uint32_t id;               /* Device ID (1..IO_MAX_DEVICES, assigned on registration) */
     char name[32];             /* Device name */
     device_type_t type;        /* Device type */
     uint32_t major;            /* Major device number */
@@ -64,29 +71,54 @@ typedef struct {
     void* private_data;        /* File-specific data */
 } file_t;
 
+struct io_request;
+
+/* Completion callback, run on the submitting thread */
+typedef void (*io_completion_callback_t)(struct io_request* request);
+
 /* I/O request */
-typedef struct {
+typedef struct io_request {
     uint32_t id;               /* Request ID */
     io_operation_t operation;  /* Operation type */
     void* device;              /* Target device */
+    int fd;                    /* Target descriptor (or fixed file index) */
     void* buffer;              /* Data buffer */
     uint32_t size;             /* Buffer size */
     uint64_t offset;           /* Device offset */
     uint32_t flags;            /* Request flags */
     uint8_t priority;          /* Request priority */
-    uint64_t deadline;         /* Request deadline */
+    uint64_t deadline;         /* Monotonic ns after which the request is cancelled (0 = none) */
     uint32_t pid;              /* Requesting process ID */
-    void* completion_callback; /* Completion callback */
+    io_completion_callback_t completion_callback; /* Completion callback (NULL = none) */
     void* private_data;        /* Request-specific data */
+    error_code_t status;       /* Completion status */
+    int32_t result;            /* Bytes transferred, accepted descriptor or negative errno */
 } io_request_t;
 
+/* io_request_t flags */
+#define IO_REQUEST_FIXED_FILE  (1U << 0) /* fd is an index returned by io_register_file */
+#define IO_REQUEST_SUBMIT_NOW  (1U << 1) /* Submit immediately instead of batching */
+
+/* Per-thread submission ring limits */
+#define IO_RING_ENTRIES        256     /* Submission queue entries */
+#define IO_RING_MAX_INFLIGHT   1024    /* Requests in flight per thread (power of two) */
+#define IO_RING_MAX_BUFFERS    64      /* Registered buffers per thread */
+#define IO_RING_MAX_FILES      1024    /* Fixed file slots per thread */
+
+/* Regular files of at least this size opened read-only are memory mapped */
+#define IO_FILE_MAP_MIN        (64 * 1024)
+
+/* Readahead window of sequentially read files (the default starting window, and the largest) */
+#define IO_READAHEAD_MIN       (128 * 1024)
+#define IO_READAHEAD_MAX       (2 * 1024 * 1024)
+
 /* I/O statistics */
 typedef struct {
     uint64_t read_count;       /* Number of read operations */
     uint64_t write_count;      /* Number of write operations */
     uint64_t read_bytes;       /* Number of bytes read */
     uint64_t write_bytes;      /* Number of bytes written */
-    uint64_t io_wait_time;     /* Total I/O wait time */
+    uint64_t io_wait_time;     /* Total I/O wait time in nanoseconds */
     float read_throughput;     /* Read throughput in bytes/second */
     float write_throughput;    /* Write throughput in bytes/second */
     float average_latency;     /* Average I/O latency in milliseconds */
@@ -96,8 +128,8 @@ typedef struct {
 /* Performance metrics for I/O subsystem */
 typedef struct {
     io_statistics_t global;    /* Global I/O statistics */
-    io_statistics_t* devices;  /* Per-device I/O statistics */
-    uint32_t device_count;     /* Number of devices */
+    io_statistics_t* devices;  /* Per-device I/O statistics, devices[id - 1] */
+    uint32_t device_count;     /* Number of entries in devices */
     uint32_t pending_requests; /* Number of pending requests */
     uint32_t completed_requests; /* Number of completed requests */
     float io_utilization;      /* I/O subsystem utilization (0-1) */
@@ -111,6 +143,37 @@ typedef struct {
     uint32_t prefetch_adjustments; /* Number of prefetch adjustments */
 } io_optimization_t;
 
+/* Gather buffer for io_writev */
+typedef struct {
+    const void* base;          /* Start of buffer */
+    size_t length;             /* Buffer length in bytes */
+} io_vector_t;
+
+/* io_writev flags */
+#define IO_WRITE_MORE (1U << 0) /* More data follows; coalesce with the next write */
+
+/* Readiness events reported by the reactor */
+typedef enum {
+    IO_EVENT_READ   = (1 << 0), /* Descriptor is readable */
+    IO_EVENT_WRITE  = (1 << 1), /* Descriptor is writable */
+    IO_EVENT_ERROR  = (1 << 2), /* Error condition on descriptor */
+    IO_EVENT_HANGUP = (1 << 3)  /* Peer closed the connection */
+} io_event_flags_t;
+
+/* Ready descriptor returned by io_reactor_wait */
+typedef struct {
+    uint32_t events;           /* IO_EVENT_* flags */
+    void* data;                /* Data registered with the descriptor */
+} io_event_t;
+
+/* Edge-triggered readiness reactor */
+typedef struct {
+    int backend_fd;            /* Backend (epoll) descriptor */
+    int wakeup_fd;             /* Descriptor used to interrupt a wait */
+    uint32_t max_events;       /* Capacity of the backend event array */
+    void* backend_events;      /* Backend event array */
+} io_reactor_t;
+
 /* Initialize I/O subsystem */
 error_code_t io_init(void);
 
@@ -126,9 +189,12 @@ device_t* io_find_device(uint32_t device_id);
 /* Find device by name */
 device_t* io_find_device_by_name(const char* name);
 
-/* Open file */
+/* Open file (open(2) flags and mode) */
 error_code_t io_open(const char* path, uint32_t flags, uint32_t mode, file_t** file);
 
+/* Wrap an open descriptor; io_close leaves it open */
+error_code_t io_attach_file(int fd, uint32_t flags, file_t** file);
+
 /* Close file */
 error_code_t io_close(file_t* file);
 
@@ -150,15 +216,34 @@ error_code_t io_submit_request(io_request_t* request);
 /* Cancel I/O request */
 error_code_t io_cancel_request(uint32_t request_id);
 
-/* Wait for I/O completion */
+/* Wait for I/O completion (timeout in milliseconds, UINT64_MAX = forever) */
 error_code_t io_wait_completion(uint32_t request_id, uint64_t timeout);
 
+/* Asynchronous request ring (io_uring, epoll fallback) */
+error_code_t io_flush_requests(uint32_t* submitted);
+error_code_t io_poll_completions(uint32_t* completed);
+error_code_t io_register_buffers(const io_vector_t* buffers, uint32_t count);
+error_code_t io_register_file(int fd, int* index);
+error_code_t io_unregister_file(int index);
+const char* io_ring_backend(void);
+void io_ring_release(void);
+error_code_t io_ring_set_workers(uint32_t workers);
+uint32_t io_ring_get_workers(void);
+
 /* Set I/O scheduling policy */
 error_code_t io_set_scheduling_policy(io_scheduling_policy_t policy);
+io_scheduling_policy_t io_get_scheduling_policy(void);
+
+/* Starting readahead window of sequential reads (page size to IO_READAHEAD_MAX) */
+error_code_t io_set_readahead(uint32_t bytes);
+uint32_t io_get_readahead(void);
 
 /* Get I/O metrics */
 error_code_t io_get_metrics(io_metrics_t* metrics);
 
+/* Get the optimization history */
+error_code_t io_get_optimization(io_optimization_t* optimization);
+
 /* Self-optimization interface */
 error_code_t io_optimize(void);
 error_code_t io_analyze_patterns(void);
@@ -170,6 +255,25 @@ error_code_t io_create_server_socket(uint16_t port, int* server_fd);
 error_code_t io_accept_connection(int server_fd, int* client_fd);
 error_code_t io_read_socket(int fd, void* buffer, uint32_t size, uint32_t* bytes_read);
 error_code_t io_write_socket(int fd, const void* buffer, uint32_t size, uint32_t* bytes_written);
+error_code_t io_writev(int fd, const io_vector_t* vectors, uint32_t count, uint32_t flags, uint32_t* bytes_written);
+error_code_t io_sendfile(int out_fd, int in_fd, uint64_t* offset, uint32_t size, uint32_t* bytes_sent);
 error_code_t io_close_socket(int fd);
 
+/* Wait for a non-blocking descriptor (IO_EVENT_READ or IO_EVENT_WRITE),
+   parking a scheduler thread instead of its CPU */
+error_code_t io_wait_ready(int fd, uint32_t events);
+
+/* Wake the threads waiting on a descriptor */
+error_code_t io_wait_wake(int fd);
+
+/* Readiness reactor for non-blocking descriptors (edge-triggered) */
+error_code_t io_reactor_create(io_reactor_t* reactor, uint32_t max_events);
+error_code_t io_reactor_destroy(io_reactor_t* reactor);
+error_code_t io_reactor_add(io_reactor_t* reactor, int fd, uint32_t events, void* data);
+error_code_t io_reactor_modify(io_reactor_t* reactor, int fd, uint32_t events, void* data);
+error_code_t io_reactor_remove(io_reactor_t* reactor, int fd);
+error_code_t io_reactor_wait(io_reactor_t* reactor, io_event_t* events, uint32_t max_events,
+                             int32_t timeout_ms, uint32_t* event_count);
+error_code_t io_reactor_wakeup(io_reactor_t* reactor);
+
 #endif /* NEXOS_IO_H */
\ No newline at end of file
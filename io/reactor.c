@@ -0,0 +1,207 @@
+/**
+ * NexOS I/O Subsystem - Readiness Reactor
+ *
+ * This file implements the edge-triggered readiness reactor used by the
+ * network services. Descriptors must be non-blocking: every readiness
+ * event has to be drained until the operation reports ERROR_TIMEOUT.
+ */
+
+#include "io.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+/**
+ * Translate IO_EVENT_* flags to epoll flags
+ */
+static uint32_t to_epoll_events(uint32_t events) {
+    uint32_t result = EPOLLET | EPOLLRDHUP;
+    
+    if (events & IO_EVENT_READ) result |= EPOLLIN;
+    if (events & IO_EVENT_WRITE) result |= EPOLLOUT;
+    
+    return result;
+}
+
+/**
+ * Translate epoll flags to IO_EVENT_* flags
+ */
+static uint32_t from_epoll_events(uint32_t events) {
+    uint32_t result = 0;
+    
+    if (events & EPOLLIN) result |= IO_EVENT_READ;
+    if (events & EPOLLOUT) result |= IO_EVENT_WRITE;
+    if (events & EPOLLERR) result |= IO_EVENT_ERROR;
+    if (events & (EPOLLHUP | EPOLLRDHUP)) result |= IO_EVENT_HANGUP;
+    
+    return result;
+}
+
+/**
+ * Create a reactor
+ */
+error_code_t io_reactor_create(io_reactor_t* reactor, uint32_t max_events) {
+    if (!reactor || max_events == 0) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    reactor->backend_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (reactor->backend_fd < 0) {
+        return ERROR_RESOURCE_BUSY;
+    }
+    
+    /* Wakeup descriptor lets other threads interrupt io_reactor_wait */
+    reactor->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (reactor->wakeup_fd < 0) {
+        close(reactor->backend_fd);
+        return ERROR_RESOURCE_BUSY;
+    }
+    
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &reactor->wakeup_fd;
+    if (epoll_ctl(reactor->backend_fd, EPOLL_CTL_ADD, reactor->wakeup_fd, &ev) < 0) {
+        close(reactor->wakeup_fd);
+        close(reactor->backend_fd);
+        return ERROR_RESOURCE_BUSY;
+    }
+    
+    reactor->backend_events = malloc(sizeof(struct epoll_event) * max_events);
+    if (!reactor->backend_events) {
+        close(reactor->wakeup_fd);
+        close(reactor->backend_fd);
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    reactor->max_events = max_events;
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Destroy a reactor
+ */
+error_code_t io_reactor_destroy(io_reactor_t* reactor) {
+    if (!reactor) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    close(reactor->wakeup_fd);
+    close(reactor->backend_fd);
+    free(reactor->backend_events);
+    memset(reactor, 0, sizeof(io_reactor_t));
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Register a descriptor with the reactor
+ */
+error_code_t io_reactor_add(io_reactor_t* reactor, int fd, uint32_t events, void* data) {
+    if (!reactor || fd < 0) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    struct epoll_event ev;
+    ev.events = to_epoll_events(events);
+    ev.data.ptr = data;
+    
+    if (epoll_ctl(reactor->backend_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        return errno == ENOMEM || errno == ENOSPC ? ERROR_MEMORY_ALLOCATION : ERROR_RESOURCE_BUSY;
+    }
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Change the events or data registered for a descriptor
+ */
+error_code_t io_reactor_modify(io_reactor_t* reactor, int fd, uint32_t events, void* data) {
+    if (!reactor || fd < 0) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    struct epoll_event ev;
+    ev.events = to_epoll_events(events);
+    ev.data.ptr = data;
+    
+    if (epoll_ctl(reactor->backend_fd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+        return ERROR_RESOURCE_BUSY;
+    }
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Unregister a descriptor from the reactor
+ */
+error_code_t io_reactor_remove(io_reactor_t* reactor, int fd) {
+    if (!reactor || fd < 0) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    if (epoll_ctl(reactor->backend_fd, EPOLL_CTL_DEL, fd, NULL) < 0) {
+        return ERROR_RESOURCE_BUSY;
+    }
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Wait for ready descriptors
+ *
+ * A negative timeout waits indefinitely. Wakeups and interrupted waits
+ * return ERROR_NONE with fewer (possibly zero) events.
+ */
+error_code_t io_reactor_wait(io_reactor_t* reactor, io_event_t* events, uint32_t max_events,
+                             int32_t timeout_ms, uint32_t* event_count) {
+    if (!reactor || !events || max_events == 0 || !event_count) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    if (max_events > reactor->max_events) {
+        max_events = reactor->max_events;
+    }
+    
+    struct epoll_event* ready = (struct epoll_event*)reactor->backend_events;
+    int count = epoll_wait(reactor->backend_fd, ready, (int)max_events, timeout_ms);
+    
+    *event_count = 0;
+    if (count < 0) {
+        return errno == EINTR ? ERROR_NONE : ERROR_RESOURCE_BUSY;
+    }
+    
+    for (int i = 0; i < count; i++) {
+        if (ready[i].data.ptr == &reactor->wakeup_fd) {
+            /* Drain wakeup counter */
+            uint64_t value;
+            while (read(reactor->wakeup_fd, &value, sizeof(value)) > 0) {
+            }
+            continue;
+        }
+    
+        io_event_t* event = &events[(*event_count)++];
+        event->events = from_epoll_events(ready[i].events);
+        event->data = ready[i].data.ptr;
+    }
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Interrupt a thread blocked in io_reactor_wait
+ */
+error_code_t io_reactor_wakeup(io_reactor_t* reactor) {
+    if (!reactor) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    uint64_t value = 1;
+    if (write(reactor->wakeup_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+        return ERROR_RESOURCE_BUSY;
+    }
+    
+    return ERROR_NONE;
+}
@@ -0,0 +1,235 @@
+/**
+ * NexOS I/O Subsystem - Request Scheduler
+ *
+ * Dispatch heap and queueing statistics for the request ring.
+ */
+
+#include "sched.h"
+#include "stats.h"
+
+/**
+ * Heap order: earlier dispatch time first, then queueing order
+ */
+static bool entry_before(const io_sched_entry_t* a, const io_sched_entry_t* b) {
+    if (a->key != b->key) {
+        return a->key < b->key;
+    }
+    
+    /* Sequence numbers wrap; compare their distance */
+    return (int32_t)(a->sequence - b->sequence) < 0;
+}
+
+static void sift_up(io_sched_queue_t* queue, uint32_t index) {
+    io_sched_entry_t entry = queue->entries[index];
+    
+    while (index > 0) {
+        uint32_t parent = (index - 1) / 2;
+        if (!entry_before(&entry, &queue->entries[parent])) {
+            break;
+        }
+        queue->entries[index] = queue->entries[parent];
+        index = parent;
+    }
+    
+    queue->entries[index] = entry;
+}
+
+static void sift_down(io_sched_queue_t* queue, uint32_t index) {
+    io_sched_entry_t entry = queue->entries[index];
+    
+    for (;;) {
+        uint32_t child = index * 2 + 1;
+        if (child >= queue->count) {
+            break;
+        }
+        if (child + 1 < queue->count && entry_before(&queue->entries[child + 1], &queue->entries[child])) {
+            child++;
+        }
+        if (!entry_before(&queue->entries[child], &entry)) {
+            break;
+        }
+        queue->entries[index] = queue->entries[child];
+        index = child;
+    }
+    
+    queue->entries[index] = entry;
+}
+
+/**
+ * Initialize a dispatch queue
+ */
+void io_sched_queue_init(io_sched_queue_t* queue) {
+    queue->count = 0;
+    queue->sequence = 0;
+}
+
+/**
+ * Queue a request
+ *
+ * The queue holds at most IO_RING_MAX_INFLIGHT entries, one per ring slot.
+ */
+void io_sched_queue_push(io_sched_queue_t* queue, uint64_t key, uint32_t slot) {
+    uint32_t index = queue->count++;
+    
+    queue->entries[index].key = key;
+    queue->entries[index].sequence = queue->sequence++;
+    queue->entries[index].slot = slot;
+    sift_up(queue, index);
+}
+
+/**
+ * Remove the request due first
+ */
+bool io_sched_queue_pop(io_sched_queue_t* queue, uint32_t* slot) {
+    if (queue->count == 0) {
+        return false;
+    }
+    
+    *slot = queue->entries[0].slot;
+    queue->entries[0] = queue->entries[--queue->count];
+    if (queue->count > 0) {
+        sift_down(queue, 0);
+    }
+    
+    return true;
+}
+
+/**
+ * Change the key and slot of a queued entry (e.g. after a merge)
+ */
+void io_sched_queue_update(io_sched_queue_t* queue, uint32_t index, uint64_t key, uint32_t slot) {
+    queue->entries[index].key = key;
+    queue->entries[index].slot = slot;
+    sift_up(queue, index);
+    sift_down(queue, index);
+}
+
+/**
+ * Remove a queued entry
+ */
+void io_sched_queue_remove(io_sched_queue_t* queue, uint32_t index) {
+    queue->entries[index] = queue->entries[--queue->count];
+    if (index < queue->count) {
+        sift_up(queue, index);
+        sift_down(queue, index);
+    }
+}
+
+/**
+ * Restore heap order after keys were rewritten in place
+ */
+void io_sched_queue_heapify(io_sched_queue_t* queue) {
+    for (uint32_t i = queue->count / 2; i-- > 0;) {
+        sift_down(queue, i);
+    }
+}
+
+/**
+ * Compute the dispatch time of a request under a policy
+ */
+uint64_t io_sched_key(const io_request_t* request, io_scheduling_policy_t policy, uint64_t submit_ns) {
+    switch (policy) {
+        case IO_SCHED_DEADLINE:
+            if (request->deadline != 0) {
+                return request->deadline;
+            }
+            if (request->operation == IO_OP_WRITE || request->operation == IO_OP_SEND ||
+                request->operation == IO_OP_FLUSH) {
+                return submit_ns + IO_SCHED_WRITE_EXPIRE_NS;
+            }
+            return submit_ns + IO_SCHED_READ_EXPIRE_NS;
+        case IO_SCHED_PRIORITY:
+            return submit_ns + (uint64_t)request->priority * IO_SCHED_PRIORITY_SLICE_NS;
+        default:
+            return submit_ns;
+    }
+}
+
+/**
+ * Account a submitted request
+ *
+ * depth is the number of requests of the submitting thread already queued
+ * or in flight.
+ */
+void io_sched_account_submit(const io_request_t* request, uint32_t depth) {
+    io_stats_shard_t* shard = io_stats_shard();
+    if (!shard) {
+        return;
+    }
+    
+    io_stats_add(shard, IO_STAT_SUBMITTED, 1);
+    io_stats_add(shard, IO_STAT_DEPTH_SUM, depth);
+    
+    if (request->deadline != 0) {
+        io_stats_add(shard, IO_STAT_DEADLINE_REQUESTS, 1);
+    }
+    if (request->priority != 0) {
+        io_stats_add(shard, IO_STAT_PRIORITIZED_REQUESTS, 1);
+    }
+}
+
+/**
+ * Account a completed request
+ *
+ * result is the request's result; transfers count towards the read and
+ * write totals of the subsystem and of the request's device.
+ */
+void io_sched_account_complete(const io_request_t* request, int32_t result, uint64_t latency_ns,
+                                bool missed_deadline) {
+    io_stats_shard_t* shard = io_stats_shard();
+    if (!shard) {
+        return;
+    }
+    
+    io_stats_add(shard, IO_STAT_COMPLETED, 1);
+    io_stats_add(shard, IO_STAT_OPERATIONS, 1);
+    io_stats_add(shard, IO_STAT_LATENCY_NS, latency_ns);
+    if (missed_deadline) {
+        io_stats_add(shard, IO_STAT_DEADLINE_MISSES, 1);
+    }
+    
+    bool write = request->operation == IO_OP_WRITE || request->operation == IO_OP_SEND;
+    bool transfer = write || request->operation == IO_OP_READ || request->operation == IO_OP_RECV;
+    if (transfer && result >= 0) {
+        io_stats_add(shard, write ? IO_STAT_WRITES : IO_STAT_READS, 1);
+        io_stats_add(shard, write ? IO_STAT_WRITE_BYTES : IO_STAT_READ_BYTES, (uint64_t)result);
+    }
+    
+    const device_t* device = request->device;
+    if (device && device->id >= 1 && device->id <= IO_MAX_DEVICES) {
+        io_stats_add_device(shard, device->id, IO_DEVICE_STAT_COMPLETED, 1);
+        io_stats_add_device(shard, device->id, IO_DEVICE_STAT_LATENCY_NS, latency_ns);
+        if (transfer && result >= 0) {
+            io_stats_add_device(shard, device->id, write ? IO_DEVICE_STAT_WRITES : IO_DEVICE_STAT_READS, 1);
+            io_stats_add_device(shard, device->id, write ? IO_DEVICE_STAT_WRITE_BYTES : IO_DEVICE_STAT_READ_BYTES,
+                                (uint64_t)result);
+        }
+    }
+}
+
+/**
+ * Account a request merged into a queued neighbour
+ */
+void io_sched_account_merge(void) {
+    io_stats_shard_t* shard = io_stats_shard();
+    if (shard) {
+        io_stats_add(shard, IO_STAT_MERGED, 1);
+    }
+}
+
+/**
+ * Read the cumulative statistics
+ */
+void io_sched_get_statistics(io_sched_stats_t* stats) {
+    io_stats_snapshot_t snapshot;
+    io_stats_snapshot(&snapshot);
+    
+    stats->submitted = snapshot.values[IO_STAT_SUBMITTED];
+    stats->completed = snapshot.values[IO_STAT_COMPLETED];
+    stats->depth_sum = snapshot.values[IO_STAT_DEPTH_SUM];
+    stats->latency_ns = snapshot.values[IO_STAT_LATENCY_NS];
+    stats->deadline_requests = snapshot.values[IO_STAT_DEADLINE_REQUESTS];
+    stats->prioritized_requests = snapshot.values[IO_STAT_PRIORITIZED_REQUESTS];
+    stats->deadline_misses = snapshot.values[IO_STAT_DEADLINE_MISSES];
+    stats->merged = snapshot.values[IO_STAT_MERGED];
+}
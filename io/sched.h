@@ -0,0 +1,78 @@
+/**
+ * NexOS I/O Subsystem - Request Scheduler
+ *
+ * Dispatch queue used by the request ring under IO_SCHED_DEADLINE and
+ * IO_SCHED_PRIORITY. Once IO_SCHED_DISPATCH_DEPTH requests of a thread are
+ * in flight, further requests wait in a binary min-heap keyed by a
+ * dispatch time: the request deadline (or an expiry derived from the
+ * submission time) under IO_SCHED_DEADLINE, and the submission time plus
+ * a slice per priority level under IO_SCHED_PRIORITY, so low-priority work
+ * is delayed by a bounded amount rather than starved.
+ *
+ * The scheduler also accounts queueing statistics (depth, latency,
+ * deadline misses) in the sharded I/O statistics (see stats.h); io_optimize
+ * picks the adaptive policy from them.
+ */
+
+#ifndef NEXOS_IO_SCHED_H
+#define NEXOS_IO_SCHED_H
+
+#include "io.h"
+
+/* Requests in flight per thread before the scheduler holds requests back */
+#define IO_SCHED_DISPATCH_DEPTH 32
+
+/* Expiry of requests submitted without a deadline (IO_SCHED_DEADLINE) */
+#define IO_SCHED_READ_EXPIRE_NS  500000000ULL
+#define IO_SCHED_WRITE_EXPIRE_NS 5000000000ULL
+
+/* Dispatch delay per priority level (IO_SCHED_PRIORITY, 0 = highest) */
+#define IO_SCHED_PRIORITY_SLICE_NS 10000000ULL
+
+/* Limits of a merged block device request */
+#define IO_SCHED_MAX_MERGE       16
+#define IO_SCHED_MAX_MERGE_BYTES (1024 * 1024)
+
+/* Queued request */
+typedef struct {
+    uint64_t key;              /* Dispatch time */
+    uint32_t sequence;         /* Queueing order, breaks ties */
+    uint32_t slot;             /* Ring slot of the request (or merged group) */
+} io_sched_entry_t;
+
+/* Per-thread dispatch queue */
+typedef struct {
+    io_sched_entry_t entries[IO_RING_MAX_INFLIGHT];
+    uint32_t count;
+    uint32_t sequence;
+} io_sched_queue_t;
+
+/* Cumulative scheduler statistics */
+typedef struct {
+    uint64_t submitted;        /* Requests submitted */
+    uint64_t completed;        /* Requests completed */
+    uint64_t depth_sum;        /* Sum of the queue depth seen by each submission */
+    uint64_t latency_ns;       /* Sum of submission-to-completion latencies */
+    uint64_t deadline_requests; /* Requests submitted with a deadline */
+    uint64_t prioritized_requests; /* Requests submitted with a non-zero priority */
+    uint64_t deadline_misses;  /* Requests completed after their deadline */
+    uint64_t merged;           /* Requests merged into an adjacent request */
+} io_sched_stats_t;
+
+/* Dispatch queue */
+void io_sched_queue_init(io_sched_queue_t* queue);
+void io_sched_queue_push(io_sched_queue_t* queue, uint64_t key, uint32_t slot);
+bool io_sched_queue_pop(io_sched_queue_t* queue, uint32_t* slot);
+void io_sched_queue_update(io_sched_queue_t* queue, uint32_t index, uint64_t key, uint32_t slot);
+void io_sched_queue_remove(io_sched_queue_t* queue, uint32_t index);
+void io_sched_queue_heapify(io_sched_queue_t* queue);
+uint64_t io_sched_key(const io_request_t* request, io_scheduling_policy_t policy, uint64_t submit_ns);
+
+/* Statistics */
+void io_sched_account_submit(const io_request_t* request, uint32_t depth);
+void io_sched_account_complete(const io_request_t* request, int32_t result, uint64_t latency_ns,
+                                bool missed_deadline);
+void io_sched_account_merge(void);
+void io_sched_get_statistics(io_sched_stats_t* stats);
+
+#endif /* NEXOS_IO_SCHED_H */
@@ -0,0 +1,165 @@
+/**
+ * NexOS I/O Subsystem - Sharded Statistics
+ *
+ * Shard registration, aggregation and tick calibration.
+ */
+
+#define _GNU_SOURCE
+#include "stats.h"
+#include <time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/* Calibration needs at least this much wall time between samples */
+#define CALIBRATION_MIN_NS 1000000ULL
+
+_Thread_local io_stats_shard_t* io_stats_local;
+
+/* Shard registry; writers never take the lock after attaching */
+static struct {
+    pthread_mutex_t lock;
+    io_stats_shard_t* active;          /* Shards of running threads */
+    io_stats_shard_t* free;            /* Zeroed shards of exited threads */
+    io_stats_snapshot_t retired;       /* Counters folded in from exited threads */
+    uint64_t calibration_ticks;        /* Tick and time at the first attach */
+    uint64_t calibration_ns;
+    pthread_key_t key;
+    bool key_created;
+} stats_state = {
+    .lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+/**
+ * Current monotonic time in nanoseconds
+ */
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Add a shard's counters to a snapshot
+ */
+static void accumulate(io_stats_snapshot_t* snapshot, io_stats_shard_t* shard) {
+    for (uint32_t i = 0; i < IO_STAT_COUNT; i++) {
+        snapshot->values[i] += atomic_load_explicit(&shard->values[i], memory_order_relaxed);
+    }
+    
+    for (uint32_t d = 0; d < IO_MAX_DEVICES; d++) {
+        for (uint32_t i = 0; i < IO_DEVICE_STAT_COUNT; i++) {
+            snapshot->devices[d][i] += atomic_load_explicit(&shard->devices[d][i], memory_order_relaxed);
+        }
+    }
+}
+
+/**
+ * Retire the shard of an exiting thread
+ */
+static void shard_destructor(void* value) {
+    io_stats_shard_t* shard = value;
+    
+    pthread_mutex_lock(&stats_state.lock);
+    
+    accumulate(&stats_state.retired, shard);
+    
+    io_stats_shard_t** link = &stats_state.active;
+    while (*link && *link != shard) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = shard->next;
+    }
+    
+    memset(shard, 0, sizeof(*shard));
+    shard->next = stats_state.free;
+    stats_state.free = shard;
+    
+    pthread_mutex_unlock(&stats_state.lock);
+    
+    io_stats_local = NULL;
+}
+
+/**
+ * Give the calling thread a shard
+ *
+ * Returns NULL if no memory is available, in which case the thread's I/O
+ * goes unaccounted.
+ */
+io_stats_shard_t* io_stats_attach(void) {
+    pthread_mutex_lock(&stats_state.lock);
+    
+    if (!stats_state.key_created) {
+        if (pthread_key_create(&stats_state.key, shard_destructor) != 0) {
+            pthread_mutex_unlock(&stats_state.lock);
+            return NULL;
+        }
+        stats_state.key_created = true;
+        stats_state.calibration_ticks = io_stats_ticks();
+        stats_state.calibration_ns = monotonic_ns();
+    }
+    
+    io_stats_shard_t* shard = stats_state.free;
+    if (shard) {
+        stats_state.free = shard->next;
+    } else {
+        shard = aligned_alloc(IO_STATS_CACHE_LINE, sizeof(io_stats_shard_t));
+        if (!shard) {
+            pthread_mutex_unlock(&stats_state.lock);
+            return NULL;
+        }
+        memset(shard, 0, sizeof(*shard));
+    }
+    
+    shard->next = stats_state.active;
+    stats_state.active = shard;
+    
+    pthread_mutex_unlock(&stats_state.lock);
+    
+    pthread_setspecific(stats_state.key, shard);
+    io_stats_local = shard;
+    return shard;
+}
+
+/**
+ * Sum the counters of all threads, past and present
+ */
+void io_stats_snapshot(io_stats_snapshot_t* snapshot) {
+    pthread_mutex_lock(&stats_state.lock);
+    
+    memcpy(snapshot, &stats_state.retired, sizeof(*snapshot));
+    for (io_stats_shard_t* shard = stats_state.active; shard; shard = shard->next) {
+        accumulate(snapshot, shard);
+    }
+    
+    pthread_mutex_unlock(&stats_state.lock);
+    
+    snapshot->time_ns = monotonic_ns();
+}
+
+/**
+ * Length of a tick in nanoseconds
+ *
+ * Calibrated over the time since the first shard was attached; 1.0 until
+ * enough time has passed.
+ */
+double io_stats_ns_per_tick(void) {
+    pthread_mutex_lock(&stats_state.lock);
+    uint64_t base_ticks = stats_state.calibration_ticks;
+    uint64_t base_ns = stats_state.calibration_ns;
+    bool calibrated = stats_state.key_created;
+    pthread_mutex_unlock(&stats_state.lock);
+    
+    if (!calibrated) {
+        return 1.0;
+    }
+    
+    uint64_t ticks = io_stats_ticks();
+    uint64_t ns = monotonic_ns();
+    if (ns - base_ns < CALIBRATION_MIN_NS || ticks <= base_ticks) {
+        return 1.0;
+    }
+    
+    return (double)(ns - base_ns) / (double)(ticks - base_ticks);
+}
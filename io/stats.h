@@ -0,0 +1,159 @@
+/**
+ * NexOS I/O Subsystem - Sharded Statistics
+ *
+ * Every thread doing I/O owns a cache-line-aligned shard of counters and
+ * is its only writer, so the hot path performs plain relaxed loads and
+ * stores with no lock, atomic read-modify-write or false sharing. Readers
+ * sum all shards under a lock that writers never take; shards of exited
+ * threads are folded into a retired total and reused.
+ *
+ * Latency of system-call I/O is sampled: one operation in
+ * IO_STATS_SAMPLE_INTERVAL is timed with the time stamp counter, which
+ * costs a few cycles instead of a clock_gettime call. Ticks are converted
+ * to nanoseconds with a rate calibrated against CLOCK_MONOTONIC.
+ */
+
+#ifndef NEXOS_IO_STATS_H
+#define NEXOS_IO_STATS_H
+
+#include "io.h"
+#include <stdatomic.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* Shards are aligned to (and padded to a multiple of) a cache line */
+#define IO_STATS_CACHE_LINE 64
+
+/* One system-call operation in this many is timed */
+#define IO_STATS_SAMPLE_INTERVAL 16
+
+/* Counters kept per shard */
+typedef enum {
+    IO_STAT_READS,             /* Successful read operations */
+    IO_STAT_WRITES,            /* Successful write operations */
+    IO_STAT_READ_BYTES,
+    IO_STAT_WRITE_BYTES,
+    IO_STAT_OPERATIONS,        /* Completed operations (system calls and ring requests) */
+    IO_STAT_SAMPLED_OPS,       /* System-call operations timed */
+    IO_STAT_SAMPLED_TICKS,     /* Ticks spent in timed system calls */
+    IO_STAT_SUBMITTED,         /* Ring requests submitted */
+    IO_STAT_COMPLETED,         /* Ring requests completed */
+    IO_STAT_DEPTH_SUM,         /* Queue depth seen by each submission */
+    IO_STAT_LATENCY_NS,        /* Ring request latency */
+    IO_STAT_DEADLINE_REQUESTS, /* Ring requests submitted with a deadline */
+    IO_STAT_PRIORITIZED_REQUESTS, /* Ring requests submitted with a priority */
+    IO_STAT_DEADLINE_MISSES,   /* Ring requests completed after their deadline */
+    IO_STAT_MERGED,            /* Ring requests merged into a neighbour */
+    IO_STAT_PREFETCH_ADJUSTMENTS, /* Readahead advice or window changes */
+    IO_STAT_COUNT
+} io_stat_t;
+
+/* Counters kept per device and shard */
+typedef enum {
+    IO_DEVICE_STAT_READS,
+    IO_DEVICE_STAT_WRITES,
+    IO_DEVICE_STAT_READ_BYTES,
+    IO_DEVICE_STAT_WRITE_BYTES,
+    IO_DEVICE_STAT_COMPLETED,  /* Requests completed */
+    IO_DEVICE_STAT_LATENCY_NS, /* Latency of those requests */
+    IO_DEVICE_STAT_COUNT
+} io_device_stat_t;
+
+/* Per-thread counters */
+typedef struct io_stats_shard {
+    _Alignas(IO_STATS_CACHE_LINE) _Atomic uint64_t values[IO_STAT_COUNT];
+    _Atomic uint64_t devices[IO_MAX_DEVICES][IO_DEVICE_STAT_COUNT]; /* Indexed by device ID - 1 */
+    uint32_t sample_countdown; /* Operations until the next timed one (owner only) */
+    struct io_stats_shard* next;
+} io_stats_shard_t;
+
+/* Sum of all shards */
+typedef struct {
+    uint64_t values[IO_STAT_COUNT];
+    uint64_t devices[IO_MAX_DEVICES][IO_DEVICE_STAT_COUNT];
+    uint64_t time_ns;          /* CLOCK_MONOTONIC when taken */
+} io_stats_snapshot_t;
+
+extern _Thread_local io_stats_shard_t* io_stats_local;
+
+/* Function prototypes */
+io_stats_shard_t* io_stats_attach(void);
+void io_stats_snapshot(io_stats_snapshot_t* snapshot);
+double io_stats_ns_per_tick(void);
+
+/**
+ * Get the calling thread's shard
+ */
+static inline io_stats_shard_t* io_stats_shard(void) {
+    io_stats_shard_t* shard = io_stats_local;
+    return shard ? shard : io_stats_attach();
+}
+
+/**
+ * Add to a counter of the calling thread's shard (single writer)
+ */
+static inline void io_stats_add(io_stats_shard_t* shard, io_stat_t stat, uint64_t value) {
+    atomic_store_explicit(&shard->values[stat],
+                          atomic_load_explicit(&shard->values[stat], memory_order_relaxed) + value,
+                          memory_order_relaxed);
+}
+
+static inline void io_stats_add_device(io_stats_shard_t* shard, uint32_t device_id, io_device_stat_t stat,
+                                       uint64_t value) {
+    _Atomic uint64_t* counter = &shard->devices[device_id - 1][stat];
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value,
+                          memory_order_relaxed);
+}
+
+/**
+ * Read the time stamp counter (CLOCK_MONOTONIC nanoseconds elsewhere)
+ */
+static inline uint64_t io_stats_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/**
+ * Start timing a system call if it is the one being sampled
+ *
+ * Returns the start tick, or 0 if the operation is not timed.
+ */
+static inline uint64_t io_stats_sample_start(void) {
+    io_stats_shard_t* shard = io_stats_shard();
+    
+    if (!shard || shard->sample_countdown-- != 0) {
+        return 0;
+    }
+    
+    shard->sample_countdown = IO_STATS_SAMPLE_INTERVAL - 1;
+    return io_stats_ticks() | 1;
+}
+
+/**
+ * Account a successful system-call read or write
+ */
+static inline void io_stats_record(bool write, uint64_t bytes, uint64_t start) {
+    io_stats_shard_t* shard = io_stats_shard();
+    
+    if (!shard) {
+        return;
+    }
+    
+    io_stats_add(shard, write ? IO_STAT_WRITES : IO_STAT_READS, 1);
+    io_stats_add(shard, write ? IO_STAT_WRITE_BYTES : IO_STAT_READ_BYTES, bytes);
+    io_stats_add(shard, IO_STAT_OPERATIONS, 1);
+    
+    if (start) {
+        io_stats_add(shard, IO_STAT_SAMPLED_OPS, 1);
+        io_stats_add(shard, IO_STAT_SAMPLED_TICKS, io_stats_ticks() - start);
+    }
+}
+
+#endif /* NEXOS_IO_STATS_H */
@@ -0,0 +1,1617 @@
+/**
+ * NexOS I/O Subsystem - Asynchronous Request Ring
+ *
+ * This file implements io_submit_request, io_cancel_request and
+ * io_wait_completion on top of io_uring. Every thread owns a ring, created
+ * on first use, so submission and completion take no locks: a request
+ * completes on the ring of the thread that submitted it and has to be
+ * waited on or cancelled from that thread.
+ *
+ * Submissions are batched in the submission queue and handed to the kernel
+ * with a single io_uring_enter when the caller flushes, polls or waits (or
+ * the queue fills up). Completions are reaped straight from the shared
+ * completion queue, so polling costs no system call. Buffers and
+ * descriptors can be registered once to skip per-request page pinning and
+ * file table lookups.
+ *
+ * Under IO_SCHED_DEADLINE and IO_SCHED_PRIORITY only IO_SCHED_DISPATCH_DEPTH
+ * requests per thread are handed to the backend at a time; the rest wait
+ * in the scheduler's dispatch queue (see sched.h), where reads or writes
+ * of adjacent ranges of a block device are merged into one vectored
+ * request.
+ *
+ * A request with a deadline is cancelled once the deadline passes, as by
+ * io_cancel_request. Every ring keeps the deadlines on a timer wheel
+ * (see scheduler/timer.h), advanced whenever the ring reaps, and waits in
+ * io_wait_completion end at the next of them.
+ *
+ * Kernels without a usable io_uring (older than 5.11, or with io_uring
+ * disabled) fall back to an epoll loop: operations are attempted when
+ * their descriptor is ready and parked on epoll otherwise.
+ */
+
+#define _GNU_SOURCE
+#include "io.h"
+#include "sched.h"
+#include "../scheduler/timer.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/* user_data of cancellation entries, whose completions are ignored */
+#define RING_CANCEL_TAG UINT64_MAX
+
+/* End of a slot list */
+#define RING_NIL UINT32_MAX
+
+/* Features the io_uring backend relies on (all present since Linux 5.11) */
+#define RING_REQUIRED_FEATURES (IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG)
+
+/* Readiness events handled per epoll_wait in fallback mode */
+#define RING_FALLBACK_EVENTS 64
+
+/* Request slot states */
+typedef enum {
+    SLOT_FREE,
+    SLOT_QUEUED,               /* Held back in the dispatch queue */
+    SLOT_PENDING,              /* Handed to the kernel or parked on epoll */
+    SLOT_READY,                /* Finished in fallback mode, not yet reported */
+    SLOT_DONE                  /* Reported, waiting for io_wait_completion */
+} ring_slot_state_t;
+
+/* In-flight request */
+typedef struct {
+    io_request_t* request;
+    uint32_t id;
+    ring_slot_state_t state;
+    uint32_t next;             /* Next slot in the fallback wait or ready list */
+    int fd;                    /* Resolved descriptor (fallback) */
+    uint32_t events;           /* epoll events waited for (fallback) */
+    uint64_t submit_ns;        /* Submission time */
+    wheel_timer_t deadline_timer; /* Cancels the request at its deadline */
+    
+    /* Merged group (the first member describes the group) */
+    uint32_t merge_head;       /* First member, RING_NIL for the first member itself */
+    uint32_t merge_next;       /* Next member in offset order */
+    uint32_t merge_tail;       /* Last member */
+    uint32_t merge_count;      /* Number of members */
+    uint64_t merge_bytes;      /* Total size of the members */
+    struct iovec* iov;         /* Member buffers while a group is dispatched */
+} ring_slot_t;
+
+/* Per-thread request ring */
+typedef struct {
+    bool uring;                /* io_uring (true) or epoll fallback */
+    int ring_fd;
+    
+    /* Submission queue */
+    atomic_uint* sq_head;
+    atomic_uint* sq_tail;
+    unsigned* sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sq_local_tail;    /* Entries prepared; published to the kernel on enter */
+    struct io_uring_sqe* sqes;
+    
+    /* Completion queue */
+    atomic_uint* cq_head;
+    atomic_uint* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes;
+    
+    void* ring_map;
+    size_t ring_map_size;
+    size_t sqe_map_size;
+    
+    /* Registered resources */
+    io_vector_t buffers[IO_RING_MAX_BUFFERS];
+    uint32_t buffer_count;
+    int files[IO_RING_MAX_FILES];     /* Fixed file slots (-1 = free) */
+    bool files_registered;
+    
+    /* epoll fallback */
+    int epoll_fd;
+    uint32_t wait_head;        /* Slots parked until their descriptor is ready */
+    uint32_t ready_head;       /* Slots finished but not yet reported */
+    uint32_t ready_tail;
+    
+    /* Scheduler */
+    io_sched_queue_t queue;
+    io_scheduling_policy_t queue_policy; /* Policy the queue keys were computed for */
+    uint32_t dispatched;       /* Requests (or groups) handed to the backend */
+    bool dispatching;          /* Draining the queue; completions must not recurse */
+    timer_wheel_t deadlines;   /* Timers of requests with a deadline (monotonic ms) */
+    
+    /* Async workers */
+    unsigned default_workers;  /* Bounded worker limit set up by the kernel (0 = none) */
+    uint32_t workers_version;  /* ring_workers_version last applied */
+    
+    /* Requests in flight */
+    ring_slot_t slots[IO_RING_MAX_INFLIGHT];
+    uint32_t inflight;
+} io_ring_t;
+
+static _Thread_local io_ring_t* thread_ring;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static atomic_uint next_request_id = 1;
+
+/* Bounded async worker limit of every ring (0 = kernel default), and the
+   number of times it was set, for rings to catch up with */
+static _Atomic uint32_t ring_workers;
+static _Atomic uint32_t ring_workers_version;
+
+/* Function prototypes */
+static void ring_destroy(io_ring_t* ring);
+static void ring_dispatch_queued(io_ring_t* ring);
+static void deadline_expired(wheel_timer_t* timer);
+static error_code_t ring_dispatch(io_ring_t* ring, ring_slot_t* slot);
+
+/**
+ * io_uring system calls (no liburing dependency)
+ */
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params* params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags,
+                              void* arg, size_t arg_size) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, const void* arg, unsigned count) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+/**
+ * Translate an errno value to an error code
+ */
+static error_code_t status_from_errno(int error) {
+    switch (error) {
+        case EAGAIN:
+        case ETIME:
+        case ECANCELED:
+            return ERROR_TIMEOUT;
+        case EINVAL:
+        case EBADF:
+        case EFAULT:
+        case ENOTSOCK:
+            return ERROR_INVALID_PARAMETER;
+        case ENOMEM:
+        case ENOBUFS:
+            return ERROR_MEMORY_ALLOCATION;
+        case EPERM:
+        case EACCES:
+            return ERROR_PERMISSION_DENIED;
+        default:
+            return ERROR_RESOURCE_BUSY;
+    }
+}
+
+/**
+ * Current monotonic time in nanoseconds
+ */
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Tear down a thread's ring when the thread exits
+ */
+static void ring_key_destructor(void* ring) {
+    thread_ring = NULL;
+    ring_destroy(ring);
+}
+
+static void ring_key_create(void) {
+    pthread_key_create(&ring_key, ring_key_destructor);
+}
+
+/**
+ * Set up an io_uring instance and map its queues
+ *
+ * Returns false if the kernel has no usable io_uring.
+ */
+static bool uring_setup(io_ring_t* ring) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER;
+    params.cq_entries = IO_RING_MAX_INFLIGHT;
+    
+    int fd = sys_io_uring_setup(IO_RING_ENTRIES, &params);
+    if (fd < 0 && errno == EINVAL) {
+        /* SINGLE_ISSUER needs Linux 6.0 */
+        memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = IO_RING_MAX_INFLIGHT;
+        fd = sys_io_uring_setup(IO_RING_ENTRIES, &params);
+    }
+    if (fd < 0) {
+        return false;
+    }
+    
+    if ((params.features & RING_REQUIRED_FEATURES) != RING_REQUIRED_FEATURES) {
+        close(fd);
+        return false;
+    }
+    
+    /* With SINGLE_MMAP both rings share one mapping */
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    size_t map_size = sq_size > cq_size ? sq_size : cq_size;
+    
+    char* map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     fd, IORING_OFF_SQ_RING);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    
+    size_t sqe_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqes = mmap(NULL, sqe_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        munmap(map, map_size);
+        close(fd);
+        return false;
+    }
+    
+    ring->uring = true;
+    ring->ring_fd = fd;
+    ring->ring_map = map;
+    ring->ring_map_size = map_size;
+    ring->sqe_map_size = sqe_size;
+    ring->sq_head = (atomic_uint*)(map + params.sq_off.head);
+    ring->sq_tail = (atomic_uint*)(map + params.sq_off.tail);
+    ring->sq_array = (unsigned*)(map + params.sq_off.array);
+    ring->sq_mask = *(unsigned*)(map + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    ring->sq_local_tail = atomic_load_explicit(ring->sq_tail, memory_order_relaxed);
+    ring->sqes = sqes;
+    ring->cq_head = (atomic_uint*)(map + params.cq_off.head);
+    ring->cq_tail = (atomic_uint*)(map + params.cq_off.tail);
+    ring->cq_mask = *(unsigned*)(map + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(map + params.cq_off.cqes);
+    
+    /* Zero limits only read the current ones (Linux 5.15 and later) */
+    unsigned limits[2] = { 0, 0 };
+    if (sys_io_uring_register(fd, IORING_REGISTER_IOWQ_MAX_WORKERS, limits, 2) == 0) {
+        ring->default_workers = limits[0];
+    }
+    
+    return true;
+}
+
+/**
+ * Bring a ring's async worker limit up to date with io_ring_set_workers
+ */
+static void ring_sync_workers(io_ring_t* ring) {
+    uint32_t version = atomic_load_explicit(&ring_workers_version, memory_order_acquire);
+    if (version == ring->workers_version) {
+        return;
+    }
+    ring->workers_version = version;
+    
+    if (!ring->uring || ring->default_workers == 0) {
+        return;
+    }
+    
+    uint32_t workers = atomic_load_explicit(&ring_workers, memory_order_relaxed);
+    unsigned limits[2] = { workers ? workers : ring->default_workers, 0 };
+    sys_io_uring_register(ring->ring_fd, IORING_REGISTER_IOWQ_MAX_WORKERS, limits, 2);
+}
+
+/**
+ * Get the calling thread's ring, creating it on first use
+ */
+static io_ring_t* ring_get(void) {
+    if (thread_ring) {
+        ring_sync_workers(thread_ring);
+        return thread_ring;
+    }
+    
+    pthread_once(&ring_key_once, ring_key_create);
+    
+    io_ring_t* ring = calloc(1, sizeof(io_ring_t));
+    if (!ring) {
+        return NULL;
+    }
+    
+    ring->ring_fd = -1;
+    ring->epoll_fd = -1;
+    ring->wait_head = RING_NIL;
+    ring->ready_head = RING_NIL;
+    ring->ready_tail = RING_NIL;
+    for (uint32_t i = 0; i < IO_RING_MAX_FILES; i++) {
+        ring->files[i] = -1;
+    }
+    io_sched_queue_init(&ring->queue);
+    timer_wheel_init(&ring->deadlines, monotonic_ns() / 1000000ULL);
+    for (uint32_t i = 0; i < IO_RING_MAX_INFLIGHT; i++) {
+        wheel_timer_init(&ring->slots[i].deadline_timer, deadline_expired, &ring->slots[i]);
+    }
+    
+    if (!uring_setup(ring)) {
+        ring->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (ring->epoll_fd < 0) {
+            free(ring);
+            return NULL;
+        }
+    }
+    
+    pthread_setspecific(ring_key, ring);
+    thread_ring = ring;
+    ring_sync_workers(ring);
+    return ring;
+}
+
+/**
+ * Destroy a ring
+ *
+ * Requests still in flight are cancelled by the kernel; their callbacks
+ * do not run.
+ */
+static void ring_destroy(io_ring_t* ring) {
+    if (!ring) {
+        return;
+    }
+    
+    for (uint32_t i = 0; i < IO_RING_MAX_INFLIGHT; i++) {
+        free(ring->slots[i].iov);
+    }
+    
+    if (ring->uring) {
+        munmap(ring->sqes, ring->sqe_map_size);
+        munmap(ring->ring_map, ring->ring_map_size);
+        close(ring->ring_fd);
+    } else {
+        close(ring->epoll_fd);
+    }
+    
+    free(ring);
+}
+
+/**
+ * Find the slot of an in-flight request
+ */
+static ring_slot_t* ring_find_slot(io_ring_t* ring, uint32_t request_id) {
+    if (!ring || request_id == 0) {
+        return NULL;
+    }
+    
+    ring_slot_t* slot = &ring->slots[request_id & (IO_RING_MAX_INFLIGHT - 1)];
+    if (slot->state == SLOT_FREE || slot->id != request_id) {
+        return NULL;
+    }
+    
+    return slot;
+}
+
+/**
+ * Assign a request ID and slot
+ *
+ * IDs are unique across threads; an ID whose slot is taken is skipped.
+ */
+static ring_slot_t* ring_alloc_slot(io_ring_t* ring, io_request_t* request) {
+    for (;;) {
+        uint32_t id = atomic_fetch_add_explicit(&next_request_id, 1, memory_order_relaxed);
+        if (id == 0) {
+            continue;
+        }
+    
+        ring_slot_t* slot = &ring->slots[id & (IO_RING_MAX_INFLIGHT - 1)];
+        if (slot->state != SLOT_FREE) {
+            continue;
+        }
+    
+        slot->request = request;
+        slot->id = id;
+        slot->state = SLOT_PENDING;
+        slot->next = RING_NIL;
+        slot->fd = -1;
+        slot->events = 0;
+        slot->submit_ns = monotonic_ns();
+        slot->merge_head = RING_NIL;
+        slot->merge_next = RING_NIL;
+        slot->merge_tail = id & (IO_RING_MAX_INFLIGHT - 1);
+        slot->merge_count = 1;
+        slot->merge_bytes = request->size;
+        slot->iov = NULL;
+        ring->inflight++;
+    
+        request->id = id;
+        request->status = ERROR_NONE;
+        request->result = 0;
+        return slot;
+    }
+}
+
+static void ring_release_slot(io_ring_t* ring, ring_slot_t* slot) {
+    slot->state = SLOT_FREE;
+    slot->request = NULL;
+    ring->inflight--;
+}
+
+/**
+ * Record a request's completion and run its callback
+ *
+ * Requests with a callback are released before it runs, so the callback
+ * may resubmit the request; the others stay until io_wait_completion.
+ */
+static void ring_finish(io_ring_t* ring, ring_slot_t* slot, int32_t result) {
+    io_request_t* request = slot->request;
+    timer_wheel_cancel(&slot->deadline_timer);
+    request->result = result;
+    request->status = result >= 0 ? ERROR_NONE : status_from_errno(-result);
+    slot->state = SLOT_DONE;
+    
+    if (request->completion_callback) {
+        ring_release_slot(ring, slot);
+        request->completion_callback(request);
+    }
+}
+
+/**
+ * Complete a dispatched request (or merged group) and refill the backend
+ *
+ * The result of a merged group is spread over its members in offset
+ * order; an error fails all of them.
+ */
+static void ring_complete(io_ring_t* ring, uint32_t request_id, int32_t result) {
+    ring_slot_t* slot = ring_find_slot(ring, request_id);
+    if (!slot) {
+        return;
+    }
+    
+    if (slot->state == SLOT_PENDING || slot->state == SLOT_READY) {
+        ring->dispatched--;
+    }
+    free(slot->iov);
+    slot->iov = NULL;
+    
+    uint64_t now = monotonic_ns();
+    int64_t remaining = result;
+    uint32_t index = (uint32_t)(slot - ring->slots);
+    
+    while (index != RING_NIL) {
+        ring_slot_t* member = &ring->slots[index];
+        const io_request_t* request = member->request;
+        index = member->merge_next;
+    
+        int32_t part = result;
+        if (result >= 0 && slot->merge_count > 1) {
+            part = (int32_t)(remaining < (int64_t)request->size ? remaining : (int64_t)request->size);
+            remaining -= part;
+        }
+    
+        io_sched_account_complete(request, part, now - member->submit_ns,
+                                  request->deadline != 0 && now > request->deadline);
+        ring_finish(ring, member, part);
+    }
+    
+    ring_dispatch_queued(ring);
+}
+
+/**
+ * Publish prepared entries and enter the kernel
+ *
+ * Submits everything queued and, if wait_nr is non-zero, waits until
+ * that many completions are available or the timeout expires.
+ */
+static error_code_t uring_enter(io_ring_t* ring, uint32_t wait_nr, const struct timespec* timeout,
+                                uint32_t* submitted) {
+    atomic_store_explicit(ring->sq_tail, ring->sq_local_tail, memory_order_release);
+    unsigned to_submit = ring->sq_local_tail - atomic_load_explicit(ring->sq_head, memory_order_acquire);
+    
+    if (submitted) {
+        *submitted = 0;
+    }
+    if (to_submit == 0 && wait_nr == 0) {
+        return ERROR_NONE;
+    }
+    
+    unsigned flags = 0;
+    struct io_uring_getevents_arg arg;
+    void* arg_ptr = NULL;
+    size_t arg_size = 0;
+    
+    if (wait_nr > 0) {
+        flags |= IORING_ENTER_GETEVENTS;
+        if (timeout) {
+            memset(&arg, 0, sizeof(arg));
+            arg.ts = (uint64_t)(uintptr_t)timeout;
+            flags |= IORING_ENTER_EXT_ARG;
+            arg_ptr = &arg;
+            arg_size = sizeof(arg);
+        }
+    }
+    
+    int result = sys_io_uring_enter(ring->ring_fd, to_submit, wait_nr, flags, arg_ptr, arg_size);
+    if (result < 0) {
+        /* Interrupted waits are resumed by the caller; EBUSY means the
+           completion queue overflowed and clears once it is reaped */
+        if (errno == EINTR || errno == EBUSY) {
+            return ERROR_NONE;
+        }
+        return status_from_errno(errno);
+    }
+    
+    if (submitted) {
+        *submitted = (uint32_t)result;
+    }
+    return ERROR_NONE;
+}
+
+/**
+ * Reap available completions without entering the kernel
+ */
+static uint32_t uring_reap(io_ring_t* ring) {
+    uint32_t count = 0;
+    
+    for (;;) {
+        unsigned head = atomic_load_explicit(ring->cq_head, memory_order_relaxed);
+        if (head == atomic_load_explicit(ring->cq_tail, memory_order_acquire)) {
+            break;
+        }
+    
+        /* Consume the entry before running callbacks, which may reap too */
+        const struct io_uring_cqe* cqe = &ring->cqes[head & ring->cq_mask];
+        uint64_t user_data = cqe->user_data;
+        int32_t result = cqe->res;
+        atomic_store_explicit(ring->cq_head, head + 1, memory_order_release);
+    
+        if (user_data != RING_CANCEL_TAG) {
+            ring_complete(ring, (uint32_t)user_data, result);
+            count++;
+        }
+    }
+    
+    return count;
+}
+
+/**
+ * Get a free submission queue entry, flushing the queue if it is full
+ */
+static struct io_uring_sqe* uring_get_sqe(io_ring_t* ring) {
+    unsigned head = atomic_load_explicit(ring->sq_head, memory_order_acquire);
+    
+    if (ring->sq_local_tail - head >= ring->sq_entries) {
+        if (uring_enter(ring, 0, NULL, NULL) != ERROR_NONE) {
+            uring_reap(ring);
+            if (uring_enter(ring, 0, NULL, NULL) != ERROR_NONE) {
+                return NULL;
+            }
+        }
+        head = atomic_load_explicit(ring->sq_head, memory_order_acquire);
+        if (ring->sq_local_tail - head >= ring->sq_entries) {
+            return NULL;
+        }
+    }
+    
+    unsigned index = ring->sq_local_tail & ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ring->sq_local_tail++;
+    return sqe;
+}
+
+/**
+ * Find the registered buffer containing [buffer, buffer + size)
+ */
+static int find_registered_buffer(const io_ring_t* ring, const void* buffer, uint32_t size) {
+    uintptr_t start = (uintptr_t)buffer;
+    
+    for (uint32_t i = 0; i < ring->buffer_count; i++) {
+        uintptr_t base = (uintptr_t)ring->buffers[i].base;
+        if (start >= base && start + size <= base + ring->buffers[i].length) {
+            return (int)i;
+        }
+    }
+    
+    return -1;
+}
+
+/**
+ * Queue a request on the io_uring submission queue
+ */
+static error_code_t uring_prepare(io_ring_t* ring, ring_slot_t* slot) {
+    io_request_t* request = slot->request;
+    bool fixed_file = (request->flags & IO_REQUEST_FIXED_FILE) != 0;
+    int buffer = -1;
+    uint8_t opcode;
+    
+    switch (request->operation) {
+        case IO_OP_READ:
+        case IO_OP_WRITE:
+            if (slot->iov) {
+                opcode = request->operation == IO_OP_READ ? IORING_OP_READV : IORING_OP_WRITEV;
+                break;
+            }
+            buffer = find_registered_buffer(ring, request->buffer, request->size);
+            if (request->operation == IO_OP_READ) {
+                opcode = buffer >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ;
+            } else {
+                opcode = buffer >= 0 ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+            }
+            break;
+        case IO_OP_RECV:
+            opcode = IORING_OP_RECV;
+            break;
+        case IO_OP_SEND:
+            opcode = IORING_OP_SEND;
+            break;
+        case IO_OP_ACCEPT:
+            opcode = IORING_OP_ACCEPT;
+            break;
+        case IO_OP_FLUSH:
+            opcode = IORING_OP_FSYNC;
+            break;
+        case IO_OP_CLOSE:
+            opcode = IORING_OP_CLOSE;
+            break;
+        default:
+            return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    struct io_uring_sqe* sqe = uring_get_sqe(ring);
+    if (!sqe) {
+        return ERROR_RESOURCE_BUSY;
+    }
+    
+    sqe->opcode = opcode;
+    sqe->fd = request->fd;
+    sqe->user_data = slot->id;
+    if (fixed_file) {
+        sqe->flags |= IOSQE_FIXED_FILE;
+    }
+    
+    switch (request->operation) {
+        case IO_OP_READ:
+        case IO_OP_WRITE:
+            sqe->addr = (uint64_t)(uintptr_t)(slot->iov ? (void*)slot->iov : request->buffer);
+            sqe->len = slot->iov ? slot->merge_count : request->size;
+            sqe->off = request->offset;
+            if (buffer >= 0) {
+                sqe->buf_index = (uint16_t)buffer;
+            }
+            break;
+        case IO_OP_RECV:
+        case IO_OP_SEND:
+            sqe->addr = (uint64_t)(uintptr_t)request->buffer;
+            sqe->len = request->size;
+            sqe->msg_flags = request->operation == IO_OP_SEND ? MSG_NOSIGNAL : 0;
+            break;
+        case IO_OP_ACCEPT:
+            sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+            break;
+        default:
+            break;
+    }
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Attempt a request in fallback mode
+ *
+ * Returns true once the request has finished (successfully or not) and
+ * false if its descriptor is not ready yet.
+ */
+static bool fallback_attempt(ring_slot_t* slot) {
+    io_request_t* request = slot->request;
+    ssize_t result;
+    
+    /* Blocking descriptors are only touched once poll reports them ready */
+    if (slot->events) {
+        struct pollfd pfd = { .fd = slot->fd, .events = (short)slot->events };
+        if (poll(&pfd, 1, 0) == 0) {
+            return false;
+        }
+    }
+    
+    do {
+        switch (request->operation) {
+            case IO_OP_READ:
+                if (slot->iov) {
+                    result = preadv(slot->fd, slot->iov, (int)slot->merge_count, (off_t)request->offset);
+                    break;
+                }
+                result = pread(slot->fd, request->buffer, request->size, (off_t)request->offset);
+                if (result < 0 && errno == ESPIPE) {
+                    result = read(slot->fd, request->buffer, request->size);
+                }
+                break;
+            case IO_OP_WRITE:
+                if (slot->iov) {
+                    result = pwritev(slot->fd, slot->iov, (int)slot->merge_count, (off_t)request->offset);
+                    break;
+                }
+                result = pwrite(slot->fd, request->buffer, request->size, (off_t)request->offset);
+                if (result < 0 && errno == ESPIPE) {
+                    result = write(slot->fd, request->buffer, request->size);
+                }
+                break;
+            case IO_OP_RECV:
+                result = recv(slot->fd, request->buffer, request->size, MSG_DONTWAIT);
+                break;
+            case IO_OP_SEND:
+                result = send(slot->fd, request->buffer, request->size, MSG_DONTWAIT | MSG_NOSIGNAL);
+                break;
+            case IO_OP_ACCEPT:
+                result = accept4(slot->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                break;
+            case IO_OP_FLUSH:
+                result = fsync(slot->fd);
+                break;
+            default:
+                result = close(slot->fd);
+                break;
+        }
+    } while (result < 0 && errno == EINTR);
+    
+    if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return false;
+    }
+    
+    request->result = result < 0 ? -errno : (int32_t)result;
+    return true;
+}
+
+/**
+ * Append a finished slot to the ready list
+ */
+static void fallback_push_ready(io_ring_t* ring, ring_slot_t* slot) {
+    uint32_t index = (uint32_t)(slot - ring->slots);
+    
+    slot->state = SLOT_READY;
+    slot->next = RING_NIL;
+    if (ring->ready_tail == RING_NIL) {
+        ring->ready_head = index;
+    } else {
+        ring->slots[ring->ready_tail].next = index;
+    }
+    ring->ready_tail = index;
+}
+
+/**
+ * Re-arm (or drop) the epoll registration of a descriptor
+ *
+ * Registrations are one-shot and cover every request parked on the
+ * descriptor.
+ */
+static error_code_t fallback_arm(io_ring_t* ring, int fd) {
+    uint32_t events = 0;
+    
+    for (uint32_t i = ring->wait_head; i != RING_NIL; i = ring->slots[i].next) {
+        if (ring->slots[i].fd == fd) {
+            events |= ring->slots[i].events;
+        }
+    }
+    
+    if (events == 0) {
+        /* The descriptor may already be closed */
+        epoll_ctl(ring->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+        return ERROR_NONE;
+    }
+    
+    struct epoll_event ev;
+    ev.events = events | EPOLLONESHOT;
+    ev.data.fd = fd;
+    if (epoll_ctl(ring->epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+        if (errno != ENOENT || epoll_ctl(ring->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            return status_from_errno(errno);
+        }
+    }
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Unlink a slot from the wait list
+ */
+static void fallback_unlink(io_ring_t* ring, ring_slot_t* slot) {
+    uint32_t index = (uint32_t)(slot - ring->slots);
+    uint32_t* link = &ring->wait_head;
+    
+    while (*link != RING_NIL && *link != index) {
+        link = &ring->slots[*link].next;
+    }
+    if (*link == index) {
+        *link = slot->next;
+    }
+    slot->next = RING_NIL;
+}
+
+/**
+ * Start a request in fallback mode
+ */
+static error_code_t fallback_prepare(io_ring_t* ring, ring_slot_t* slot) {
+    io_request_t* request = slot->request;
+    
+    slot->fd = request->fd;
+    if (request->flags & IO_REQUEST_FIXED_FILE) {
+        slot->fd = ring->files[request->fd];
+    }
+    
+    switch (request->operation) {
+        case IO_OP_READ:
+        case IO_OP_RECV:
+        case IO_OP_ACCEPT:
+            slot->events = EPOLLIN;
+            break;
+        case IO_OP_WRITE:
+        case IO_OP_SEND:
+            slot->events = EPOLLOUT;
+            break;
+        case IO_OP_FLUSH:
+        case IO_OP_CLOSE:
+            slot->events = 0;
+            break;
+        default:
+            return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    if (fallback_attempt(slot)) {
+        fallback_push_ready(ring, slot);
+        return ERROR_NONE;
+    }
+    
+    slot->next = ring->wait_head;
+    ring->wait_head = (uint32_t)(slot - ring->slots);
+    
+    error_code_t err = fallback_arm(ring, slot->fd);
+    if (err != ERROR_NONE) {
+        fallback_unlink(ring, slot);
+    }
+    return err;
+}
+
+/**
+ * Report finished fallback requests
+ */
+static uint32_t fallback_reap(io_ring_t* ring) {
+    uint32_t count = 0;
+    
+    while (ring->ready_head != RING_NIL) {
+        ring_slot_t* slot = &ring->slots[ring->ready_head];
+        ring->ready_head = slot->next;
+        if (ring->ready_head == RING_NIL) {
+            ring->ready_tail = RING_NIL;
+        }
+    
+        ring_complete(ring, slot->id, slot->request->result);
+        count++;
+    }
+    
+    return count;
+}
+
+/**
+ * Retry parked requests whose descriptors became ready
+ */
+static error_code_t fallback_poll(io_ring_t* ring, int timeout_ms) {
+    struct epoll_event events[RING_FALLBACK_EVENTS];
+    
+    int count = epoll_wait(ring->epoll_fd, events, RING_FALLBACK_EVENTS, timeout_ms);
+    if (count < 0) {
+        return errno == EINTR ? ERROR_NONE : status_from_errno(errno);
+    }
+    
+    for (int i = 0; i < count; i++) {
+        int fd = events[i].data.fd;
+        uint32_t* link = &ring->wait_head;
+    
+        while (*link != RING_NIL) {
+            ring_slot_t* slot = &ring->slots[*link];
+            if (slot->fd == fd && fallback_attempt(slot)) {
+                *link = slot->next;
+                fallback_push_ready(ring, slot);
+            } else {
+                link = &slot->next;
+            }
+        }
+    
+        fallback_arm(ring, fd);
+    }
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Cancel a request whose deadline has passed
+ */
+static void deadline_expired(wheel_timer_t* timer) {
+    ring_slot_t* slot = timer->arg;
+    io_cancel_request(slot->id);
+}
+
+/**
+ * Report available completions without blocking
+ *
+ * Requests past their deadline are cancelled first, so those cancelled
+ * in fallback mode are reported right away.
+ */
+static uint32_t ring_reap(io_ring_t* ring) {
+    if (ring->deadlines.count > 0) {
+        timer_wheel_advance(&ring->deadlines, monotonic_ns() / 1000000ULL);
+    }
+    return ring->uring ? uring_reap(ring) : fallback_reap(ring);
+}
+
+/**
+ * Check that a request can be issued by the ring
+ */
+static error_code_t ring_validate(const io_ring_t* ring, const io_request_t* request) {
+    bool fixed_file = (request->flags & IO_REQUEST_FIXED_FILE) != 0;
+    
+    switch (request->operation) {
+        case IO_OP_READ:
+        case IO_OP_WRITE:
+        case IO_OP_RECV:
+        case IO_OP_SEND:
+        case IO_OP_ACCEPT:
+        case IO_OP_FLUSH:
+            break;
+        case IO_OP_CLOSE:
+            /* Fixed files are released with io_unregister_file */
+            if (fixed_file) {
+                return ERROR_INVALID_PARAMETER;
+            }
+            break;
+        default:
+            return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    if (fixed_file && (request->fd < 0 || request->fd >= IO_RING_MAX_FILES || ring->files[request->fd] < 0)) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Whether a request may be merged with requests for adjacent ranges
+ */
+static bool request_mergeable(const io_request_t* request) {
+    const device_t* device = request->device;
+    
+    return (request->operation == IO_OP_READ || request->operation == IO_OP_WRITE) &&
+           request->size > 0 && device && device->type == DEVICE_TYPE_BLOCK;
+}
+
+/**
+ * Refresh the bookkeeping of a merged group starting at head
+ */
+static void group_rebuild(io_ring_t* ring, uint32_t head) {
+    ring_slot_t* first = &ring->slots[head];
+    
+    first->merge_head = RING_NIL;
+    first->merge_count = 0;
+    first->merge_bytes = 0;
+    for (uint32_t i = head; i != RING_NIL; i = ring->slots[i].merge_next) {
+        if (i != head) {
+            ring->slots[i].merge_head = head;
+        }
+        first->merge_tail = i;
+        first->merge_count++;
+        first->merge_bytes += ring->slots[i].request->size;
+    }
+}
+
+/**
+ * Dispatch time of a group: that of its most urgent member
+ */
+static uint64_t group_key(const io_ring_t* ring, uint32_t head, io_scheduling_policy_t policy) {
+    uint64_t key = UINT64_MAX;
+    
+    for (uint32_t i = head; i != RING_NIL; i = ring->slots[i].merge_next) {
+        uint64_t member = io_sched_key(ring->slots[i].request, policy, ring->slots[i].submit_ns);
+        if (member < key) {
+            key = member;
+        }
+    }
+    
+    return key;
+}
+
+/**
+ * Recompute queue keys after the scheduling policy changed
+ */
+static void ring_rekey(io_ring_t* ring, io_scheduling_policy_t policy) {
+    if (ring->queue_policy == policy) {
+        return;
+    }
+    
+    for (uint32_t i = 0; i < ring->queue.count; i++) {
+        ring->queue.entries[i].key = group_key(ring, ring->queue.entries[i].slot, policy);
+    }
+    io_sched_queue_heapify(&ring->queue);
+    ring->queue_policy = policy;
+}
+
+/**
+ * Hold a request back in the dispatch queue
+ *
+ * A block device read or write continuing (or preceding) a queued group
+ * of the same kind joins that group instead of taking its own entry.
+ */
+static void ring_queue(io_ring_t* ring, ring_slot_t* slot) {
+    uint32_t index = (uint32_t)(slot - ring->slots);
+    const io_request_t* request = slot->request;
+    uint64_t key = io_sched_key(request, ring->queue_policy, slot->submit_ns);
+    
+    slot->state = SLOT_QUEUED;
+    
+    if (request_mergeable(request)) {
+        for (uint32_t i = 0; i < ring->queue.count; i++) {
+            const io_sched_entry_t* entry = &ring->queue.entries[i];
+            const ring_slot_t* head = &ring->slots[entry->slot];
+            const io_request_t* first = head->request;
+            const io_request_t* last = ring->slots[head->merge_tail].request;
+    
+            if (first->operation != request->operation || first->device != request->device ||
+                first->fd != request->fd || first->flags != request->flags ||
+                head->merge_count >= IO_SCHED_MAX_MERGE ||
+                head->merge_bytes + request->size > IO_SCHED_MAX_MERGE_BYTES) {
+                continue;
+            }
+    
+            uint32_t group = entry->slot;
+            uint64_t merged_key = key < entry->key ? key : entry->key;
+    
+            if (last->offset + last->size == request->offset) {
+                ring->slots[head->merge_tail].merge_next = index;
+            } else if (request->offset + request->size == first->offset) {
+                slot->merge_next = entry->slot;
+                group = index;
+            } else {
+                continue;
+            }
+    
+            group_rebuild(ring, group);
+            io_sched_queue_update(&ring->queue, i, merged_key, group);
+            io_sched_account_merge();
+            return;
+        }
+    }
+    
+    io_sched_queue_push(&ring->queue, key, index);
+}
+
+/**
+ * Take a queued request out of the dispatch queue
+ *
+ * Leaving a merged group splits it: the members after the request form a
+ * group of their own.
+ */
+static void ring_unqueue(io_ring_t* ring, ring_slot_t* slot) {
+    uint32_t index = (uint32_t)(slot - ring->slots);
+    uint32_t head = slot->merge_head != RING_NIL ? slot->merge_head : index;
+    uint32_t position = 0;
+    
+    while (ring->queue.entries[position].slot != head) {
+        position++;
+    }
+    
+    if (head == index) {
+        uint32_t next = slot->merge_next;
+        if (next == RING_NIL) {
+            io_sched_queue_remove(&ring->queue, position);
+        } else {
+            group_rebuild(ring, next);
+            io_sched_queue_update(&ring->queue, position, group_key(ring, next, ring->queue_policy), next);
+        }
+    } else {
+        uint32_t previous = head;
+        while (ring->slots[previous].merge_next != index) {
+            previous = ring->slots[previous].merge_next;
+        }
+        ring->slots[previous].merge_next = RING_NIL;
+        group_rebuild(ring, head);
+        io_sched_queue_update(&ring->queue, position, group_key(ring, head, ring->queue_policy), head);
+    
+        uint32_t rest = slot->merge_next;
+        if (rest != RING_NIL) {
+            group_rebuild(ring, rest);
+            io_sched_queue_push(&ring->queue, group_key(ring, rest, ring->queue_policy), rest);
+        }
+    }
+    
+    slot->merge_head = RING_NIL;
+    slot->merge_next = RING_NIL;
+}
+
+/**
+ * Hand a request (or merged group) to the backend
+ */
+static error_code_t ring_dispatch(io_ring_t* ring, ring_slot_t* slot) {
+    uint32_t head = (uint32_t)(slot - ring->slots);
+    
+    if (slot->merge_count > 1) {
+        slot->iov = malloc(sizeof(struct iovec) * slot->merge_count);
+        if (!slot->iov) {
+            return ERROR_MEMORY_ALLOCATION;
+        }
+    
+        uint32_t count = 0;
+        for (uint32_t i = head; i != RING_NIL; i = ring->slots[i].merge_next) {
+            slot->iov[count].iov_base = ring->slots[i].request->buffer;
+            slot->iov[count].iov_len = ring->slots[i].request->size;
+            count++;
+        }
+    }
+    
+    ring_slot_state_t state = slot->state;
+    for (uint32_t i = head; i != RING_NIL; i = ring->slots[i].merge_next) {
+        ring->slots[i].state = SLOT_PENDING;
+    }
+    
+    error_code_t err = ring->uring ? uring_prepare(ring, slot) : fallback_prepare(ring, slot);
+    if (err != ERROR_NONE) {
+        for (uint32_t i = head; i != RING_NIL; i = ring->slots[i].merge_next) {
+            ring->slots[i].state = state;
+        }
+        free(slot->iov);
+        slot->iov = NULL;
+        return err;
+    }
+    
+    ring->dispatched++;
+    return ERROR_NONE;
+}
+
+/**
+ * Dispatch queued requests while the backend has room
+ *
+ * Under IO_SCHED_FIFO the queue (left over from another policy) is
+ * drained completely.
+ */
+static void ring_dispatch_queued(io_ring_t* ring) {
+    if (ring->queue.count == 0 || ring->dispatching) {
+        return;
+    }
+    
+    io_scheduling_policy_t policy = io_get_scheduling_policy();
+    if (policy != IO_SCHED_FIFO) {
+        ring_rekey(ring, policy);
+    }
+    
+    ring->dispatching = true;
+    
+    uint32_t index;
+    while ((policy == IO_SCHED_FIFO || ring->dispatched < IO_SCHED_DISPATCH_DEPTH) &&
+           io_sched_queue_pop(&ring->queue, &index)) {
+        ring_slot_t* slot = &ring->slots[index];
+        if (ring_dispatch(ring, slot) != ERROR_NONE) {
+            ring_complete(ring, slot->id, -EBUSY);
+        }
+    }
+    
+    ring->dispatching = false;
+}
+
+/**
+ * Submit an I/O request
+ *
+ * The request is queued on the calling thread's ring and handed to the
+ * kernel with the next flush, poll or wait (or right away with
+ * IO_REQUEST_SUBMIT_NOW). Under IO_SCHED_DEADLINE and IO_SCHED_PRIORITY it
+ * may first wait in the dispatch queue. request->id is assigned here. The
+ * request and its buffer must stay valid until it completes.
+ */
+error_code_t io_submit_request(io_request_t* request) {
+    if (!request) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    io_ring_t* ring = ring_get();
+    if (!ring) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    
+    error_code_t err = ring_validate(ring, request);
+    if (err != ERROR_NONE) {
+        return err;
+    }
+    
+    if (ring->inflight >= IO_RING_MAX_INFLIGHT) {
+        ring_reap(ring);
+        if (ring->inflight >= IO_RING_MAX_INFLIGHT) {
+            return ERROR_RESOURCE_BUSY;
+        }
+    }
+    
+    ring_slot_t* slot = ring_alloc_slot(ring, request);
+    io_scheduling_policy_t policy = io_get_scheduling_policy();
+    io_sched_account_submit(request, ring->dispatched + ring->queue.count);
+    
+    if (policy != IO_SCHED_FIFO &&
+        (ring->dispatched >= IO_SCHED_DISPATCH_DEPTH || ring->queue.count > 0)) {
+        if (ring->queue.count == 0) {
+            ring->queue_policy = policy;
+        }
+        ring_rekey(ring, policy);
+        ring_queue(ring, slot);
+        ring_dispatch_queued(ring);
+    } else {
+        ring_dispatch_queued(ring);
+        err = ring_dispatch(ring, slot);
+        if (err != ERROR_NONE) {
+            ring_release_slot(ring, slot);
+            return err;
+        }
+    }
+    
+    if (request->deadline != 0) {
+        /* Whole milliseconds, rounded up so no request is cancelled early */
+        timer_wheel_add(&ring->deadlines, &slot->deadline_timer,
+                        request->deadline / 1000000ULL + (request->deadline % 1000000ULL != 0));
+    }
+    
+    if (ring->uring && (request->flags & IO_REQUEST_SUBMIT_NOW)) {
+        return uring_enter(ring, 0, NULL, NULL);
+    }
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Cancel an I/O request
+ *
+ * A queued request completes right away. Otherwise cancellation is
+ * asynchronous and takes the whole merged group the request joined: the
+ * request still completes, with ERROR_TIMEOUT and a result of -ECANCELED
+ * unless it finished first.
+ */
+error_code_t io_cancel_request(uint32_t request_id) {
+    io_ring_t* ring = thread_ring;
+    ring_slot_t* slot = ring_find_slot(ring, request_id);
+    if (!slot) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    if (slot->state == SLOT_QUEUED) {
+        ring_unqueue(ring, slot);
+        ring_finish(ring, slot, -ECANCELED);
+        return ERROR_NONE;
+    }
+    
+    if (slot->state != SLOT_PENDING) {
+        return ERROR_NONE;
+    }
+    
+    if (slot->merge_head != RING_NIL) {
+        slot = &ring->slots[slot->merge_head];
+        if (slot->state != SLOT_PENDING) {
+            return ERROR_NONE;
+        }
+    }
+    
+    if (!ring->uring) {
+        fallback_unlink(ring, slot);
+        fallback_arm(ring, slot->fd);
+        slot->request->result = -ECANCELED;
+        fallback_push_ready(ring, slot);
+        return ERROR_NONE;
+    }
+    
+    struct io_uring_sqe* sqe = uring_get_sqe(ring);
+    if (!sqe) {
+        return ERROR_RESOURCE_BUSY;
+    }
+    
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = slot->id;
+    sqe->user_data = RING_CANCEL_TAG;
+    
+    return uring_enter(ring, 0, NULL, NULL);
+}
+
+/**
+ * Wait for an I/O request to complete
+ *
+ * Submits queued requests and waits up to timeout milliseconds
+ * (UINT64_MAX = no limit). Returns ERROR_NONE once the request has
+ * completed, in which case request->status and request->result hold its
+ * outcome and the request ID is released, or ERROR_TIMEOUT.
+ */
+error_code_t io_wait_completion(uint32_t request_id, uint64_t timeout) {
+    io_ring_t* ring = thread_ring;
+    ring_slot_t* slot = ring_find_slot(ring, request_id);
+    if (!slot) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    uint64_t deadline = UINT64_MAX;
+    if (timeout != UINT64_MAX) {
+        uint64_t now = monotonic_ns();
+        deadline = timeout < (UINT64_MAX - now) / 1000000ULL ? now + timeout * 1000000ULL : UINT64_MAX;
+    }
+    
+    for (;;) {
+        ring_dispatch_queued(ring);
+        if (ring->uring) {
+            error_code_t err = uring_enter(ring, 0, NULL, NULL);
+            if (err != ERROR_NONE && err != ERROR_TIMEOUT) {
+                return err;
+            }
+        }
+        ring_reap(ring);
+    
+        /* Requests with a callback are released as soon as they complete */
+        if (slot->state == SLOT_FREE || slot->id != request_id) {
+            return ERROR_NONE;
+        }
+        if (slot->state == SLOT_DONE) {
+            ring_release_slot(ring, slot);
+            return ERROR_NONE;
+        }
+    
+        uint64_t now = monotonic_ns();
+        if (now >= deadline) {
+            return ERROR_TIMEOUT;
+        }
+    
+        /* Wake up for the next request deadline as well */
+        uint64_t wake = deadline;
+        uint64_t expiry = timer_wheel_next(&ring->deadlines);
+        if (expiry < UINT64_MAX / 1000000ULL && expiry * 1000000ULL < wake) {
+            wake = expiry * 1000000ULL;
+            if (wake <= now) {
+                continue;
+            }
+        }
+    
+        uint64_t remaining = wake - now;
+        error_code_t err;
+        if (ring->uring) {
+            struct timespec ts;
+            ts.tv_sec = (time_t)(remaining / 1000000000ULL);
+            ts.tv_nsec = (long)(remaining % 1000000000ULL);
+            err = uring_enter(ring, 1, wake == UINT64_MAX ? NULL : &ts, NULL);
+        } else {
+            int timeout_ms = -1;
+            if (wake != UINT64_MAX) {
+                uint64_t ms = (remaining + 999999ULL) / 1000000ULL;
+                timeout_ms = ms > INT32_MAX ? INT32_MAX : (int)ms;
+            }
+            err = fallback_poll(ring, timeout_ms);
+        }
+    
+        if (err != ERROR_NONE && err != ERROR_TIMEOUT) {
+            return err;
+        }
+    }
+}
+
+/**
+ * Hand queued requests to the kernel
+ */
+error_code_t io_flush_requests(uint32_t* submitted) {
+    io_ring_t* ring = thread_ring;
+    
+    if (submitted) {
+        *submitted = 0;
+    }
+    if (!ring || !ring->uring) {
+        return ERROR_NONE;
+    }
+    
+    return uring_enter(ring, 0, NULL, submitted);
+}
+
+/**
+ * Submit queued requests and report available completions without blocking
+ *
+ * Once everything is submitted this costs no system call with io_uring.
+ */
+error_code_t io_poll_completions(uint32_t* completed) {
+    io_ring_t* ring = thread_ring;
+    
+    if (completed) {
+        *completed = 0;
+    }
+    if (!ring) {
+        return ERROR_NONE;
+    }
+    
+    error_code_t err = ERROR_NONE;
+    if (ring->uring) {
+        err = uring_enter(ring, 0, NULL, NULL);
+    } else if (ring->wait_head != RING_NIL) {
+        err = fallback_poll(ring, 0);
+    }
+    
+    uint32_t count = ring_reap(ring);
+    if (completed) {
+        *completed = count;
+    }
+    
+    return err;
+}
+
+/**
+ * Register buffers with the calling thread's ring
+ *
+ * Replaces any previous set (count 0 drops it). READ and WRITE requests
+ * whose buffer lies within a registered buffer use it automatically. Must
+ * not be called while such requests are in flight.
+ */
+error_code_t io_register_buffers(const io_vector_t* buffers, uint32_t count) {
+    if (count > IO_RING_MAX_BUFFERS || (count > 0 && !buffers)) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    io_ring_t* ring = ring_get();
+    if (!ring) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    
+    if (ring->uring) {
+        if (ring->buffer_count > 0) {
+            sys_io_uring_register(ring->ring_fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+            ring->buffer_count = 0;
+        }
+    
+        if (count > 0) {
+            struct iovec iov[IO_RING_MAX_BUFFERS];
+            for (uint32_t i = 0; i < count; i++) {
+                iov[i].iov_base = (void*)buffers[i].base;
+                iov[i].iov_len = buffers[i].length;
+            }
+            if (sys_io_uring_register(ring->ring_fd, IORING_REGISTER_BUFFERS, iov, count) < 0) {
+                return status_from_errno(errno);
+            }
+        }
+    }
+    
+    if (count > 0) {
+        memcpy(ring->buffers, buffers, count * sizeof(io_vector_t));
+    }
+    ring->buffer_count = count;
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Register a descriptor in the calling thread's fixed file table
+ *
+ * Requests flagged IO_REQUEST_FIXED_FILE pass the returned index as fd,
+ * which saves the kernel a file table lookup and reference per request.
+ * The descriptor itself stays open and owned by the caller.
+ */
+error_code_t io_register_file(int fd, int* index) {
+    if (fd < 0 || !index) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    io_ring_t* ring = ring_get();
+    if (!ring) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    
+    int slot = 0;
+    while (slot < IO_RING_MAX_FILES && ring->files[slot] >= 0) {
+        slot++;
+    }
+    if (slot == IO_RING_MAX_FILES) {
+        return ERROR_RESOURCE_BUSY;
+    }
+    
+    if (ring->uring) {
+        /* The table is registered sparse on first use and updated in place */
+        if (!ring->files_registered) {
+            if (sys_io_uring_register(ring->ring_fd, IORING_REGISTER_FILES, ring->files, IO_RING_MAX_FILES) < 0) {
+                return status_from_errno(errno);
+            }
+            ring->files_registered = true;
+        }
+    
+        struct io_uring_files_update update;
+        memset(&update, 0, sizeof(update));
+        update.offset = (uint32_t)slot;
+        update.fds = (uint64_t)(uintptr_t)&fd;
+        if (sys_io_uring_register(ring->ring_fd, IORING_REGISTER_FILES_UPDATE, &update, 1) < 0) {
+            return status_from_errno(errno);
+        }
+    }
+    
+    ring->files[slot] = fd;
+    *index = slot;
+    return ERROR_NONE;
+}
+
+/**
+ * Remove a descriptor from the fixed file table
+ */
+error_code_t io_unregister_file(int index) {
+    io_ring_t* ring = thread_ring;
+    
+    if (!ring || index < 0 || index >= IO_RING_MAX_FILES || ring->files[index] < 0) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    if (ring->uring) {
+        int clear = -1;
+        struct io_uring_files_update update;
+        memset(&update, 0, sizeof(update));
+        update.offset = (uint32_t)index;
+        update.fds = (uint64_t)(uintptr_t)&clear;
+        if (sys_io_uring_register(ring->ring_fd, IORING_REGISTER_FILES_UPDATE, &update, 1) < 0) {
+            return status_from_errno(errno);
+        }
+    }
+    
+    ring->files[index] = -1;
+    return ERROR_NONE;
+}
+
+/**
+ * Name of the backend serving the calling thread's ring
+ */
+const char* io_ring_backend(void) {
+    io_ring_t* ring = ring_get();
+    
+    if (!ring) {
+        return "none";
+    }
+    
+    return ring->uring ? "io_uring" : "epoll";
+}
+
+/**
+ * Release the calling thread's ring
+ *
+ * Happens automatically when the thread exits. Requests still in flight
+ * are cancelled without running their callbacks.
+ */
+void io_ring_release(void) {
+    io_ring_t* ring = thread_ring;
+    
+    if (!ring) {
+        return;
+    }
+    
+    pthread_setspecific(ring_key, NULL);
+    thread_ring = NULL;
+    ring_destroy(ring);
+}
+
+/**
+ * Limit the bounded async workers of every ring (0 = kernel default)
+ *
+ * io_uring hands reads and writes of regular files that cannot complete
+ * inline to a pool of workers per ring. Rings pick the limit up the next
+ * time their thread uses them; kernels before 5.15 have no limit to set.
+ */
+error_code_t io_ring_set_workers(uint32_t workers) {
+    if (workers > IO_RING_MAX_INFLIGHT) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    atomic_store_explicit(&ring_workers, workers, memory_order_relaxed);
+    atomic_fetch_add_explicit(&ring_workers_version, 1, memory_order_release);
+    return ERROR_NONE;
+}
+
+/**
+ * Get the bounded async worker limit of the rings (0 = kernel default)
+ */
+uint32_t io_ring_get_workers(void) {
+    return atomic_load_explicit(&ring_workers, memory_order_relaxed);
+}
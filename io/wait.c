@@ -0,0 +1,288 @@
+/**
+ * NexOS I/O Subsystem - Descriptor Waiting
+ *
+ * This file implements io_wait_ready and io_wait_wake. A scheduler thread
+ * that waits for a non-blocking descriptor parks instead of holding its
+ * CPU: the descriptor is registered once, edge-triggered for both
+ * directions, with a reactor served by a poller thread started on the
+ * first wait, and the poller unblocks waiters as readiness arrives. Other
+ * callers wait in poll(2).
+ *
+ * Each descriptor has a slot per direction that holds nothing, an event
+ * no waiter has consumed yet, or the parked thread. Waiter and poller
+ * move it with compare-and-swap, so readiness arriving between a failed
+ * operation and the park is not lost, and a parked thread only resumes
+ * once the poller is done with it. Errors and hangups wake both
+ * directions. Wakeups may be spurious: callers retry the operation and
+ * wait again.
+ */
+
+#define _GNU_SOURCE
+#include "io.h"
+#include "wait.h"
+#include "../scheduler/scheduler.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+
+/* Descriptors per table chunk, and chunks (descriptors up to 4M) */
+#define WAIT_CHUNK_SIZE 4096
+#define WAIT_CHUNKS     1024
+
+/* Events taken from the reactor at a time */
+#define WAIT_EVENTS 256
+
+/* Slot values other than a parked thread */
+#define SLOT_EMPTY 0
+#define SLOT_READY 1
+
+/* Waiting state of a descriptor */
+typedef struct {
+    _Atomic uintptr_t readers; /* SLOT_EMPTY, SLOT_READY or a parked thread_t* */
+    _Atomic uintptr_t writers;
+    _Atomic bool registered;   /* Added to the poller's reactor */
+} wait_entry_t;
+
+/* Waiting state */
+static struct {
+    pthread_once_t once;
+    error_code_t status;       /* Result of starting the poller */
+    io_reactor_t reactor;
+    pthread_t poller;
+    _Atomic(wait_entry_t*) chunks[WAIT_CHUNKS];
+} wait_state = {
+    .once = PTHREAD_ONCE_INIT
+};
+
+/**
+ * Get a descriptor's waiting state, allocating its chunk if asked to
+ */
+static wait_entry_t* wait_entry(int fd, bool create) {
+    uint32_t chunk = (uint32_t)fd / WAIT_CHUNK_SIZE;
+    if (chunk >= WAIT_CHUNKS) {
+        return NULL;
+    }
+    
+    wait_entry_t* entries = atomic_load_explicit(&wait_state.chunks[chunk], memory_order_acquire);
+    if (!entries && create) {
+        wait_entry_t* allocated = calloc(WAIT_CHUNK_SIZE, sizeof(wait_entry_t));
+        if (!allocated) {
+            return NULL;
+        }
+        if (atomic_compare_exchange_strong_explicit(&wait_state.chunks[chunk], &entries, allocated,
+                                                    memory_order_acq_rel, memory_order_acquire)) {
+            entries = allocated;
+        } else {
+            free(allocated);
+        }
+    }
+    
+    return entries ? &entries[(uint32_t)fd % WAIT_CHUNK_SIZE] : NULL;
+}
+
+/**
+ * Deliver readiness to a slot: unblock its parked thread, or keep the
+ * event for the next waiter
+ */
+static void slot_wake(_Atomic uintptr_t* slot) {
+    uintptr_t value = atomic_load_explicit(slot, memory_order_acquire);
+    
+    for (;;) {
+        if (value == SLOT_READY) {
+            return;
+        }
+        uintptr_t next = value == SLOT_EMPTY ? SLOT_READY : SLOT_EMPTY;
+        if (atomic_compare_exchange_weak_explicit(slot, &value, next,
+                                                  memory_order_acq_rel, memory_order_acquire)) {
+            break;
+        }
+    }
+    
+    if (value != SLOT_EMPTY) {
+        scheduler_unblock((thread_t*)value);
+    }
+}
+
+/**
+ * Park the calling thread on a slot until readiness is delivered
+ */
+static error_code_t slot_park(_Atomic uintptr_t* slot, thread_t* self) {
+    /* An event since the last wait is consumed at once */
+    uintptr_t value = SLOT_READY;
+    if (atomic_compare_exchange_strong_explicit(slot, &value, SLOT_EMPTY,
+                                                memory_order_acq_rel, memory_order_acquire)) {
+        return ERROR_NONE;
+    }
+    if (value != SLOT_EMPTY) {
+        /* Another thread waits in the same direction */
+        return ERROR_RESOURCE_BUSY;
+    }
+    
+    if (!atomic_compare_exchange_strong_explicit(slot, &value, (uintptr_t)self,
+                                                 memory_order_acq_rel, memory_order_acquire)) {
+        /* The event arrived meanwhile */
+        atomic_store_explicit(slot, SLOT_EMPTY, memory_order_relaxed);
+        return ERROR_NONE;
+    }
+    
+    /* Returns once slot_wake has unblocked the thread, or at once if it
+       did so before the thread switched out */
+    return scheduler_block_current();
+}
+
+/**
+ * Poller thread: deliver the reactor's events to the waiting threads
+ */
+static void* poller_main(void* arg) {
+    (void)arg;
+    io_event_t events[WAIT_EVENTS];
+    
+    for (;;) {
+        uint32_t event_count;
+        if (io_reactor_wait(&wait_state.reactor, events, WAIT_EVENTS, -1, &event_count) != ERROR_NONE) {
+            return NULL;
+        }
+    
+        for (uint32_t i = 0; i < event_count; i++) {
+            wait_entry_t* entry = events[i].data;
+            uint32_t flags = events[i].events;
+    
+            if (flags & (IO_EVENT_READ | IO_EVENT_ERROR | IO_EVENT_HANGUP)) {
+                slot_wake(&entry->readers);
+            }
+            if (flags & (IO_EVENT_WRITE | IO_EVENT_ERROR | IO_EVENT_HANGUP)) {
+                slot_wake(&entry->writers);
+            }
+        }
+    }
+}
+
+static void poller_start(void) {
+    error_code_t err = io_reactor_create(&wait_state.reactor, WAIT_EVENTS);
+    
+    if (err == ERROR_NONE) {
+        if (pthread_create(&wait_state.poller, NULL, poller_main, NULL) == 0) {
+            pthread_detach(wait_state.poller);
+        } else {
+            io_reactor_destroy(&wait_state.reactor);
+            err = ERROR_RESOURCE_BUSY;
+        }
+    }
+    
+    wait_state.status = err;
+}
+
+/**
+ * Add a descriptor to the poller's reactor unless it already is
+ */
+static error_code_t wait_register(wait_entry_t* entry, int fd) {
+    if (atomic_load_explicit(&entry->registered, memory_order_acquire) ||
+        atomic_exchange_explicit(&entry->registered, true, memory_order_acq_rel)) {
+        return ERROR_NONE;
+    }
+    
+    /* Events left over from an earlier descriptor of the same number */
+    atomic_store_explicit(&entry->readers, SLOT_EMPTY, memory_order_relaxed);
+    atomic_store_explicit(&entry->writers, SLOT_EMPTY, memory_order_relaxed);
+    
+    /* Adding reports the readiness the descriptor already has */
+    error_code_t err = io_reactor_add(&wait_state.reactor, fd, IO_EVENT_READ | IO_EVENT_WRITE, entry);
+    if (err == ERROR_RESOURCE_BUSY) {
+        /* Still registered from before io_wait_forget */
+        err = io_reactor_modify(&wait_state.reactor, fd, IO_EVENT_READ | IO_EVENT_WRITE, entry);
+    }
+    if (err != ERROR_NONE) {
+        atomic_store_explicit(&entry->registered, false, memory_order_release);
+    }
+    return err;
+}
+
+/**
+ * Wait for a descriptor in poll(2)
+ */
+static error_code_t poll_ready(int fd, uint32_t events) {
+    struct pollfd request = {
+        .fd = fd,
+        .events = (events & IO_EVENT_READ) ? POLLIN : POLLOUT
+    };
+    int result;
+    
+    do {
+        result = poll(&request, 1, -1);
+    } while (result < 0 && errno == EINTR);
+    
+    return result < 0 ? ERROR_RESOURCE_BUSY : ERROR_NONE;
+}
+
+/**
+ * Wait until a non-blocking descriptor may be ready
+ *
+ * events is IO_EVENT_READ or IO_EVENT_WRITE. On a scheduler thread the
+ * thread parks and its CPU runs other threads meanwhile; at most one
+ * thread may wait per descriptor and direction. Returns ERROR_NONE on
+ * readiness, a spurious wakeup or io_wait_wake alike, so callers retry
+ * their operation and wait again if it still reports ERROR_TIMEOUT.
+ */
+error_code_t io_wait_ready(int fd, uint32_t events) {
+    if (fd < 0 || (events != IO_EVENT_READ && events != IO_EVENT_WRITE)) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    thread_t* self = scheduler_get_current();
+    if (!self) {
+        return poll_ready(fd, events);
+    }
+    
+    pthread_once(&wait_state.once, poller_start);
+    if (wait_state.status != ERROR_NONE) {
+        /* No poller: block the CPU rather than fail */
+        return poll_ready(fd, events);
+    }
+    
+    wait_entry_t* entry = wait_entry(fd, true);
+    if (!entry) {
+        return poll_ready(fd, events);
+    }
+    
+    error_code_t err = wait_register(entry, fd);
+    if (err != ERROR_NONE) {
+        return err;
+    }
+    
+    return slot_park(events == IO_EVENT_READ ? &entry->readers : &entry->writers, self);
+}
+
+/**
+ * Wake the threads waiting on a descriptor
+ *
+ * Their io_wait_ready returns as on readiness. May be called from any
+ * thread; a thread that starts waiting afterwards returns at once.
+ */
+error_code_t io_wait_wake(int fd) {
+    if (fd < 0) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    wait_entry_t* entry = wait_entry(fd, false);
+    if (entry) {
+        slot_wake(&entry->readers);
+        slot_wake(&entry->writers);
+    }
+    return ERROR_NONE;
+}
+
+/**
+ * Drop the waiting state of a descriptor about to be closed
+ *
+ * Closing the descriptor removes it from the reactor; the entry is
+ * registered again by the next wait on a descriptor of the same number.
+ */
+void io_wait_forget(int fd) {
+    wait_entry_t* entry = fd >= 0 ? wait_entry(fd, false) : NULL;
+    
+    if (entry && atomic_load_explicit(&entry->registered, memory_order_relaxed)) {
+        atomic_store_explicit(&entry->registered, false, memory_order_release);
+    }
+}
@@ -0,0 +1,17 @@
+/**
+ * NexOS I/O Subsystem - Descriptor Waiting
+ *
+ * Internal interface between io_wait_ready and the functions that close
+ * descriptors (see wait.c).
+ */
+
+#ifndef NEXOS_IO_WAIT_H
+#define NEXOS_IO_WAIT_H
+
+#include "io.h"
+
+/* Drop the waiting state of a descriptor about to be closed; no thread
+   may be waiting on it */
+void io_wait_forget(int fd);
+
+#endif /* NEXOS_IO_WAIT_H */
@@ -0,0 +1,169 @@
+/**
+ * NexOS Kernel - Handle Tables
+ *
+ * This file implements generation-tagged handle tables (see handle.h).
+ */
+
+#include "handle.h"
+#include "../memory/memory.h"
+#include <string.h>
+
+/* Generation bits of a handle of the table */
+static uint32_t generation_of(const handle_table_t* table, uint32_t generation) {
+    return generation & (UINT32_MAX >> table->index_bits);
+}
+
+static uint32_t make_handle(const handle_table_t* table, uint32_t index, uint32_t generation) {
+    return (generation_of(table, generation) << table->index_bits) | index;
+}
+
+/**
+ * Initialize a table
+ *
+ * The descriptors, generations and free list links share one allocation,
+ * mapped directly at kernel table sizes.
+ */
+error_code_t handle_table_init(handle_table_t* table, uint32_t capacity, uint32_t object_size) {
+    if (!table || capacity < 2 || (capacity & (capacity - 1)) || object_size == 0) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    /* Keep the generations after the descriptors aligned */
+    object_size = (object_size + 7) & ~7U;
+    uint64_t size = (uint64_t)capacity * (object_size + 2 * sizeof(uint32_t));
+    if (size > UINT32_MAX) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    char* storage = memory_allocate((uint32_t)size);
+    if (!storage) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    
+    pthread_mutex_init(&table->lock, NULL);
+    table->objects = storage;
+    table->generations = (_Atomic uint32_t*)(storage + (size_t)capacity * object_size);
+    table->next_free = (uint32_t*)(table->generations + capacity);
+    table->object_size = object_size;
+    table->capacity = capacity;
+    table->index_bits = (uint32_t)__builtin_ctz(capacity);
+    table->free_head = capacity;
+    table->count = 0;
+    atomic_init(&table->extent, 0);
+    
+    for (uint32_t i = 0; i < capacity; i++) {
+        atomic_init(&table->generations[i], 0);
+    }
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Allocate a descriptor
+ *
+ * Takes the most recently freed slot, or the first one never used.
+ */
+void* handle_table_alloc(handle_table_t* table, uint32_t* handle) {
+    if (!table || !handle) {
+        return NULL;
+    }
+    
+    pthread_mutex_lock(&table->lock);
+    
+    uint32_t index = table->free_head;
+    uint32_t extent = atomic_load_explicit(&table->extent, memory_order_relaxed);
+    if (index != table->capacity) {
+        table->free_head = table->next_free[index];
+    } else if (extent < table->capacity) {
+        index = extent;
+        atomic_store_explicit(&table->extent, extent + 1, memory_order_release);
+    } else {
+        pthread_mutex_unlock(&table->lock);
+        return NULL;
+    }
+    
+    void* object = table->objects + (size_t)index * table->object_size;
+    memset(object, 0, table->object_size);
+    
+    /* Publish the zeroed descriptor with its new, odd generation */
+    uint32_t generation = atomic_load_explicit(&table->generations[index], memory_order_relaxed) + 1;
+    atomic_store_explicit(&table->generations[index], generation, memory_order_release);
+    table->count++;
+    
+    pthread_mutex_unlock(&table->lock);
+    
+    *handle = make_handle(table, index, generation);
+    return object;
+}
+
+/**
+ * Free a descriptor
+ *
+ * Fails on a stale handle, so a descriptor is freed once however many
+ * copies of its handle are around.
+ */
+error_code_t handle_table_free(handle_table_t* table, uint32_t handle) {
+    if (!table) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    uint32_t index = handle_index(table, handle);
+    
+    pthread_mutex_lock(&table->lock);
+    
+    uint32_t generation = atomic_load_explicit(&table->generations[index], memory_order_relaxed);
+    if (!(generation & 1) || make_handle(table, index, generation) != handle) {
+        pthread_mutex_unlock(&table->lock);
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    atomic_store_explicit(&table->generations[index], generation + 1, memory_order_release);
+    table->next_free[index] = table->free_head;
+    table->free_head = index;
+    table->count--;
+    
+    pthread_mutex_unlock(&table->lock);
+    return ERROR_NONE;
+}
+
+/**
+ * Get the live descriptor of a handle
+ */
+void* handle_table_get(handle_table_t* table, uint32_t handle) {
+    if (!table || !table->objects) {
+        return NULL;
+    }
+    
+    uint32_t index = handle_index(table, handle);
+    uint32_t generation = atomic_load_explicit(&table->generations[index], memory_order_acquire);
+    if (!(generation & 1) || make_handle(table, index, generation) != handle) {
+        return NULL;
+    }
+    
+    return table->objects + (size_t)index * table->object_size;
+}
+
+/**
+ * Get the next live descriptor in slot order
+ *
+ * Walks the descriptors in memory order up to the highest slot ever used.
+ */
+void* handle_table_next(handle_table_t* table, uint32_t* cursor, uint32_t* handle) {
+    if (!table || !table->objects || !cursor) {
+        return NULL;
+    }
+    
+    uint32_t extent = atomic_load_explicit(&table->extent, memory_order_acquire);
+    while (*cursor < extent) {
+        uint32_t index = (*cursor)++;
+        uint32_t generation = atomic_load_explicit(&table->generations[index], memory_order_acquire);
+        if (generation & 1) {
+            if (handle) {
+                *handle = make_handle(table, index, generation);
+            }
+            return table->objects + (size_t)index * table->object_size;
+        }
+    }
+    
+    return NULL;
+}
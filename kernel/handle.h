@@ -0,0 +1,64 @@
+/**
+ * NexOS Kernel - Handle Tables
+ *
+ * Fixed-capacity tables of descriptors addressed by generation-tagged
+ * handles. A handle holds the slot index in its low bits and the slot's
+ * generation above them. The generation is odd while the slot is live and
+ * moves on each time the slot is allocated or freed, so a handle kept past
+ * a free no longer matches and looking it up fails rather than reaching
+ * the descriptor that reuses the slot. A lookup is a mask and a compare.
+ * Generations wrap, after 2^(31 - index bits) reuses of one slot.
+ *
+ * Descriptors are stored contiguously in slot order and never move. The
+ * most recently freed slot is reused first and slots above the highest one
+ * ever used are untouched, so live descriptors stay packed at the front
+ * and the pages of the storage are only touched as the table fills.
+ *
+ * Allocating and freeing take the table's lock; lookups and iteration take
+ * none. Descriptor storage lives as long as the table, so a lookup racing
+ * a free reads a stale but mapped descriptor at worst.
+ */
+
+#ifndef NEXOS_KERNEL_HANDLE_H
+#define NEXOS_KERNEL_HANDLE_H
+
+#include "kernel.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+typedef struct {
+    pthread_mutex_t lock;      /* Guards allocation and freeing */
+    char* objects;             /* Descriptors, capacity * object_size bytes */
+    _Atomic uint32_t* generations; /* Per slot, odd while live */
+    uint32_t* next_free;       /* Free list links */
+    uint32_t object_size;
+    uint32_t capacity;         /* Slots, a power of two */
+    uint32_t index_bits;       /* log2(capacity) */
+    uint32_t free_head;        /* Most recently freed slot (capacity if none) */
+    _Atomic uint32_t extent;   /* Slots ever used; all above are free */
+    uint32_t count;            /* Live slots */
+} handle_table_t;
+
+/* Initialize a table of capacity (a power of two, at least 2) descriptors */
+error_code_t handle_table_init(handle_table_t* table, uint32_t capacity, uint32_t object_size);
+
+/* Allocate a zeroed descriptor and its handle (NULL if the table is full) */
+void* handle_table_alloc(handle_table_t* table, uint32_t* handle);
+
+/* Free a descriptor by handle, invalidating the handle */
+error_code_t handle_table_free(handle_table_t* table, uint32_t handle);
+
+/* Get the live descriptor of a handle (NULL if stale or invalid) */
+void* handle_table_get(handle_table_t* table, uint32_t handle);
+
+/* Get the next live descriptor in slot order, from the slot at *cursor
+   (start at 0; NULL once past the last one) */
+void* handle_table_next(handle_table_t* table, uint32_t* cursor, uint32_t* handle);
+
+/* Slot index of a handle */
+static inline uint32_t handle_index(const handle_table_t* table, uint32_t handle) {
+    return handle & (table->capacity - 1);
+}
+
+#endif /* NEXOS_KERNEL_HANDLE_H */
@@ -4,71 +4,250 @@
  * This file implements the core functionality of the NexOS microkernel.
  */
 
+#define _GNU_SOURCE
 #include "kernel.h"
+#include "handle.h"
 #include "../memory/memory.h"
 #include "../scheduler/scheduler.h"
+#include "../io/io.h"
 #include "../ai_engine/ai_engine.h"
 #include "../security/security.h"
 #include <stddef.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+
+/* Slice of the analysis thread (ms): it spends at most its CPU budget per
+   slice on a pass and sleeps through the rest */
+#define ANALYSIS_SLICE_MS 10
+
+/* Patch trials: request throughput and latency are measured over a window
+   before a patch is applied and a window after, and the patch is kept only
+   if both windows saw enough requests and it improved them enough */
+#define TRIAL_WINDOW_MS 5000
+#define TRIAL_MIN_REQUESTS 100
+#define TRIAL_MIN_IMPROVEMENT 0.02f
+
+/* Stages of a self-evolution analysis pass */
+typedef enum {
+    ANALYSIS_IDLE,             /* No pass under way */
+    ANALYSIS_SUGGEST,          /* Metrics taken, to be analyzed */
+    ANALYSIS_GENERATE,         /* Suggestions to turn into patches */
+    ANALYSIS_APPLY,            /* Patches left to trial */
+    ANALYSIS_BASELINE,         /* Measuring before the trial patch is applied */
+    ANALYSIS_TRIAL,            /* Measuring with the trial patch applied */
+    ANALYSIS_RECORD            /* History left to update */
+} analysis_stage_t;
+
+/* Analysis pass, taken one step at a time */
+typedef struct {
+    analysis_stage_t stage;
+    void* suggestions;
+    void* patches;
+    uint32_t patch_count;
+    uint32_t next_patch;       /* Next patch to trial */
+    patch_descriptor_t* trial_patch; /* Patch under trial */
+    performance_metrics_t window_start; /* Metrics at the start of the window */
+    double baseline_throughput;    /* Requests per second before the patch */
+    double baseline_latency;       /* Mean request latency (ns) before the patch */
+    uint64_t baseline_requests;    /* Requests completed before the patch */
+    uint64_t resume_at;            /* Monotonic time (ms) the window closes, 0 if none */
+} analysis_pass_t;
+
+/* Subsystems, brought up in dependency order, each exactly once */
+typedef enum {
+    SUBSYSTEM_MEMORY,
+    SUBSYSTEM_TABLES,          /* Process and thread tables */
+    SUBSYSTEM_SCHEDULER,
+    SUBSYSTEM_SECURITY,
+    SUBSYSTEM_AI_ENGINE,
+    SUBSYSTEM_EVOLUTION,
+    SUBSYSTEM_COUNT
+} subsystem_t;
+
+#define SUBSYSTEM_BIT(subsystem) (1U << (subsystem))
+
+typedef struct {
+    error_code_t (*init)(void);
+    uint32_t depends;          /* SUBSYSTEM_BIT of each subsystem needed first */
+    bool lazy;                 /* Brought up on first use rather than by kernel_init */
+} subsystem_desc_t;
+
+static error_code_t tables_init(void);
+static error_code_t ai_engine_start(void);
+static error_code_t evolution_setup(void);
+
+static const subsystem_desc_t subsystems[SUBSYSTEM_COUNT] = {
+    [SUBSYSTEM_MEMORY] = { memory_init, 0, false },
+    [SUBSYSTEM_TABLES] = { tables_init, SUBSYSTEM_BIT(SUBSYSTEM_MEMORY), false },
+    [SUBSYSTEM_SCHEDULER] = { scheduler_init,
+                              SUBSYSTEM_BIT(SUBSYSTEM_MEMORY) | SUBSYSTEM_BIT(SUBSYSTEM_TABLES), false },
+    [SUBSYSTEM_SECURITY] = { security_init, SUBSYSTEM_BIT(SUBSYSTEM_MEMORY), false },
+    [SUBSYSTEM_AI_ENGINE] = { ai_engine_start,
+                              SUBSYSTEM_BIT(SUBSYSTEM_TABLES) | SUBSYSTEM_BIT(SUBSYSTEM_SCHEDULER) |
+                              SUBSYSTEM_BIT(SUBSYSTEM_SECURITY), true },
+    [SUBSYSTEM_EVOLUTION] = { evolution_setup,
+                              SUBSYSTEM_BIT(SUBSYSTEM_AI_ENGINE) | SUBSYSTEM_BIT(SUBSYSTEM_SECURITY), true },
+};
 
 /* Global kernel state */
 static struct {
     bool initialized;
     process_t* current_process;
-    thread_t* current_thread;
-    uint32_t next_pid;
-    uint32_t next_tid;
     uint64_t uptime;
     self_evolution_t evolution;
-} kernel_state = {0};
+    handle_table_t processes;  /* Process descriptors by PID */
+    handle_table_t threads;    /* Thread descriptors by TID */
+    pthread_mutex_t thread_list_lock; /* Guards the processes' thread lists */
+    
+    /* Self-evolution analysis */
+    pthread_mutex_t analysis_lock; /* Guards the pass and the thread's state */
+    pthread_cond_t analysis_wake;  /* Signalled to stop the thread */
+    analysis_pass_t analysis;
+    uint32_t kept_patches[TUNABLE_COUNT]; /* Last patch kept on each tunable, 0 if none */
+    pthread_t analysis_thread;
+    bool analysis_running;
+    bool analysis_stopping;
+    uint32_t analysis_interval_ms; /* Between passes of the thread */
+    uint32_t analysis_budget_us;   /* CPU time per slice */
+    
+    /* Subsystems up, one SUBSYSTEM_BIT each; bringing one up takes the lock */
+    pthread_mutex_t init_lock;
+    _Atomic uint32_t subsystems_up;
+} kernel_state = {
+    .analysis_lock = PTHREAD_MUTEX_INITIALIZER,
+    .init_lock = PTHREAD_MUTEX_INITIALIZER,
+    .thread_list_lock = PTHREAD_MUTEX_INITIALIZER
+};
 
 /**
- * Initialize the kernel and all subsystems
+ * Current monotonic time in milliseconds
  */
-error_code_t kernel_init(void) {
-    if (kernel_state.initialized) {
+static uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000ULL + (uint64_t)ts.tv_nsec / 1000000ULL;
+}
+
+/**
+ * CPU time used by the calling thread in microseconds
+ */
+static uint64_t thread_cpu_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL;
+}
+
+/**
+ * Bring up a subsystem, and first those it depends on, unless it is up
+ *
+ * Called with the init lock held. A subsystem that fails stays down and
+ * is tried again on its next use.
+ */
+static error_code_t subsystem_start(subsystem_t subsystem) {
+    if (atomic_load_explicit(&kernel_state.subsystems_up, memory_order_relaxed) & SUBSYSTEM_BIT(subsystem)) {
         return ERROR_NONE;
     }
     
-    /* Initialize memory subsystem first */
-    error_code_t err = memory_init();
-    if (err != ERROR_NONE) {
-        return err;
+    const subsystem_desc_t* desc = &subsystems[subsystem];
+    for (uint32_t dependency = 0; dependency < SUBSYSTEM_COUNT; dependency++) {
+        if (desc->depends & SUBSYSTEM_BIT(dependency)) {
+            error_code_t err = subsystem_start((subsystem_t)dependency);
+            if (err != ERROR_NONE) {
+                return err;
+            }
+        }
     }
     
-    /* Initialize scheduler */
-    err = scheduler_init();
+    error_code_t err = desc->init();
     if (err != ERROR_NONE) {
         return err;
     }
     
-    /* Initialize AI engine */
-    err = ai_engine_init();
-    if (err != ERROR_NONE) {
-        return err;
+    atomic_fetch_or_explicit(&kernel_state.subsystems_up, SUBSYSTEM_BIT(subsystem), memory_order_release);
+    return ERROR_NONE;
+}
+
+/**
+ * Get a subsystem up, bringing it up on first use
+ */
+static error_code_t subsystem_require(subsystem_t subsystem) {
+    if (atomic_load_explicit(&kernel_state.subsystems_up, memory_order_acquire) & SUBSYSTEM_BIT(subsystem)) {
+        return ERROR_NONE;
     }
     
-    /* Initialize security module */
-    err = security_init();
+    pthread_mutex_lock(&kernel_state.init_lock);
+    error_code_t err = subsystem_start(subsystem);
+    pthread_mutex_unlock(&kernel_state.init_lock);
+    
+    return err;
+}
+
+/**
+ * Initialize the process and thread tables
+ *
+ * Process and thread IDs are handles into descriptor tables.
+ */
+static error_code_t tables_init(void) {
+    error_code_t err = handle_table_init(&kernel_state.processes, MAX_PROCESSES, sizeof(process_t));
     if (err != ERROR_NONE) {
         return err;
     }
-    
-    /* Initialize self-evolution system */
-    err = self_evolution_init();
+    return handle_table_init(&kernel_state.threads, MAX_THREADS, sizeof(thread_t));
+}
+
+/**
+ * Bring up the AI engine and profile the processes created before it
+ */
+static error_code_t ai_engine_start(void) {
+    error_code_t err = ai_engine_init();
     if (err != ERROR_NONE) {
         return err;
     }
     
-    /* Set initial kernel state */
-    kernel_state.initialized = true;
-    kernel_state.next_pid = 1;  /* PID 0 reserved for kernel */
-    kernel_state.next_tid = 1;  /* TID 0 reserved for kernel main thread */
-    kernel_state.uptime = 0;
+    uint32_t cursor = 0;
+    uint32_t pid;
+    process_t* process;
+    while ((process = handle_table_next(&kernel_state.processes, &cursor, &pid)) != NULL) {
+        if (!process->ai_profile) {
+            ai_engine_create_process_profile(process);
+        }
+    }
     
     return ERROR_NONE;
 }
 
+/**
+ * Initialize the kernel and all subsystems
+ *
+ * Brings up the subsystems in dependency order, each exactly once; the AI
+ * engine and self-evolution wait for their first use, so none of their
+ * state is set up before the system is serving.
+ */
+error_code_t kernel_init(void) {
+    if (kernel_state.initialized) {
+        return ERROR_NONE;
+    }
+    
+    error_code_t err = ERROR_NONE;
+    pthread_mutex_lock(&kernel_state.init_lock);
+    for (uint32_t subsystem = 0; subsystem < SUBSYSTEM_COUNT && err == ERROR_NONE; subsystem++) {
+        if (!subsystems[subsystem].lazy) {
+            err = subsystem_start((subsystem_t)subsystem);
+        }
+    }
+    
+    /* Set initial kernel state */
+    if (err == ERROR_NONE && !kernel_state.initialized) {
+        kernel_state.uptime = 0;
+        kernel_state.initialized = true;
+    }
+    pthread_mutex_unlock(&kernel_state.init_lock);
+    
+    return err;
+}
+
 /**
  * Create a new process
  */
@@ -81,14 +260,15 @@ error_code_t process_create(process_t** process, void (*entry)(void*), void* arg
         return ERROR_INVALID_PARAMETER;
     }
     
-    /* Allocate process descriptor */
-    process_t* new_process = (process_t*)memory_allocate(sizeof(process_t));
+    /* Allocate process descriptor (handles are never 0, the kernel's PID) */
+    uint32_t pid;
+    process_t* new_process = handle_table_alloc(&kernel_state.processes, &pid);
     if (!new_process) {
-        return ERROR_MEMORY_ALLOCATION;
+        return ERROR_RESOURCE_BUSY;
     }
     
     /* Initialize process descriptor */
-    new_process->pid = kernel_state.next_pid++;
+    new_process->pid = pid;
     new_process->parent_pid = process_get_current() ? process_get_current()->pid : 0;
     new_process->state = PROCESS_CREATED;
     new_process->priority = priority;
@@ -100,7 +280,7 @@ error_code_t process_create(process_t** process, void (*entry)(void*), void* arg
     /* Allocate memory space for the process */
     error_code_t err = memory_allocate_process_space(new_process);
     if (err != ERROR_NONE) {
-        memory_free(new_process);
+        handle_table_free(&kernel_state.processes, pid);
         return err;
     }
     
@@ -109,7 +289,7 @@ error_code_t process_create(process_t** process, void (*entry)(void*), void* arg
     err = thread_create(&initial_thread, new_process, entry, arg, priority);
     if (err != ERROR_NONE) {
         memory_free_process_space(new_process);
-        memory_free(new_process);
+        handle_table_free(&kernel_state.processes, pid);
         return err;
     }
     
@@ -123,8 +303,9 @@ error_code_t process_create(process_t** process, void (*entry)(void*), void* arg
     err = scheduler_add_process(new_process);
     if (err != ERROR_NONE) {
         thread_terminate(initial_thread->tid);
+        ai_engine_destroy_process_profile(new_process);
         memory_free_process_space(new_process);
-        memory_free(new_process);
+        handle_table_free(&kernel_state.processes, pid);
         return err;
     }
     
@@ -141,21 +322,22 @@ error_code_t process_terminate(uint32_t pid) {
     }
     
     /* Find process */
-    process_t* process = scheduler_find_process(pid);
+    process_t* process = process_find(pid);
     if (!process) {
         return ERROR_INVALID_PARAMETER;
     }
     
-    /* Check permissions */
-    if (process_get_current()->pid != 0 && /* Kernel can terminate any process */
-        process_get_current()->pid != process->pid && 
-        process_get_current()->pid != process->parent_pid) {
+    /* Check permissions (no current process is the kernel) */
+    uint32_t caller = process_get_current() ? process_get_current()->pid : 0;
+    if (caller != 0 && /* Kernel can terminate any process */
+        caller != process->pid && 
+        caller != process->parent_pid) {
         return ERROR_PERMISSION_DENIED;
     }
     
-    /* Terminate all threads */
-    for (uint32_t i = 0; i < process->thread_count; i++) {
-        thread_terminate(process->threads[i].tid);
+    /* Terminate all threads (each one leaves the list at its index) */
+    for (uint32_t i = process->thread_count; i-- > 0;) {
+        thread_terminate(process->threads[i]);
     }
     
     /* Free resources */
@@ -164,9 +346,34 @@ error_code_t process_terminate(uint32_t pid) {
     /* Remove from scheduler */
     scheduler_remove_process(process);
     
-    /* Free process descriptor */
-    memory_free(process);
+    /* Release the AI profile */
+    ai_engine_destroy_process_profile(process);
+    
+    /* Free process descriptor, invalidating the PID */
+    process->state = PROCESS_TERMINATED;
+    handle_table_free(&kernel_state.processes, pid);
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Set process priority
+ */
+error_code_t process_set_priority(uint32_t pid, uint8_t priority) {
+    if (!kernel_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    if (priority >= MAX_PRIORITY_LEVELS) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    process_t* process = process_find(pid);
+    if (!process) {
+        return ERROR_INVALID_PARAMETER;
+    }
     
+    process->priority = priority;
     return ERROR_NONE;
 }
 
@@ -177,31 +384,59 @@ process_t* process_get_current(void) {
     return kernel_state.current_process;
 }
 
+/**
+ * Find a process by ID (NULL if it has terminated)
+ */
+process_t* process_find(uint32_t pid) {
+    return handle_table_get(&kernel_state.processes, pid);
+}
+
+/**
+ * Remove a thread from its process's list, moving the last thread into its place
+ */
+static void process_remove_thread(process_t* process, uint32_t tid) {
+    pthread_mutex_lock(&kernel_state.thread_list_lock);
+    for (uint32_t i = 0; i < process->thread_count; i++) {
+        if (process->threads[i] == tid) {
+            process->threads[i] = process->threads[--process->thread_count];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&kernel_state.thread_list_lock);
+}
+
 /**
  * Create a new thread
  */
 error_code_t thread_create(thread_t** thread, process_t* process, void (*entry)(void*), void* arg, uint8_t priority) {
+    return thread_create_on(thread, process, entry, arg, priority, KERNEL_STACK_SIZE, THREAD_CPU_ANY);
+}
+
+/**
+ * Create a new thread with a stack of stack_size bytes, bound to a CPU
+ *
+ * The thread only ever runs on cpu (see scheduler_bind_thread), or on any
+ * CPU for THREAD_CPU_ANY.
+ */
+error_code_t thread_create_on(thread_t** thread, process_t* process, void (*entry)(void*), void* arg, uint8_t priority,
+                              uint32_t stack_size, uint32_t cpu) {
     if (!kernel_state.initialized) {
         return ERROR_NOT_IMPLEMENTED;
     }
     
-    if (!thread || !process || !entry || priority >= MAX_PRIORITY_LEVELS) {
+    if (!thread || !process || !entry || priority >= MAX_PRIORITY_LEVELS || stack_size == 0) {
         return ERROR_INVALID_PARAMETER;
     }
     
-    /* Check if process has reached thread limit */
-    if (process->thread_count >= MAX_THREADS_PER_PROCESS) {
-        return ERROR_RESOURCE_BUSY;
-    }
-    
-    /* Allocate thread descriptor */
-    thread_t* new_thread = (thread_t*)memory_allocate(sizeof(thread_t));
+    /* Allocate thread descriptor (handles are never 0, the kernel main thread's TID) */
+    uint32_t tid;
+    thread_t* new_thread = handle_table_alloc(&kernel_state.threads, &tid);
     if (!new_thread) {
-        return ERROR_MEMORY_ALLOCATION;
+        return ERROR_RESOURCE_BUSY;
     }
     
     /* Initialize thread descriptor */
-    new_thread->tid = kernel_state.next_tid++;
+    new_thread->tid = tid;
     new_thread->pid = process->pid;
     new_thread->state = THREAD_CREATED;
     new_thread->priority = priority;
@@ -211,29 +446,46 @@ error_code_t thread_create(thread_t** thread, process_t* process, void (*entry)(
     new_thread->arg = arg;
     
     /* Allocate stack for the thread */
-    error_code_t err = memory_allocate_thread_stack(new_thread, KERNEL_STACK_SIZE);
+    error_code_t err = memory_allocate_thread_stack(new_thread, stack_size);
     if (err != ERROR_NONE) {
-        memory_free(new_thread);
+        handle_table_free(&kernel_state.threads, tid);
         return err;
     }
     
     /* Initialize thread context */
     err = scheduler_init_thread_context(new_thread);
+    if (err == ERROR_NONE && cpu != THREAD_CPU_ANY) {
+        err = scheduler_bind_thread(new_thread, cpu);
+        if (err != ERROR_NONE) {
+            scheduler_remove_thread(new_thread);
+        }
+    }
     if (err != ERROR_NONE) {
         memory_free_thread_stack(new_thread);
-        memory_free(new_thread);
+        handle_table_free(&kernel_state.threads, tid);
         return err;
     }
     
-    /* Add thread to process */
-    process->threads[process->thread_count++] = *new_thread;
+    /* Add thread to process, unless it has reached the thread limit */
+    pthread_mutex_lock(&kernel_state.thread_list_lock);
+    if (process->thread_count >= MAX_THREADS_PER_PROCESS) {
+        err = ERROR_RESOURCE_BUSY;
+    } else {
+        process->threads[process->thread_count++] = tid;
+    }
+    pthread_mutex_unlock(&kernel_state.thread_list_lock);
     
     /* Add thread to scheduler */
-    err = scheduler_add_thread(new_thread);
+    if (err == ERROR_NONE) {
+        err = scheduler_add_thread(new_thread);
+        if (err != ERROR_NONE) {
+            process_remove_thread(process, tid);
+        }
+    }
     if (err != ERROR_NONE) {
-        process->thread_count--;
+        scheduler_remove_thread(new_thread);
         memory_free_thread_stack(new_thread);
-        memory_free(new_thread);
+        handle_table_free(&kernel_state.threads, tid);
         return err;
     }
     
@@ -242,26 +494,105 @@ error_code_t thread_create(thread_t** thread, process_t* process, void (*entry)(
 }
 
 /**
- * Get current thread
+ * Terminate a thread
+ *
+ * The thread must not be running: the calling thread and threads running
+ * on other CPUs are refused with ERROR_RESOURCE_BUSY.
  */
-thread_t* thread_get_current(void) {
-    return kernel_state.current_thread;
+error_code_t thread_terminate(uint32_t tid) {
+    if (!kernel_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    thread_t* thread = thread_find(tid);
+    if (!thread) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    if (thread == thread_get_current()) {
+        return ERROR_RESOURCE_BUSY;
+    }
+    
+    /* Remove from scheduler */
+    if (thread->context) {
+        error_code_t err = scheduler_remove_thread(thread);
+        if (err != ERROR_NONE) {
+            return err;
+        }
+    }
+    
+    memory_free_thread_stack(thread);
+    
+    /* Remove from its process */
+    process_t* process = process_find(thread->pid);
+    if (process) {
+        process_remove_thread(process, tid);
+    }
+    
+    /* Free thread descriptor, invalidating the TID */
+    thread->state = THREAD_TERMINATED;
+    return handle_table_free(&kernel_state.threads, tid);
 }
 
 /**
- * Initialize self-evolution system
+ * Set thread priority
+ *
+ * Takes effect the next time the thread is queued.
  */
-error_code_t self_evolution_init(void) {
+error_code_t thread_set_priority(uint32_t tid, uint8_t priority) {
     if (!kernel_state.initialized) {
         return ERROR_NOT_IMPLEMENTED;
     }
     
+    if (priority >= MAX_PRIORITY_LEVELS) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    thread_t* thread = thread_find(tid);
+    if (!thread) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    thread->priority = priority;
+    return ERROR_NONE;
+}
+
+/**
+ * Get current thread
+ */
+thread_t* thread_get_current(void) {
+    return scheduler_get_current();
+}
+
+/**
+ * Find a thread by ID (NULL if it has terminated)
+ */
+thread_t* thread_find(uint32_t tid) {
+    return handle_table_get(&kernel_state.threads, tid);
+}
+
+/**
+ * Set up self-evolution state (brought up by subsystem_require)
+ */
+static error_code_t evolution_setup(void) {
     /* Initialize self-evolution state */
     kernel_state.evolution.last_analysis_time = 0;
     kernel_state.evolution.optimization_count = 0;
     kernel_state.evolution.patch_count = 0;
+    kernel_state.evolution.skipped_count = 0;
+    for (uint32_t i = 0; i < TUNABLE_COUNT; i++) {
+        kernel_state.kept_patches[i] = 0;
+    }
     kernel_state.evolution.evolution_level = 0;
     kernel_state.evolution.evolution_enabled = false;
+    kernel_state.analysis.stage = ANALYSIS_IDLE;
+    
+    /* The analysis thread's waits run on the monotonic clock */
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&kernel_state.analysis_wake, &attr);
+    pthread_condattr_destroy(&attr);
     
     /* Allocate performance metrics storage */
     kernel_state.evolution.performance_metrics = memory_allocate(sizeof(performance_metrics_t));
@@ -279,6 +610,20 @@ error_code_t self_evolution_init(void) {
     return ERROR_NONE;
 }
 
+/**
+ * Initialize self-evolution system
+ *
+ * Brings up the AI engine on the way; self-evolution calls that need it
+ * do the same, so calling this first is optional.
+ */
+error_code_t self_evolution_init(void) {
+    if (!kernel_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    return subsystem_require(SUBSYSTEM_EVOLUTION);
+}
+
 /**
  * Enable or disable self-evolution
  */
@@ -293,7 +638,14 @@ error_code_t self_evolution_enable(bool enable) {
         return err;
     }
     
+    err = subsystem_require(SUBSYSTEM_EVOLUTION);
+    if (err != ERROR_NONE) {
+        return err;
+    }
+    
+    pthread_mutex_lock(&kernel_state.analysis_lock);
     kernel_state.evolution.evolution_enabled = enable;
+    pthread_mutex_unlock(&kernel_state.analysis_lock);
     
     /* If enabling, trigger initial analysis */
     if (enable) {
@@ -303,66 +655,497 @@ error_code_t self_evolution_enable(bool enable) {
     return ERROR_NONE;
 }
 
+/**
+ * Apply a tuning action through the subsystem owning its tunable
+ */
+static error_code_t apply_tuning(tuning_action_t* action) {
+    switch (action->tunable) {
+        case TUNABLE_TIME_SLICE:
+            return scheduler_apply_optimization(action);
+    
+        case TUNABLE_IO_POLICY:
+        case TUNABLE_READAHEAD:
+        case TUNABLE_IO_WORKERS:
+            return io_apply_optimization(action);
+    
+        case TUNABLE_CACHE_SIZE:
+            return memory_apply_optimization(action);
+    
+        default:
+            return ERROR_INVALID_PARAMETER;
+    }
+}
+
+/**
+ * Revert an applied patch, restoring the value its tuning action replaced
+ * and dropping its rollback entry
+ */
+static void revert_patch(patch_descriptor_t* patch) {
+    apply_tuning((tuning_action_t*)patch->original_code);
+    security_rollback_patch(patch->id);
+    patch->applied = false;
+}
+
+/**
+ * End the analysis pass, releasing what it generated
+ *
+ * A patch still under trial is reverted.
+ */
+static void analysis_end(void) {
+    analysis_pass_t* pass = &kernel_state.analysis;
+    
+    if (pass->trial_patch && pass->trial_patch->applied) {
+        revert_patch(pass->trial_patch);
+    }
+    if (pass->suggestions) {
+        ai_engine_free_suggestions(pass->suggestions);
+    }
+    if (pass->patches) {
+        ai_engine_free_patches(pass->patches, pass->patch_count);
+    }
+    
+    pass->suggestions = NULL;
+    pass->patches = NULL;
+    pass->patch_count = 0;
+    pass->next_patch = 0;
+    pass->trial_patch = NULL;
+    pass->resume_at = 0;
+    pass->stage = ANALYSIS_IDLE;
+}
+
+/**
+ * Begin an analysis pass on the latest collected metrics
+ *
+ * Called with the analysis lock held and no pass under way.
+ */
+static error_code_t analysis_begin(void) {
+    performance_metrics_t* metrics = kernel_state.evolution.performance_metrics;
+    
+    error_code_t err = ai_engine_get_metrics(metrics);
+    if (err != ERROR_NONE) {
+        return err;
+    }
+    
+    /* Update analysis timestamp */
+    kernel_state.evolution.last_analysis_time = metrics->uptime;
+    kernel_state.analysis.stage = ANALYSIS_SUGGEST;
+    return ERROR_NONE;
+}
+
+/**
+ * Check whether the pass is waiting for its measurement window to close
+ */
+static bool analysis_waiting(void) {
+    return kernel_state.analysis.resume_at > monotonic_ms();
+}
+
+/**
+ * Close the measurement window and open the next one
+ *
+ * Reports the request throughput (per second), mean latency (ns) and
+ * completed requests of the window closed, if asked for.
+ */
+static error_code_t analysis_window(double* throughput, double* latency, uint64_t* requests) {
+    analysis_pass_t* pass = &kernel_state.analysis;
+    performance_metrics_t metrics;
+    
+    error_code_t err = ai_engine_collect_metrics(&metrics);
+    if (err != ERROR_NONE) {
+        return err;
+    }
+    
+    if (throughput) {
+        uint64_t count = metrics.requests - pass->window_start.requests;
+        uint64_t elapsed = metrics.uptime - pass->window_start.uptime;
+        *requests = count;
+        *throughput = elapsed ? (double)count * 1000.0 / (double)elapsed : 0.0;
+        *latency = count ? (double)(metrics.request_latency - pass->window_start.request_latency) /
+                           (double)count : 0.0;
+    }
+    
+    pass->window_start = metrics;
+    pass->resume_at = monotonic_ms() + TRIAL_WINDOW_MS;
+    return ERROR_NONE;
+}
+
+/**
+ * Take the next step of the analysis pass
+ *
+ * Each step is one bounded piece of work: analyzing the metrics,
+ * generating and verifying the patches, opening or closing a trial window or recording
+ * the pass. Called with the analysis lock held; a failed step ends the
+ * pass.
+ *
+ * A patch is trialled one window at a time: the baseline window measures
+ * without it, the trial window with it applied. Improvement weighs the
+ * relative gain in throughput and the relative drop in latency equally;
+ * a patch is reverted unless both windows completed TRIAL_MIN_REQUESTS
+ * and it improved by TRIAL_MIN_IMPROVEMENT.
+ */
+static error_code_t analysis_step(void) {
+    analysis_pass_t* pass = &kernel_state.analysis;
+    error_code_t err = ERROR_NONE;
+    
+    switch (pass->stage) {
+        case ANALYSIS_SUGGEST:
+            /* Analyze collected metrics */
+            err = ai_engine_analyze_performance(kernel_state.evolution.performance_metrics,
+                                                &pass->suggestions);
+            if (err == ERROR_NONE) {
+                pass->stage = ANALYSIS_GENERATE;
+            }
+            break;
+    
+        case ANALYSIS_GENERATE:
+            /* Check the rollback log before trusting it with more patches */
+            err = security_verify_integrity();
+            if (err != ERROR_NONE) {
+                break;
+            }
+    
+            /* Generate patches for suggested optimizations and verify them
+               in one batch */
+            err = ai_engine_generate_patches(pass->suggestions, &pass->patches, &pass->patch_count);
+            if (err == ERROR_NONE) {
+                if (pass->patch_count > 0) {
+                    security_verify_patches((void**)pass->patches,
+                                            (uint32_t*)((void**)pass->patches + pass->patch_count),
+                                            pass->patch_count);
+                }
+                pass->next_patch = 0;
+                pass->stage = ANALYSIS_APPLY;
+            }
+            break;
+    
+        case ANALYSIS_APPLY:
+            if (pass->next_patch < pass->patch_count) {
+                uint32_t i = pass->next_patch++;
+                patch_descriptor_t* patch = ((patch_descriptor_t**)pass->patches)[i];
+    
+                /* Skip patches that failed verification, and measure without the next */
+                if (patch->verified) {
+                    err = analysis_window(NULL, NULL, NULL);
+                    if (err == ERROR_NONE) {
+                        pass->trial_patch = patch;
+                        pass->stage = ANALYSIS_BASELINE;
+                    }
+                } else {
+                    kernel_state.evolution.skipped_count++;
+                }
+            } else {
+                pass->stage = ANALYSIS_RECORD;
+            }
+            break;
+    
+        case ANALYSIS_BASELINE:
+            if (analysis_waiting()) {
+                break;
+            }
+            err = analysis_window(&pass->baseline_throughput, &pass->baseline_latency,
+                                  &pass->baseline_requests);
+            if (err != ERROR_NONE) {
+                break;
+            }
+    
+            /* Apply the patch and measure with it; one that fails to apply
+               or changes nothing is skipped rather than trialled */
+            if (self_evolution_apply_patch(pass->trial_patch, sizeof(patch_descriptor_t)) == ERROR_NONE) {
+                const tuning_action_t* action = (const tuning_action_t*)pass->trial_patch->patch_code;
+                if (action->previous != action->value) {
+                    pass->stage = ANALYSIS_TRIAL;
+                    break;
+                }
+                revert_patch(pass->trial_patch);
+            }
+            kernel_state.evolution.skipped_count++;
+            pass->trial_patch = NULL;
+            pass->resume_at = 0;
+            pass->stage = ANALYSIS_APPLY;
+            break;
+    
+        case ANALYSIS_TRIAL: {
+            if (analysis_waiting()) {
+                break;
+            }
+            double throughput;
+            double latency;
+            uint64_t requests;
+            err = analysis_window(&throughput, &latency, &requests);
+            if (err != ERROR_NONE) {
+                break;
+            }
+    
+            float improvement = 0.0f;
+            bool keep = false;
+            if (pass->baseline_requests >= TRIAL_MIN_REQUESTS && requests >= TRIAL_MIN_REQUESTS &&
+                pass->baseline_throughput > 0.0 && pass->baseline_latency > 0.0) {
+                improvement = (float)(0.5 * (throughput - pass->baseline_throughput) / pass->baseline_throughput +
+                                      0.5 * (pass->baseline_latency - latency) / pass->baseline_latency);
+                keep = improvement >= TRIAL_MIN_IMPROVEMENT;
+            }
+    
+            /* A kept patch supersedes the one kept before it on its tunable,
+               leaving the log one rollback entry per tunable that undoes
+               every patch kept on it */
+            if (keep) {
+                const tuning_action_t* action = (const tuning_action_t*)pass->trial_patch->patch_code;
+                uint32_t* kept = &kernel_state.kept_patches[action->tunable];
+                if (*kept != 0) {
+                    security_supersede_rollback_entry(pass->trial_patch->id, *kept);
+                }
+                *kept = pass->trial_patch->id;
+                kernel_state.evolution.patch_count++;
+            } else {
+                revert_patch(pass->trial_patch);
+            }
+            ai_engine_record_trial(pass->trial_patch, improvement, !keep);
+    
+            pass->trial_patch = NULL;
+            pass->resume_at = 0;
+            pass->stage = ANALYSIS_APPLY;
+            break;
+        }
+    
+        case ANALYSIS_RECORD:
+            /* Learn from the trials, publish the history and save it with
+               the models for the next start */
+            kernel_state.evolution.optimization_count++;
+            ai_engine_learn_from_history();
+            ai_engine_get_optimization_history(kernel_state.evolution.optimization_history);
+            ai_engine_save_snapshot();
+            analysis_end();
+            break;
+    
+        case ANALYSIS_IDLE:
+            break;
+    }
+    
+    if (err != ERROR_NONE) {
+        analysis_end();
+    }
+    return err;
+}
+
 /**
  * Analyze system for potential optimizations
+ *
+ * Collects metrics and advances the pass under way, or begins one, on the
+ * calling thread until it ends or waits for a trial window to close. A
+ * later call, or the analysis thread, takes the pass on from there.
  */
 error_code_t self_evolution_analyze(void) {
     if (!kernel_state.initialized || !kernel_state.evolution.evolution_enabled) {
         return ERROR_NOT_IMPLEMENTED;
     }
     
-    /* Update analysis timestamp */
-    kernel_state.evolution.last_analysis_time = kernel_state.uptime;
-    
     /* Collect performance metrics */
-    error_code_t err = ai_engine_collect_metrics(kernel_state.evolution.performance_metrics);
+    performance_metrics_t metrics;
+    error_code_t err = ai_engine_collect_metrics(&metrics);
     if (err != ERROR_NONE) {
         return err;
     }
     
-    /* Analyze collected metrics */
-    void* optimization_suggestions = NULL;
-    err = ai_engine_analyze_performance(kernel_state.evolution.performance_metrics, &optimization_suggestions);
+    pthread_mutex_lock(&kernel_state.analysis_lock);
+    if (kernel_state.analysis.stage == ANALYSIS_IDLE) {
+        err = analysis_begin();
+    }
+    while (err == ERROR_NONE && kernel_state.analysis.stage != ANALYSIS_IDLE && !analysis_waiting()) {
+        err = analysis_step();
+    }
+    pthread_mutex_unlock(&kernel_state.analysis_lock);
+    
+    return err;
+}
+
+/**
+ * Apply a patch
+ *
+ * A patch is a verified patch_descriptor_t whose code is a tuning action
+ * and whose original code receives the inverse action once it applies;
+ * the inverse is what its rollback entry keeps. Patches are not reapplied.
+ */
+error_code_t self_evolution_apply_patch(void* patch, uint32_t size) {
+    if (!kernel_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    if (!patch || size != sizeof(patch_descriptor_t)) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    patch_descriptor_t* descriptor = (patch_descriptor_t*)patch;
+    if (!descriptor->verified) {
+        return ERROR_PERMISSION_DENIED;
+    }
+    if (descriptor->applied || !descriptor->patch_code || !descriptor->original_code ||
+        descriptor->size != sizeof(tuning_action_t) ||
+        descriptor->original_size != sizeof(tuning_action_t)) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    tuning_action_t* action = (tuning_action_t*)descriptor->patch_code;
+    tuning_action_t* inverse = (tuning_action_t*)descriptor->original_code;
+    
+    error_code_t err = apply_tuning(action);
     if (err != ERROR_NONE) {
         return err;
     }
     
-    /* Generate patches for suggested optimizations */
-    void* patches = NULL;
-    uint32_t patch_count = 0;
-    err = ai_engine_generate_patches(optimization_suggestions, &patches, &patch_count);
+    inverse->tunable = action->tunable;
+    inverse->value = action->previous;
+    inverse->previous = action->value;
+    descriptor->applied = true;
+    
+    /* A patch that cannot be rolled back does not stay applied */
+    err = security_create_rollback_entry(descriptor);
     if (err != ERROR_NONE) {
-        ai_engine_free_suggestions(optimization_suggestions);
-        return err;
+        apply_tuning(inverse);
+        descriptor->applied = false;
     }
+    return err;
+}
+
+/**
+ * Wait on the analysis thread's condition until a monotonic time (ms)
+ */
+static void analysis_wait_until(uint64_t deadline) {
+    struct timespec ts;
+    ts.tv_sec = (time_t)(deadline / 1000);
+    ts.tv_nsec = (long)(deadline % 1000) * 1000000L;
+    pthread_cond_timedwait(&kernel_state.analysis_wake, &kernel_state.analysis_lock, &ts);
+}
+
+/**
+ * Analysis thread
+ *
+ * Begins a pass every interval on metrics collected since the last one and
+ * takes its steps in slices of ANALYSIS_SLICE_MS, stopping for the rest of
+ * a slice once the steps have used its CPU budget. A step runs to the end,
+ * so the budget is exceeded by at most one step. While a trial window is
+ * open the thread sleeps until it closes.
+ */
+static void* analysis_main(void* arg) {
+    (void)arg;
+    uint64_t next_pass = monotonic_ms();
     
-    /* Apply generated patches */
-    for (uint32_t i = 0; i < patch_count; i++) {
-        void* patch = ((void**)patches)[i];
-        uint32_t patch_size = ((uint32_t*)patches)[patch_count + i];
-        
-        /* Verify patch safety */
-        err = security_verify_patch(patch, patch_size);
-        if (err != ERROR_NONE) {
-            continue;  /* Skip unsafe patches */
+    pthread_mutex_lock(&kernel_state.analysis_lock);
+    while (!kernel_state.analysis_stopping) {
+        uint64_t now = monotonic_ms();
+    
+        if (kernel_state.analysis.stage != ANALYSIS_IDLE && kernel_state.analysis.resume_at > now) {
+            /* A trial window is open */
+            analysis_wait_until(kernel_state.analysis.resume_at);
+            continue;
+        }
+    
+        if (kernel_state.analysis.stage == ANALYSIS_IDLE) {
+            if (now < next_pass) {
+                analysis_wait_until(next_pass);
+                continue;
+            }
+            next_pass = now + kernel_state.analysis_interval_ms;
+    
+            /* Metrics the last pass saw already are skipped */
+            uint64_t analyzed = kernel_state.evolution.last_analysis_time;
+            if (!kernel_state.evolution.evolution_enabled || analysis_begin() != ERROR_NONE) {
+                continue;
+            }
+            if (kernel_state.evolution.last_analysis_time == analyzed) {
+                analysis_end();
+                continue;
+            }
+        }
+    
+        uint64_t slice_start = thread_cpu_us();
+        while (kernel_state.analysis.stage != ANALYSIS_IDLE && !analysis_waiting() &&
+               thread_cpu_us() - slice_start < kernel_state.analysis_budget_us) {
+            analysis_step();
         }
-        
-        /* Apply the patch */
-        err = self_evolution_apply_patch(patch, patch_size);
-        if (err == ERROR_NONE) {
-            kernel_state.evolution.patch_count++;
+    
+        if (kernel_state.analysis.stage != ANALYSIS_IDLE && !analysis_waiting() &&
+            !kernel_state.analysis_stopping) {
+            analysis_wait_until(now + ANALYSIS_SLICE_MS);
         }
     }
+    pthread_mutex_unlock(&kernel_state.analysis_lock);
+    
+    return NULL;
+}
+
+/**
+ * Start the analysis thread
+ *
+ * The thread runs under SCHED_IDLE where the system allows it, so it only
+ * gets CPU time nothing else wants, and reads the metrics published by
+ * ai_engine_collect_metrics rather than collecting them itself, other than
+ * at the edges of trial windows.
+ */
+error_code_t self_evolution_start(uint32_t interval_ms, uint32_t budget_us) {
+    if (!kernel_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
     
-    /* Update optimization history */
-    ai_engine_update_optimization_history(kernel_state.evolution.optimization_history, 
-                                         optimization_suggestions, patches, patch_count);
+    if (interval_ms == 0 || budget_us == 0) {
+        return ERROR_INVALID_PARAMETER;
+    }
     
-    /* Clean up */
-    ai_engine_free_suggestions(optimization_suggestions);
-    ai_engine_free_patches(patches, patch_count);
+    error_code_t err = subsystem_require(SUBSYSTEM_EVOLUTION);
+    if (err != ERROR_NONE) {
+        return err;
+    }
+    
+    pthread_mutex_lock(&kernel_state.analysis_lock);
+    if (kernel_state.analysis_running) {
+        pthread_mutex_unlock(&kernel_state.analysis_lock);
+        return ERROR_RESOURCE_BUSY;
+    }
+    
+    kernel_state.analysis_interval_ms = interval_ms;
+    kernel_state.analysis_budget_us = budget_us;
+    kernel_state.analysis_stopping = false;
+    
+    pthread_attr_t attr;
+    struct sched_param param = { .sched_priority = 0 };
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_IDLE);
+    pthread_attr_setschedparam(&attr, &param);
+    
+    int result = pthread_create(&kernel_state.analysis_thread, &attr, analysis_main, NULL);
+    if (result != 0) {
+        result = pthread_create(&kernel_state.analysis_thread, NULL, analysis_main, NULL);
+    }
+    pthread_attr_destroy(&attr);
+    
+    kernel_state.analysis_running = (result == 0);
+    pthread_mutex_unlock(&kernel_state.analysis_lock);
+    
+    return result == 0 ? ERROR_NONE : ERROR_MEMORY_ALLOCATION;
+}
+
+/**
+ * Stop the analysis thread, abandoning a pass under way
+ */
+error_code_t self_evolution_stop(void) {
+    pthread_mutex_lock(&kernel_state.analysis_lock);
+    if (!kernel_state.analysis_running) {
+        pthread_mutex_unlock(&kernel_state.analysis_lock);
+        return ERROR_NONE;
+    }
+    
+    kernel_state.analysis_stopping = true;
+    pthread_cond_signal(&kernel_state.analysis_wake);
+    pthread_mutex_unlock(&kernel_state.analysis_lock);
+    
+    pthread_join(kernel_state.analysis_thread, NULL);
+    
+    pthread_mutex_lock(&kernel_state.analysis_lock);
+    kernel_state.analysis_running = false;
+    if (kernel_state.analysis.stage != ANALYSIS_IDLE) {
+        analysis_end();
+    }
+    pthread_mutex_unlock(&kernel_state.analysis_lock);
     
-    kernel_state.evolution.optimization_count++;
     return ERROR_NONE;
 }
 
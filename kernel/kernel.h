@@ -19,11 +19,20 @@
 
 /* System constants */
 #define MAX_PROCESSES 1024
-#define MAX_THREADS_PER_PROCESS 64
+#define MAX_THREADS_PER_PROCESS 1024
+#define MAX_THREADS 65536
 #define MAX_PRIORITY_LEVELS 32
 #define KERNEL_STACK_SIZE 16384
 #define PAGE_SIZE 4096
 
+/* Slot of a process or thread ID in the kernel's handle tables (IDs are
+   handles: the slot in the low bits, a generation above) */
+#define PROCESS_SLOT(pid) ((pid) & (MAX_PROCESSES - 1))
+#define THREAD_SLOT(tid) ((tid) & (MAX_THREADS - 1))
+
+/* CPU of a thread free to run on any of the scheduler's CPUs */
+#define THREAD_CPU_ANY UINT32_MAX
+
 /* Error codes */
 typedef enum {
     ERROR_NONE = 0,
@@ -61,7 +70,7 @@ typedef struct process {
     process_state_t state;             /* Current process state */
     uint8_t priority;                  /* Process priority (0-31, 0 highest) */
     void* memory_space;                /* Process memory space */
-    struct thread* threads;            /* Threads belonging to this process */
+    uint32_t threads[MAX_THREADS_PER_PROCESS]; /* IDs of the threads belonging to this process */
     uint32_t thread_count;             /* Number of threads */
     void* resources;                   /* Resources owned by the process */
     uint64_t cpu_time;                 /* CPU time used */
@@ -84,13 +93,34 @@ typedef struct thread {
     uint64_t cpu_time;                 /* CPU time used */
     uint64_t last_scheduled;           /* Last time thread was scheduled */
     void* ai_profile;                  /* AI optimization profile */
+    struct thread* queue_next;         /* Next thread on its run queue */
+    struct thread* queue_prev;         /* Previous thread on its run queue */
 } thread_t;
 
+/* Parameters self-evolution tunes, each owned by one subsystem */
+typedef enum {
+    TUNABLE_TIME_SLICE,        /* Scheduler time slice (ms) */
+    TUNABLE_IO_POLICY,         /* I/O scheduling policy (io_scheduling_policy_t) */
+    TUNABLE_READAHEAD,         /* Starting readahead window of sequential reads (bytes) */
+    TUNABLE_IO_WORKERS,        /* Async workers per request ring (0 = kernel default) */
+    TUNABLE_CACHE_SIZE,        /* Empty slab memory the allocator keeps for reuse (bytes) */
+    TUNABLE_COUNT
+} tunable_t;
+
+/* Tuning action, the optimization data taken by the subsystems'
+   *_apply_optimization: sets a tunable and reports the value it replaced */
+typedef struct {
+    uint32_t tunable;          /* tunable_t */
+    uint64_t value;            /* Value to set */
+    uint64_t previous;         /* Value replaced, filled in when applied */
+} tuning_action_t;
+
 /* Self-evolution metadata */
 typedef struct {
     uint64_t last_analysis_time;       /* Last time code was analyzed */
     uint32_t optimization_count;       /* Number of self-optimizations */
     uint32_t patch_count;              /* Number of self-patches applied */
+    uint32_t skipped_count;            /* Number of patches not trialled (unverified, failed or no change) */
     uint8_t evolution_level;           /* Current evolution level */
     bool evolution_enabled;            /* Whether evolution is enabled */
     void* performance_metrics;         /* Performance data collection */
@@ -105,12 +135,16 @@ error_code_t process_create(process_t** process, void (*entry)(void*), void* arg
 error_code_t process_terminate(uint32_t pid);
 error_code_t process_set_priority(uint32_t pid, uint8_t priority);
 process_t* process_get_current(void);
+process_t* process_find(uint32_t pid);
 
 /* Thread management */
 error_code_t thread_create(thread_t** thread, process_t* process, void (*entry)(void*), void* arg, uint8_t priority);
+error_code_t thread_create_on(thread_t** thread, process_t* process, void (*entry)(void*), void* arg, uint8_t priority,
+                              uint32_t stack_size, uint32_t cpu);
 error_code_t thread_terminate(uint32_t tid);
 error_code_t thread_set_priority(uint32_t tid, uint8_t priority);
 thread_t* thread_get_current(void);
+thread_t* thread_find(uint32_t tid);
 
 /* Scheduler interface */
 error_code_t scheduler_init(void);
@@ -122,6 +156,8 @@ error_code_t scheduler_sleep(uint64_t milliseconds);
 error_code_t self_evolution_init(void);
 error_code_t self_evolution_enable(bool enable);
 error_code_t self_evolution_analyze(void);
+error_code_t self_evolution_start(uint32_t interval_ms, uint32_t budget_us);
+error_code_t self_evolution_stop(void);
 error_code_t self_evolution_apply_patch(void* patch, uint32_t size);
 self_evolution_t* self_evolution_get_status(void);
 
@@ -0,0 +1,127 @@
+/**
+ * NexOS Memory Management - Bump Arena
+ *
+ * This file implements a bump allocator for allocations that share a
+ * lifetime, such as everything belonging to one request. Allocation only
+ * advances a pointer; memory is returned all at once by arena_reset, which
+ * keeps one regular block so a reused arena does not call malloc again.
+ * Arenas are not thread-safe.
+ */
+
+#include "memory.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdalign.h>
+
+#define ARENA_ALIGNMENT alignof(max_align_t)
+
+/**
+ * Allocate a block with room for at least size bytes
+ */
+static arena_block_t* arena_new_block(arena_t* arena, size_t size) {
+    size_t capacity = size > arena->block_size ? size : arena->block_size;
+    
+    arena_block_t* block = malloc(sizeof(arena_block_t) + capacity);
+    if (!block) {
+        return NULL;
+    }
+    
+    block->capacity = capacity;
+    block->used = 0;
+    block->next = arena->head;
+    arena->head = block;
+    
+    return block;
+}
+
+/**
+ * Initialize an empty arena
+ *
+ * No memory is allocated until the first arena_alloc.
+ */
+void arena_init(arena_t* arena, size_t block_size) {
+    arena->head = NULL;
+    arena->block_size = block_size > 0 ? block_size : ARENA_BLOCK_SIZE;
+}
+
+/**
+ * Allocate size bytes, aligned for any type
+ *
+ * Returns NULL if a new block is needed and cannot be allocated.
+ */
+void* arena_alloc(arena_t* arena, size_t size) {
+    if (size == 0) {
+        size = 1;
+    }
+    
+    arena_block_t* block = arena->head;
+    if (block) {
+        size_t offset = (block->used + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+        if (offset <= block->capacity && size <= block->capacity - offset) {
+            block->used = offset + size;
+            return block->data + offset;
+        }
+    }
+    
+    /* Oversized requests get a block of their own */
+    block = arena_new_block(arena, size);
+    if (!block) {
+        return NULL;
+    }
+    
+    block->used = size;
+    return block->data;
+}
+
+/**
+ * Copy length bytes of a string into the arena, adding a terminator
+ */
+char* arena_strndup(arena_t* arena, const char* string, size_t length) {
+    char* copy = arena_alloc(arena, length + 1);
+    if (!copy) {
+        return NULL;
+    }
+    
+    memcpy(copy, string, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+/**
+ * Release every allocation, keeping one regular block for reuse
+ */
+void arena_reset(arena_t* arena) {
+    arena_block_t* keep = NULL;
+    arena_block_t* block = arena->head;
+    
+    while (block) {
+        arena_block_t* next = block->next;
+        if (!keep && block->capacity == arena->block_size) {
+            keep = block;
+        } else {
+            free(block);
+        }
+        block = next;
+    }
+    
+    if (keep) {
+        keep->used = 0;
+        keep->next = NULL;
+    }
+    arena->head = keep;
+}
+
+/**
+ * Free all memory held by an arena
+ */
+void arena_destroy(arena_t* arena) {
+    arena_block_t* block = arena->head;
+    
+    while (block) {
+        arena_block_t* next = block->next;
+        free(block);
+        block = next;
+    }
+    
+    arena->head = NULL;
+}
@@ -0,0 +1,270 @@
+/**
+ * NexOS Memory Management - Core Implementation
+ *
+ * This file implements initialization, process spaces, metrics and
+ * self-optimization of the memory subsystem. Allocation lives in slab.c,
+ * the heap profiler in profile.c.
+ */
+
+#define _GNU_SOURCE
+#include "memory.h"
+#include "slab.h"
+#include "profile.h"
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+/* Fragmentation from which memory_optimize defragments */
+#define DEFRAGMENT_THRESHOLD 0.5f
+
+/* Memory subsystem state */
+static struct {
+    bool initialized;
+    pthread_mutex_t lock;      /* Guards the analysis */
+    memory_optimization_t optimization;
+    
+    /* Last usage analysis */
+    memory_profile_site_t* sites; /* Profile at the last analysis (MEMORY_PROFILE_SITES) */
+    uint64_t analyzed_ns;
+    uint32_t site_count;
+    uint64_t top_site_live_bytes;
+    uint64_t top_site_churn;
+} memory_state = {
+    .lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+static uint64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * Initialize memory subsystem
+ *
+ * memory_allocate works before initialization; this only enables the
+ * metrics and optimization interface.
+ */
+error_code_t memory_init(void) {
+    memory_state.initialized = true;
+    return ERROR_NONE;
+}
+
+/**
+ * Allocate memory space for a process
+ *
+ * Processes share the kernel's address space, so there is nothing to set
+ * up: memory_space stays NULL.
+ */
+error_code_t memory_allocate_process_space(process_t* process) {
+    if (!process) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    process->memory_space = NULL;
+    return ERROR_NONE;
+}
+
+/**
+ * Free memory space for a process
+ */
+error_code_t memory_free_process_space(process_t* process) {
+    if (!process) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    process->memory_space = NULL;
+    return ERROR_NONE;
+}
+
+/**
+ * Get memory metrics
+ *
+ * Allocation counts and byte totals come from the allocator's per-thread
+ * counters. fragmentation_ratio is the share of memory held from the
+ * system that no live object uses (free slab space and empty slabs).
+ */
+error_code_t memory_get_metrics(memory_metrics_t* metrics) {
+    if (!memory_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    if (!metrics) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    slab_stats_t stats;
+    slab_get_statistics(&stats);
+    
+    memset(metrics, 0, sizeof(memory_metrics_t));
+    
+    long page_size = sysconf(_SC_PAGESIZE);
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long available = sysconf(_SC_AVPHYS_PAGES);
+    if (page_size > 0 && pages > 0) {
+        metrics->total_physical_memory = (uint64_t)pages * (uint64_t)page_size;
+    }
+    if (page_size > 0 && available > 0) {
+        metrics->free_physical_memory = (uint64_t)available * (uint64_t)page_size;
+    }
+    
+    metrics->total_virtual_memory = stats.reserved_bytes;
+    metrics->free_virtual_memory = stats.reserved_bytes > stats.live_bytes ? stats.reserved_bytes - stats.live_bytes : 0;
+    
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        metrics->page_fault_count = (uint32_t)(usage.ru_minflt + usage.ru_majflt);
+    }
+    
+    metrics->allocation_count = (uint32_t)stats.allocations;
+    metrics->free_count = (uint32_t)stats.frees;
+    metrics->peak_memory_usage = stats.peak_bytes;
+    
+    if (stats.held_bytes > 0 && stats.live_bytes <= stats.held_bytes) {
+        metrics->fragmentation_ratio = 1.0f - (float)((double)stats.live_bytes / (double)stats.held_bytes);
+    }
+    metrics->live_memory = stats.live_bytes;
+    metrics->cached_memory = stats.cached_bytes;
+    
+    pthread_mutex_lock(&memory_state.lock);
+    metrics->allocation_sites = memory_state.site_count;
+    metrics->top_site_live_bytes = memory_state.top_site_live_bytes;
+    metrics->top_site_churn = memory_state.top_site_churn;
+    pthread_mutex_unlock(&memory_state.lock);
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Analyze memory usage patterns
+ *
+ * Takes a heap profile and finds the call site with the most live bytes
+ * and the one freeing the most objects per second since the previous
+ * analysis. The results show up in memory_get_metrics.
+ */
+error_code_t memory_analyze_usage_patterns(void) {
+    if (!memory_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    memory_profile_site_t* sites = memory_allocate(MEMORY_PROFILE_SITES * sizeof(memory_profile_site_t));
+    if (!sites) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    
+    uint32_t count = profile_snapshot(sites);
+    uint64_t now = monotonic_ns();
+    
+    pthread_mutex_lock(&memory_state.lock);
+    
+    memory_profile_site_t* previous = memory_state.sites;
+    uint64_t elapsed = now - memory_state.analyzed_ns;
+    uint64_t top_live = 0;
+    uint64_t top_churn = 0;
+    
+    for (uint32_t i = 0; i < MEMORY_PROFILE_SITES; i++) {
+        if (sites[i].depth == 0) {
+            continue;
+        }
+        if (sites[i].live_bytes > top_live) {
+            top_live = sites[i].live_bytes;
+        }
+    
+        /* Sites keep their index, so the previous profile lines up */
+        if (previous && elapsed > 0) {
+            uint64_t before = previous[i].depth > 0 ? previous[i].freed_objects : 0;
+            uint64_t freed = sites[i].freed_objects > before ? sites[i].freed_objects - before : 0;
+            uint64_t churn = (uint64_t)((double)freed * 1e9 / (double)elapsed);
+            if (churn > top_churn) {
+                top_churn = churn;
+            }
+        }
+    }
+    
+    memory_state.sites = sites;
+    memory_state.analyzed_ns = now;
+    memory_state.site_count = count;
+    memory_state.top_site_live_bytes = top_live;
+    memory_state.top_site_churn = top_churn;
+    
+    pthread_mutex_unlock(&memory_state.lock);
+    
+    if (previous) {
+        memory_free(previous);
+    }
+    return ERROR_NONE;
+}
+
+/**
+ * Defragment memory
+ *
+ * Returns the pages of empty slabs to the system, which lowers the
+ * fragmentation ratio by the memory no object uses.
+ */
+error_code_t memory_defragment(void) {
+    if (!memory_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    slab_trim();
+    
+    pthread_mutex_lock(&memory_state.lock);
+    memory_state.optimization.defragmentation_count++;
+    pthread_mutex_unlock(&memory_state.lock);
+    return ERROR_NONE;
+}
+
+/**
+ * Optimize memory
+ *
+ * Refreshes the usage analysis and defragments once more than
+ * DEFRAGMENT_THRESHOLD of the memory held goes unused.
+ */
+error_code_t memory_optimize(void) {
+    error_code_t result = memory_analyze_usage_patterns();
+    if (result != ERROR_NONE) {
+        return result;
+    }
+    
+    memory_metrics_t metrics;
+    result = memory_get_metrics(&metrics);
+    if (result != ERROR_NONE) {
+        return result;
+    }
+    
+    if (metrics.fragmentation_ratio > DEFRAGMENT_THRESHOLD) {
+        result = memory_defragment();
+    }
+    
+    pthread_mutex_lock(&memory_state.lock);
+    memory_state.optimization.optimization_count++;
+    pthread_mutex_unlock(&memory_state.lock);
+    return result;
+}
+
+/**
+ * Apply a tuning action
+ *
+ * Takes a tuning_action_t setting TUNABLE_CACHE_SIZE, the empty slab
+ * memory kept for reuse (UINT64_MAX for no limit), and reports the limit
+ * it replaced.
+ */
+error_code_t memory_apply_optimization(void* optimization_data) {
+    if (!memory_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    tuning_action_t* action = optimization_data;
+    if (!action || action->tunable != TUNABLE_CACHE_SIZE) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    action->previous = slab_set_cache_limit(action->value);
+    
+    pthread_mutex_lock(&memory_state.lock);
+    memory_state.optimization.cache_optimization_count++;
+    pthread_mutex_unlock(&memory_state.lock);
+    return ERROR_NONE;
+}
@@ -12,6 +12,35 @@
 #include "../kernel/kernel.h"
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
+
+/* Default block size of a bump arena */
+#define ARENA_BLOCK_SIZE 4096
+
+/* Size and alignment of the slabs small objects are carved from */
+#define MEMORY_SLAB_SIZE (64 * 1024)
+
+/* Largest allocation served from size-class slabs; larger ones are mapped */
+#define MEMORY_SMALL_MAX 8192
+
+/* Number of general size classes (16-byte steps to 128, then four per
+   power of two up to MEMORY_SMALL_MAX) */
+#define MEMORY_SIZE_CLASSES 32
+
+/* Maximum number of object caches */
+#define MEMORY_MAX_CACHES 16
+
+/* Mean bytes allocated between heap profile samples */
+#define MEMORY_PROFILE_RATE (512 * 1024)
+
+/* Call stack frames recorded per sample */
+#define MEMORY_PROFILE_DEPTH 16
+
+/* Distinct call sites tracked by the heap profiler */
+#define MEMORY_PROFILE_SITES 1024
+
+/* Size class of allocations larger than MEMORY_SMALL_MAX */
+#define MEMORY_CLASS_LARGE UINT32_MAX
 
 /* Memory region types */
 typedef enum {
@@ -70,6 +99,11 @@ typedef struct {
     uint32_t free_count;               /* Number of memory frees */
     uint64_t peak_memory_usage;        /* Peak memory usage in bytes */
     float fragmentation_ratio;         /* Memory fragmentation ratio (0-1) */
+    uint64_t live_memory;              /* Bytes in live allocations */
+    uint32_t allocation_sites;         /* Call sites seen by the heap profiler */
+    uint64_t top_site_live_bytes;      /* Estimated live bytes of the largest site */
+    uint64_t top_site_churn;           /* Estimated frees per second of the busiest site */
+    uint64_t cached_memory;            /* Empty slab memory kept for reuse */
 } memory_metrics_t;
 
 /* Optimization history for memory subsystem */
@@ -80,6 +114,40 @@ typedef struct {
     uint32_t cache_optimization_count; /* Number of cache optimizations */
 } memory_optimization_t;
 
+/* Arena block */
+typedef struct arena_block {
+    struct arena_block* next;  /* Previously filled block */
+    size_t capacity;           /* Usable bytes in data */
+    size_t used;               /* Bytes handed out from data */
+    char data[];
+} arena_block_t;
+
+/* Bump allocator released in one step */
+typedef struct arena {
+    arena_block_t* head;       /* Block currently allocated from */
+    size_t block_size;         /* Capacity of regular blocks */
+} arena_t;
+
+/* Object cache: slabs dedicated to objects of one type */
+typedef struct {
+    char name[32];             /* Cache name (usually the type name) */
+    uint32_t object_size;      /* Object size, rounded to 16 bytes */
+    uint32_t class_index;      /* Slab class serving the cache */
+} memory_cache_t;
+
+/* Allocation call site seen by the heap profiler (estimated counts) */
+typedef struct {
+    void* frames[MEMORY_PROFILE_DEPTH]; /* Return addresses, innermost first */
+    uint32_t depth;            /* Frames recorded */
+    uint32_t size_class;       /* Slab class (caches follow the general classes) or MEMORY_CLASS_LARGE */
+    uint64_t live_objects;     /* Allocated and not freed */
+    uint64_t live_bytes;
+    uint64_t allocated_objects; /* Since profiling started */
+    uint64_t allocated_bytes;
+    uint64_t freed_objects;    /* Churn */
+    uint64_t freed_bytes;
+} memory_profile_site_t;
+
 /* Initialize memory subsystem */
 error_code_t memory_init(void);
 
@@ -89,6 +157,23 @@ void* memory_allocate(uint32_t size);
 /* Free memory */
 error_code_t memory_free(void* ptr);
 
+/* Object caches (caches live as long as the process) */
+memory_cache_t* memory_cache_create(const char* name, uint32_t object_size);
+void* memory_cache_alloc(memory_cache_t* cache);
+error_code_t memory_cache_free(memory_cache_t* cache, void* ptr);
+
+/* Heap profiler (rate 0 stops sampling; sites are sorted by live bytes) */
+error_code_t memory_profile_set_rate(uint32_t bytes);
+uint32_t memory_profile_get_sites(memory_profile_site_t* sites, uint32_t max);
+error_code_t memory_profile_dump(const char* path);
+
+/* Bump arena for short-lived allocations (single-threaded) */
+void arena_init(arena_t* arena, size_t block_size);
+void* arena_alloc(arena_t* arena, size_t size);
+char* arena_strndup(arena_t* arena, const char* string, size_t length);
+void arena_reset(arena_t* arena);
+void arena_destroy(arena_t* arena);
+
 /* Allocate memory space for a process */
 error_code_t memory_allocate_process_space(process_t* process);
 
@@ -0,0 +1,360 @@
+/**
+ * NexOS Memory Management - Heap Profiler
+ *
+ * This file implements the sample intervals, the call site table and the
+ * profile dump (see profile.h). The dump uses the text format of the
+ * gperftools heap profiler, which pprof reads:
+ *
+ *   heap profile: <live>: <live bytes> [<allocated>: <allocated bytes>] @ heap_v2/<rate>
+ *   <live>: <live bytes> [<allocated>: <allocated bytes>] @ <return addresses>
+ *   ...
+ *   MAPPED_LIBRARIES:
+ *   <contents of /proc/self/maps>
+ *
+ * with raw sample counts, which pprof scales by the rate itself.
+ */
+
+#define _GNU_SOURCE
+#include "profile.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <execinfo.h>
+
+/* Frames of the profiler and the sampling path on a sampled stack; the
+   allocator entry point stays unless the compiler jumped to the sampling
+   path */
+#define PROFILE_SKIP_FRAMES 2
+
+/* Bits of randomness per interval */
+#define INTERVAL_BITS 26
+
+/* Call site (raw sample counts) */
+typedef struct {
+    void* frames[MEMORY_PROFILE_DEPTH];
+    uint32_t depth;            /* 0 if the slot is unused */
+    uint32_t size_class;
+    uint64_t hash;
+    uint64_t allocations;
+    uint64_t allocated_bytes;
+    uint64_t frees;
+    uint64_t freed_bytes;
+} profile_site_t;
+
+/* Profiler state */
+static struct {
+    pthread_mutex_t lock;      /* Guards the site table */
+    _Atomic uint32_t rate;     /* Mean bytes between samples (0 = off) */
+    uint32_t site_count;
+    profile_site_t sites[MEMORY_PROFILE_SITES];
+} profile_state = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .rate = MEMORY_PROFILE_RATE
+};
+
+_Static_assert((MEMORY_PROFILE_SITES & (MEMORY_PROFILE_SITES - 1)) == 0, "site table size must be a power of two");
+
+/**
+ * Approximate log2 (within 0.01)
+ */
+static double fast_log2(uint64_t value) {
+    int exponent = 63 - __builtin_clzll(value);
+    double mantissa = (double)value / (double)(1ULL << exponent) - 1.0;
+    return exponent + mantissa * (1.3465 - 0.3465 * mantissa);
+}
+
+/**
+ * e^(-x) for x >= 0
+ */
+static double exp_negative(double x) {
+    if (x > 40.0) {
+        return 0.0;
+    }
+    
+    /* e^(-x) = 2^(-whole) * e^(-fraction * ln 2) */
+    double y = x * 1.4426950408889634;
+    uint32_t whole = (uint32_t)y;
+    double t = (y - whole) * 0.6931471805599453;
+    
+    double term = 1.0;
+    double sum = 1.0;
+    for (int i = 1; i <= 10; i++) {
+        term *= -t / i;
+        sum += term;
+    }
+    while (whole-- > 0) {
+        sum *= 0.5;
+    }
+    return sum;
+}
+
+/**
+ * Allocations one sample of the given average size stands for
+ */
+static double sample_scale(uint64_t bytes, uint64_t samples, uint32_t rate) {
+    if (rate == 0 || samples == 0 || bytes == 0) {
+        return 1.0;
+    }
+    
+    return 1.0 / (1.0 - exp_negative((double)bytes / (double)samples / (double)rate));
+}
+
+/**
+ * Bytes until the next sample
+ *
+ * Intervals are exponentially distributed, so every allocated byte is
+ * equally likely to be sampled whatever the allocation sizes.
+ */
+int64_t profile_next_interval(uint64_t* seed) {
+    uint32_t rate = atomic_load_explicit(&profile_state.rate, memory_order_relaxed);
+    if (rate == 0) {
+        return 0;
+    }
+    
+    /* xorshift64* */
+    uint64_t x = *seed ? *seed : 0x9E3779B97F4A7C15ULL;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *seed = x;
+    uint64_t q = ((x * 0x2545F4914F6CDD1DULL) >> (64 - INTERVAL_BITS)) + 1;
+    
+    /* -ln(q / 2^INTERVAL_BITS) * rate */
+    double interval = (INTERVAL_BITS - fast_log2(q)) * 0.6931471805599453 * rate;
+    return interval < 1.0 ? 1 : (int64_t)interval;
+}
+
+/**
+ * Record a sampled allocation
+ *
+ * Must be called directly from the allocator's sampling path, whose frames
+ * are left out of the stack.
+ */
+uint32_t profile_record_allocation(uint32_t size_class, uint32_t size) {
+    void* frames[MEMORY_PROFILE_DEPTH + PROFILE_SKIP_FRAMES];
+    int captured = backtrace(frames, MEMORY_PROFILE_DEPTH + PROFILE_SKIP_FRAMES);
+    uint32_t depth = captured > PROFILE_SKIP_FRAMES ? (uint32_t)captured - PROFILE_SKIP_FRAMES : 0;
+    void** stack = frames + PROFILE_SKIP_FRAMES;
+    
+    /* Stacks with no frames above the allocator share one site per class */
+    uint32_t stored = depth > 0 ? depth : 1;
+    
+    /* FNV-1a over the stack and the class */
+    uint64_t hash = 0xcbf29ce484222325ULL ^ size_class;
+    for (uint32_t i = 0; i < depth; i++) {
+        hash = (hash ^ (uint64_t)(uintptr_t)stack[i]) * 0x100000001b3ULL;
+    }
+    
+    pthread_mutex_lock(&profile_state.lock);
+    
+    uint32_t index = (uint32_t)hash & (MEMORY_PROFILE_SITES - 1);
+    for (uint32_t probe = 0; probe < MEMORY_PROFILE_SITES; probe++) {
+        profile_site_t* site = &profile_state.sites[index];
+    
+        if (site->depth == 0) {
+            site->depth = stored;
+            memcpy(site->frames, stack, depth * sizeof(void*));
+            site->size_class = size_class;
+            site->hash = hash;
+            profile_state.site_count++;
+        } else if (site->hash != hash || site->size_class != size_class || site->depth != stored ||
+                   memcmp(site->frames, stack, depth * sizeof(void*)) != 0) {
+            index = (index + 1) & (MEMORY_PROFILE_SITES - 1);
+            continue;
+        }
+    
+        site->allocations++;
+        site->allocated_bytes += size;
+        pthread_mutex_unlock(&profile_state.lock);
+        return index + 1;
+    }
+    
+    /* Table full: the sample is lost */
+    pthread_mutex_unlock(&profile_state.lock);
+    return 0;
+}
+
+void profile_record_free(uint32_t site, uint32_t size) {
+    if (site == 0 || site > MEMORY_PROFILE_SITES) {
+        return;
+    }
+    
+    pthread_mutex_lock(&profile_state.lock);
+    profile_state.sites[site - 1].frees++;
+    profile_state.sites[site - 1].freed_bytes += size;
+    pthread_mutex_unlock(&profile_state.lock);
+}
+
+/**
+ * Copy the raw site table (a MEMORY_PROFILE_SITES array)
+ */
+static uint32_t copy_sites(profile_site_t* sites) {
+    pthread_mutex_lock(&profile_state.lock);
+    memcpy(sites, profile_state.sites, sizeof(profile_state.sites));
+    uint32_t count = profile_state.site_count;
+    pthread_mutex_unlock(&profile_state.lock);
+    return count;
+}
+
+static profile_site_t* allocate_sites(void) {
+    return memory_allocate((uint32_t)sizeof(profile_state.sites));
+}
+
+uint32_t profile_snapshot(memory_profile_site_t* sites) {
+    profile_site_t* raw = allocate_sites();
+    if (!raw) {
+        memset(sites, 0, MEMORY_PROFILE_SITES * sizeof(memory_profile_site_t));
+        return 0;
+    }
+    
+    uint32_t count = copy_sites(raw);
+    uint32_t rate = atomic_load_explicit(&profile_state.rate, memory_order_relaxed);
+    
+    for (uint32_t i = 0; i < MEMORY_PROFILE_SITES; i++) {
+        memory_profile_site_t* site = &sites[i];
+        memset(site, 0, sizeof(*site));
+        if (raw[i].depth == 0) {
+            continue;
+        }
+    
+        /* Frees are scaled like the allocations they undo */
+        double scale = sample_scale(raw[i].allocated_bytes, raw[i].allocations, rate);
+    
+        memcpy(site->frames, raw[i].frames, sizeof(site->frames));
+        site->depth = raw[i].depth;
+        site->size_class = raw[i].size_class;
+        site->allocated_objects = (uint64_t)(raw[i].allocations * scale + 0.5);
+        site->allocated_bytes = (uint64_t)(raw[i].allocated_bytes * scale + 0.5);
+        site->freed_objects = (uint64_t)(raw[i].frees * scale + 0.5);
+        site->freed_bytes = (uint64_t)(raw[i].freed_bytes * scale + 0.5);
+        site->live_objects = site->allocated_objects - site->freed_objects;
+        site->live_bytes = site->allocated_bytes - site->freed_bytes;
+    }
+    
+    memory_free(raw);
+    return count;
+}
+
+/**
+ * Set the mean bytes between samples
+ *
+ * Heaps pick up a new rate at their next sample; 0 stops sampling.
+ */
+error_code_t memory_profile_set_rate(uint32_t bytes) {
+    atomic_store_explicit(&profile_state.rate, bytes, memory_order_relaxed);
+    return ERROR_NONE;
+}
+
+static int compare_live_bytes(const void* a, const void* b) {
+    const memory_profile_site_t* left = a;
+    const memory_profile_site_t* right = b;
+    
+    if (left->live_bytes != right->live_bytes) {
+        return left->live_bytes < right->live_bytes ? 1 : -1;
+    }
+    return left->allocated_bytes < right->allocated_bytes ? 1 : (left->allocated_bytes > right->allocated_bytes ? -1 : 0);
+}
+
+/**
+ * Get the call sites with the most live bytes
+ *
+ * Returns the number of sites copied.
+ */
+uint32_t memory_profile_get_sites(memory_profile_site_t* sites, uint32_t max) {
+    if (!sites || max == 0) {
+        return 0;
+    }
+    
+    memory_profile_site_t* all = memory_allocate(MEMORY_PROFILE_SITES * sizeof(memory_profile_site_t));
+    if (!all) {
+        return 0;
+    }
+    
+    profile_snapshot(all);
+    
+    /* Pack the used entries and sort them */
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < MEMORY_PROFILE_SITES; i++) {
+        if (all[i].depth > 0) {
+            all[count++] = all[i];
+        }
+    }
+    qsort(all, count, sizeof(memory_profile_site_t), compare_live_bytes);
+    
+    if (count > max) {
+        count = max;
+    }
+    memcpy(sites, all, count * sizeof(memory_profile_site_t));
+    
+    memory_free(all);
+    return count;
+}
+
+/**
+ * Write the heap profile to a file in pprof's legacy heap format
+ */
+error_code_t memory_profile_dump(const char* path) {
+    if (!path) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    profile_site_t* sites = allocate_sites();
+    if (!sites) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    copy_sites(sites);
+    
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        memory_free(sites);
+        return ERROR_PERMISSION_DENIED;
+    }
+    
+    uint64_t live = 0, live_bytes = 0, allocated = 0, allocated_bytes = 0;
+    for (uint32_t i = 0; i < MEMORY_PROFILE_SITES; i++) {
+        if (sites[i].depth > 0) {
+            live += sites[i].allocations - sites[i].frees;
+            live_bytes += sites[i].allocated_bytes - sites[i].freed_bytes;
+            allocated += sites[i].allocations;
+            allocated_bytes += sites[i].allocated_bytes;
+        }
+    }
+    
+    fprintf(file, "heap profile: %6llu: %8llu [%6llu: %8llu] @ heap_v2/%u\n",
+            (unsigned long long)live, (unsigned long long)live_bytes,
+            (unsigned long long)allocated, (unsigned long long)allocated_bytes,
+            atomic_load_explicit(&profile_state.rate, memory_order_relaxed));
+    
+    for (uint32_t i = 0; i < MEMORY_PROFILE_SITES; i++) {
+        profile_site_t* site = &sites[i];
+        if (site->depth == 0) {
+            continue;
+        }
+    
+        fprintf(file, "%6llu: %8llu [%6llu: %8llu] @",
+                (unsigned long long)(site->allocations - site->frees),
+                (unsigned long long)(site->allocated_bytes - site->freed_bytes),
+                (unsigned long long)site->allocations, (unsigned long long)site->allocated_bytes);
+        for (uint32_t f = 0; f < site->depth && site->frames[f]; f++) {
+            fprintf(file, " %p", site->frames[f]);
+        }
+        fputc('\n', file);
+    }
+    
+    /* pprof maps the addresses to binaries and symbols with the mappings */
+    fputs("\nMAPPED_LIBRARIES:\n", file);
+    FILE* maps = fopen("/proc/self/maps", "r");
+    if (maps) {
+        char buffer[4096];
+        size_t length;
+        while ((length = fread(buffer, 1, sizeof(buffer), maps)) > 0) {
+            fwrite(buffer, 1, length, file);
+        }
+        fclose(maps);
+    }
+    
+    memory_free(sites);
+    return fclose(file) == 0 ? ERROR_NONE : ERROR_UNKNOWN;
+}
@@ -0,0 +1,33 @@
+/**
+ * NexOS Memory Management - Heap Profiler
+ *
+ * The allocator samples allocations by bytes: every heap counts down a
+ * random interval, exponentially distributed with a mean of the profile
+ * rate, and records the allocation that crosses zero together with its
+ * call stack. Sampled objects are mapped like large allocations, so their
+ * slab header can carry the call site and unsampled frees never look
+ * anything up.
+ *
+ * Counts are kept per call site and size class as raw samples; an
+ * allocation of size bytes stands for 1 / (1 - e^(-size / rate)) of them.
+ */
+
+#ifndef NEXOS_MEMORY_PROFILE_H
+#define NEXOS_MEMORY_PROFILE_H
+
+#include "memory.h"
+
+/* Bytes until the next sample, drawn from the seed; 0 if profiling is off */
+int64_t profile_next_interval(uint64_t* seed);
+
+/* Record a sampled allocation (returns its site + 1, or 0 if not recorded) */
+uint32_t profile_record_allocation(uint32_t size_class, uint32_t size);
+
+/* Record the free of a sampled allocation */
+void profile_record_free(uint32_t site, uint32_t size);
+
+/* Copy all MEMORY_PROFILE_SITES sites in table order, so a site keeps its
+   index; unused entries have no frames (returns the sites in use) */
+uint32_t profile_snapshot(memory_profile_site_t* sites);
+
+#endif /* NEXOS_MEMORY_PROFILE_H */
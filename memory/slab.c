@@ -0,0 +1,892 @@
+/**
+ * NexOS Memory Management - Slab Allocator
+ *
+ * This file implements memory_allocate, memory_free and the object caches
+ * on per-thread heaps of size-class slabs (see slab.h).
+ *
+ * A slab whose objects are all handed out leaves its heap's partial list
+ * and is marked full. The first thread to free one of its objects remotely
+ * clears the mark and queues the slab on the owner's reclaim list, from
+ * which the owner puts it back on the partial list. Slabs emptied by their
+ * owner go back to a shared pool; slab memory itself is never unmapped,
+ * so a remote free racing with the reuse of a slab stays harmless. The
+ * pool keeps the pages of up to a cache limit of empty slabs (no limit by
+ * default) and hands back the pages of any beyond it; slab_trim hands back
+ * the pages of every pooled slab.
+ *
+ * Allocations picked by the heap profiler (see profile.h) are mapped like
+ * large ones and keep their class and call site in the header.
+ */
+
+#define _GNU_SOURCE
+#include "slab.h"
+#include "profile.h"
+#include <stdatomic.h>
+#include <stdalign.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* Slabs reserved from the system at a time */
+#define SEGMENT_SIZE (64 * MEMORY_SLAB_SIZE)
+
+/* Offset of the first object in a slab (and of a large allocation) */
+#define SLAB_HEADER_SIZE 192
+
+/* General size classes followed by one class per object cache */
+#define CLASS_COUNT (MEMORY_SIZE_CLASSES + MEMORY_MAX_CACHES)
+
+#define CACHE_LINE 64
+
+/* Bytes between checks whether profiling was turned on */
+#define PROFILE_IDLE_INTERVAL (64LL * 1024 * 1024)
+
+typedef enum {
+    SLAB_SMALL,
+    SLAB_LARGE
+} slab_kind_t;
+
+/* Per-heap counters */
+typedef enum {
+    HEAP_STAT_ALLOCATIONS,
+    HEAP_STAT_FREES,
+    HEAP_STAT_LIVE_BYTES,      /* Wraps when objects are freed by another heap */
+    HEAP_STAT_COUNT
+} heap_stat_t;
+
+struct heap;
+
+/* Slab header, at the start of every slab and large allocation */
+typedef struct slab {
+    slab_kind_t kind;
+    uint32_t class_index;
+    uint32_t object_size;      /* Object size (requested size if large) */
+    uint32_t site;             /* Heap profile site + 1 if sampled (large) */
+    uint32_t used;             /* Objects not on the local free list (owner only) */
+    _Atomic(struct heap*) owner; /* Heap allocating from the slab (NULL in the pool) */
+    struct slab* next;         /* Owner's partial list, or the pool */
+    struct slab* prev;
+    void* free;                /* Objects freed by the owner */
+    uint8_t* bump;             /* Never allocated space */
+    uint8_t* end;
+    size_t length;             /* Mapping length (large) */
+    bool in_partial;           /* On the owner's partial list (owner only) */
+    bool decommitted;          /* Pages after the header given back (pool only) */
+    
+    /* Written by other threads */
+    alignas(CACHE_LINE) _Atomic(void*) remote; /* Objects freed by other threads */
+    _Atomic bool full;         /* Off the partial list, waiting for a free */
+    _Atomic bool queued;       /* On a reclaim list */
+    struct slab* reclaim_next;
+} slab_t;
+
+_Static_assert(sizeof(slab_t) <= SLAB_HEADER_SIZE, "slab header too large");
+
+/* Per-thread heap */
+typedef struct heap {
+    slab_t* partial[CLASS_COUNT]; /* Slabs with free objects; allocation uses the head */
+    struct heap* next;         /* All heaps */
+    struct heap* parked_next;  /* Heaps of exited threads */
+    _Atomic uint64_t stats[HEAP_STAT_COUNT]; /* Single writer: the thread using the heap */
+    int64_t sample_bytes;      /* Bytes to allocate until the next profile sample */
+    uint64_t sample_seed;
+    
+    /* Written by other threads */
+    alignas(CACHE_LINE) _Atomic(slab_t*) reclaimed; /* Full slabs that got remote frees */
+} heap_t;
+
+static _Thread_local heap_t* local_heap;
+
+/* Allocator state */
+static struct {
+    pthread_mutex_t lock;      /* Guards heaps, the pool and the caches */
+    heap_t* heaps;
+    heap_t* parked;
+    slab_t* pool;              /* Empty slabs */
+    uint64_t pool_limit;       /* Bytes of pooled slabs kept committed */
+    uint64_t pool_committed;   /* Bytes of pooled slabs not given back */
+    uint8_t* segment_next;     /* Uncarved part of the newest segment */
+    uint8_t* segment_end;
+    pthread_key_t key;
+    bool key_created;
+    memory_cache_t caches[MEMORY_MAX_CACHES];
+    uint32_t cache_count;
+    _Atomic uint64_t held_bytes;
+    _Atomic uint64_t peak_bytes;
+    _Atomic uint64_t reserved_bytes;
+} slab_state = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .pool_limit = UINT64_MAX
+};
+
+/**
+ * Map length bytes aligned to MEMORY_SLAB_SIZE
+ */
+static void* map_aligned(size_t length) {
+    size_t span = length + MEMORY_SLAB_SIZE;
+    uint8_t* base = mmap(NULL, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+    
+    uintptr_t start = ((uintptr_t)base + MEMORY_SLAB_SIZE - 1) & ~(uintptr_t)(MEMORY_SLAB_SIZE - 1);
+    size_t head = start - (uintptr_t)base;
+    size_t tail = span - head - length;
+    if (head > 0) {
+        munmap(base, head);
+    }
+    if (tail > 0) {
+        munmap((uint8_t*)start + length, tail);
+    }
+    
+    return (void*)start;
+}
+
+static size_t system_page_size(void) {
+    static _Atomic size_t cached;
+    size_t size = atomic_load_explicit(&cached, memory_order_relaxed);
+    if (size == 0) {
+        long system = sysconf(_SC_PAGESIZE);
+        size = system > 0 ? (size_t)system : PAGE_SIZE;
+        atomic_store_explicit(&cached, size, memory_order_relaxed);
+    }
+    return size;
+}
+
+/**
+ * Account memory obtained from the system
+ */
+static void held_add(uint64_t bytes) {
+    uint64_t held = atomic_fetch_add_explicit(&slab_state.held_bytes, bytes, memory_order_relaxed) + bytes;
+    uint64_t peak = atomic_load_explicit(&slab_state.peak_bytes, memory_order_relaxed);
+    
+    while (held > peak && !atomic_compare_exchange_weak_explicit(&slab_state.peak_bytes, &peak, held,
+                                                                 memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+/**
+ * Add to a counter of the calling thread's heap
+ */
+static inline void heap_count(heap_t* heap, heap_stat_t stat, uint64_t value) {
+    atomic_store_explicit(&heap->stats[stat],
+                          atomic_load_explicit(&heap->stats[stat], memory_order_relaxed) + value,
+                          memory_order_relaxed);
+}
+
+/**
+ * Park the heap of an exiting thread for the next thread
+ */
+static void heap_destructor(void* value) {
+    heap_t* heap = value;
+    
+    pthread_mutex_lock(&slab_state.lock);
+    heap->parked_next = slab_state.parked;
+    slab_state.parked = heap;
+    pthread_mutex_unlock(&slab_state.lock);
+    
+    local_heap = NULL;
+}
+
+/**
+ * Give the calling thread a heap
+ */
+static heap_t* heap_attach(void) {
+    pthread_mutex_lock(&slab_state.lock);
+    
+    if (!slab_state.key_created) {
+        if (pthread_key_create(&slab_state.key, heap_destructor) != 0) {
+            pthread_mutex_unlock(&slab_state.lock);
+            return NULL;
+        }
+        slab_state.key_created = true;
+    }
+    
+    heap_t* heap = slab_state.parked;
+    if (heap) {
+        slab_state.parked = heap->parked_next;
+    } else {
+        heap = aligned_alloc(CACHE_LINE, sizeof(heap_t));
+        if (!heap) {
+            pthread_mutex_unlock(&slab_state.lock);
+            return NULL;
+        }
+        memset(heap, 0, sizeof(*heap));
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        heap->sample_seed = (uint64_t)(uintptr_t)heap ^ ((uint64_t)now.tv_sec << 30) ^ (uint64_t)now.tv_nsec;
+        heap->sample_bytes = profile_next_interval(&heap->sample_seed);
+        if (heap->sample_bytes == 0) {
+            heap->sample_bytes = PROFILE_IDLE_INTERVAL;
+        }
+        heap->next = slab_state.heaps;
+        slab_state.heaps = heap;
+    }
+    
+    pthread_mutex_unlock(&slab_state.lock);
+    
+    pthread_setspecific(slab_state.key, heap);
+    local_heap = heap;
+    return heap;
+}
+
+static inline heap_t* current_heap(void) {
+    heap_t* heap = local_heap;
+    return heap ? heap : heap_attach();
+}
+
+/**
+ * Find the size class of a small request
+ */
+static inline uint32_t size_class(uint32_t size) {
+    if (size <= 128) {
+        return size == 0 ? 0 : (size - 1) / 16;
+    }
+    
+    uint32_t order = 31 - (uint32_t)__builtin_clz(size - 1);
+    return 8 + (order - 7) * 4 + ((size - 1) >> (order - 2)) - 4;
+}
+
+/**
+ * Object size of a class
+ */
+static uint32_t class_size(uint32_t index) {
+    if (index >= MEMORY_SIZE_CLASSES) {
+        return slab_state.caches[index - MEMORY_SIZE_CLASSES].object_size;
+    }
+    if (index < 8) {
+        return (index + 1) * 16;
+    }
+    
+    uint32_t order = 7 + (index - 8) / 4;
+    return (1U << order) + ((index - 8) % 4 + 1) * (1U << (order - 2));
+}
+
+static inline slab_t* slab_of(void* ptr) {
+    return (slab_t*)((uintptr_t)ptr & ~(uintptr_t)(MEMORY_SLAB_SIZE - 1));
+}
+
+/**
+ * Take an empty slab from the pool, reserving a segment if needed
+ */
+static slab_t* pool_acquire(void) {
+    pthread_mutex_lock(&slab_state.lock);
+    
+    slab_t* slab = slab_state.pool;
+    if (slab) {
+        slab_state.pool = slab->next;
+        bool decommitted = slab->decommitted;
+        slab->decommitted = false;
+        if (!decommitted) {
+            slab_state.pool_committed -= MEMORY_SLAB_SIZE;
+        }
+        pthread_mutex_unlock(&slab_state.lock);
+    
+        /* Given back pages come back zeroed on first touch */
+        if (decommitted) {
+            held_add(MEMORY_SLAB_SIZE - system_page_size());
+        }
+        return slab;
+    }
+    
+    if (slab_state.segment_next == slab_state.segment_end) {
+        uint8_t* segment = map_aligned(SEGMENT_SIZE);
+        if (!segment) {
+            pthread_mutex_unlock(&slab_state.lock);
+            return NULL;
+        }
+        slab_state.segment_next = segment;
+        slab_state.segment_end = segment + SEGMENT_SIZE;
+        atomic_fetch_add_explicit(&slab_state.reserved_bytes, SEGMENT_SIZE, memory_order_relaxed);
+    }
+    
+    slab = (slab_t*)slab_state.segment_next;
+    slab_state.segment_next += MEMORY_SLAB_SIZE;
+    
+    pthread_mutex_unlock(&slab_state.lock);
+    
+    held_add(MEMORY_SLAB_SIZE);
+    return slab;
+}
+
+/**
+ * Give back the pages of a pooled slab but its header
+ *
+ * Called with the allocator lock held. Returns the bytes given back.
+ */
+static uint64_t pool_decommit(slab_t* slab) {
+    size_t page = system_page_size();
+    if (page < SLAB_HEADER_SIZE || page >= MEMORY_SLAB_SIZE || slab->decommitted) {
+        return 0;
+    }
+    if (madvise((uint8_t*)slab + page, MEMORY_SLAB_SIZE - page, MADV_DONTNEED) != 0) {
+        return 0;
+    }
+    
+    slab->decommitted = true;
+    slab_state.pool_committed -= MEMORY_SLAB_SIZE;
+    return MEMORY_SLAB_SIZE - page;
+}
+
+/**
+ * Decommit pooled slabs until the pool fits its cache limit
+ *
+ * Called with the allocator lock held. Returns the bytes given back.
+ */
+static uint64_t pool_fit(void) {
+    uint64_t released = 0;
+    for (slab_t* slab = slab_state.pool;
+         slab && slab_state.pool_committed > slab_state.pool_limit; slab = slab->next) {
+        released += pool_decommit(slab);
+    }
+    return released;
+}
+
+static void pool_release(slab_t* slab) {
+    atomic_store_explicit(&slab->owner, NULL, memory_order_relaxed);
+    
+    pthread_mutex_lock(&slab_state.lock);
+    slab->next = slab_state.pool;
+    slab_state.pool = slab;
+    slab_state.pool_committed += MEMORY_SLAB_SIZE;
+    
+    uint64_t released = 0;
+    if (slab_state.pool_committed > slab_state.pool_limit) {
+        released = pool_decommit(slab);
+    }
+    pthread_mutex_unlock(&slab_state.lock);
+    
+    if (released) {
+        atomic_fetch_sub_explicit(&slab_state.held_bytes, released, memory_order_relaxed);
+    }
+}
+
+static void partial_push_front(heap_t* heap, slab_t* slab) {
+    slab_t** head = &heap->partial[slab->class_index];
+    
+    slab->prev = NULL;
+    slab->next = *head;
+    if (*head) {
+        (*head)->prev = slab;
+    }
+    *head = slab;
+    slab->in_partial = true;
+}
+
+/**
+ * Put a slab behind the head, so the head keeps being allocated from
+ */
+static void partial_insert(heap_t* heap, slab_t* slab) {
+    slab_t* head = heap->partial[slab->class_index];
+    if (!head) {
+        partial_push_front(heap, slab);
+        return;
+    }
+    
+    slab->prev = head;
+    slab->next = head->next;
+    if (head->next) {
+        head->next->prev = slab;
+    }
+    head->next = slab;
+    slab->in_partial = true;
+}
+
+static void partial_remove(heap_t* heap, slab_t* slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        heap->partial[slab->class_index] = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    slab->in_partial = false;
+}
+
+/**
+ * Queue a full slab that got a remote free on its owner's reclaim list
+ */
+static void slab_notify(slab_t* slab) {
+    heap_t* owner = atomic_load_explicit(&slab->owner, memory_order_relaxed);
+    if (!owner || atomic_exchange_explicit(&slab->queued, true, memory_order_acquire)) {
+        return;
+    }
+    
+    slab_t* top = atomic_load_explicit(&owner->reclaimed, memory_order_relaxed);
+    do {
+        slab->reclaim_next = top;
+    } while (!atomic_compare_exchange_weak_explicit(&owner->reclaimed, &top, slab,
+                                                    memory_order_release, memory_order_relaxed));
+}
+
+/**
+ * Move slabs from the reclaim list back to the partial lists
+ */
+static void heap_drain_reclaimed(heap_t* heap) {
+    slab_t* slab = atomic_exchange_explicit(&heap->reclaimed, NULL, memory_order_acquire);
+    
+    while (slab) {
+        slab_t* next = slab->reclaim_next;
+        atomic_store_explicit(&slab->queued, false, memory_order_release);
+    
+        heap_t* owner = atomic_load_explicit(&slab->owner, memory_order_relaxed);
+        if (owner == heap) {
+            if (!slab->in_partial) {
+                partial_insert(heap, slab);
+            }
+        } else if (owner) {
+            /* Reused by another heap since it was queued */
+            slab_notify(slab);
+        }
+        slab = next;
+    }
+}
+
+/**
+ * Move objects freed by other threads to the local free list
+ */
+static void slab_collect(slab_t* slab) {
+    void* list = atomic_exchange_explicit(&slab->remote, NULL, memory_order_acquire);
+    if (!list) {
+        return;
+    }
+    
+    uint32_t count = 1;
+    void* last = list;
+    while (*(void**)last) {
+        last = *(void**)last;
+        count++;
+    }
+    
+    *(void**)last = slab->free;
+    slab->free = list;
+    slab->used -= count;
+}
+
+/**
+ * Take an exhausted slab off the partial list
+ */
+static void slab_retire(heap_t* heap, slab_t* slab) {
+    partial_remove(heap, slab);
+    
+    /* A remote free that missed the full mark must not strand the slab */
+    atomic_store_explicit(&slab->full, true, memory_order_seq_cst);
+    if (atomic_load_explicit(&slab->remote, memory_order_seq_cst) &&
+        atomic_exchange_explicit(&slab->full, false, memory_order_seq_cst)) {
+        partial_insert(heap, slab);
+    }
+}
+
+static void slab_init(slab_t* slab, heap_t* heap, uint32_t index) {
+    uint32_t object_size = class_size(index);
+    
+    slab->kind = SLAB_SMALL;
+    slab->class_index = index;
+    slab->object_size = object_size;
+    slab->used = 0;
+    slab->free = NULL;
+    slab->bump = (uint8_t*)slab + SLAB_HEADER_SIZE;
+    slab->end = slab->bump + (MEMORY_SLAB_SIZE - SLAB_HEADER_SIZE) / object_size * object_size;
+    slab->in_partial = false;
+    atomic_store_explicit(&slab->remote, NULL, memory_order_relaxed);
+    atomic_store_explicit(&slab->full, false, memory_order_relaxed);
+    atomic_store_explicit(&slab->queued, false, memory_order_relaxed);
+    atomic_store_explicit(&slab->owner, heap, memory_order_relaxed);
+}
+
+/**
+ * Allocate when the head slab of a class has no free object
+ */
+static void* heap_allocate_slow(heap_t* heap, uint32_t index) {
+    heap_drain_reclaimed(heap);
+    
+    slab_t* slab;
+    while ((slab = heap->partial[index])) {
+        if (!slab->free) {
+            slab_collect(slab);
+        }
+        if (slab->free || slab->bump < slab->end) {
+            break;
+        }
+        slab_retire(heap, slab);
+    }
+    
+    if (!slab) {
+        slab = pool_acquire();
+        if (!slab) {
+            return NULL;
+        }
+        slab_init(slab, heap, index);
+        partial_push_front(heap, slab);
+    }
+    
+    void* object;
+    if (slab->free) {
+        object = slab->free;
+        slab->free = *(void**)object;
+    } else {
+        object = slab->bump;
+        slab->bump += slab->object_size;
+    }
+    slab->used++;
+    
+    heap_count(heap, HEAP_STAT_ALLOCATIONS, 1);
+    heap_count(heap, HEAP_STAT_LIVE_BYTES, slab->object_size);
+    return object;
+}
+
+static inline void* heap_allocate(heap_t* heap, uint32_t index) {
+    slab_t* slab = heap->partial[index];
+    void* object;
+    
+    if (!slab || !(object = slab->free)) {
+        return heap_allocate_slow(heap, index);
+    }
+    
+    slab->free = *(void**)object;
+    slab->used++;
+    
+    heap_count(heap, HEAP_STAT_ALLOCATIONS, 1);
+    heap_count(heap, HEAP_STAT_LIVE_BYTES, slab->object_size);
+    return object;
+}
+
+/**
+ * Free an object of a small slab
+ */
+static void slab_free(slab_t* slab, void* ptr) {
+    heap_t* heap = current_heap();
+    
+    if (heap) {
+        heap_count(heap, HEAP_STAT_FREES, 1);
+        heap_count(heap, HEAP_STAT_LIVE_BYTES, -(uint64_t)slab->object_size);
+    }
+    
+    if (heap && atomic_load_explicit(&slab->owner, memory_order_relaxed) == heap) {
+        *(void**)ptr = slab->free;
+        slab->free = ptr;
+        slab->used--;
+    
+        if (!slab->in_partial) {
+            if (atomic_exchange_explicit(&slab->full, false, memory_order_seq_cst)) {
+                partial_insert(heap, slab);
+            }
+        } else if (slab->used == 0 && heap->partial[slab->class_index] != slab) {
+            partial_remove(heap, slab);
+            pool_release(slab);
+        }
+        return;
+    }
+    
+    void* top = atomic_load_explicit(&slab->remote, memory_order_relaxed);
+    do {
+        *(void**)ptr = top;
+    } while (!atomic_compare_exchange_weak_explicit(&slab->remote, &top, ptr,
+                                                    memory_order_seq_cst, memory_order_relaxed));
+    
+    if (atomic_load_explicit(&slab->full, memory_order_seq_cst) &&
+        atomic_exchange_explicit(&slab->full, false, memory_order_seq_cst)) {
+        slab_notify(slab);
+    }
+}
+
+/**
+ * Map an allocation larger than MEMORY_SMALL_MAX, or a sampled one
+ */
+static void* large_allocate(heap_t* heap, uint32_t size, uint32_t index) {
+    size_t length = (SLAB_HEADER_SIZE + (size_t)size + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+    slab_t* slab = map_aligned(length);
+    if (!slab) {
+        return NULL;
+    }
+    
+    slab->kind = SLAB_LARGE;
+    slab->class_index = index;
+    slab->object_size = size;
+    slab->site = 0;
+    slab->length = length;
+    atomic_fetch_add_explicit(&slab_state.reserved_bytes, length, memory_order_relaxed);
+    held_add(length);
+    
+    heap_count(heap, HEAP_STAT_ALLOCATIONS, 1);
+    heap_count(heap, HEAP_STAT_LIVE_BYTES, size);
+    
+    return (uint8_t*)slab + SLAB_HEADER_SIZE;
+}
+
+static error_code_t large_free(slab_t* slab) {
+    size_t length = slab->length;
+    uint32_t size = slab->object_size;
+    uint32_t site = slab->site;
+    
+    if (munmap(slab, length) != 0) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    atomic_fetch_sub_explicit(&slab_state.reserved_bytes, length, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&slab_state.held_bytes, length, memory_order_relaxed);
+    profile_record_free(site, size);
+    
+    heap_t* heap = current_heap();
+    if (heap) {
+        heap_count(heap, HEAP_STAT_FREES, 1);
+        heap_count(heap, HEAP_STAT_LIVE_BYTES, -(uint64_t)size);
+    }
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Start the interval to the next sample
+ *
+ * Returns whether the allocation that ended the interval is sampled.
+ */
+static bool heap_sample_restart(heap_t* heap) {
+    int64_t interval = profile_next_interval(&heap->sample_seed);
+    heap->sample_bytes = interval > 0 ? interval : PROFILE_IDLE_INTERVAL;
+    return interval > 0;
+}
+
+static inline bool heap_sample(heap_t* heap, uint32_t size) {
+    heap->sample_bytes -= size;
+    return heap->sample_bytes < 0 && heap_sample_restart(heap);
+}
+
+/**
+ * Allocate a sampled object and record it with the profiler
+ *
+ * Kept out of line so the profiler knows how many frames to skip.
+ */
+static __attribute__((noinline)) void* sample_allocate(heap_t* heap, uint32_t size, uint32_t index) {
+    uint32_t object_size = index == MEMORY_CLASS_LARGE ? size : class_size(index);
+    void* object = large_allocate(heap, object_size, index);
+    if (object) {
+        slab_of(object)->site = profile_record_allocation(index, object_size);
+    }
+    return object;
+}
+
+/**
+ * Allocate memory
+ *
+ * Memory is aligned to 16 bytes. Returns NULL if no memory is available.
+ */
+void* memory_allocate(uint32_t size) {
+    heap_t* heap = current_heap();
+    if (!heap) {
+        return NULL;
+    }
+    
+    uint32_t index = size > MEMORY_SMALL_MAX ? MEMORY_CLASS_LARGE : size_class(size);
+    if (heap_sample(heap, size)) {
+        return sample_allocate(heap, size, index);
+    }
+    if (index == MEMORY_CLASS_LARGE) {
+        return large_allocate(heap, size, index);
+    }
+    
+    return heap_allocate(heap, index);
+}
+
+/**
+ * Free memory
+ *
+ * Any thread may free memory allocated by any other.
+ */
+error_code_t memory_free(void* ptr) {
+    if (!ptr) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    slab_t* slab = slab_of(ptr);
+    if (slab->kind == SLAB_LARGE) {
+        return large_free(slab);
+    }
+    
+    slab_free(slab, ptr);
+    return ERROR_NONE;
+}
+
+/**
+ * Create an object cache
+ *
+ * Creating a cache whose name already exists returns the existing cache
+ * if the object size matches. Returns NULL if the size is out of range,
+ * differs from an existing cache's or MEMORY_MAX_CACHES caches exist.
+ */
+memory_cache_t* memory_cache_create(const char* name, uint32_t object_size) {
+    if (!name || object_size == 0 || object_size > MEMORY_SMALL_MAX) {
+        return NULL;
+    }
+    
+    uint32_t size = (object_size + 15) & ~15U;
+    memory_cache_t* cache = NULL;
+    
+    pthread_mutex_lock(&slab_state.lock);
+    
+    for (uint32_t i = 0; i < slab_state.cache_count; i++) {
+        if (strncmp(slab_state.caches[i].name, name, sizeof(slab_state.caches[i].name)) == 0) {
+            cache = slab_state.caches[i].object_size == size ? &slab_state.caches[i] : NULL;
+            pthread_mutex_unlock(&slab_state.lock);
+            return cache;
+        }
+    }
+    
+    if (slab_state.cache_count < MEMORY_MAX_CACHES) {
+        cache = &slab_state.caches[slab_state.cache_count];
+        snprintf(cache->name, sizeof(cache->name), "%s", name);
+        cache->object_size = size;
+        cache->class_index = MEMORY_SIZE_CLASSES + slab_state.cache_count;
+        slab_state.cache_count++;
+    }
+    
+    pthread_mutex_unlock(&slab_state.lock);
+    
+    return cache;
+}
+
+/**
+ * Allocate an object from a cache
+ */
+void* memory_cache_alloc(memory_cache_t* cache) {
+    if (!cache) {
+        return NULL;
+    }
+    
+    heap_t* heap = current_heap();
+    if (!heap) {
+        return NULL;
+    }
+    
+    if (heap_sample(heap, cache->object_size)) {
+        return sample_allocate(heap, cache->object_size, cache->class_index);
+    }
+    
+    return heap_allocate(heap, cache->class_index);
+}
+
+/**
+ * Return an object to its cache
+ */
+error_code_t memory_cache_free(memory_cache_t* cache, void* ptr) {
+    if (!cache || !ptr) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    slab_t* slab = slab_of(ptr);
+    if (slab->class_index != cache->class_index) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    if (slab->kind == SLAB_LARGE) {
+        return large_free(slab);
+    }
+    
+    slab_free(slab, ptr);
+    return ERROR_NONE;
+}
+
+/**
+ * Take the empty slabs off a heap's partial lists
+ *
+ * The heap must be the caller's or parked. Empty slabs are chained onto
+ * list through next.
+ */
+static void heap_trim(heap_t* heap, slab_t** list) {
+    heap_drain_reclaimed(heap);
+    
+    for (uint32_t index = 0; index < CLASS_COUNT; index++) {
+        slab_t* slab = heap->partial[index];
+        while (slab) {
+            slab_t* next = slab->next;
+    
+            /* An empty slab has no object left that a remote free could return */
+            slab_collect(slab);
+            if (slab->used == 0) {
+                partial_remove(heap, slab);
+                slab->next = *list;
+                *list = slab;
+            }
+            slab = next;
+        }
+    }
+}
+
+/**
+ * Return the memory of empty slabs to the system
+ *
+ * Trims the calling thread's heap and the heaps of exited threads, then
+ * gives back the pages of every pooled slab but its header. Returns the
+ * bytes given back.
+ */
+uint64_t slab_trim(void) {
+    slab_t* empty = NULL;
+    
+    if (local_heap) {
+        heap_trim(local_heap, &empty);
+    }
+    
+    pthread_mutex_lock(&slab_state.lock);
+    for (heap_t* heap = slab_state.parked; heap; heap = heap->parked_next) {
+        heap_trim(heap, &empty);
+    }
+    pthread_mutex_unlock(&slab_state.lock);
+    
+    while (empty) {
+        slab_t* next = empty->next;
+        pool_release(empty);
+        empty = next;
+    }
+    
+    uint64_t released = 0;
+    
+    pthread_mutex_lock(&slab_state.lock);
+    for (slab_t* slab = slab_state.pool; slab; slab = slab->next) {
+        released += pool_decommit(slab);
+    }
+    pthread_mutex_unlock(&slab_state.lock);
+    
+    atomic_fetch_sub_explicit(&slab_state.held_bytes, released, memory_order_relaxed);
+    return released;
+}
+
+/**
+ * Set the bytes of empty slabs the pool keeps committed for reuse
+ *
+ * Pooled slabs beyond the new limit are given back at once. Returns the
+ * previous limit (UINT64_MAX for none).
+ */
+uint64_t slab_set_cache_limit(uint64_t bytes) {
+    pthread_mutex_lock(&slab_state.lock);
+    uint64_t previous = slab_state.pool_limit;
+    slab_state.pool_limit = bytes;
+    uint64_t released = pool_fit();
+    pthread_mutex_unlock(&slab_state.lock);
+    
+    atomic_fetch_sub_explicit(&slab_state.held_bytes, released, memory_order_relaxed);
+    return previous;
+}
+
+/**
+ * Sum the allocator counters
+ */
+void slab_get_statistics(slab_stats_t* stats) {
+    memset(stats, 0, sizeof(*stats));
+    
+    pthread_mutex_lock(&slab_state.lock);
+    stats->cached_bytes = slab_state.pool_committed;
+    for (heap_t* heap = slab_state.heaps; heap; heap = heap->next) {
+        stats->allocations += atomic_load_explicit(&heap->stats[HEAP_STAT_ALLOCATIONS], memory_order_relaxed);
+        stats->frees += atomic_load_explicit(&heap->stats[HEAP_STAT_FREES], memory_order_relaxed);
+        stats->live_bytes += atomic_load_explicit(&heap->stats[HEAP_STAT_LIVE_BYTES], memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&slab_state.lock);
+    
+    stats->held_bytes = atomic_load_explicit(&slab_state.held_bytes, memory_order_relaxed);
+    stats->peak_bytes = atomic_load_explicit(&slab_state.peak_bytes, memory_order_relaxed);
+    stats->reserved_bytes = atomic_load_explicit(&slab_state.reserved_bytes, memory_order_relaxed);
+}
@@ -0,0 +1,47 @@
+/**
+ * NexOS Memory Management - Slab Allocator
+ *
+ * memory_allocate serves requests up to MEMORY_SMALL_MAX bytes from
+ * size-class slabs: MEMORY_SLAB_SIZE-aligned blocks carved into objects of
+ * one size, so the slab of any object is found by masking its address.
+ * Larger requests are mapped directly.
+ *
+ * Every thread owns a heap with a list of partially used slabs per class
+ * and allocates and frees objects of its own slabs without locks or atomic
+ * read-modify-writes. Objects freed by another thread are pushed onto a
+ * lock-free list of their slab and collected by the owner once its local
+ * free list runs dry. The heap of an exited thread is kept, slabs
+ * included, and handed to the next thread that starts.
+ *
+ * Object caches are classes of their own, so kernel objects of one type
+ * share slabs only with each other.
+ *
+ * Empty slabs stay with the allocator, up to a cache limit, until
+ * slab_trim returns their pages.
+ */
+
+#ifndef NEXOS_MEMORY_SLAB_H
+#define NEXOS_MEMORY_SLAB_H
+
+#include "memory.h"
+
+/* Allocator counters summed over all heaps */
+typedef struct {
+    uint64_t allocations;      /* Objects allocated */
+    uint64_t frees;            /* Objects freed */
+    uint64_t live_bytes;       /* Bytes of objects in use (rounded to their class) */
+    uint64_t held_bytes;       /* Slabs and large mappings obtained from the system */
+    uint64_t peak_bytes;       /* Highest held_bytes */
+    uint64_t reserved_bytes;   /* Address space reserved for slabs and large mappings */
+    uint64_t cached_bytes;     /* Empty slabs kept committed for reuse */
+} slab_stats_t;
+
+void slab_get_statistics(slab_stats_t* stats);
+
+/* Return the memory of empty slabs to the system (returns the bytes) */
+uint64_t slab_trim(void);
+
+/* Limit the empty slab memory kept for reuse (returns the previous limit) */
+uint64_t slab_set_cache_limit(uint64_t bytes);
+
+#endif /* NEXOS_MEMORY_SLAB_H */
@@ -0,0 +1,278 @@
+/**
+ * NexOS Memory Management - Thread Stacks
+ *
+ * This file implements memory_allocate_thread_stack and
+ * memory_free_thread_stack on pools of recycled stacks, one pool per
+ * (page-rounded) stack size. A pool reserves address space for
+ * REGION_SLOTS stacks at a time, each below a guard page that stays
+ * inaccessible; a slot is made accessible the first time it is handed out
+ * and physical pages are only committed as the stack is touched. Stacks
+ * of at least HUGE_STACK_MIN bytes ask for transparent huge pages.
+ *
+ * Freed stacks keep their pages and go onto a lock-free list of the pool,
+ * so creating a thread usually costs a single compare-and-swap.
+ */
+
+#define _GNU_SOURCE
+#include "memory.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* Stacks reserved at a time, and regions per pool (enough stacks for a
+   thread per connection at 100k connections) */
+#define REGION_SLOTS 256
+#define MAX_REGIONS  512
+
+/* Distinct stack sizes */
+#define MAX_POOLS 8
+
+/* Stacks from this size on are backed by transparent huge pages */
+#define HUGE_STACK_MIN (2 * 1024 * 1024)
+
+/* Reserved run of stack slots */
+typedef struct {
+    uint8_t* base;             /* First slot; each slot is a guard page and a stack */
+    _Atomic uint32_t carved;   /* Slots handed out at least once */
+    _Atomic uint32_t next[REGION_SLOTS]; /* Free list links (slot number + 1, 0 = end) */
+} stack_region_t;
+
+/* Stacks of one size */
+typedef struct {
+    uint32_t stack_size;       /* Usable bytes per stack (page multiple) */
+    size_t slot_size;          /* Guard page and stack */
+    _Atomic uint64_t free_head; /* Tag (high half) and slot number + 1 (low half) */
+    _Atomic(stack_region_t*) regions[MAX_REGIONS];
+    _Atomic uint32_t region_count;
+} stack_pool_t;
+
+/* Stack pool state */
+static struct {
+    pthread_mutex_t lock;      /* Serializes pool and region creation */
+    stack_pool_t pools[MAX_POOLS];
+    _Atomic uint32_t pool_count;
+    _Atomic size_t page_size;
+} stack_state = {
+    .lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+static size_t page_size(void) {
+    size_t size = atomic_load_explicit(&stack_state.page_size, memory_order_relaxed);
+    if (size == 0) {
+        long system = sysconf(_SC_PAGESIZE);
+        size = system > 0 ? (size_t)system : PAGE_SIZE;
+        atomic_store_explicit(&stack_state.page_size, size, memory_order_relaxed);
+    }
+    return size;
+}
+
+static _Atomic uint32_t* slot_next(stack_pool_t* pool, uint32_t slot) {
+    stack_region_t* region = atomic_load_explicit(&pool->regions[slot / REGION_SLOTS], memory_order_acquire);
+    return &region->next[slot % REGION_SLOTS];
+}
+
+static uint8_t* slot_stack(stack_pool_t* pool, uint32_t slot) {
+    stack_region_t* region = atomic_load_explicit(&pool->regions[slot / REGION_SLOTS], memory_order_acquire);
+    return region->base + (size_t)(slot % REGION_SLOTS) * pool->slot_size + page_size();
+}
+
+/**
+ * Find or create the pool for a page-rounded stack size
+ */
+static stack_pool_t* find_pool(uint32_t stack_size) {
+    uint32_t count = atomic_load_explicit(&stack_state.pool_count, memory_order_acquire);
+    for (uint32_t i = 0; i < count; i++) {
+        if (stack_state.pools[i].stack_size == stack_size) {
+            return &stack_state.pools[i];
+        }
+    }
+    
+    pthread_mutex_lock(&stack_state.lock);
+    
+    stack_pool_t* pool = NULL;
+    count = atomic_load_explicit(&stack_state.pool_count, memory_order_relaxed);
+    for (uint32_t i = 0; i < count && !pool; i++) {
+        if (stack_state.pools[i].stack_size == stack_size) {
+            pool = &stack_state.pools[i];
+        }
+    }
+    
+    if (!pool && count < MAX_POOLS) {
+        pool = &stack_state.pools[count];
+        pool->stack_size = stack_size;
+        pool->slot_size = page_size() + stack_size;
+        atomic_store_explicit(&stack_state.pool_count, count + 1, memory_order_release);
+    }
+    
+    pthread_mutex_unlock(&stack_state.lock);
+    return pool;
+}
+
+/**
+ * Pop a recycled stack (slot number + 1, or 0 if none)
+ */
+static uint32_t pool_pop(stack_pool_t* pool) {
+    uint64_t head = atomic_load_explicit(&pool->free_head, memory_order_acquire);
+    
+    for (;;) {
+        uint32_t index = (uint32_t)head;
+        if (index == 0) {
+            return 0;
+        }
+    
+        /* The tag makes a concurrent pop and push of the same slot fail the swap */
+        uint32_t next = atomic_load_explicit(slot_next(pool, index - 1), memory_order_relaxed);
+        uint64_t desired = (((head >> 32) + 1) << 32) | next;
+        if (atomic_compare_exchange_weak_explicit(&pool->free_head, &head, desired,
+                                                  memory_order_acquire, memory_order_acquire)) {
+            return index;
+        }
+    }
+}
+
+static void pool_push(stack_pool_t* pool, uint32_t index) {
+    uint64_t head = atomic_load_explicit(&pool->free_head, memory_order_relaxed);
+    uint64_t desired;
+    
+    do {
+        atomic_store_explicit(slot_next(pool, index - 1), (uint32_t)head, memory_order_relaxed);
+        desired = (((head >> 32) + 1) << 32) | index;
+    } while (!atomic_compare_exchange_weak_explicit(&pool->free_head, &head, desired,
+                                                    memory_order_release, memory_order_relaxed));
+}
+
+/**
+ * Hand out a never used slot, reserving a region if needed
+ *
+ * Returns the slot number + 1, or 0 if the pool is exhausted.
+ */
+static uint32_t pool_carve(stack_pool_t* pool) {
+    for (;;) {
+        uint32_t count = atomic_load_explicit(&pool->region_count, memory_order_acquire);
+        if (count > 0) {
+            stack_region_t* region = atomic_load_explicit(&pool->regions[count - 1], memory_order_acquire);
+            uint32_t slot = atomic_fetch_add_explicit(&region->carved, 1, memory_order_relaxed);
+            if (slot < REGION_SLOTS) {
+                uint32_t index = (count - 1) * REGION_SLOTS + slot;
+                uint8_t* stack = slot_stack(pool, index);
+    
+                /* Commit the stack; the guard page below it stays inaccessible */
+                if (mprotect(stack, pool->stack_size, PROT_READ | PROT_WRITE) != 0) {
+                    return 0;
+                }
+                if (pool->stack_size >= HUGE_STACK_MIN) {
+                    madvise(stack, pool->stack_size, MADV_HUGEPAGE);
+                }
+                return index + 1;
+            }
+        }
+    
+        pthread_mutex_lock(&stack_state.lock);
+    
+        /* Another thread may have added a region meanwhile */
+        if (atomic_load_explicit(&pool->region_count, memory_order_relaxed) == count) {
+            if (count == MAX_REGIONS) {
+                pthread_mutex_unlock(&stack_state.lock);
+                return 0;
+            }
+    
+            stack_region_t* region = calloc(1, sizeof(stack_region_t));
+            void* base = region ? mmap(NULL, pool->slot_size * REGION_SLOTS, PROT_NONE,
+                                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0) : MAP_FAILED;
+            if (base == MAP_FAILED) {
+                free(region);
+                pthread_mutex_unlock(&stack_state.lock);
+                return 0;
+            }
+    
+            region->base = base;
+            atomic_store_explicit(&pool->regions[count], region, memory_order_release);
+            atomic_store_explicit(&pool->region_count, count + 1, memory_order_release);
+        }
+    
+        pthread_mutex_unlock(&stack_state.lock);
+    }
+}
+
+/**
+ * Find the pool and slot of a stack
+ */
+static stack_pool_t* find_slot(const void* stack, uint32_t* index) {
+    uint32_t pools = atomic_load_explicit(&stack_state.pool_count, memory_order_acquire);
+    
+    for (uint32_t p = 0; p < pools; p++) {
+        stack_pool_t* pool = &stack_state.pools[p];
+        uint32_t regions = atomic_load_explicit(&pool->region_count, memory_order_acquire);
+    
+        for (uint32_t r = 0; r < regions; r++) {
+            stack_region_t* region = atomic_load_explicit(&pool->regions[r], memory_order_acquire);
+            const uint8_t* start = region->base;
+            if ((const uint8_t*)stack < start || (const uint8_t*)stack >= start + pool->slot_size * REGION_SLOTS) {
+                continue;
+            }
+    
+            size_t offset = (size_t)((const uint8_t*)stack - start);
+            if (offset % pool->slot_size != page_size()) {
+                return NULL;
+            }
+            *index = r * REGION_SLOTS + (uint32_t)(offset / pool->slot_size) + 1;
+            return pool;
+        }
+    }
+    
+    return NULL;
+}
+
+/**
+ * Allocate stack for a thread
+ *
+ * Sets thread->stack to the lowest usable address and thread->stack_size
+ * to size rounded up to whole pages.
+ */
+error_code_t memory_allocate_thread_stack(thread_t* thread, uint32_t size) {
+    if (!thread || size == 0 || size > UINT32_MAX - page_size()) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    uint32_t stack_size = (uint32_t)((size + page_size() - 1) & ~(page_size() - 1));
+    stack_pool_t* pool = find_pool(stack_size);
+    if (!pool) {
+        return ERROR_RESOURCE_BUSY;
+    }
+    
+    uint32_t index = pool_pop(pool);
+    if (index == 0) {
+        index = pool_carve(pool);
+    }
+    if (index == 0) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    
+    thread->stack = slot_stack(pool, index - 1);
+    thread->stack_size = stack_size;
+    return ERROR_NONE;
+}
+
+/**
+ * Free stack for a thread
+ *
+ * The stack keeps its pages for the next thread of the same stack size.
+ */
+error_code_t memory_free_thread_stack(thread_t* thread) {
+    if (!thread || !thread->stack) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    uint32_t index;
+    stack_pool_t* pool = find_slot(thread->stack, &index);
+    if (!pool) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    pool_push(pool, index);
+    thread->stack = NULL;
+    thread->stack_size = 0;
+    return ERROR_NONE;
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include "kernel/kernel.h"
 #include "memory/memory.h"
 #include "scheduler/scheduler.h"
@@ -10,6 +11,18 @@
 #include <string.h>
 #include <signal.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+
+/* Interval of the periodic self-evolution analysis (ms) */
+#define ANALYSIS_INTERVAL_MS 60000
+
+/* CPU time the analysis thread may use per slice (us) */
+#define ANALYSIS_BUDGET_US 1000
+
+/* Interval of the metric collection the analysis reads (ms) */
+#define METRICS_INTERVAL_MS 1000
 
 /* Global variables */
 volatile sig_atomic_t running = 1;
@@ -17,6 +30,11 @@ volatile sig_atomic_t running = 1;
 /* Function prototypes */
 void handle_signal(int sig);
 void setup_signal_handlers();
+void* run_scheduler(void* arg);
+uint64_t monotonic_ms(void);
+void metrics_tick(wheel_timer_t* timer);
+void request_totals(uint64_t* requests, uint64_t* latency_ns);
+void wait_for_timers(timer_wheel_t* timers, const sigset_t* wait_mask);
 
 /**
  * Signal handler
@@ -41,6 +59,67 @@ void setup_signal_handlers() {
     signal(SIGPIPE, SIG_IGN);  /* Ignore SIGPIPE to handle client disconnects gracefully */
 }
 
+/**
+ * Scheduler thread: runs the scheduler's CPUs until every thread exits
+ */
+void* run_scheduler(void* arg) {
+    (void)arg;
+    scheduler_start();
+    return NULL;
+}
+
+/**
+ * Get monotonic time in milliseconds
+ */
+uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000ULL + (uint64_t)ts.tv_nsec / 1000000ULL;
+}
+
+/**
+ * Periodic metric collection, published for the analysis thread
+ */
+void metrics_tick(wheel_timer_t* timer) {
+    (void)timer;
+    performance_metrics_t metrics;
+    ai_engine_collect_metrics(&metrics);
+}
+
+/**
+ * Request source of the AI engine: the web server's completed responses,
+ * which self-evolution trials its patches against
+ */
+void request_totals(uint64_t* requests, uint64_t* latency_ns) {
+    webserver_stats_t stats;
+    if (webserver_get_stats(&stats) == ERROR_NONE) {
+        *requests = stats.completed_count;
+        *latency_ns = stats.latency_ns;
+    }
+}
+
+/**
+ * Sleep until the next timer is due or a signal arrives
+ *
+ * The signals are only delivered during the wait, so one arriving just
+ * before it cannot be missed.
+ */
+void wait_for_timers(timer_wheel_t* timers, const sigset_t* wait_mask) {
+    uint64_t next = timer_wheel_next(timers);
+    uint64_t now = monotonic_ms();
+    
+    if (next == UINT64_MAX) {
+        ppoll(NULL, 0, NULL, wait_mask);
+        return;
+    }
+    
+    uint64_t delay = next > now ? next - now : 0;
+    struct timespec timeout;
+    timeout.tv_sec = (time_t)(delay / 1000);
+    timeout.tv_nsec = (long)(delay % 1000) * 1000000L;
+    ppoll(NULL, 0, &timeout, wait_mask);
+}
+
 /**
  * Main function
  */
@@ -48,6 +127,11 @@ int main(int argc, char* argv[]) {
     /* Default configuration */
     uint16_t port = 8080;
     char* webroot = "./webroot";
+    uint32_t workers = 0;
+    bool pin_workers = false;
+    uint32_t cache_mb = 64;
+    char* metrics_path = "/metrics";
+    char* snapshot_path = "";
     
     /* Parse command line arguments */
     for (int i = 1; i < argc; i++) {
@@ -61,11 +145,38 @@ int main(int argc, char* argv[]) {
                 webroot = argv[i + 1];
                 i++;
             }
+        } else if (strcmp(argv[i], "-w") == 0 || strcmp(argv[i], "--workers") == 0) {
+            if (i + 1 < argc) {
+                workers = atoi(argv[i + 1]);
+                i++;
+            }
+        } else if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--cache") == 0) {
+            if (i + 1 < argc) {
+                cache_mb = atoi(argv[i + 1]);
+                i++;
+            }
+        } else if (strcmp(argv[i], "-m") == 0 || strcmp(argv[i], "--metrics") == 0) {
+            if (i + 1 < argc) {
+                metrics_path = argv[i + 1];
+                i++;
+            }
+        } else if (strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "--snapshot") == 0) {
+            if (i + 1 < argc) {
+                snapshot_path = argv[i + 1];
+                i++;
+            }
+        } else if (strcmp(argv[i], "-a") == 0 || strcmp(argv[i], "--affinity") == 0) {
+            pin_workers = true;
         } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
             printf("Usage: %s [options]\n", argv[0]);
             printf("Options:\n");
             printf("  -p, --port PORT    Port to listen on (default: 8080)\n");
             printf("  -r, --root DIR     Web root directory (default: ./webroot)\n");
+            printf("  -w, --workers N    Number of worker threads (default: CPU count)\n");
+            printf("  -a, --affinity     Pin each worker or scheduler CPU thread to its own core\n");
+            printf("  -c, --cache MB     Static asset cache size, 0 to disable (default: 64)\n");
+            printf("  -m, --metrics PATH Serve Prometheus metrics at PATH, \"\" to disable (default: /metrics)\n");
+            printf("  -s, --snapshot FILE Keep learned AI state in FILE (default: none)\n");
             printf("  -h, --help         Show this help message\n");
             return 0;
         }
@@ -74,6 +185,15 @@ int main(int argc, char* argv[]) {
     /* Setup signal handlers */
     setup_signal_handlers();
     
+    /* Hold SIGINT and SIGTERM for the main loop's waits; the threads
+       started from here on inherit the mask */
+    sigset_t stop_signals;
+    sigset_t wait_mask;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, &wait_mask);
+    
     printf("\nNexOS Web Server\n");
     printf("===============\n\n");
     
@@ -85,58 +205,40 @@ int main(int argc, char* argv[]) {
         return 1;
     }
     
-    /* Initialize security subsystem */
-    printf("\nInitializing security subsystem...\n");
-    err = security_init();
-    if (err != ERROR_NONE) {
-        printf("Failed to initialize security subsystem: %d\n", err);
-        return 1;
-    }
-    
-    /* Initialize AI engine */
-    printf("\nInitializing AI engine...\n");
-    err = ai_engine_init();
-    if (err != ERROR_NONE) {
-        printf("Failed to initialize AI engine: %d\n", err);
-        return 1;
-    }
-    
-    /* Initialize self-evolution system */
-    printf("\nInitializing self-evolution system...\n");
-    err = self_evolution_init();
-    if (err != ERROR_NONE) {
-        printf("Failed to initialize self-evolution system: %d\n", err);
-        return 1;
-    }
-    
-    /* Enable self-evolution */
-    printf("\nEnabling self-evolution...\n");
-    err = self_evolution_enable(true);
-    if (err != ERROR_NONE) {
-        printf("Failed to enable self-evolution: %d\n", err);
-        return 1;
+    /* The AI engine and self-evolution come up once the server is
+       serving, warm from the snapshot if one was saved */
+    if (snapshot_path[0] != '\0') {
+        err = ai_engine_set_snapshot(snapshot_path);
+        if (err != ERROR_NONE) {
+            printf("Failed to open AI snapshot %s: %d\n", snapshot_path, err);
+        }
     }
     
     /* Initialize web server */
-    printf("\nInitializing web server...\n");
     webserver_config_t config = {
         .port = port,
         .webroot = webroot,
         .max_connections = 1000,
-        .timeout = 30000
+        .timeout = 30000,
+        .workers = workers,
+        .pin_workers = pin_workers,
+        .cache_size = (size_t)cache_mb * 1024 * 1024,
+        .metrics_path = metrics_path
     };
     err = webserver_init(&config);
     if (err != ERROR_NONE) {
         printf("Failed to initialize web server: %d\n", err);
         return 1;
     }
+    ai_engine_set_request_source(request_totals);
     
     /* Start web server */
     printf("\nStarting web server on port %d...\n", port);
     printf("Web root: %s\n", webroot);
     printf("Press Ctrl+C to stop\n\n");
     
-    /* Create a thread for the web server */
+    /* Create a thread for the web server; on a scheduler thread it serves
+       every connection on a thread of its own */
     process_t* web_process;
     err = process_create(&web_process, (void (*)(void*))webserver_start, NULL, 10);
     if (err != ERROR_NONE) {
@@ -144,21 +246,61 @@ int main(int argc, char* argv[]) {
         return 1;
     }
     
+    /* The descriptor may be gone by shutdown; its PID then no longer matches */
+    uint32_t web_pid = web_process->pid;
+    
+    /* Run the scheduler beside the main loop, its CPUs pinned if asked */
+    scheduler_set_pinning(pin_workers);
+    pthread_t scheduler_thread;
+    if (pthread_create(&scheduler_thread, NULL, run_scheduler, NULL) != 0) {
+        printf("Failed to start the scheduler\n");
+        return 1;
+    }
+    
+    /* Periodic work runs off a timer wheel, one tick per millisecond */
+    timer_wheel_t timers;
+    wheel_timer_t metrics;
+    timer_wheel_init(&timers, monotonic_ms());
+    wheel_timer_init(&metrics, metrics_tick, NULL);
+    metrics.period = METRICS_INTERVAL_MS;
+    timer_wheel_add(&timers, &metrics, monotonic_ms());
+    
+    /* Enable self-evolution */
+    printf("Enabling self-evolution...\n");
+    err = self_evolution_enable(true);
+    if (err != ERROR_NONE) {
+        printf("Failed to enable self-evolution: %d\n", err);
+    }
+    
+    /* Analysis runs on a low-priority thread of its own, off the serving path */
+    if (err == ERROR_NONE) {
+        err = self_evolution_start(ANALYSIS_INTERVAL_MS, ANALYSIS_BUDGET_US);
+        if (err != ERROR_NONE) {
+            printf("Failed to start self-evolution analysis: %d\n", err);
+        }
+    }
+    
     /* Main loop */
     while (running) {
-        /* Perform periodic self-evolution analysis */
-        self_evolution_analyze();
-        
-        /* Sleep for a while */
-        sleep(60);
+        timer_wheel_advance(&timers, monotonic_ms());
+        if (running) {
+            wait_for_timers(&timers, &wait_mask);
+        }
     }
     
+    self_evolution_stop();
+    ai_engine_set_request_source(NULL);
+    ai_engine_save_snapshot();
+    
     /* Stop web server */
     printf("\nStopping web server...\n");
     webserver_stop();
     
+    /* The scheduler returns once the web server's threads have exited */
+    pthread_join(scheduler_thread, NULL);
+    
     /* Terminate web process */
-    process_terminate(web_process->pid);
+    process_terminate(web_pid);
     
     printf("\nNexOS shut down successfully\n");
     return 0;
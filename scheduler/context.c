@@ -0,0 +1,124 @@
+/**
+ * NexOS Scheduler - Context Switch
+ *
+ * This file implements context_switch in assembly (see context.h).
+ *
+ * x86-64: registers[0..5] hold rbx, rbp and r12-r15; status_register
+ * holds MXCSR in its low half and the x87 control word above it.
+ *
+ * aarch64: registers[0..10] hold x19-x29, fp_registers d8-d15 and
+ * status_register FPCR; program_counter is the link register.
+ */
+
+#include "context.h"
+#include <stdint.h>
+#include <string.h>
+
+/* The assembly below hard-codes these offsets */
+_Static_assert(offsetof(cpu_context_t, registers) == 0, "cpu_context_t layout");
+_Static_assert(offsetof(cpu_context_t, program_counter) == 128, "cpu_context_t layout");
+_Static_assert(offsetof(cpu_context_t, stack_pointer) == 136, "cpu_context_t layout");
+_Static_assert(offsetof(cpu_context_t, status_register) == 144, "cpu_context_t layout");
+_Static_assert(offsetof(cpu_context_t, fp_registers) == 152, "cpu_context_t layout");
+
+#if defined(__x86_64__)
+
+/* Default MXCSR and x87 control word */
+#define CONTEXT_INITIAL_STATUS (((uint64_t)0x037F << 32) | 0x1F80)
+
+__asm__(
+    ".text\n"
+    ".globl context_switch\n"
+    ".type context_switch, %function\n"
+    "context_switch:\n"
+    "    movq %rbx, 0(%rdi)\n"
+    "    movq %rbp, 8(%rdi)\n"
+    "    movq %r12, 16(%rdi)\n"
+    "    movq %r13, 24(%rdi)\n"
+    "    movq %r14, 32(%rdi)\n"
+    "    movq %r15, 40(%rdi)\n"
+    "    movq (%rsp), %rax\n"           /* Resume at the return address */
+    "    movq %rax, 128(%rdi)\n"
+    "    leaq 8(%rsp), %rax\n"          /* with the return address popped */
+    "    movq %rax, 136(%rdi)\n"
+    "    stmxcsr 144(%rdi)\n"
+    "    fnstcw 148(%rdi)\n"
+    "    movq 0(%rsi), %rbx\n"
+    "    movq 8(%rsi), %rbp\n"
+    "    movq 16(%rsi), %r12\n"
+    "    movq 24(%rsi), %r13\n"
+    "    movq 32(%rsi), %r14\n"
+    "    movq 40(%rsi), %r15\n"
+    "    ldmxcsr 144(%rsi)\n"
+    "    fldcw 148(%rsi)\n"
+    "    movq 136(%rsi), %rsp\n"
+    "    jmpq *128(%rsi)\n"
+    ".size context_switch, .-context_switch\n"
+);
+
+#elif defined(__aarch64__)
+
+#define CONTEXT_INITIAL_STATUS 0
+
+__asm__(
+    ".text\n"
+    ".globl context_switch\n"
+    ".type context_switch, %function\n"
+    "context_switch:\n"
+    "    stp x19, x20, [x0, #0]\n"
+    "    stp x21, x22, [x0, #16]\n"
+    "    stp x23, x24, [x0, #32]\n"
+    "    stp x25, x26, [x0, #48]\n"
+    "    stp x27, x28, [x0, #64]\n"
+    "    str x29, [x0, #80]\n"
+    "    str x30, [x0, #128]\n"
+    "    mov x9, sp\n"
+    "    str x9, [x0, #136]\n"
+    "    mrs x9, fpcr\n"
+    "    str x9, [x0, #144]\n"
+    "    stp d8, d9, [x0, #152]\n"
+    "    stp d10, d11, [x0, #168]\n"
+    "    stp d12, d13, [x0, #184]\n"
+    "    stp d14, d15, [x0, #200]\n"
+    "    ldp x19, x20, [x1, #0]\n"
+    "    ldp x21, x22, [x1, #16]\n"
+    "    ldp x23, x24, [x1, #32]\n"
+    "    ldp x25, x26, [x1, #48]\n"
+    "    ldp x27, x28, [x1, #64]\n"
+    "    ldr x29, [x1, #80]\n"
+    "    ldr x30, [x1, #128]\n"
+    "    ldr x9, [x1, #136]\n"
+    "    mov sp, x9\n"
+    "    ldr x9, [x1, #144]\n"
+    "    msr fpcr, x9\n"
+    "    ldp d8, d9, [x1, #152]\n"
+    "    ldp d10, d11, [x1, #168]\n"
+    "    ldp d12, d13, [x1, #184]\n"
+    "    ldp d14, d15, [x1, #200]\n"
+    "    ret\n"
+    ".size context_switch, .-context_switch\n"
+);
+
+#else
+#error "context_switch is not implemented for this architecture"
+#endif
+
+/**
+ * Prepare a context that starts entry on a stack
+ *
+ * Switching to the context enters entry as if it had been called with the
+ * stack empty; entry must switch away instead of returning.
+ */
+void context_init(cpu_context_t* context, void* stack, size_t size, void (*entry)(void)) {
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    
+    memset(context, 0, sizeof(cpu_context_t));
+#if defined(__x86_64__)
+    /* A null return address ends the call chain */
+    top -= sizeof(uint64_t);
+    *(uint64_t*)top = 0;
+#endif
+    context->program_counter = (uint64_t)(uintptr_t)entry;
+    context->stack_pointer = top;
+    context->status_register = CONTEXT_INITIAL_STATUS;
+}
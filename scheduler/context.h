@@ -0,0 +1,22 @@
+/**
+ * NexOS Scheduler - Context Switch
+ *
+ * Switches between threads in user space. Only the registers the calling
+ * convention preserves across a call are saved, and the signal mask is
+ * left alone, so a switch is a few dozen instructions and no system call.
+ * Implemented for x86-64 and aarch64.
+ */
+
+#ifndef NEXOS_SCHEDULER_CONTEXT_H
+#define NEXOS_SCHEDULER_CONTEXT_H
+
+#include "scheduler.h"
+#include <stddef.h>
+
+/* Prepare a context that starts entry on a stack (entry must not return) */
+void context_init(cpu_context_t* context, void* stack, size_t size, void (*entry)(void));
+
+/* Save the running context in from and resume to */
+void context_switch(cpu_context_t* from, cpu_context_t* to);
+
+#endif /* NEXOS_SCHEDULER_CONTEXT_H */
@@ -0,0 +1,111 @@
+/**
+ * NexOS Scheduler - Work-Stealing Deque
+ *
+ * This file implements the Chase-Lev deque (see deque.h).
+ */
+
+#include "deque.h"
+#include "../memory/memory.h"
+#include <stddef.h>
+
+static deque_array_t* array_create(uint64_t capacity) {
+    deque_array_t* array = memory_allocate((uint32_t)(sizeof(deque_array_t) + capacity * sizeof(void*)));
+    if (!array) {
+        return NULL;
+    }
+    
+    array->mask = capacity - 1;
+    array->retired = NULL;
+    return array;
+}
+
+void deque_init(deque_t* deque) {
+    atomic_init(&deque->top, 0);
+    atomic_init(&deque->bottom, 0);
+    atomic_init(&deque->array, NULL);
+}
+
+void deque_destroy(deque_t* deque) {
+    deque_array_t* array = atomic_load_explicit(&deque->array, memory_order_relaxed);
+    
+    while (array) {
+        deque_array_t* retired = array->retired;
+        memory_free(array);
+        array = retired;
+    }
+    atomic_store_explicit(&deque->array, NULL, memory_order_relaxed);
+}
+
+/**
+ * Replace the array with one twice as large holding the same items
+ */
+static deque_array_t* deque_grow(deque_t* deque, deque_array_t* array, int64_t top, int64_t bottom) {
+    uint64_t capacity = array ? (array->mask + 1) * 2 : DEQUE_INITIAL_CAPACITY;
+    deque_array_t* grown = array_create(capacity);
+    if (!grown) {
+        return NULL;
+    }
+    
+    for (int64_t i = top; i < bottom; i++) {
+        void* item = atomic_load_explicit(&array->slots[i & array->mask], memory_order_relaxed);
+        atomic_store_explicit(&grown->slots[i & grown->mask], item, memory_order_relaxed);
+    }
+    grown->retired = array;
+    
+    atomic_store_explicit(&deque->array, grown, memory_order_release);
+    return grown;
+}
+
+/**
+ * Push an item at the bottom
+ *
+ * Only the owner may push. Fails only if a larger array cannot be
+ * allocated.
+ */
+error_code_t deque_push(deque_t* deque, void* item) {
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    deque_array_t* array = atomic_load_explicit(&deque->array, memory_order_relaxed);
+    
+    if (!array || bottom - top > (int64_t)array->mask) {
+        array = deque_grow(deque, array, top, bottom);
+        if (!array) {
+            return ERROR_MEMORY_ALLOCATION;
+        }
+    }
+    
+    atomic_store_explicit(&array->slots[bottom & array->mask], item, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    return ERROR_NONE;
+}
+
+/**
+ * Take the item at the top
+ *
+ * Returns NULL if the deque is empty or another CPU took the item first.
+ */
+void* deque_take(deque_t* deque) {
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    
+    if (top >= bottom) {
+        return NULL;
+    }
+    
+    deque_array_t* array = atomic_load_explicit(&deque->array, memory_order_consume);
+    void* item = atomic_load_explicit(&array->slots[top & array->mask], memory_order_relaxed);
+    
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                 memory_order_seq_cst, memory_order_relaxed)) {
+        return NULL;
+    }
+    return item;
+}
+
+int64_t deque_size(deque_t* deque) {
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+    return bottom > top ? bottom - top : 0;
+}
@@ -0,0 +1,50 @@
+/**
+ * NexOS Scheduler - Work-Stealing Deque
+ *
+ * Chase-Lev deque of pointers (Chase and Lev, SPAA 2005, with the C11
+ * orderings of Le et al., PPoPP 2013). Only the owning CPU pushes, at the
+ * bottom; any CPU, the owner included, takes from the top with a single
+ * compare-and-swap, so a queue is served in FIFO order. The array grows
+ * when full; outgrown arrays are kept until the deque is destroyed, since
+ * a concurrent taker may still read them.
+ */
+
+#ifndef NEXOS_SCHEDULER_DEQUE_H
+#define NEXOS_SCHEDULER_DEQUE_H
+
+#include "../kernel/kernel.h"
+#include <stdatomic.h>
+#include <stdalign.h>
+#include <stdint.h>
+
+/* Slots of a deque's first array */
+#define DEQUE_INITIAL_CAPACITY 64
+
+typedef struct deque_array {
+    uint64_t mask;             /* Capacity - 1 (capacity is a power of two) */
+    struct deque_array* retired; /* Older, smaller array */
+    _Atomic(void*) slots[];
+} deque_array_t;
+
+typedef struct {
+    alignas(64) _Atomic int64_t top; /* Next slot to take */
+    alignas(64) _Atomic int64_t bottom; /* Next slot to push (owner) */
+    _Atomic(deque_array_t*) array; /* NULL until the first push */
+} deque_t;
+
+/* Initialize an empty deque */
+void deque_init(deque_t* deque);
+
+/* Free a deque's arrays (no other CPU may use it) */
+void deque_destroy(deque_t* deque);
+
+/* Push at the bottom (owner only) */
+error_code_t deque_push(deque_t* deque, void* item);
+
+/* Take the oldest item (any CPU; NULL if empty or lost to another taker) */
+void* deque_take(deque_t* deque);
+
+/* Items in the deque (a hint while others push or take) */
+int64_t deque_size(deque_t* deque);
+
+#endif /* NEXOS_SCHEDULER_DEQUE_H */
@@ -0,0 +1,1703 @@
+/**
+ * NexOS Scheduler - Core Implementation
+ *
+ * Every CPU runs a scheduling loop on an OS thread of its own, one per
+ * core the process may run on (pinned to that core if asked, see
+ * scheduler_set_pinning), and owns one work-stealing deque per priority
+ * level (see deque.h). A thread made ready on a CPU is queued on that
+ * CPU's deque for its level; a CPU runs the oldest thread of its highest
+ * non-empty level and, once its own deques are empty, takes one from
+ * another CPU, so no lock is shared between CPUs on the scheduling path.
+ * Threads made ready outside the scheduler's CPUs (before the scheduler
+ * starts, or by other OS threads) go through shared run queues, and a
+ * thread bound to a CPU (scheduler_bind_thread) through that CPU's bound
+ * run queues, which no other CPU takes from. These are the only queues
+ * behind a lock: lists linked through thread_t.
+ *
+ * Every CPU, and every locked queue, keeps a bitmap of the levels holding
+ * threads, so the highest one is found by counting trailing zeros rather
+ * than by looking at each level.
+ *
+ * A thread that blocks on a scheduler mutex held by a thread of a lower
+ * priority lends the holder its priority until the holder unlocks, and
+ * runs the holder in its place if it is queued.
+ *
+ * Threads run on their own stacks and switch cooperatively (context.h): a
+ * thread runs until it yields, blocks or returns from its entry point,
+ * then switches back to the scheduling loop of the CPU it is on. What happens to it next
+ * is decided on the loop's stack, so no other CPU can pick the thread up
+ * while its stack is still in use.
+ *
+ * Every CPU also keeps a timer wheel (timer.h), which its loop advances
+ * between threads: sleeping threads and the timers of bound threads wait
+ * there, and an idle CPU sleeps until its first timer is due or work
+ * arrives, rather than waking up to look.
+ */
+
+#define _GNU_SOURCE
+#include "scheduler.h"
+#include "deque.h"
+#include "context.h"
+#include "timer.h"
+#include "../memory/memory.h"
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Most CPUs the scheduler runs on */
+#define SCHED_MAX_CPUS 64
+
+/* Default time slice (ms) */
+#define DEFAULT_TIME_SLICE 10
+
+/* Time slice range of the adaptive policy (ms) */
+#define MIN_TIME_SLICE 1
+#define MAX_TIME_SLICE 100
+
+/* Queued threads a CPU may hold beyond the average before idle CPUs are woken */
+#define IMBALANCE_THRESHOLD 2
+
+/* Where a thread is in its life with the scheduler */
+typedef enum {
+    RUN_NEW,                   /* Context created, not added yet */
+    RUN_QUEUED,                /* On a run queue */
+    RUN_RUNNING,
+    RUN_WOKEN,                 /* Running and unblocked before it blocked */
+    RUN_PARKED,                /* Blocked */
+    RUN_EXITED,                /* Returned from its entry point */
+    RUN_REMOVED                /* Removed; freed with the last queue entry */
+} run_state_t;
+
+/* Why a thread switched back to the scheduling loop */
+typedef enum {
+    SWITCH_YIELD,
+    SWITCH_BLOCK,
+    SWITCH_EXIT
+} switch_reason_t;
+
+/* Run queues behind a lock */
+typedef struct {
+    pthread_mutex_t lock;
+    run_queue_t levels[MAX_PRIORITY_LEVELS];
+    _Atomic uint32_t occupied; /* Bit n set while levels[n] is not empty */
+} locked_queue_t;
+
+/* Scheduler's record of a thread (thread_t.context) */
+typedef struct sched_thread {
+    cpu_context_t context;     /* Saved while the thread is off its CPU */
+    thread_t* thread;
+    struct cpu* home;          /* CPU the thread is bound to, NULL if none */
+    _Atomic int run_state;     /* run_state_t */
+    _Atomic uint32_t refs;     /* Queue entries, plus one until removed */
+    _Atomic uint32_t inherited; /* Priority lent by mutex waiters (MAX_PRIORITY_LEVELS if none) */
+    struct sched_thread* wait_next; /* Next waiter on the same mutex */
+    bool linked;               /* On a locked run queue (its lock) */
+    uint32_t linked_level;     /* Its level there */
+    switch_reason_t reason;
+    bool responded;            /* Has run at least once */
+    uint64_t created_ns;
+    uint64_t ready_ns;         /* Last queued */
+    uint64_t dispatched_ns;    /* Last switched to */
+    uint64_t run_ns;           /* Time on a CPU */
+} sched_thread_t;
+
+/* Per-CPU counters */
+typedef enum {
+    CPU_STAT_SWITCHES,
+    CPU_STAT_PREEMPTIONS,      /* Yields after a full time slice */
+    CPU_STAT_BUSY_NS,
+    CPU_STAT_IDLE_NS,
+    CPU_STAT_STEALS,           /* Threads taken from other CPUs */
+    CPU_STAT_WAIT_NS,          /* Queued time of dispatched threads */
+    CPU_STAT_DISPATCHES,
+    CPU_STAT_RESPONSE_NS,      /* Creation to first dispatch */
+    CPU_STAT_RESPONSES,
+    CPU_STAT_TURNAROUND_NS,    /* Creation to exit */
+    CPU_STAT_EXITS,
+    CPU_STAT_COUNT
+} cpu_stat_t;
+
+/* Scheduler CPU */
+typedef struct cpu {
+    deque_t queues[MAX_PRIORITY_LEVELS]; /* Ready threads per level */
+    _Atomic uint32_t levels;   /* Bit n set while queues[n] may hold threads */
+    locked_queue_t bound;      /* Ready threads bound to the CPU */
+    uint32_t id;
+    uint32_t core;             /* Core of the process's allowed set the CPU runs for */
+    pthread_t os_thread;
+    cpu_context_t context;     /* Scheduling loop */
+    sched_thread_t* current;   /* Thread running on the CPU */
+    sched_thread_t* next;      /* Claimed thread to run before the queues */
+    uint64_t seed;             /* Victim selection */
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+    _Atomic bool idle;         /* Waiting on idle_cond */
+    timer_wheel_t timers;      /* Timers in monotonic ms, used by this CPU only */
+    _Atomic uint64_t stats[CPU_STAT_COUNT]; /* Single writer: the CPU */
+} cpu_t;
+
+/* Scheduler state */
+static struct {
+    bool initialized;
+    pthread_mutex_t lock;      /* Guards the registry, tuning and analysis */
+    _Atomic int policy;        /* scheduling_policy_t */
+    _Atomic uint32_t time_slice;
+    _Atomic bool preemption_enabled;
+    scheduler_optimization_t optimization;
+    
+    /* Processes and threads added to the scheduler, by ID slot */
+    process_t* processes[MAX_PROCESSES];
+    thread_t* threads[MAX_THREADS];
+    memory_cache_t* thread_cache;
+    
+    /* Unbound threads made ready outside the scheduler's CPUs */
+    locked_queue_t shared;
+    
+    /* CPUs */
+    cpu_t cpus[SCHED_MAX_CPUS];
+    uint32_t cpu_count;
+    bool pin_cpus;             /* Pin each CPU's OS thread to its core */
+    _Atomic uint32_t active_threads; /* Added, not exited or removed */
+    _Atomic bool running;
+    _Atomic bool stopping;
+    _Atomic uint32_t idle_cpus;
+    
+    /* Totals at the last workload analysis */
+    uint64_t analyzed_wait_ns;
+    uint64_t analyzed_dispatches;
+    uint32_t imbalance;        /* Queued threads of the busiest CPU above the average */
+    _Atomic uint32_t priority_inversions;
+} sched_state = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .shared.lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+/* Thread sleeping on a timer of its CPU */
+typedef struct {
+    wheel_timer_t timer;
+    thread_t* thread;
+    _Atomic bool expired;
+} sleeper_t;
+
+static _Thread_local cpu_t* local_cpu;
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static uint64_t now_ms(void) {
+    return now_ns() / 1000000;
+}
+
+/**
+ * Get the CPU of the calling OS thread
+ *
+ * A thread may resume on another CPU after switching, so the thread-local
+ * is read through a call the compiler cannot fold across the switch.
+ */
+static __attribute__((noinline)) cpu_t* this_cpu(void) {
+    return local_cpu;
+}
+
+static inline void cpu_count_stat(cpu_t* cpu, cpu_stat_t stat, uint64_t value) {
+    atomic_store_explicit(&cpu->stats[stat],
+                          atomic_load_explicit(&cpu->stats[stat], memory_order_relaxed) + value,
+                          memory_order_relaxed);
+}
+
+static uint64_t stat_total(cpu_stat_t stat) {
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < sched_state.cpu_count; i++) {
+        total += atomic_load_explicit(&sched_state.cpus[i].stats[stat], memory_order_relaxed);
+    }
+    return total;
+}
+
+/**
+ * Levels below limit as a bitmap
+ */
+static inline uint32_t levels_below(uint32_t limit) {
+    return limit >= MAX_PRIORITY_LEVELS ? UINT32_MAX : (1U << limit) - 1;
+}
+
+/**
+ * Priority of a thread, raised by any it inherits
+ */
+static uint32_t effective_priority(sched_thread_t* record) {
+    uint32_t inherited = atomic_load_explicit(&record->inherited, memory_order_relaxed);
+    return record->thread->priority < inherited ? record->thread->priority : inherited;
+}
+
+/**
+ * Run queue level of a thread under the current policy
+ */
+static uint32_t queue_level(sched_thread_t* record) {
+    if (atomic_load_explicit(&sched_state.policy, memory_order_relaxed) == SCHED_POLICY_ROUND_ROBIN) {
+        return 0;
+    }
+    uint32_t priority = effective_priority(record);
+    return priority < MAX_PRIORITY_LEVELS ? priority : MAX_PRIORITY_LEVELS - 1;
+}
+
+/**
+ * Drop a reference to a record, freeing it with the last one
+ */
+static void record_release(sched_thread_t* record) {
+    if (atomic_fetch_sub_explicit(&record->refs, 1, memory_order_acq_rel) == 1) {
+        memory_cache_free(sched_state.thread_cache, record);
+    }
+}
+
+/**
+ * Register an object at the slot of its ID (with the registry locked)
+ *
+ * IDs are kernel handles, so live objects never share a slot.
+ */
+static error_code_t registry_add(void** slot, void* item) {
+    if (*slot && *slot != item) {
+        return ERROR_RESOURCE_BUSY;
+    }
+    
+    *slot = item;
+    return ERROR_NONE;
+}
+
+/**
+ * Unregister an object (with the registry locked)
+ */
+static bool registry_remove(void** slot, void* item) {
+    if (*slot != item) {
+        return false;
+    }
+    
+    *slot = NULL;
+    return true;
+}
+
+/**
+ * Wake a CPU waiting for threads
+ */
+static void cpu_wake(cpu_t* cpu) {
+    pthread_mutex_lock(&cpu->idle_lock);
+    pthread_cond_signal(&cpu->idle_cond);
+    pthread_mutex_unlock(&cpu->idle_lock);
+}
+
+/**
+ * Wake a CPU after making a thread ready: target, or any idle one if NULL
+ */
+static void notify_idle(cpu_t* target) {
+    /* Pairs with the fence in cpu_idle: either the idle CPU sees the new
+       thread or this sees the idle CPU */
+    atomic_thread_fence(memory_order_seq_cst);
+    if (target) {
+        if (atomic_load_explicit(&target->idle, memory_order_relaxed)) {
+            cpu_wake(target);
+        }
+        return;
+    }
+    if (atomic_load_explicit(&sched_state.idle_cpus, memory_order_relaxed) == 0) {
+        return;
+    }
+    for (uint32_t i = 0; i < sched_state.cpu_count; i++) {
+        if (atomic_load_explicit(&sched_state.cpus[i].idle, memory_order_relaxed)) {
+            cpu_wake(&sched_state.cpus[i]);
+            return;
+        }
+    }
+}
+
+/**
+ * Wake every CPU waiting for threads
+ */
+static void notify_all(void) {
+    for (uint32_t i = 0; i < sched_state.cpu_count; i++) {
+        cpu_wake(&sched_state.cpus[i]);
+    }
+}
+
+/**
+ * Locked run queues of a thread: its CPU's if bound, else the shared ones
+ */
+static locked_queue_t* locked_queue_of(sched_thread_t* record) {
+    return record->home ? &record->home->bound : &sched_state.shared;
+}
+
+/**
+ * Highest level with threads on locked run queues (MAX_PRIORITY_LEVELS if none)
+ */
+static uint32_t locked_level(locked_queue_t* queue) {
+    uint32_t occupied = atomic_load_explicit(&queue->occupied, memory_order_relaxed);
+    return occupied ? (uint32_t)__builtin_ctz(occupied) : MAX_PRIORITY_LEVELS;
+}
+
+/**
+ * Link a thread at the tail of a level (the queue's lock held)
+ */
+static void locked_link(locked_queue_t* queue, sched_thread_t* record, uint32_t level) {
+    run_queue_t* run_queue = &queue->levels[level];
+    thread_t* thread = record->thread;
+    
+    thread->queue_next = NULL;
+    thread->queue_prev = run_queue->tail;
+    if (run_queue->tail) {
+        run_queue->tail->queue_next = thread;
+    } else {
+        run_queue->head = thread;
+    }
+    run_queue->tail = thread;
+    run_queue->thread_count++;
+    
+    record->linked = true;
+    record->linked_level = level;
+    atomic_fetch_or_explicit(&queue->occupied, 1U << level, memory_order_relaxed);
+}
+
+/**
+ * Unlink a thread from its level (the queue's lock held)
+ */
+static void locked_unlink(locked_queue_t* queue, sched_thread_t* record) {
+    run_queue_t* run_queue = &queue->levels[record->linked_level];
+    thread_t* thread = record->thread;
+    
+    if (thread->queue_prev) {
+        thread->queue_prev->queue_next = thread->queue_next;
+    } else {
+        run_queue->head = thread->queue_next;
+    }
+    if (thread->queue_next) {
+        thread->queue_next->queue_prev = thread->queue_prev;
+    } else {
+        run_queue->tail = thread->queue_prev;
+    }
+    thread->queue_next = NULL;
+    thread->queue_prev = NULL;
+    
+    if (--run_queue->thread_count == 0) {
+        atomic_fetch_and_explicit(&queue->occupied, ~(1U << record->linked_level), memory_order_relaxed);
+    }
+    record->linked = false;
+}
+
+/**
+ * Append a thread to its level of its locked run queues
+ *
+ * A thread still linked from an earlier time it was queued keeps that
+ * place, which serves for this time too.
+ */
+static void locked_push(sched_thread_t* record, uint32_t level) {
+    locked_queue_t* queue = locked_queue_of(record);
+    
+    pthread_mutex_lock(&queue->lock);
+    if (!record->linked) {
+        locked_link(queue, record, level);
+        atomic_fetch_add_explicit(&record->refs, 1, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ * Move a linked thread to the tail of another level
+ */
+static void locked_requeue(sched_thread_t* record, uint32_t level) {
+    locked_queue_t* queue = locked_queue_of(record);
+    
+    pthread_mutex_lock(&queue->lock);
+    if (record->linked && record->linked_level != level) {
+        locked_unlink(queue, record);
+        locked_link(queue, record, level);
+    }
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ * Take the oldest thread of the highest level below limit
+ */
+static sched_thread_t* locked_take(locked_queue_t* queue, uint32_t limit) {
+    sched_thread_t* record = NULL;
+    
+    pthread_mutex_lock(&queue->lock);
+    
+    uint32_t levels = atomic_load_explicit(&queue->occupied, memory_order_relaxed) & levels_below(limit);
+    if (levels) {
+        /* Read the record before the lock lets the thread be removed */
+        record = queue->levels[__builtin_ctz(levels)].head->context;
+        locked_unlink(queue, record);
+    }
+    
+    pthread_mutex_unlock(&queue->lock);
+    return record;
+}
+
+/**
+ * Unlink a removed thread from its locked run queues
+ */
+static void locked_remove(sched_thread_t* record) {
+    locked_queue_t* queue = locked_queue_of(record);
+    
+    pthread_mutex_lock(&queue->lock);
+    bool removed = record->linked;
+    if (removed) {
+        locked_unlink(queue, record);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    
+    if (removed) {
+        record_release(record);
+    }
+}
+
+/**
+ * Queue a ready thread (its run state must be RUN_QUEUED)
+ *
+ * Bound threads never go on a deque, where another CPU could take them.
+ */
+static void enqueue(sched_thread_t* record) {
+    uint32_t level = queue_level(record);
+    cpu_t* cpu = this_cpu();
+    
+    record->ready_ns = now_ns();
+    if (cpu && !record->home) {
+        atomic_fetch_add_explicit(&record->refs, 1, memory_order_relaxed);
+        if (deque_push(&cpu->queues[level], record) == ERROR_NONE) {
+            atomic_fetch_or_explicit(&cpu->levels, 1U << level, memory_order_release);
+            notify_idle(NULL);
+            return;
+        }
+        atomic_fetch_sub_explicit(&record->refs, 1, memory_order_relaxed);
+    }
+    locked_push(record, level);
+    notify_idle(record->home);
+}
+
+/**
+ * Check the thread of a queue entry out for running
+ *
+ * Fails if the thread has already been run from another entry or removed;
+ * either way the entry's reference is dropped.
+ */
+static bool claim(sched_thread_t* record) {
+    int expected = RUN_QUEUED;
+    bool claimed = atomic_compare_exchange_strong_explicit(&record->run_state, &expected, RUN_RUNNING,
+                                                           memory_order_acquire, memory_order_acquire);
+    record_release(record);
+    return claimed;
+}
+
+/**
+ * Highest level below limit with threads on a CPU's deques
+ * (MAX_PRIORITY_LEVELS if none)
+ *
+ * Only a CPU pushes onto its own deques, so the CPU itself (owner) may
+ * clear the bit of a level it finds empty: the level stays empty until the
+ * CPU sets the bit again.
+ */
+static uint32_t local_level(cpu_t* cpu, uint32_t limit, bool owner) {
+    uint32_t levels = atomic_load_explicit(&cpu->levels, memory_order_acquire) & levels_below(limit);
+    
+    while (levels) {
+        uint32_t level = (uint32_t)__builtin_ctz(levels);
+        if (deque_size(&cpu->queues[level]) > 0) {
+            return level;
+        }
+        if (owner) {
+            atomic_fetch_and_explicit(&cpu->levels, ~(1U << level), memory_order_relaxed);
+        }
+        levels &= levels - 1;
+    }
+    return MAX_PRIORITY_LEVELS;
+}
+
+/**
+ * Take the oldest thread of the highest level another CPU has queued
+ */
+static sched_thread_t* steal(cpu_t* cpu, uint32_t limit) {
+    uint32_t count = sched_state.cpu_count;
+    if (count < 2) {
+        return NULL;
+    }
+    
+    /* xorshift */
+    cpu->seed ^= cpu->seed << 13;
+    cpu->seed ^= cpu->seed >> 7;
+    cpu->seed ^= cpu->seed << 17;
+    uint32_t start = (uint32_t)(cpu->seed % count);
+    
+    for (uint32_t i = 0; i < count; i++) {
+        cpu_t* victim = &sched_state.cpus[(start + i) % count];
+        if (victim == cpu) {
+            continue;
+        }
+    
+        uint32_t level = local_level(victim, limit, false);
+        if (level < limit) {
+            sched_thread_t* record = deque_take(&victim->queues[level]);
+            if (record) {
+                cpu_count_stat(cpu, CPU_STAT_STEALS, 1);
+                return record;
+            }
+        }
+    }
+    
+    return NULL;
+}
+
+/**
+ * Pick the next thread for a CPU
+ */
+static sched_thread_t* cpu_next(cpu_t* cpu) {
+    for (;;) {
+        uint32_t level = local_level(cpu, MAX_PRIORITY_LEVELS, true);
+        uint32_t bound = locked_level(&cpu->bound);
+        uint32_t shared = locked_level(&sched_state.shared);
+        sched_thread_t* record;
+    
+        /* Locked queues go first unless of a lower level; an empty result
+           means another CPU, or a thief, got there first */
+        if (bound < MAX_PRIORITY_LEVELS && bound <= shared && bound <= level) {
+            record = locked_take(&cpu->bound, bound + 1);
+        } else if (shared < MAX_PRIORITY_LEVELS && shared <= level) {
+            record = locked_take(&sched_state.shared, shared + 1);
+        } else if (level < MAX_PRIORITY_LEVELS) {
+            record = deque_take(&cpu->queues[level]);
+        } else {
+            record = steal(cpu, MAX_PRIORITY_LEVELS);
+            if (!record) {
+                return NULL;
+            }
+        }
+    
+        if (record && claim(record)) {
+            return record;
+        }
+    }
+}
+
+/**
+ * Whether a CPU could take a queued thread
+ */
+static bool work_available(cpu_t* cpu) {
+    if (locked_level(&cpu->bound) < MAX_PRIORITY_LEVELS ||
+        locked_level(&sched_state.shared) < MAX_PRIORITY_LEVELS) {
+        return true;
+    }
+    for (uint32_t i = 0; i < sched_state.cpu_count; i++) {
+        if (local_level(&sched_state.cpus[i], MAX_PRIORITY_LEVELS, false) < MAX_PRIORITY_LEVELS) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void cpu_idle(cpu_t* cpu) {
+    uint64_t start = now_ns();
+    
+    pthread_mutex_lock(&cpu->idle_lock);
+    atomic_store_explicit(&cpu->idle, true, memory_order_relaxed);
+    atomic_fetch_add_explicit(&sched_state.idle_cpus, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    
+    if (!work_available(cpu) && !atomic_load_explicit(&sched_state.stopping, memory_order_relaxed)) {
+        /* Only this CPU arms its timers, so none can come due earlier meanwhile */
+        uint64_t wake = timer_wheel_next(&cpu->timers);
+        if (wake == UINT64_MAX) {
+            pthread_cond_wait(&cpu->idle_cond, &cpu->idle_lock);
+        } else if (wake > start / 1000000) {
+            struct timespec deadline;
+            deadline.tv_sec = (time_t)(wake / 1000);
+            deadline.tv_nsec = (long)(wake % 1000) * 1000000L;
+            pthread_cond_timedwait(&cpu->idle_cond, &cpu->idle_lock, &deadline);
+        }
+    }
+    
+    atomic_fetch_sub_explicit(&sched_state.idle_cpus, 1, memory_order_relaxed);
+    atomic_store_explicit(&cpu->idle, false, memory_order_relaxed);
+    pthread_mutex_unlock(&cpu->idle_lock);
+    
+    cpu_count_stat(cpu, CPU_STAT_IDLE_NS, now_ns() - start);
+}
+
+/**
+ * Let the CPU loops return once no thread is left to run
+ */
+static void thread_retired(void) {
+    if (atomic_fetch_sub_explicit(&sched_state.active_threads, 1, memory_order_acq_rel) == 1 &&
+        atomic_load_explicit(&sched_state.running, memory_order_relaxed)) {
+        atomic_store_explicit(&sched_state.stopping, true, memory_order_relaxed);
+        notify_all();
+    }
+}
+
+/**
+ * Run a thread until it switches back, then requeue, park or retire it
+ */
+static void cpu_dispatch(cpu_t* cpu, sched_thread_t* record) {
+    thread_t* thread = record->thread;
+    uint64_t start = now_ns();
+    
+    cpu_count_stat(cpu, CPU_STAT_WAIT_NS, start - record->ready_ns);
+    cpu_count_stat(cpu, CPU_STAT_DISPATCHES, 1);
+    if (!record->responded) {
+        record->responded = true;
+        cpu_count_stat(cpu, CPU_STAT_RESPONSE_NS, start - record->created_ns);
+        cpu_count_stat(cpu, CPU_STAT_RESPONSES, 1);
+    }
+    
+    thread->state = THREAD_RUNNING;
+    thread->last_scheduled = start / 1000000;
+    record->dispatched_ns = start;
+    record->reason = SWITCH_YIELD;
+    cpu->current = record;
+    cpu_count_stat(cpu, CPU_STAT_SWITCHES, 1);
+    
+    context_switch(&cpu->context, &record->context);
+    
+    cpu->current = NULL;
+    uint64_t end = now_ns();
+    cpu_count_stat(cpu, CPU_STAT_BUSY_NS, end - start);
+    record->run_ns += end - start;
+    thread->cpu_time = record->run_ns / 1000000;
+    
+    switch (record->reason) {
+        case SWITCH_YIELD:
+            thread->state = THREAD_READY;
+            atomic_store_explicit(&record->run_state, RUN_QUEUED, memory_order_relaxed);
+            enqueue(record);
+            break;
+    
+        case SWITCH_BLOCK: {
+            thread->state = THREAD_BLOCKED;
+            int expected = RUN_RUNNING;
+            if (!atomic_compare_exchange_strong_explicit(&record->run_state, &expected, RUN_PARKED,
+                                                         memory_order_acq_rel, memory_order_acquire)) {
+                /* Unblocked while still running */
+                thread->state = THREAD_READY;
+                atomic_store_explicit(&record->run_state, RUN_QUEUED, memory_order_relaxed);
+                enqueue(record);
+            }
+            break;
+        }
+    
+        case SWITCH_EXIT:
+            thread->state = THREAD_TERMINATED;
+            cpu_count_stat(cpu, CPU_STAT_TURNAROUND_NS, end - record->created_ns);
+            cpu_count_stat(cpu, CPU_STAT_EXITS, 1);
+            atomic_store_explicit(&record->run_state, RUN_EXITED, memory_order_release);
+            thread_retired();
+            break;
+    }
+}
+
+static void cpu_loop(cpu_t* cpu) {
+    local_cpu = cpu;
+    
+    for (;;) {
+        if (cpu->timers.count > 0) {
+            timer_wheel_advance(&cpu->timers, now_ms());
+        }
+    
+        sched_thread_t* record = cpu->next;
+        if (record) {
+            cpu->next = NULL;
+        } else {
+            record = cpu_next(cpu);
+        }
+        if (record) {
+            cpu_dispatch(cpu, record);
+            continue;
+        }
+    
+        if (atomic_load_explicit(&sched_state.stopping, memory_order_relaxed)) {
+            break;
+        }
+        cpu_idle(cpu);
+    }
+    
+    local_cpu = NULL;
+}
+
+static void pin_to_core(pthread_t os_thread, uint32_t core) {
+    if (sched_state.pin_cpus && core < CPU_SETSIZE) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(core, &set);
+        pthread_setaffinity_np(os_thread, sizeof(set), &set);
+    }
+}
+
+static void* cpu_thread(void* arg) {
+    cpu_t* cpu = arg;
+    cpu_loop(cpu);
+    return NULL;
+}
+
+/**
+ * First function on a thread's stack
+ */
+static void thread_start(void) {
+    sched_thread_t* record = this_cpu()->current;
+    
+    record->thread->entry_point(record->thread->arg);
+    
+    /* The record's context is never resumed, so it takes what is saved */
+    record->reason = SWITCH_EXIT;
+    context_switch(&record->context, &this_cpu()->context);
+}
+
+/**
+ * Switch from the running thread back to its CPU's scheduling loop
+ */
+static error_code_t switch_out(switch_reason_t reason) {
+    cpu_t* cpu = this_cpu();
+    if (!cpu || !cpu->current) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    sched_thread_t* record = cpu->current;
+    record->reason = reason;
+    context_switch(&record->context, &cpu->context);
+    return ERROR_NONE;
+}
+
+/**
+ * Initialize scheduler
+ *
+ * Sets up one CPU per core in the process's allowed set (sched_getaffinity,
+ * so taskset and cpusets are honoured), up to SCHED_MAX_CPUS.
+ */
+error_code_t scheduler_init(void) {
+    if (sched_state.initialized) {
+        return ERROR_NONE;
+    }
+    
+    sched_state.thread_cache = memory_cache_create("sched_thread_t", sizeof(sched_thread_t));
+    if (!sched_state.thread_cache) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    
+    uint32_t cores[SCHED_MAX_CPUS];
+    uint32_t core_count = 0;
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (uint32_t core = 0; core < CPU_SETSIZE && core_count < SCHED_MAX_CPUS; core++) {
+            if (CPU_ISSET(core, &allowed)) {
+                cores[core_count++] = core;
+            }
+        }
+    }
+    if (core_count == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        core_count = online < 1 ? 1 : (online > SCHED_MAX_CPUS ? SCHED_MAX_CPUS : (uint32_t)online);
+        for (uint32_t i = 0; i < core_count; i++) {
+            cores[i] = i;
+        }
+    }
+    sched_state.cpu_count = core_count;
+    
+    /* Idle CPUs wait for their timers on the monotonic clock */
+    pthread_condattr_t idle_attr;
+    pthread_condattr_init(&idle_attr);
+    pthread_condattr_setclock(&idle_attr, CLOCK_MONOTONIC);
+    
+    for (uint32_t i = 0; i < sched_state.cpu_count; i++) {
+        cpu_t* cpu = &sched_state.cpus[i];
+        for (uint32_t level = 0; level < MAX_PRIORITY_LEVELS; level++) {
+            deque_init(&cpu->queues[level]);
+        }
+        pthread_mutex_init(&cpu->bound.lock, NULL);
+        pthread_mutex_init(&cpu->idle_lock, NULL);
+        pthread_cond_init(&cpu->idle_cond, &idle_attr);
+        timer_wheel_init(&cpu->timers, now_ms());
+        cpu->id = i;
+        cpu->core = cores[i];
+        cpu->seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+    }
+    pthread_condattr_destroy(&idle_attr);
+    
+    atomic_store_explicit(&sched_state.policy, SCHED_POLICY_PRIORITY, memory_order_relaxed);
+    atomic_store_explicit(&sched_state.time_slice, DEFAULT_TIME_SLICE, memory_order_relaxed);
+    atomic_store_explicit(&sched_state.preemption_enabled, true, memory_order_relaxed);
+    
+    sched_state.initialized = true;
+    return ERROR_NONE;
+}
+
+/**
+ * Start scheduler
+ *
+ * Runs CPU 0 on the calling thread and the others on threads of their
+ * own. Returns once every thread added has exited or been removed.
+ */
+error_code_t scheduler_start(void) {
+    if (!sched_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    if (atomic_exchange_explicit(&sched_state.running, true, memory_order_acq_rel)) {
+        return ERROR_RESOURCE_BUSY;
+    }
+    
+    atomic_store_explicit(&sched_state.stopping,
+                          atomic_load_explicit(&sched_state.active_threads, memory_order_acquire) == 0,
+                          memory_order_relaxed);
+    
+    cpu_set_t original;
+    bool restore = pthread_getaffinity_np(pthread_self(), sizeof(original), &original) == 0;
+    
+    uint32_t started = 1;
+    for (uint32_t i = 1; i < sched_state.cpu_count; i++) {
+        cpu_t* cpu = &sched_state.cpus[i];
+        if (pthread_create(&cpu->os_thread, NULL, cpu_thread, cpu) != 0) {
+            break;
+        }
+        pin_to_core(cpu->os_thread, cpu->core);
+        started++;
+    }
+    
+    sched_state.cpus[0].os_thread = pthread_self();
+    pin_to_core(pthread_self(), sched_state.cpus[0].core);
+    cpu_loop(&sched_state.cpus[0]);
+    
+    for (uint32_t i = 1; i < started; i++) {
+        pthread_join(sched_state.cpus[i].os_thread, NULL);
+    }
+    if (restore) {
+        pthread_setaffinity_np(pthread_self(), sizeof(original), &original);
+    }
+    
+    atomic_store_explicit(&sched_state.running, false, memory_order_release);
+    return ERROR_NONE;
+}
+
+/**
+ * Pin each CPU's OS thread to its core
+ *
+ * Off by default, leaving placement to the system. Takes effect when the
+ * scheduler starts.
+ */
+error_code_t scheduler_set_pinning(bool pin) {
+    if (atomic_load_explicit(&sched_state.running, memory_order_acquire)) {
+        return ERROR_RESOURCE_BUSY;
+    }
+    
+    sched_state.pin_cpus = pin;
+    return ERROR_NONE;
+}
+
+/**
+ * Add process to scheduler
+ */
+error_code_t scheduler_add_process(process_t* process) {
+    if (!sched_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    if (!process) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    pthread_mutex_lock(&sched_state.lock);
+    error_code_t err = registry_add((void**)&sched_state.processes[PROCESS_SLOT(process->pid)], process);
+    pthread_mutex_unlock(&sched_state.lock);
+    
+    if (err == ERROR_NONE) {
+        process->state = PROCESS_READY;
+    }
+    return err;
+}
+
+/**
+ * Remove process from scheduler
+ */
+error_code_t scheduler_remove_process(process_t* process) {
+    if (!sched_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    if (!process) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    pthread_mutex_lock(&sched_state.lock);
+    bool removed = registry_remove((void**)&sched_state.processes[PROCESS_SLOT(process->pid)], process);
+    pthread_mutex_unlock(&sched_state.lock);
+    
+    return removed ? ERROR_NONE : ERROR_INVALID_PARAMETER;
+}
+
+/**
+ * Find process by ID
+ */
+process_t* scheduler_find_process(uint32_t pid) {
+    pthread_mutex_lock(&sched_state.lock);
+    process_t* found = sched_state.processes[PROCESS_SLOT(pid)];
+    if (found && found->pid != pid) {
+        found = NULL;
+    }
+    pthread_mutex_unlock(&sched_state.lock);
+    
+    return found;
+}
+
+/**
+ * Initialize thread context
+ *
+ * The thread starts at its entry point on its stack (thread->stack must be
+ * allocated) the first time a CPU runs it.
+ */
+error_code_t scheduler_init_thread_context(thread_t* thread) {
+    if (!sched_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    if (!thread || !thread->stack || thread->stack_size == 0 || !thread->entry_point) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    sched_thread_t* record = memory_cache_alloc(sched_state.thread_cache);
+    if (!record) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    memset(record, 0, sizeof(*record));
+    
+    context_init(&record->context, thread->stack, thread->stack_size, thread_start);
+    record->thread = thread;
+    record->created_ns = now_ns();
+    atomic_init(&record->run_state, RUN_NEW);
+    atomic_init(&record->refs, 1);
+    atomic_init(&record->inherited, MAX_PRIORITY_LEVELS);
+    
+    thread->queue_next = NULL;
+    thread->queue_prev = NULL;
+    thread->context = record;
+    return ERROR_NONE;
+}
+
+/**
+ * Bind a thread to a CPU
+ *
+ * A bound thread only ever runs on that CPU (cpu is taken modulo the CPU
+ * count), so threads bound to the same CPU never run at the same time.
+ * Must be called before the thread is added.
+ */
+error_code_t scheduler_bind_thread(thread_t* thread, uint32_t cpu) {
+    if (!sched_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    if (!thread || !thread->context) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    sched_thread_t* record = thread->context;
+    if (atomic_load_explicit(&record->run_state, memory_order_relaxed) != RUN_NEW) {
+        return ERROR_RESOURCE_BUSY;
+    }
+    
+    record->home = &sched_state.cpus[cpu % sched_state.cpu_count];
+    return ERROR_NONE;
+}
+
+/**
+ * Get the number of CPUs the scheduler runs on (0 before scheduler_init)
+ */
+uint32_t scheduler_get_cpu_count(void) {
+    return sched_state.initialized ? sched_state.cpu_count : 0;
+}
+
+/**
+ * Add thread to scheduler
+ *
+ * The thread is queued on the calling CPU, on its own CPU if bound, or on
+ * the shared run queues if the caller is not one of the scheduler's CPUs.
+ */
+error_code_t scheduler_add_thread(thread_t* thread) {
+    if (!sched_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    if (!thread || !thread->context) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    sched_thread_t* record = thread->context;
+    int expected = RUN_NEW;
+    if (atomic_load_explicit(&record->run_state, memory_order_relaxed) != RUN_NEW) {
+        return ERROR_RESOURCE_BUSY;
+    }
+    
+    pthread_mutex_lock(&sched_state.lock);
+    error_code_t err = registry_add((void**)&sched_state.threads[THREAD_SLOT(thread->tid)], thread);
+    pthread_mutex_unlock(&sched_state.lock);
+    if (err != ERROR_NONE) {
+        return err;
+    }
+    
+    if (!atomic_compare_exchange_strong_explicit(&record->run_state, &expected, RUN_QUEUED,
+                                                 memory_order_acq_rel, memory_order_relaxed)) {
+        pthread_mutex_lock(&sched_state.lock);
+        registry_remove((void**)&sched_state.threads[THREAD_SLOT(thread->tid)], thread);
+        pthread_mutex_unlock(&sched_state.lock);
+        return ERROR_RESOURCE_BUSY;
+    }
+    
+    atomic_fetch_add_explicit(&sched_state.active_threads, 1, memory_order_relaxed);
+    thread->state = THREAD_READY;
+    enqueue(record);
+    return ERROR_NONE;
+}
+
+/**
+ * Remove thread from scheduler
+ *
+ * Releases the thread's context; the thread must not be running.
+ */
+error_code_t scheduler_remove_thread(thread_t* thread) {
+    if (!sched_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    if (!thread || !thread->context) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    sched_thread_t* record = thread->context;
+    int state = atomic_load_explicit(&record->run_state, memory_order_acquire);
+    
+    do {
+        if (state == RUN_RUNNING || state == RUN_WOKEN || state == RUN_REMOVED) {
+            return ERROR_RESOURCE_BUSY;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&record->run_state, &state, RUN_REMOVED,
+                                                    memory_order_acq_rel, memory_order_acquire));
+    
+    /* Entries left on deques keep the record until CPUs take them */
+    locked_remove(record);
+    record_release(record);
+    
+    thread->context = NULL;
+    
+    pthread_mutex_lock(&sched_state.lock);
+    registry_remove((void**)&sched_state.threads[THREAD_SLOT(thread->tid)], thread);
+    pthread_mutex_unlock(&sched_state.lock);
+    
+    if (state == RUN_QUEUED || state == RUN_PARKED) {
+        thread_retired();
+    }
+    return ERROR_NONE;
+}
+
+/**
+ * Find thread by ID
+ */
+thread_t* scheduler_find_thread(uint32_t tid) {
+    pthread_mutex_lock(&sched_state.lock);
+    thread_t* found = sched_state.threads[THREAD_SLOT(tid)];
+    if (found && found->tid != tid) {
+        found = NULL;
+    }
+    pthread_mutex_unlock(&sched_state.lock);
+    
+    return found;
+}
+
+/**
+ * Get the thread running on the calling CPU (NULL outside threads)
+ */
+thread_t* scheduler_get_current(void) {
+    cpu_t* cpu = this_cpu();
+    return cpu && cpu->current ? cpu->current->thread : NULL;
+}
+
+/**
+ * Perform context switch
+ *
+ * Switches the running thread out in favour of the next ready thread; the
+ * thread is queued again behind the threads of its level.
+ */
+error_code_t scheduler_context_switch(void) {
+    return switch_out(SWITCH_YIELD);
+}
+
+/**
+ * Yield CPU
+ *
+ * Keeps running the caller if no thread of the same or a higher level (a
+ * strictly higher one under SCHED_POLICY_FIFO) is ready on this CPU, the
+ * shared queues or, taken over now, another CPU. Outside the scheduler's
+ * threads this yields the OS thread.
+ */
+error_code_t scheduler_yield(void) {
+    cpu_t* cpu = this_cpu();
+    if (!cpu || !cpu->current) {
+        sched_yield();
+        return ERROR_NONE;
+    }
+    
+    uint32_t level = queue_level(cpu->current);
+    uint32_t limit = atomic_load_explicit(&sched_state.policy, memory_order_relaxed) == SCHED_POLICY_FIFO ? level : level + 1;
+    
+    if (local_level(cpu, limit, true) >= limit && locked_level(&cpu->bound) >= limit &&
+        locked_level(&sched_state.shared) >= limit) {
+        sched_thread_t* stolen;
+        do {
+            stolen = steal(cpu, limit);
+        } while (stolen && !claim(stolen));
+    
+        if (!stolen) {
+            return ERROR_NONE;
+        }
+    
+        /* The loop runs the stolen thread right after queuing the caller */
+        cpu->next = stolen;
+    }
+    
+    uint64_t slice_ns = (uint64_t)atomic_load_explicit(&sched_state.time_slice, memory_order_relaxed) * 1000000;
+    if (atomic_load_explicit(&sched_state.preemption_enabled, memory_order_relaxed) &&
+        now_ns() - cpu->current->dispatched_ns >= slice_ns) {
+        cpu_count_stat(cpu, CPU_STAT_PREEMPTIONS, 1);
+    }
+    
+    return switch_out(SWITCH_YIELD);
+}
+
+/**
+ * Block current thread
+ *
+ * The thread runs again after scheduler_unblock; an unblock that arrives
+ * while the thread is still running makes this return at once.
+ */
+error_code_t scheduler_block_current(void) {
+    return switch_out(SWITCH_BLOCK);
+}
+
+/**
+ * Unblock thread
+ */
+error_code_t scheduler_unblock(thread_t* thread) {
+    if (!sched_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    if (!thread || !thread->context) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    sched_thread_t* record = thread->context;
+    
+    for (;;) {
+        int state = atomic_load_explicit(&record->run_state, memory_order_acquire);
+    
+        if (state == RUN_PARKED) {
+            if (atomic_compare_exchange_weak_explicit(&record->run_state, &state, RUN_QUEUED,
+                                                      memory_order_acq_rel, memory_order_acquire)) {
+                thread->state = THREAD_READY;
+                enqueue(record);
+                return ERROR_NONE;
+            }
+        } else if (state == RUN_RUNNING) {
+            if (atomic_compare_exchange_weak_explicit(&record->run_state, &state, RUN_WOKEN,
+                                                      memory_order_acq_rel, memory_order_acquire)) {
+                return ERROR_NONE;
+            }
+        } else if (state == RUN_QUEUED || state == RUN_WOKEN) {
+            return ERROR_NONE;
+        } else {
+            return ERROR_INVALID_PARAMETER;
+        }
+    }
+}
+
+static void mutex_guard_lock(scheduler_mutex_t* mutex) {
+    while (atomic_exchange_explicit(&mutex->guard, true, memory_order_acquire)) {
+        while (atomic_load_explicit(&mutex->guard, memory_order_relaxed)) {
+            sched_yield();
+        }
+    }
+}
+
+static void mutex_guard_unlock(scheduler_mutex_t* mutex) {
+    atomic_store_explicit(&mutex->guard, false, memory_order_release);
+}
+
+/**
+ * Lend a priority to the holder of a mutex
+ *
+ * Returns the holder, checked out for running, if it was queued and may
+ * run on the caller's CPU: the CPU then runs it next instead of leaving it
+ * behind threads of the priority it was queued at. A holder bound to
+ * another CPU moves up to the lent priority on that CPU's queues instead.
+ */
+static sched_thread_t* inherit_priority(cpu_t* cpu, sched_thread_t* holder, uint32_t priority) {
+    uint32_t inherited = atomic_load_explicit(&holder->inherited, memory_order_relaxed);
+    while (priority < inherited &&
+           !atomic_compare_exchange_weak_explicit(&holder->inherited, &inherited, priority,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+    }
+    
+    if (holder->home && holder->home != cpu) {
+        locked_requeue(holder, queue_level(holder));
+        return NULL;
+    }
+    
+    /* Its queue entries are left to fail when taken */
+    int expected = RUN_QUEUED;
+    if (atomic_compare_exchange_strong_explicit(&holder->run_state, &expected, RUN_RUNNING,
+                                                memory_order_acquire, memory_order_relaxed)) {
+        return holder;
+    }
+    return NULL;
+}
+
+/**
+ * Initialize a scheduler mutex
+ */
+error_code_t scheduler_mutex_init(scheduler_mutex_t* mutex) {
+    if (!mutex) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    atomic_init(&mutex->owner, NULL);
+    atomic_init(&mutex->guard, false);
+    mutex->waiters = NULL;
+    return ERROR_NONE;
+}
+
+/**
+ * Lock a scheduler mutex
+ *
+ * Blocks the calling thread while another holds the mutex; waiters get it
+ * in priority order, and first come first served within a priority. A
+ * holder of a lower priority than the caller is a priority inversion: it
+ * inherits the caller's priority until it unlocks.
+ */
+error_code_t scheduler_mutex_lock(scheduler_mutex_t* mutex) {
+    cpu_t* cpu = this_cpu();
+    if (!mutex || !cpu || !cpu->current) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    sched_thread_t* record = cpu->current;
+    thread_t* self = record->thread;
+    thread_t* owner = NULL;
+    if (atomic_compare_exchange_strong_explicit(&mutex->owner, &owner, self,
+                                                memory_order_acquire, memory_order_relaxed)) {
+        return ERROR_NONE;
+    }
+    
+    mutex_guard_lock(mutex);
+    
+    /* The owner cannot change while the guard is held, except from free */
+    owner = NULL;
+    if (atomic_compare_exchange_strong_explicit(&mutex->owner, &owner, self,
+                                                memory_order_acquire, memory_order_relaxed)) {
+        mutex_guard_unlock(mutex);
+        return ERROR_NONE;
+    }
+    if (owner == self) {
+        mutex_guard_unlock(mutex);
+        return ERROR_RESOURCE_BUSY;
+    }
+    
+    uint32_t priority = effective_priority(record);
+    sched_thread_t** link = (sched_thread_t**)&mutex->waiters;
+    while (*link && effective_priority(*link) <= priority) {
+        link = &(*link)->wait_next;
+    }
+    record->wait_next = *link;
+    *link = record;
+    
+    sched_thread_t* holder = owner->context;
+    sched_thread_t* handoff = NULL;
+    if (effective_priority(holder) > priority) {
+        atomic_fetch_add_explicit(&sched_state.priority_inversions, 1, memory_order_relaxed);
+        handoff = inherit_priority(cpu, holder, priority);
+    }
+    
+    mutex_guard_unlock(mutex);
+    
+    if (handoff) {
+        /* The loop runs the holder right after parking the caller */
+        cpu->next = handoff;
+    }
+    
+    /* Ownership is handed over before the waiter is unblocked */
+    do {
+        switch_out(SWITCH_BLOCK);
+    } while (atomic_load_explicit(&mutex->owner, memory_order_acquire) != self);
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Unlock a scheduler mutex
+ *
+ * Hands the mutex to its highest priority waiter, if any, and drops the
+ * priority the caller inherited.
+ */
+error_code_t scheduler_mutex_unlock(scheduler_mutex_t* mutex) {
+    cpu_t* cpu = this_cpu();
+    if (!mutex || !cpu || !cpu->current ||
+        atomic_load_explicit(&mutex->owner, memory_order_relaxed) != cpu->current->thread) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    sched_thread_t* record = cpu->current;
+    
+    mutex_guard_lock(mutex);
+    sched_thread_t* next = mutex->waiters;
+    if (next) {
+        mutex->waiters = next->wait_next;
+        next->wait_next = NULL;
+    }
+    atomic_store_explicit(&mutex->owner, next ? next->thread : NULL, memory_order_release);
+    mutex_guard_unlock(mutex);
+    
+    atomic_store_explicit(&record->inherited, MAX_PRIORITY_LEVELS, memory_order_relaxed);
+    
+    if (next) {
+        scheduler_unblock(next->thread);
+    }
+    return ERROR_NONE;
+}
+
+static void sleeper_expired(wheel_timer_t* timer) {
+    sleeper_t* sleeper = timer->arg;
+    thread_t* thread = sleeper->thread;
+    
+    /* The sleeper may return as soon as it sees this */
+    atomic_store_explicit(&sleeper->expired, true, memory_order_release);
+    scheduler_unblock(thread);
+}
+
+/**
+ * Sleep current thread
+ *
+ * A scheduler thread parks on a timer of its CPU, which the CPU runs
+ * other threads or idles around; elsewhere this sleeps the OS thread.
+ */
+error_code_t scheduler_sleep(uint64_t milliseconds) {
+    cpu_t* cpu = this_cpu();
+    if (!cpu || !cpu->current) {
+        struct timespec duration;
+        duration.tv_sec = (time_t)(milliseconds / 1000);
+        duration.tv_nsec = (long)(milliseconds % 1000) * 1000000L;
+        int result;
+        do {
+            result = nanosleep(&duration, &duration);
+        } while (result < 0 && errno == EINTR);
+        return ERROR_NONE;
+    }
+    
+    sleeper_t sleeper;
+    wheel_timer_init(&sleeper.timer, sleeper_expired, &sleeper);
+    sleeper.thread = cpu->current->thread;
+    atomic_init(&sleeper.expired, false);
+    
+    uint64_t now = now_ms();
+    timer_wheel_add(&cpu->timers, &sleeper.timer,
+                    milliseconds < UINT64_MAX - now ? now + milliseconds : UINT64_MAX);
+    
+    /* The timer fires on this CPU's loop, after the thread has switched out */
+    while (!atomic_load_explicit(&sleeper.expired, memory_order_acquire)) {
+        scheduler_block_current();
+    }
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Arm a timer on the calling CPU
+ *
+ * expires is in monotonic milliseconds. The callback runs on the CPU's
+ * scheduling loop, between threads, so it must not block; it may unblock
+ * threads and arm or cancel timers of the CPU. Only the CPU that armed a
+ * timer may cancel or move it, which makes these timers fit for threads
+ * bound to a CPU.
+ */
+error_code_t scheduler_timer_add(wheel_timer_t* timer, uint64_t expires) {
+    cpu_t* cpu = this_cpu();
+    if (!cpu || !timer || !timer->callback) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    if (wheel_timer_armed(timer) && timer->wheel != &cpu->timers) {
+        return ERROR_RESOURCE_BUSY;
+    }
+    
+    timer_wheel_add(&cpu->timers, timer, expires);
+    return ERROR_NONE;
+}
+
+/**
+ * Cancel a timer armed on the calling CPU
+ */
+error_code_t scheduler_timer_cancel(wheel_timer_t* timer) {
+    cpu_t* cpu = this_cpu();
+    if (!cpu || !timer) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    if (!wheel_timer_armed(timer)) {
+        return ERROR_NONE;
+    }
+    if (timer->wheel != &cpu->timers) {
+        return ERROR_RESOURCE_BUSY;
+    }
+    
+    timer_wheel_cancel(timer);
+    return ERROR_NONE;
+}
+
+/**
+ * Set scheduling policy
+ *
+ * Threads already queued keep their level until they are queued again.
+ */
+error_code_t scheduler_set_policy(scheduling_policy_t policy) {
+    if (!sched_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    if (policy > SCHED_POLICY_REALTIME) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    pthread_mutex_lock(&sched_state.lock);
+    if (atomic_exchange_explicit(&sched_state.policy, policy, memory_order_relaxed) != (int)policy) {
+        sched_state.optimization.policy_changes++;
+    }
+    pthread_mutex_unlock(&sched_state.lock);
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Set time slice
+ */
+error_code_t scheduler_set_time_slice(uint32_t milliseconds) {
+    if (!sched_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    if (milliseconds == 0) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    pthread_mutex_lock(&sched_state.lock);
+    if (atomic_exchange_explicit(&sched_state.time_slice, milliseconds, memory_order_relaxed) != milliseconds) {
+        sched_state.optimization.time_slice_adjustments++;
+    }
+    pthread_mutex_unlock(&sched_state.lock);
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Get time slice
+ */
+uint32_t scheduler_get_time_slice(void) {
+    return atomic_load_explicit(&sched_state.time_slice, memory_order_relaxed);
+}
+
+/**
+ * Enable/disable preemption
+ *
+ * Switching is cooperative; with preemption enabled, a yield after a full
+ * time slice counts as a preemption.
+ */
+error_code_t scheduler_set_preemption(bool enable) {
+    if (!sched_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    atomic_store_explicit(&sched_state.preemption_enabled, enable, memory_order_relaxed);
+    return ERROR_NONE;
+}
+
+/**
+ * Get scheduler metrics
+ *
+ * Times are totals over all CPUs since the scheduler started.
+ */
+error_code_t scheduler_get_metrics(scheduler_metrics_t* metrics) {
+    if (!sched_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    if (!metrics) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    memset(metrics, 0, sizeof(scheduler_metrics_t));
+    
+    uint64_t busy = stat_total(CPU_STAT_BUSY_NS);
+    uint64_t idle = stat_total(CPU_STAT_IDLE_NS);
+    uint64_t dispatches = stat_total(CPU_STAT_DISPATCHES);
+    uint64_t responses = stat_total(CPU_STAT_RESPONSES);
+    uint64_t exits = stat_total(CPU_STAT_EXITS);
+    
+    metrics->total_cpu_time = busy / 1000000;
+    metrics->idle_cpu_time = idle / 1000000;
+    metrics->context_switch_count = (uint32_t)stat_total(CPU_STAT_SWITCHES);
+    metrics->preemption_count = (uint32_t)stat_total(CPU_STAT_PREEMPTIONS);
+    
+    if (busy + idle > 0) {
+        metrics->cpu_utilization = (float)((double)busy / (double)(busy + idle));
+    }
+    if (dispatches > 0) {
+        metrics->average_wait_time = (float)((double)stat_total(CPU_STAT_WAIT_NS) / (double)dispatches / 1e6);
+    }
+    if (exits > 0) {
+        metrics->average_turnaround_time = (float)((double)stat_total(CPU_STAT_TURNAROUND_NS) / (double)exits / 1e6);
+    }
+    if (responses > 0) {
+        metrics->average_response_time = (float)((double)stat_total(CPU_STAT_RESPONSE_NS) / (double)responses / 1e6);
+    }
+    metrics->priority_inversions = atomic_load_explicit(&sched_state.priority_inversions, memory_order_relaxed);
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Get the scheduler's optimization history
+ *
+ * load_balancing_events counts threads taken from other CPUs and idle
+ * CPUs woken by scheduler_optimize.
+ */
+error_code_t scheduler_get_optimization(scheduler_optimization_t* optimization) {
+    if (!sched_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    if (!optimization) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    pthread_mutex_lock(&sched_state.lock);
+    *optimization = sched_state.optimization;
+    pthread_mutex_unlock(&sched_state.lock);
+    
+    optimization->load_balancing_events += (uint32_t)stat_total(CPU_STAT_STEALS);
+    return ERROR_NONE;
+}
+
+/**
+ * Analyze workload
+ *
+ * Measures how unevenly ready threads are spread over the CPUs and, under
+ * SCHED_POLICY_ADAPTIVE, sizes the time slice to the wait times seen since
+ * the last analysis: halved while threads wait more than two slices,
+ * doubled while they wait less than a quarter of one.
+ */
+error_code_t scheduler_analyze_workload(void) {
+    if (!sched_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    uint64_t total = 0;
+    uint64_t busiest = 0;
+    for (uint32_t i = 0; i < sched_state.cpu_count; i++) {
+        uint64_t queued = 0;
+        for (uint32_t level = 0; level < MAX_PRIORITY_LEVELS; level++) {
+            queued += (uint64_t)deque_size(&sched_state.cpus[i].queues[level]);
+        }
+        total += queued;
+        if (queued > busiest) {
+            busiest = queued;
+        }
+    }
+    
+    uint64_t wait_ns = stat_total(CPU_STAT_WAIT_NS);
+    uint64_t dispatches = stat_total(CPU_STAT_DISPATCHES);
+    
+    pthread_mutex_lock(&sched_state.lock);
+    
+    uint64_t average = total / sched_state.cpu_count;
+    sched_state.imbalance = (uint32_t)(busiest - average);
+    
+    uint64_t window_dispatches = dispatches - sched_state.analyzed_dispatches;
+    if (atomic_load_explicit(&sched_state.policy, memory_order_relaxed) == SCHED_POLICY_ADAPTIVE && window_dispatches > 0) {
+        uint64_t average_wait = (wait_ns - sched_state.analyzed_wait_ns) / window_dispatches;
+        uint32_t slice = atomic_load_explicit(&sched_state.time_slice, memory_order_relaxed);
+        uint64_t slice_ns = (uint64_t)slice * 1000000;
+        uint32_t adjusted = slice;
+    
+        if (average_wait > 2 * slice_ns && slice > MIN_TIME_SLICE) {
+            adjusted = slice / 2 > MIN_TIME_SLICE ? slice / 2 : MIN_TIME_SLICE;
+        } else if (average_wait < slice_ns / 4 && slice < MAX_TIME_SLICE) {
+            adjusted = slice * 2 < MAX_TIME_SLICE ? slice * 2 : MAX_TIME_SLICE;
+        }
+        if (adjusted != slice) {
+            atomic_store_explicit(&sched_state.time_slice, adjusted, memory_order_relaxed);
+            sched_state.optimization.time_slice_adjustments++;
+        }
+    }
+    sched_state.analyzed_wait_ns = wait_ns;
+    sched_state.analyzed_dispatches = dispatches;
+    
+    pthread_mutex_unlock(&sched_state.lock);
+    return ERROR_NONE;
+}
+
+/**
+ * Optimize scheduler
+ *
+ * Analyzes the workload and wakes idle CPUs to take threads over when one
+ * CPU holds more than IMBALANCE_THRESHOLD threads above the average.
+ */
+error_code_t scheduler_optimize(void) {
+    error_code_t err = scheduler_analyze_workload();
+    if (err != ERROR_NONE) {
+        return err;
+    }
+    
+    pthread_mutex_lock(&sched_state.lock);
+    bool rebalance = sched_state.imbalance > IMBALANCE_THRESHOLD &&
+                     atomic_load_explicit(&sched_state.idle_cpus, memory_order_relaxed) > 0;
+    if (rebalance) {
+        sched_state.optimization.load_balancing_events++;
+    }
+    pthread_mutex_unlock(&sched_state.lock);
+    
+    if (rebalance) {
+        notify_all();
+    }
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Apply a tuning action
+ *
+ * Takes a tuning_action_t setting TUNABLE_TIME_SLICE and reports the time
+ * slice it replaced.
+ */
+error_code_t scheduler_apply_optimization(void* optimization_data) {
+    if (!sched_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    tuning_action_t* action = optimization_data;
+    if (!action || action->tunable != TUNABLE_TIME_SLICE ||
+        action->value == 0 || action->value > UINT32_MAX) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    pthread_mutex_lock(&sched_state.lock);
+    uint32_t previous = atomic_exchange_explicit(&sched_state.time_slice, (uint32_t)action->value,
+                                                 memory_order_relaxed);
+    if (previous != action->value) {
+        sched_state.optimization.time_slice_adjustments++;
+    }
+    pthread_mutex_unlock(&sched_state.lock);
+    
+    action->previous = previous;
+    return ERROR_NONE;
+}
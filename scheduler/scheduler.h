@@ -10,6 +10,8 @@
 #define NEXOS_SCHEDULER_H
 
 #include "../kernel/kernel.h"
+#include "timer.h"
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -28,13 +30,14 @@ typedef struct {
     uint64_t program_counter;  /* Program counter */
     uint64_t stack_pointer;    /* Stack pointer */
     uint64_t status_register;  /* Status register */
-    /* Architecture-specific context data */
+    uint64_t fp_registers[8];  /* Floating point registers */
 } cpu_context_t;
 
-/* Run queue */
+/* Run queue (threads linked through queue_next/queue_prev) */
 typedef struct {
     uint32_t thread_count;     /* Number of threads in queue */
-    thread_t** threads;        /* Array of thread pointers */
+    thread_t* head;            /* Oldest thread */
+    thread_t* tail;            /* Newest thread */
 } run_queue_t;
 
 /* Scheduler state */
@@ -44,10 +47,20 @@ typedef struct {
     uint32_t context_switches;         /* Number of context switches */
     uint64_t last_context_switch;      /* Time of last context switch */
     run_queue_t run_queues[MAX_PRIORITY_LEVELS]; /* Run queues for each priority level */
+    uint32_t ready_levels;             /* Bit n set while run_queues[n] is not empty */
     thread_t* idle_thread;             /* Idle thread */
     bool preemption_enabled;           /* Whether preemption is enabled */
 } scheduler_state_t;
 
+/* Mutex between scheduler threads, with priority inheritance */
+typedef struct {
+    _Atomic(thread_t*) owner;          /* Holding thread, NULL if free */
+    _Atomic bool guard;                /* Spin lock over the waiters */
+    void* waiters;                     /* Blocked threads, highest priority first */
+} scheduler_mutex_t;
+
+#define SCHEDULER_MUTEX_INITIALIZER { NULL, false, NULL }
+
 /* Performance metrics for scheduler */
 typedef struct {
     uint64_t total_cpu_time;           /* Total CPU time in milliseconds */
@@ -75,6 +88,9 @@ error_code_t scheduler_init(void);
 /* Start scheduler */
 error_code_t scheduler_start(void);
 
+/* Pin each CPU to its own core of the process's allowed set (before starting) */
+error_code_t scheduler_set_pinning(bool pin);
+
 /* Add process to scheduler */
 error_code_t scheduler_add_process(process_t* process);
 
@@ -87,12 +103,21 @@ process_t* scheduler_find_process(uint32_t pid);
 /* Add thread to scheduler */
 error_code_t scheduler_add_thread(thread_t* thread);
 
+/* Bind a thread to a CPU (before adding it) */
+error_code_t scheduler_bind_thread(thread_t* thread, uint32_t cpu);
+
+/* Get the number of CPUs the scheduler runs on */
+uint32_t scheduler_get_cpu_count(void);
+
 /* Remove thread from scheduler */
 error_code_t scheduler_remove_thread(thread_t* thread);
 
 /* Find thread by ID */
 thread_t* scheduler_find_thread(uint32_t tid);
 
+/* Get the thread running on the calling CPU (NULL outside threads) */
+thread_t* scheduler_get_current(void);
+
 /* Initialize thread context */
 error_code_t scheduler_init_thread_context(thread_t* thread);
 
@@ -108,14 +133,30 @@ error_code_t scheduler_block_current(void);
 /* Unblock thread */
 error_code_t scheduler_unblock(thread_t* thread);
 
+/* Initialize a scheduler mutex */
+error_code_t scheduler_mutex_init(scheduler_mutex_t* mutex);
+
+/* Lock a scheduler mutex (scheduler threads only) */
+error_code_t scheduler_mutex_lock(scheduler_mutex_t* mutex);
+
+/* Unlock a scheduler mutex held by the calling thread */
+error_code_t scheduler_mutex_unlock(scheduler_mutex_t* mutex);
+
 /* Sleep current thread */
 error_code_t scheduler_sleep(uint64_t milliseconds);
 
+/* Arm a timer on the calling CPU (expires in monotonic ms) */
+error_code_t scheduler_timer_add(wheel_timer_t* timer, uint64_t expires);
+
+/* Cancel a timer armed on the calling CPU */
+error_code_t scheduler_timer_cancel(wheel_timer_t* timer);
+
 /* Set scheduling policy */
 error_code_t scheduler_set_policy(scheduling_policy_t policy);
 
 /* Set time slice */
 error_code_t scheduler_set_time_slice(uint32_t milliseconds);
+uint32_t scheduler_get_time_slice(void);
 
 /* Enable/disable preemption */
 error_code_t scheduler_set_preemption(bool enable);
@@ -123,6 +164,9 @@ error_code_t scheduler_set_preemption(bool enable);
 /* Get scheduler metrics */
 error_code_t scheduler_get_metrics(scheduler_metrics_t* metrics);
 
+/* Get scheduler optimization history */
+error_code_t scheduler_get_optimization(scheduler_optimization_t* optimization);
+
 /* Self-optimization interface */
 error_code_t scheduler_optimize(void);
 error_code_t scheduler_analyze_workload(void);
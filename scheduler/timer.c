@@ -0,0 +1,212 @@
+/**
+ * NexOS Scheduler - Timer Wheel
+ *
+ * This file implements the hierarchical timer wheel (see timer.h).
+ */
+
+#include "timer.h"
+
+/* List index of the due list */
+#define TIMER_LIST_DUE (TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS)
+
+static wheel_timer_t** list_head(timer_wheel_t* wheel, uint32_t list) {
+    return list == TIMER_LIST_DUE ? &wheel->due : &wheel->slots[list];
+}
+
+static void list_push(timer_wheel_t* wheel, wheel_timer_t* timer, uint32_t list) {
+    wheel_timer_t** head = list_head(wheel, list);
+    
+    timer->next = *head;
+    if (timer->next) {
+        timer->next->pprev = &timer->next;
+    }
+    *head = timer;
+    timer->pprev = head;
+    timer->list = list;
+    
+    if (list != TIMER_LIST_DUE) {
+        wheel->occupied[list / TIMER_WHEEL_SLOTS] |= 1ULL << (list % TIMER_WHEEL_SLOTS);
+    }
+}
+
+static void list_unlink(timer_wheel_t* wheel, wheel_timer_t* timer) {
+    *timer->pprev = timer->next;
+    if (timer->next) {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+    
+    if (timer->list != TIMER_LIST_DUE && !wheel->slots[timer->list]) {
+        wheel->occupied[timer->list / TIMER_WHEEL_SLOTS] &= ~(1ULL << (timer->list % TIMER_WHEEL_SLOTS));
+    }
+}
+
+/**
+ * Put a timer on the slot its expiry hashes to from the current tick
+ *
+ * That is the slot of the highest digit in which the two differ, which
+ * the wheel reaches before any later digit changes.
+ */
+static void wheel_place(timer_wheel_t* wheel, wheel_timer_t* timer) {
+    if (timer->expires <= wheel->now) {
+        list_push(wheel, timer, TIMER_LIST_DUE);
+        return;
+    }
+    
+    uint32_t level = (uint32_t)(63 - __builtin_clzll(timer->expires ^ wheel->now)) / TIMER_WHEEL_BITS;
+    uint32_t slot = (uint32_t)(timer->expires >> (level * TIMER_WHEEL_BITS)) & (TIMER_WHEEL_SLOTS - 1);
+    list_push(wheel, timer, level * TIMER_WHEEL_SLOTS + slot);
+}
+
+/**
+ * Get the lowest level holding timers (TIMER_WHEEL_LEVELS if none)
+ *
+ * Its first occupied slot is the next one the wheel reaches: every timer
+ * of a higher level lies beyond the slot the current tick is in there.
+ */
+static uint32_t lowest_level(const timer_wheel_t* wheel) {
+    for (uint32_t level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        if (wheel->occupied[level]) {
+            return level;
+        }
+    }
+    return TIMER_WHEEL_LEVELS;
+}
+
+/**
+ * Get the first tick of a slot on a level, in the current tick's range
+ */
+static uint64_t slot_start(const timer_wheel_t* wheel, uint32_t level, uint32_t slot) {
+    uint32_t shift = (level + 1) * TIMER_WHEEL_BITS;
+    uint64_t base = shift >= 64 ? 0 : wheel->now & ~((1ULL << shift) - 1);
+    return base | ((uint64_t)slot << (level * TIMER_WHEEL_BITS));
+}
+
+void timer_wheel_init(timer_wheel_t* wheel, uint64_t now) {
+    for (uint32_t i = 0; i < TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS; i++) {
+        wheel->slots[i] = NULL;
+    }
+    for (uint32_t level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        wheel->occupied[level] = 0;
+    }
+    wheel->due = NULL;
+    wheel->now = now;
+    wheel->count = 0;
+}
+
+void wheel_timer_init(wheel_timer_t* timer, wheel_timer_callback_t callback, void* arg) {
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->wheel = NULL;
+    timer->list = 0;
+    timer->expires = 0;
+    timer->period = 0;
+    timer->callback = callback;
+    timer->arg = arg;
+}
+
+/**
+ * Arm a timer
+ *
+ * A timer armed already, on this wheel or another, is moved.
+ */
+void timer_wheel_add(timer_wheel_t* wheel, wheel_timer_t* timer, uint64_t expires) {
+    timer_wheel_cancel(timer);
+    
+    timer->wheel = wheel;
+    timer->expires = expires;
+    wheel_place(wheel, timer);
+    wheel->count++;
+}
+
+void timer_wheel_cancel(wheel_timer_t* timer) {
+    if (!timer->pprev) {
+        return;
+    }
+    
+    list_unlink(timer->wheel, timer);
+    timer->wheel->count--;
+}
+
+/**
+ * Advance the wheel, firing due timers
+ *
+ * Moves from each occupied slot to the next, handing the timers of a
+ * higher level down to the levels below as their slot is reached, and
+ * fires the timers that have expired by then. Callbacks may add and
+ * cancel timers, this one included, and free a timer that is not
+ * periodic or that they cancelled; the wheel does not touch a timer once
+ * its callback has run.
+ */
+uint32_t timer_wheel_advance(timer_wheel_t* wheel, uint64_t now) {
+    uint32_t fired = 0;
+    
+    for (;;) {
+        while (wheel->due) {
+            wheel_timer_t* timer = wheel->due;
+            list_unlink(wheel, timer);
+            wheel->count--;
+    
+            if (timer->period) {
+                /* A periodic timer that fell behind skips the missed periods */
+                timer->expires += timer->period;
+                if (timer->expires <= wheel->now) {
+                    timer->expires = wheel->now + timer->period;
+                }
+                wheel_place(wheel, timer);
+                wheel->count++;
+            }
+    
+            timer->callback(timer);
+            fired++;
+        }
+    
+        uint32_t level = lowest_level(wheel);
+        if (level == TIMER_WHEEL_LEVELS) {
+            break;
+        }
+    
+        uint32_t slot = (uint32_t)__builtin_ctzll(wheel->occupied[level]);
+        uint64_t start = slot_start(wheel, level, slot);
+        if (start > now) {
+            break;
+        }
+    
+        /* Reach the slot and hash its timers again from there */
+        wheel->now = start;
+        wheel_timer_t* timer = wheel->slots[level * TIMER_WHEEL_SLOTS + slot];
+        wheel->slots[level * TIMER_WHEEL_SLOTS + slot] = NULL;
+        wheel->occupied[level] &= ~(1ULL << slot);
+    
+        while (timer) {
+            wheel_timer_t* next = timer->next;
+            wheel_place(wheel, timer);
+            timer = next;
+        }
+    }
+    
+    if (now > wheel->now) {
+        wheel->now = now;
+    }
+    return fired;
+}
+
+/**
+ * Get the tick the wheel next has to be advanced to
+ *
+ * The start of the next occupied slot: the first expiry if that slot is
+ * on level 0, otherwise the tick its timers move down a level.
+ */
+uint64_t timer_wheel_next(const timer_wheel_t* wheel) {
+    if (wheel->due) {
+        return wheel->now;
+    }
+    
+    uint32_t level = lowest_level(wheel);
+    if (level == TIMER_WHEEL_LEVELS) {
+        return UINT64_MAX;
+    }
+    
+    return slot_start(wheel, level, (uint32_t)__builtin_ctzll(wheel->occupied[level]));
+}
@@ -0,0 +1,79 @@
+/**
+ * NexOS Scheduler - Timer Wheel
+ *
+ * Hashed hierarchical timer wheel (Varghese and Lauck, SOSP 1987). Time is
+ * counted in ticks chosen by the owner (milliseconds everywhere in NexOS).
+ * Level n has 64 slots of 64^n ticks each: a timer sits on the level of
+ * the highest base-64 digit in which its expiry differs from the wheel's
+ * current tick, in the slot of that digit, and moves down a level each
+ * time the wheel reaches its slot, until it fires. Adding and cancelling
+ * a timer is a list operation; advancing skips empty slots through a
+ * bitmap per level, so an owner sleeps from one due slot to the next
+ * however many timers are armed.
+ *
+ * The timers are linked intrusively and owned by the caller. A wheel is
+ * not thread-safe: only its owner adds, cancels and advances.
+ */
+
+#ifndef NEXOS_SCHEDULER_TIMER_H
+#define NEXOS_SCHEDULER_TIMER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1U << TIMER_WHEEL_BITS)
+
+/* Enough levels of TIMER_WHEEL_BITS for any 64-bit tick */
+#define TIMER_WHEEL_LEVELS ((64 + TIMER_WHEEL_BITS - 1) / TIMER_WHEEL_BITS)
+
+typedef struct wheel_timer wheel_timer_t;
+
+/* Called with the timer disarmed (re-armed already if periodic) */
+typedef void (*wheel_timer_callback_t)(wheel_timer_t* timer);
+
+struct wheel_timer {
+    wheel_timer_t* next;
+    wheel_timer_t** pprev;     /* Link pointing at this timer, NULL while disarmed */
+    struct timer_wheel* wheel; /* Wheel the timer is armed on */
+    uint32_t list;             /* Slot index (level * slots + slot), or the due list */
+    uint64_t expires;          /* Tick the timer fires at */
+    uint64_t period;           /* Ticks between firings (0 = once) */
+    wheel_timer_callback_t callback;
+    void* arg;
+};
+
+typedef struct timer_wheel {
+    uint64_t now;              /* Tick the wheel has reached */
+    uint64_t occupied[TIMER_WHEEL_LEVELS]; /* Bit n set while slot n of the level holds timers */
+    wheel_timer_t* slots[TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS];
+    wheel_timer_t* due;        /* Expired, not fired yet */
+    uint32_t count;            /* Armed timers */
+} timer_wheel_t;
+
+/* Initialize an empty wheel at a tick */
+void timer_wheel_init(timer_wheel_t* wheel, uint64_t now);
+
+/* Initialize a disarmed timer */
+void wheel_timer_init(wheel_timer_t* timer, wheel_timer_callback_t callback, void* arg);
+
+/* Arm a timer to fire at a tick, moving it if armed already (fires at the
+   next advance if the tick has passed) */
+void timer_wheel_add(timer_wheel_t* wheel, wheel_timer_t* timer, uint64_t expires);
+
+/* Disarm a timer (nothing if not armed) */
+void timer_wheel_cancel(wheel_timer_t* timer);
+
+/* Advance to a tick, firing the timers due by then (returns how many fired) */
+uint32_t timer_wheel_advance(timer_wheel_t* wheel, uint64_t now);
+
+/* Tick the wheel next has to be advanced to, at or before the first
+   expiry (UINT64_MAX if no timer is armed) */
+uint64_t timer_wheel_next(const timer_wheel_t* wheel);
+
+static inline bool wheel_timer_armed(const wheel_timer_t* timer) {
+    return timer->pprev != NULL;
+}
+
+#endif /* NEXOS_SCHEDULER_TIMER_H */
@@ -0,0 +1,204 @@
+/**
+ * NexOS Security Subsystem - Integrity Hashing
+ *
+ * This file implements the keyed integrity hash and its stripe kernels
+ * (see integrity.h).
+ */
+
+#define _GNU_SOURCE
+#include "integrity.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/random.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_AVX2_KERNEL 1
+#endif
+
+#define STRIPE_SIZE 64
+#define BLOCK_STRIPES 16
+
+#define PRIME32_1 0x9E3779B1U
+#define PRIME32_2 0x85EBCA77U
+#define PRIME32_3 0xC2B2AE3DU
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+/* Accumulate stripes (at most BLOCK_STRIPES) into the eight lanes; stripe
+   s mixes with key words s to s + 7 */
+typedef void (*stripe_kernel_t)(uint64_t* acc, const uint8_t* data, size_t stripes,
+                                const uint64_t* key);
+
+static inline uint64_t read64(const uint8_t* p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+/**
+ * Portable kernel: each lane adds the product of the halves of its keyed
+ * word, and its neighbour the word itself
+ */
+static void accumulate_portable(uint64_t* acc, const uint8_t* data, size_t stripes,
+                                const uint64_t* key) {
+    for (size_t s = 0; s < stripes; s++) {
+        const uint8_t* stripe = data + s * STRIPE_SIZE;
+        for (uint32_t i = 0; i < 8; i++) {
+            uint64_t value = read64(stripe + i * 8);
+            uint64_t mixed = value ^ key[s + i];
+            acc[i ^ 1] += value;
+            acc[i] += (mixed & 0xFFFFFFFFULL) * (mixed >> 32);
+        }
+    }
+}
+
+#ifdef HAVE_AVX2_KERNEL
+/**
+ * AVX2 kernel: four lanes per register, the halves multiplied in one
+ * mul_epu32 and the words swapped into the neighbouring lanes by a shuffle
+ */
+__attribute__((target("avx2")))
+static void accumulate_avx2(uint64_t* acc, const uint8_t* data, size_t stripes,
+                            const uint64_t* key) {
+    __m256i low = _mm256_loadu_si256((const __m256i*)acc);
+    __m256i high = _mm256_loadu_si256((const __m256i*)(acc + 4));
+    
+    for (size_t s = 0; s < stripes; s++) {
+        const uint8_t* stripe = data + s * STRIPE_SIZE;
+        __m256i first = _mm256_loadu_si256((const __m256i*)stripe);
+        __m256i second = _mm256_loadu_si256((const __m256i*)(stripe + 32));
+        __m256i mixed_first = _mm256_xor_si256(first, _mm256_loadu_si256((const __m256i*)(key + s)));
+        __m256i mixed_second = _mm256_xor_si256(second, _mm256_loadu_si256((const __m256i*)(key + s + 4)));
+    
+        low = _mm256_add_epi64(low, _mm256_add_epi64(
+            _mm256_mul_epu32(mixed_first, _mm256_srli_epi64(mixed_first, 32)),
+            _mm256_shuffle_epi32(first, _MM_SHUFFLE(1, 0, 3, 2))));
+        high = _mm256_add_epi64(high, _mm256_add_epi64(
+            _mm256_mul_epu32(mixed_second, _mm256_srli_epi64(mixed_second, 32)),
+            _mm256_shuffle_epi32(second, _MM_SHUFFLE(1, 0, 3, 2))));
+    }
+    
+    _mm256_storeu_si256((__m256i*)acc, low);
+    _mm256_storeu_si256((__m256i*)(acc + 4), high);
+}
+#endif
+
+/**
+ * Pick the kernel for the running CPU
+ */
+static stripe_kernel_t select_kernel(void) {
+#if defined(HAVE_AVX2_KERNEL)
+    if (__builtin_cpu_supports("avx2")) {
+        return accumulate_avx2;
+    }
+#endif
+    return accumulate_portable;
+}
+
+/**
+ * Scramble the lanes after a block
+ */
+static void scramble(uint64_t* acc, const uint64_t* key) {
+    for (uint32_t i = 0; i < 8; i++) {
+        uint64_t lane = acc[i];
+        lane ^= lane >> 47;
+        lane ^= key[i];
+        acc[i] = lane * PRIME32_1;
+    }
+}
+
+/**
+ * Multiply two words into 128 bits and fold the halves together
+ */
+static uint64_t mul_fold(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+    __uint128_t product = (__uint128_t)a * b;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+#else
+    uint64_t lo_lo = (a & 0xFFFFFFFFULL) * (b & 0xFFFFFFFFULL);
+    uint64_t hi_lo = (a >> 32) * (b & 0xFFFFFFFFULL);
+    uint64_t lo_hi = (a & 0xFFFFFFFFULL) * (b >> 32);
+    uint64_t hi_hi = (a >> 32) * (b >> 32);
+    uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFFULL) + lo_hi;
+    uint64_t upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+    uint64_t lower = (cross << 32) | (lo_lo & 0xFFFFFFFFULL);
+    return lower ^ upper;
+#endif
+}
+
+/**
+ * Generate a random key
+ */
+error_code_t integrity_key_generate(integrity_key_t* key) {
+    if (!key) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    uint8_t* bytes = (uint8_t*)key->words;
+    size_t filled = 0;
+    while (filled < sizeof(key->words)) {
+        ssize_t result = getrandom(bytes + filled, sizeof(key->words) - filled, 0);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return ERROR_UNKNOWN;
+        }
+        filled += (size_t)result;
+    }
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Hash data under a key
+ *
+ * The last partial stripe is zero-padded; the size, mixed in when the
+ * lanes are merged, tells it apart from one really ending in zeroes.
+ */
+uint64_t integrity_hash(const integrity_key_t* key, const void* data, size_t size, uint64_t seed) {
+    uint64_t acc[8] = {
+        PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3,
+        PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1
+    };
+    for (uint32_t i = 0; i < 8; i++) {
+        acc[i] += seed ^ key->words[i];
+    }
+    
+    stripe_kernel_t accumulate = select_kernel();
+    const uint8_t* input = (const uint8_t*)data;
+    size_t stripes = size / STRIPE_SIZE;
+    
+    while (stripes >= BLOCK_STRIPES) {
+        accumulate(acc, input, BLOCK_STRIPES, key->words);
+        scramble(acc, key->words + INTEGRITY_KEY_WORDS - 8);
+        input += BLOCK_STRIPES * STRIPE_SIZE;
+        stripes -= BLOCK_STRIPES;
+    }
+    if (stripes > 0) {
+        accumulate(acc, input, stripes, key->words);
+        input += stripes * STRIPE_SIZE;
+    }
+    
+    size_t tail = size % STRIPE_SIZE;
+    if (tail > 0) {
+        uint8_t last[STRIPE_SIZE];
+        memset(last, 0, sizeof(last));
+        memcpy(last, input, tail);
+        accumulate(acc, last, 1, key->words + stripes);
+    }
+    
+    /* Merge the lanes and avalanche */
+    uint64_t result = (uint64_t)size * PRIME64_1;
+    for (uint32_t i = 0; i < 8; i += 2) {
+        result += mul_fold(acc[i] ^ key->words[8 + i], acc[i + 1] ^ key->words[9 + i]);
+    }
+    result ^= result >> 37;
+    result *= 0x165667919E3779F9ULL;
+    result ^= result >> 32;
+    return result;
+}
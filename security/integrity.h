@@ -0,0 +1,39 @@
+/**
+ * NexOS Security Subsystem - Integrity Hashing
+ *
+ * A keyed 64-bit hash in the style of XXH3: the input is consumed in
+ * stripes of 64 bytes into eight 64-bit accumulators, each lane mixing its
+ * word of the stripe with a word of the key and multiplying the halves of
+ * the result. The key window slides by one word per stripe, and the
+ * accumulators are scrambled with the key after every block of 16 stripes.
+ * The lanes are independent, so a stripe is two AVX2 operations wide on
+ * x86-64 CPUs that have it; other CPUs run portable code.
+ *
+ * Without the key, nobody can produce a hash that matches altered bytes, so
+ * a hash taken when data is sealed and checked before it is used detects
+ * any change made meanwhile. Keys come from the system's random source.
+ */
+
+#ifndef NEXOS_SECURITY_INTEGRITY_H
+#define NEXOS_SECURITY_INTEGRITY_H
+
+#include "../kernel/kernel.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* Key words: the window of the last stripe of a block ends at word 22,
+   and the scramble takes the last 8 */
+#define INTEGRITY_KEY_WORDS 24
+
+typedef struct {
+    uint64_t words[INTEGRITY_KEY_WORDS];
+} integrity_key_t;
+
+/* Generate a random key */
+error_code_t integrity_key_generate(integrity_key_t* key);
+
+/* Hash size bytes of data under a key, continuing from a seed (hash
+   several pieces by seeding each with the hash of the one before) */
+uint64_t integrity_hash(const integrity_key_t* key, const void* data, size_t size, uint64_t seed);
+
+#endif /* NEXOS_SECURITY_INTEGRITY_H */
@@ -5,8 +5,11 @@
  */
 
 #include "security.h"
+#include "integrity.h"
 #include "../memory/memory.h"
 #include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 /* Security state */
 static struct {
@@ -14,7 +17,16 @@ static struct {
     security_policy_descriptor_t policy;
     rollback_log_t rollback_log;
     uint32_t next_patch_id;
-} security_state = {0};
+    integrity_key_t key;           /* Key of patch and rollback hashes */
+    
+    /* Rollback log writers are serialized by the lock and bump the
+       sequence around their writes, odd while writing */
+    pthread_mutex_t lock;
+    _Atomic uint32_t log_sequence;
+    uint8_t* rollback_code;        /* Original code of each slot */
+} security_state = {
+    .lock = PTHREAD_MUTEX_INITIALIZER
+};
 
 /**
  * Initialize security subsystem
@@ -36,13 +48,32 @@ error_code_t security_init(void) {
     security_state.policy.max_patch_size = 4096;
     security_state.policy.max_patches_per_cycle = 5;
     
-    /* Initialize rollback log */
+    /* Key the integrity hashes */
+    error_code_t err = integrity_key_generate(&security_state.key);
+    if (err != ERROR_NONE) {
+        return err;
+    }
+    
+    /* Initialize rollback log, each slot with its own original code */
     security_state.rollback_log.entry_count = 0;
     security_state.rollback_log.entries = (rollback_entry_t*)memory_allocate(
-        sizeof(rollback_entry_t) * 100); /* Up to 100 rollback entries */
-    if (!security_state.rollback_log.entries) {
+        sizeof(rollback_entry_t) * SECURITY_ROLLBACK_SLOTS);
+    security_state.rollback_code = (uint8_t*)memory_allocate(
+        SECURITY_ROLLBACK_CODE_MAX * SECURITY_ROLLBACK_SLOTS);
+    if (!security_state.rollback_log.entries || !security_state.rollback_code) {
+        if (security_state.rollback_log.entries) {
+            memory_free(security_state.rollback_log.entries);
+        }
+        if (security_state.rollback_code) {
+            memory_free(security_state.rollback_code);
+        }
         return ERROR_MEMORY_ALLOCATION;
     }
+    memset(security_state.rollback_log.entries, 0, sizeof(rollback_entry_t) * SECURITY_ROLLBACK_SLOTS);
+    for (uint32_t i = 0; i < SECURITY_ROLLBACK_SLOTS; i++) {
+        security_state.rollback_log.entries[i].original_code =
+            security_state.rollback_code + (size_t)i * SECURITY_ROLLBACK_CODE_MAX;
+    }
     
     security_state.next_patch_id = 1;
     security_state.initialized = true;
@@ -74,7 +105,7 @@ error_code_t security_set_policy(security_policy_t policy) {
             security_state.policy.max_patch_size = 8192;
             security_state.policy.max_patches_per_cycle = 10;
             break;
-            
+    
         case SECURITY_POLICY_STANDARD:
             security_state.policy.allow_self_evolution = true;
             security_state.policy.allow_kernel_modifications = true;
@@ -86,7 +117,7 @@ error_code_t security_set_policy(security_policy_t policy) {
             security_state.policy.max_patch_size = 4096;
             security_state.policy.max_patches_per_cycle = 5;
             break;
-            
+    
         case SECURITY_POLICY_STRICT:
             security_state.policy.allow_self_evolution = true;
             security_state.policy.allow_kernel_modifications = false;
@@ -98,7 +129,7 @@ error_code_t security_set_policy(security_policy_t policy) {
             security_state.policy.max_patch_size = 2048;
             security_state.policy.max_patches_per_cycle = 3;
             break;
-            
+    
         case SECURITY_POLICY_PARANOID:
             security_state.policy.allow_self_evolution = false;
             security_state.policy.allow_kernel_modifications = false;
@@ -133,8 +164,61 @@ error_code_t security_get_policy(security_policy_descriptor_t* policy) {
     return ERROR_NONE;
 }
 
+/**
+ * Hash a patch: the descriptor fields that say what it does, then its code
+ */
+static uint64_t patch_hash(const patch_descriptor_t* patch) {
+    uint64_t fields[4] = {
+        patch->id | (uint64_t)patch->size << 32,
+        patch->timestamp,
+        patch->target_module | (uint64_t)patch->target_offset << 32,
+        patch->original_size
+    };
+    
+    uint64_t seed = integrity_hash(&security_state.key, fields, sizeof(fields), 0);
+    return integrity_hash(&security_state.key, patch->patch_code, patch->size, seed);
+}
+
+/**
+ * Hash a rollback entry and its original code
+ */
+static uint64_t entry_hash(const rollback_entry_t* entry) {
+    uint64_t fields[4] = {
+        entry->patch_id | (uint64_t)entry->original_size << 32,
+        entry->apply_timestamp,
+        entry->target_module | (uint64_t)entry->target_offset << 32,
+        0
+    };
+    
+    uint64_t seed = integrity_hash(&security_state.key, fields, sizeof(fields), 0);
+    return integrity_hash(&security_state.key, entry->original_code, entry->original_size, seed);
+}
+
+/**
+ * Seal a patch
+ *
+ * Verification checks the patch against the hash taken here, so the
+ * descriptor and code must not change in between.
+ */
+error_code_t security_seal_patch(patch_descriptor_t* patch) {
+    if (!security_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    if (!patch || !patch->patch_code || patch->size == 0 ||
+        patch->size > security_state.policy.max_patch_size) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    patch->integrity = patch_hash(patch);
+    return ERROR_NONE;
+}
+
 /**
  * Verify patch safety
+ *
+ * Fails with ERROR_PERMISSION_DENIED if the policy forbids the target or,
+ * when verification is required, the patch does not match its seal.
  */
 error_code_t security_verify_patch(void* patch, uint32_t size) {
     if (!security_state.initialized) {
@@ -146,7 +230,7 @@ error_code_t security_verify_patch(void* patch, uint32_t size) {
     }
     
     /* Check patch size */
-    if (size > security_state.policy.max_patch_size) {
+    if (size < sizeof(patch_descriptor_t) || size > security_state.policy.max_patch_size) {
         return ERROR_INVALID_PARAMETER;
     }
     
@@ -155,54 +239,84 @@ error_code_t security_verify_patch(void* patch, uint32_t size) {
     
     /* Check target module */
     switch (patch_desc->target_module) {
-        case 0: /* Kernel */
+        case PATCH_MODULE_KERNEL:
             if (!security_state.policy.allow_kernel_modifications) {
                 return ERROR_PERMISSION_DENIED;
             }
             break;
-            
-        case 1: /* Driver */
+    
+        case PATCH_MODULE_DRIVER:
             if (!security_state.policy.allow_driver_modifications) {
                 return ERROR_PERMISSION_DENIED;
             }
             break;
-            
-        case 2: /* Memory layout */
+    
+        case PATCH_MODULE_MEMORY:
             if (!security_state.policy.allow_memory_layout_changes) {
                 return ERROR_PERMISSION_DENIED;
             }
             break;
-            
-        case 3: /* Scheduler */
+    
+        case PATCH_MODULE_SCHEDULER:
             if (!security_state.policy.allow_scheduler_modifications) {
                 return ERROR_PERMISSION_DENIED;
             }
             break;
-            
+    
         default:
             return ERROR_INVALID_PARAMETER;
     }
     
-    /* Verify patch integrity */
-    /* In a real implementation, this would perform more sophisticated checks */
-    /* For now, we'll just do basic validation */
-    
     /* Check if patch has valid original code backup */
     if (!patch_desc->original_code || patch_desc->original_size == 0) {
         return ERROR_INVALID_PARAMETER;
     }
     
     /* Check if patch has valid patch code */
-    if (!patch_desc->patch_code || patch_desc->size == 0) {
+    if (!patch_desc->patch_code || patch_desc->size == 0 ||
+        patch_desc->size > security_state.policy.max_patch_size) {
         return ERROR_INVALID_PARAMETER;
     }
     
+    /* Verify patch integrity */
+    if (security_state.policy.require_verification && patch_desc->integrity != patch_hash(patch_desc)) {
+        return ERROR_PERMISSION_DENIED;
+    }
+    
     /* Mark patch as verified */
     patch_desc->verified = true;
     
     return ERROR_NONE;
 }
 
+/**
+ * Verify a cycle's patches
+ *
+ * Returns the number verified; patches past the policy's limit per cycle
+ * are left unverified.
+ */
+uint32_t security_verify_patches(void** patches, const uint32_t* sizes, uint32_t count) {
+    if (!security_state.initialized || !patches || !sizes) {
+        return 0;
+    }
+    
+    uint32_t verified = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        patch_descriptor_t* patch = (patch_descriptor_t*)patches[i];
+        if (!patch || sizes[i] < sizeof(patch_descriptor_t)) {
+            continue;
+        }
+    
+        patch->verified = false;
+        if (verified < security_state.policy.max_patches_per_cycle &&
+            security_verify_patch(patch, sizes[i]) == ERROR_NONE) {
+            verified++;
+        }
+    }
+    
+    return verified;
+}
+
 /**
  * Check evolution permission
  */
@@ -219,8 +333,40 @@ error_code_t security_check_evolution_permission(void) {
     return ERROR_NONE;
 }
 
+/**
+ * Begin writing the rollback log (called with the lock held)
+ */
+static void log_write_begin(void) {
+    uint32_t sequence = atomic_load_explicit(&security_state.log_sequence, memory_order_relaxed);
+    atomic_store_explicit(&security_state.log_sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+/**
+ * End writing the rollback log
+ */
+static void log_write_end(void) {
+    uint32_t sequence = atomic_load_explicit(&security_state.log_sequence, memory_order_relaxed);
+    atomic_store_explicit(&security_state.log_sequence, sequence + 1, memory_order_release);
+}
+
+/**
+ * Free a rollback entry (called with the lock held, inside a write)
+ */
+static void drop_entry(rollback_entry_t* entry) {
+    entry->patch_id = 0;
+    entry->integrity = 0;
+    security_state.rollback_log.entry_count--;
+}
+
 /**
  * Create rollback entry
+ *
+ * The entry takes the patch ID's slot and its original code is copied
+ * into the slot. While the slot still holds the entry of another patch
+ * (SECURITY_ROLLBACK_SLOTS IDs apart), which has not been rolled back,
+ * the patch is refused with ERROR_RESOURCE_BUSY rather than leaving that
+ * one without a way back.
  */
 error_code_t security_create_rollback_entry(patch_descriptor_t* patch) {
     if (!security_state.initialized) {
@@ -232,32 +378,85 @@ error_code_t security_create_rollback_entry(patch_descriptor_t* patch) {
     }
     
     /* Check if rollback is required */
-    if (security_state.policy.require_rollback_capability) {
-        /* Find next available rollback entry */
-        uint32_t entry_index = security_state.rollback_log.entry_count % 100;
-        
-        /* Initialize rollback entry */
-        rollback_entry_t* entry = &security_state.rollback_log.entries[entry_index];
-        entry->patch_id = patch->id;
-        entry->apply_timestamp = patch->timestamp;
-        
-        /* Copy original code */
-        entry->original_code = memory_allocate(patch->original_size);
-        if (!entry->original_code) {
-            return ERROR_MEMORY_ALLOCATION;
-        }
-        memcpy(entry->original_code, patch->original_code, patch->original_size);
-        
-        entry->original_size = patch->original_size;
-        entry->target_module = patch->target_module;
-        entry->target_offset = patch->target_offset;
-        
-        /* Update rollback log */
-        if (security_state.rollback_log.entry_count < 100) {
-            security_state.rollback_log.entry_count++;
-        }
+    if (!security_state.policy.require_rollback_capability) {
+        return ERROR_NONE;
+    }
+    
+    if (patch->id == 0 || !patch->original_code || patch->original_size == 0 ||
+        patch->original_size > SECURITY_ROLLBACK_CODE_MAX) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    pthread_mutex_lock(&security_state.lock);
+    rollback_entry_t* entry = &security_state.rollback_log.entries[patch->id & (SECURITY_ROLLBACK_SLOTS - 1)];
+    if (entry->patch_id != 0 && entry->patch_id != patch->id) {
+        pthread_mutex_unlock(&security_state.lock);
+        return ERROR_RESOURCE_BUSY;
+    }
+    
+    log_write_begin();
+    if (entry->patch_id == 0) {
+        security_state.rollback_log.entry_count++;
+    }
+    
+    /* Initialize rollback entry */
+    entry->patch_id = patch->id;
+    entry->apply_timestamp = patch->timestamp;
+    memcpy(entry->original_code, patch->original_code, patch->original_size);
+    entry->original_size = patch->original_size;
+    entry->target_module = patch->target_module;
+    entry->target_offset = patch->target_offset;
+    entry->integrity = entry_hash(entry);
+    
+    log_write_end();
+    pthread_mutex_unlock(&security_state.lock);
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Supersede a rollback entry
+ *
+ * The patch's entry takes the superseded patch's original code, so
+ * rolling the patch back restores what was there before either, and the
+ * superseded patch's entry is freed. Both must have live entries, and the
+ * superseded one must still match its hash.
+ */
+error_code_t security_supersede_rollback_entry(uint32_t patch_id, uint32_t superseded_id) {
+    if (!security_state.initialized) {
+        return ERROR_NOT_IMPLEMENTED;
+    }
+    
+    if (patch_id == 0 || superseded_id == 0 || patch_id == superseded_id) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    /* Without rollback capability there are no entries to supersede */
+    if (!security_state.policy.require_rollback_capability) {
+        return ERROR_NONE;
+    }
+    
+    pthread_mutex_lock(&security_state.lock);
+    rollback_entry_t* entry = &security_state.rollback_log.entries[patch_id & (SECURITY_ROLLBACK_SLOTS - 1)];
+    rollback_entry_t* superseded =
+        &security_state.rollback_log.entries[superseded_id & (SECURITY_ROLLBACK_SLOTS - 1)];
+    if (entry->patch_id != patch_id || superseded->patch_id != superseded_id) {
+        pthread_mutex_unlock(&security_state.lock);
+        return ERROR_INVALID_PARAMETER;
+    }
+    if (superseded->integrity != entry_hash(superseded)) {
+        pthread_mutex_unlock(&security_state.lock);
+        return ERROR_PERMISSION_DENIED;
     }
     
+    log_write_begin();
+    memcpy(entry->original_code, superseded->original_code, superseded->original_size);
+    entry->original_size = superseded->original_size;
+    entry->integrity = entry_hash(entry);
+    drop_entry(superseded);
+    log_write_end();
+    pthread_mutex_unlock(&security_state.lock);
+    
     return ERROR_NONE;
 }
 
@@ -269,16 +468,15 @@ error_code_t security_rollback_patch(uint32_t patch_id) {
         return ERROR_NOT_IMPLEMENTED;
     }
     
-    /* Find rollback entry for patch */
-    rollback_entry_t* entry = NULL;
-    for (uint32_t i = 0; i < security_state.rollback_log.entry_count; i++) {
-        if (security_state.rollback_log.entries[i].patch_id == patch_id) {
-            entry = &security_state.rollback_log.entries[i];
-            break;
-        }
+    if (patch_id == 0) {
+        return ERROR_INVALID_PARAMETER;
     }
     
-    if (!entry) {
+    /* Find rollback entry for patch */
+    pthread_mutex_lock(&security_state.lock);
+    rollback_entry_t* entry = &security_state.rollback_log.entries[patch_id & (SECURITY_ROLLBACK_SLOTS - 1)];
+    if (entry->patch_id != patch_id) {
+        pthread_mutex_unlock(&security_state.lock);
         return ERROR_INVALID_PARAMETER;
     }
     
@@ -286,11 +484,10 @@ error_code_t security_rollback_patch(uint32_t patch_id) {
     /* In a real implementation, this would modify the code at the target location */
     /* For now, we'll just simulate the rollback */
     
-    /* Free original code backup */
-    memory_free(entry->original_code);
-    
-    /* Mark entry as invalid */
-    entry->patch_id = 0;
+    log_write_begin();
+    drop_entry(entry);
+    log_write_end();
+    pthread_mutex_unlock(&security_state.lock);
     
     return ERROR_NONE;
 }
@@ -303,19 +500,34 @@ error_code_t security_rollback_all(void) {
         return ERROR_NOT_IMPLEMENTED;
     }
     
-    /* Rollback all patches in reverse order */
-    for (int i = security_state.rollback_log.entry_count - 1; i >= 0; i--) {
-        rollback_entry_t* entry = &security_state.rollback_log.entries[i];
-        if (entry->patch_id != 0) {
-            security_rollback_patch(entry->patch_id);
+    pthread_mutex_lock(&security_state.lock);
+    log_write_begin();
+    
+    /* Rollback all patches in reverse order, newest entry first (an old
+       patch's entry may sit beside ones many IDs newer) */
+    while (security_state.rollback_log.entry_count > 0) {
+        rollback_entry_t* newest = NULL;
+        for (uint32_t i = 0; i < SECURITY_ROLLBACK_SLOTS; i++) {
+            rollback_entry_t* entry = &security_state.rollback_log.entries[i];
+            if (entry->patch_id != 0 && (!newest || entry->patch_id > newest->patch_id)) {
+                newest = entry;
+            }
         }
+        drop_entry(newest);
     }
     
+    log_write_end();
+    pthread_mutex_unlock(&security_state.lock);
+    
     return ERROR_NONE;
 }
 
 /**
  * Get rollback log
+ *
+ * The entries are the log's own slots, not a copy, and may change while
+ * the caller reads them: a reader copies what it needs and then checks
+ * security_rollback_log_changed, starting over if it did.
  */
 error_code_t security_get_rollback_log(rollback_log_t* log) {
     if (!security_state.initialized) {
@@ -326,53 +538,54 @@ error_code_t security_get_rollback_log(rollback_log_t* log) {
         return ERROR_INVALID_PARAMETER;
     }
     
-    /* Copy rollback log */
+    log->sequence = atomic_load_explicit(&security_state.log_sequence, memory_order_acquire);
+    log->entries = security_state.rollback_log.entries;
     log->entry_count = security_state.rollback_log.entry_count;
-    log->entries = (rollback_entry_t*)memory_allocate(
-        sizeof(rollback_entry_t) * security_state.rollback_log.entry_count);
-    if (!log->entries) {
-        return ERROR_MEMORY_ALLOCATION;
-    }
     
-    /* Copy entries */
-    for (uint32_t i = 0; i < security_state.rollback_log.entry_count; i++) {
-        memcpy(&log->entries[i], &security_state.rollback_log.entries[i], 
-               sizeof(rollback_entry_t));
-        
-        /* Allocate and copy original code */
-        if (security_state.rollback_log.entries[i].original_code) {
-            log->entries[i].original_code = memory_allocate(
-                security_state.rollback_log.entries[i].original_size);
-            if (!log->entries[i].original_code) {
-                /* Free previously allocated entries */
-                for (uint32_t j = 0; j < i; j++) {
-                    memory_free(log->entries[j].original_code);
-                }
-                memory_free(log->entries);
-                return ERROR_MEMORY_ALLOCATION;
-            }
-            
-            memcpy(log->entries[i].original_code, 
-                   security_state.rollback_log.entries[i].original_code,
-                   security_state.rollback_log.entries[i].original_size);
-        }
+    return ERROR_NONE;
+}
+
+/**
+ * Check whether the rollback log changed since it was got
+ */
+bool security_rollback_log_changed(const rollback_log_t* log) {
+    if (!log) {
+        return true;
     }
     
-    return ERROR_NONE;
+    atomic_thread_fence(memory_order_acquire);
+    return (log->sequence & 1) ||
+           atomic_load_explicit(&security_state.log_sequence, memory_order_relaxed) != log->sequence;
 }
 
 /**
  * Verify system integrity
+ *
+ * Checks every rollback entry and its original code against its hash;
+ * fails with ERROR_PERMISSION_DENIED if one was altered.
  */
 error_code_t security_verify_integrity(void) {
     if (!security_state.initialized) {
         return ERROR_NOT_IMPLEMENTED;
     }
     
-    /* In a real implementation, this would verify the integrity of the system */
-    /* For now, we'll just return success */
+    error_code_t err = ERROR_NONE;
     
-    return ERROR_NONE;
+    pthread_mutex_lock(&security_state.lock);
+    for (uint32_t i = 0; i < SECURITY_ROLLBACK_SLOTS && err == ERROR_NONE; i++) {
+        const rollback_entry_t* entry = &security_state.rollback_log.entries[i];
+        if (entry->patch_id == 0) {
+            continue;
+        }
+        if ((entry->patch_id & (SECURITY_ROLLBACK_SLOTS - 1)) != i ||
+            entry->original_size > SECURITY_ROLLBACK_CODE_MAX ||
+            entry->integrity != entry_hash(entry)) {
+            err = ERROR_PERMISSION_DENIED;
+        }
+    }
+    pthread_mutex_unlock(&security_state.lock);
+    
+    return err;
 }
 
 /**
@@ -4,6 +4,17 @@
  * This file defines the security interface for NexOS.
  * The security subsystem is responsible for verifying self-evolution patches,
  * enforcing security policies, and protecting system integrity.
+ *
+ * Patches are sealed with a keyed hash (see integrity.h) when they are
+ * generated and checked against it when verified, a cycle's patches in
+ * one batch. The rollback log is a ring with a slot per patch ID modulo
+ * SECURITY_ROLLBACK_SLOTS, so finding a patch's entry is one index, and a
+ * patch whose slot is still taken by a patch not rolled back is refused.
+ * A patch superseding another takes over its entry's original code and
+ * frees its slot, so the log holds one entry per line of patches; the
+ * entries and their original code live in the ring and are hashed too, and
+ * readers get the ring itself, checked afterwards for changes under a
+ * sequence count, rather than a copy.
  */
 
 #ifndef NEXOS_SECURITY_H
@@ -45,6 +56,16 @@ typedef struct {
     uint32_t max_patches_per_cycle;        /* Maximum patches per cycle */
 } security_policy_descriptor_t;
 
+/* Patch target modules */
+#define PATCH_MODULE_KERNEL 0
+#define PATCH_MODULE_DRIVER 1              /* Drivers and the I/O subsystem */
+#define PATCH_MODULE_MEMORY 2              /* Memory layout and allocation */
+#define PATCH_MODULE_SCHEDULER 3
+
+/* Rollback log slots (a power of two), and the original code each keeps */
+#define SECURITY_ROLLBACK_SLOTS 128
+#define SECURITY_ROLLBACK_CODE_MAX 256
+
 /* Patch descriptor */
 typedef struct {
     uint32_t id;                           /* Patch ID */
@@ -57,6 +78,7 @@ typedef struct {
     void* patch_code;                      /* Patch code */
     bool applied;                          /* Whether patch is applied */
     bool verified;                         /* Whether patch is verified */
+    uint64_t integrity;                    /* Keyed hash sealing the patch */
 } patch_descriptor_t;
 
 /* Rollback entry */
@@ -67,12 +89,15 @@ typedef struct {
     uint32_t original_size;                /* Size of original code */
     uint32_t target_module;                /* Target module ID */
     uint32_t target_offset;                /* Target offset within module */
+    uint64_t integrity;                    /* Keyed hash of the entry and original code */
 } rollback_entry_t;
 
-/* Rollback log */
+/* Rollback log: entry i is the slot of patch IDs i modulo
+   SECURITY_ROLLBACK_SLOTS, free if its patch ID is 0 */
 typedef struct {
-    uint32_t entry_count;                  /* Number of entries */
-    rollback_entry_t* entries;             /* Array of entries */
+    uint32_t entry_count;                  /* Number of live entries */
+    rollback_entry_t* entries;             /* SECURITY_ROLLBACK_SLOTS entries */
+    uint32_t sequence;                     /* Change count when read */
 } rollback_log_t;
 
 /* Initialize security subsystem */
@@ -84,24 +109,39 @@ error_code_t security_set_policy(security_policy_t policy);
 /* Get security policy */
 error_code_t security_get_policy(security_policy_descriptor_t* policy);
 
+/* Seal a patch, hashing its descriptor and code */
+error_code_t security_seal_patch(patch_descriptor_t* patch);
+
 /* Verify patch safety */
 error_code_t security_verify_patch(void* patch, uint32_t size);
 
+/* Verify a cycle's patches (sizes as for security_verify_patch), marking
+   each verified or not; at most max_patches_per_cycle pass */
+uint32_t security_verify_patches(void** patches, const uint32_t* sizes, uint32_t count);
+
 /* Check evolution permission */
 error_code_t security_check_evolution_permission(void);
 
 /* Create rollback entry */
 error_code_t security_create_rollback_entry(patch_descriptor_t* patch);
 
+/* Supersede a patch's rollback entry, the patch's own entry taking over
+   its original code */
+error_code_t security_supersede_rollback_entry(uint32_t patch_id, uint32_t superseded_id);
+
 /* Rollback patch */
 error_code_t security_rollback_patch(uint32_t patch_id);
 
 /* Rollback all patches */
 error_code_t security_rollback_all(void);
 
-/* Get rollback log */
+/* Get the rollback log, read in place */
 error_code_t security_get_rollback_log(rollback_log_t* log);
 
+/* Check whether the rollback log changed since it was got, in which case
+   entries read from it may be torn */
+bool security_rollback_log_changed(const rollback_log_t* log);
+
 /* Verify system integrity */
 error_code_t security_verify_integrity(void);
 
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,6 +12,8 @@
 #include <dirent.h>
 #include <time.h>
 #include <ctype.h>
+#include <errno.h>
+#include <sys/sendfile.h>
 
 #define BUFFER_SIZE 4096
 #define SERVER_NAME "NexOS WebServer/1.0"
@@ -189,8 +192,11 @@ void handle_client(int client_fd) {
  * Serve a file
  */
 void serve_file(int client_fd, const char* path) {
-    FILE* file = fopen(path, "rb");
-    if (!file) {
+    int file_fd = open(path, O_RDONLY);
+    struct stat st;
+    if (file_fd < 0 || fstat(file_fd, &st) < 0) {
+        if (file_fd >= 0) close(file_fd);
+        
         char response[BUFFER_SIZE];
         snprintf(response, BUFFER_SIZE,
             "HTTP/1.1 404 Not Found\r\n"
@@ -204,10 +210,7 @@ void serve_file(int client_fd, const char* path) {
         return;
     }
     
-    /* Get file size */
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
+    long file_size = (long)st.st_size;
     
     /* Send headers */
     char headers[BUFFER_SIZE];
@@ -222,14 +225,19 @@ void serve_file(int client_fd, const char* path) {
     
     write(client_fd, headers, strlen(headers));
     
-    /* Send file content */
-    char buffer[BUFFER_SIZE];
-    size_t bytes_read;
-    while ((bytes_read = fread(buffer, 1, BUFFER_SIZE, file)) > 0) {
-        write(client_fd, buffer, bytes_read);
+    /* Send file content straight from the page cache */
+    off_t offset = 0;
+    while (offset < file_size) {
+        ssize_t sent = sendfile(client_fd, file_fd, &offset, file_size - offset);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            break;  /* Client went away */
+        }
     }
     
-    fclose(file);
+    close(file_fd);
 }
 
 /**
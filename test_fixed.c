@@ -56,6 +56,29 @@ error_code_t memory_free(void* ptr) {
     return ERROR_NONE;
 }
 
+memory_cache_t* memory_cache_create(const char* name, uint32_t object_size) {
+    static memory_cache_t caches[MEMORY_MAX_CACHES];
+    static uint32_t cache_count;
+    if (cache_count == MEMORY_MAX_CACHES) {
+        return NULL;
+    }
+    memory_cache_t* cache = &caches[cache_count];
+    snprintf(cache->name, sizeof(cache->name), "%s", name);
+    cache->object_size = object_size;
+    cache->class_index = MEMORY_SIZE_CLASSES + cache_count++;
+    return cache;
+}
+
+void* memory_cache_alloc(memory_cache_t* cache) {
+    return malloc(cache->object_size);
+}
+
+error_code_t memory_cache_free(memory_cache_t* cache, void* ptr) {
+    (void)cache;
+    free(ptr);
+    return ERROR_NONE;
+}
+
 error_code_t scheduler_init(void) {
     printf("Scheduler initialized\n");
     return ERROR_NONE;
@@ -0,0 +1,247 @@
+/**
+ * NexOS Web Server - HTTP Request Parser Tests
+ *
+ * Feeds request heads to the parser the way a connection does, a read at a
+ * time into one buffer, and checks the results the server acts on. Run by
+ * `make test`; exits non-zero if a check fails.
+ */
+
+#include "../webserver/http_parser.h"
+#include <stdio.h>
+#include <string.h>
+
+#define BUFFER_CAPACITY 1024
+
+static int failures = 0;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        printf("  FAIL %s:%d: %s\n", __FILE__, __LINE__, #condition); \
+        failures++; \
+    } \
+} while (0)
+
+/* Connection stand-in: a receive buffer and the request parsed from it */
+typedef struct {
+    char buffer[BUFFER_CAPACITY];
+    uint32_t length;
+    http_parser_t parser;
+    http_request_t request;
+} test_conn_t;
+
+/**
+ * Start a connection with an empty buffer
+ */
+static void conn_init(test_conn_t* conn) {
+    conn->length = 0;
+    http_parser_init(&conn->parser, &conn->request);
+}
+
+/**
+ * Append received bytes and parse what has arrived
+ */
+static http_parse_result_t conn_receive(test_conn_t* conn, const char* data, uint32_t length) {
+    if (length > BUFFER_CAPACITY - conn->length) {
+        length = BUFFER_CAPACITY - conn->length;
+    }
+    memcpy(conn->buffer + conn->length, data, length);
+    conn->length += length;
+    
+    return http_parser_execute(&conn->parser, &conn->request, conn->buffer, conn->length,
+                               BUFFER_CAPACITY);
+}
+
+/**
+ * Drop the parsed head from the buffer and parse the next request in it
+ */
+static http_parse_result_t conn_next(test_conn_t* conn) {
+    uint32_t head_length = conn->parser.head_length;
+    memmove(conn->buffer, conn->buffer + head_length, conn->length - head_length);
+    conn->length -= head_length;
+    
+    http_parser_init(&conn->parser, &conn->request);
+    return http_parser_execute(&conn->parser, &conn->request, conn->buffer, conn->length,
+                               BUFFER_CAPACITY);
+}
+
+/**
+ * Parse a whole request head in one read
+ */
+static http_parse_result_t parse(test_conn_t* conn, const char* head) {
+    conn_init(conn);
+    return conn_receive(conn, head, (uint32_t)strlen(head));
+}
+
+/**
+ * Value of a request header
+ */
+static const char* header_value(const test_conn_t* conn, http_header_id_t id, uint32_t* length) {
+    const http_header_t* header = http_request_header(&conn->request, id);
+    if (!header) {
+        return NULL;
+    }
+    
+    *length = header->value.length;
+    return conn->request.head + header->value.offset;
+}
+
+static void test_split_head(void) {
+    const char* head = "GET /dir/a%20b.html?x=1 HTTP/1.1\r\nHost: example\r\nAccept-Encoding: gzip\r\n\r\n";
+    uint32_t length = (uint32_t)strlen(head);
+    test_conn_t conn;
+    
+    /* Every split point, including inside the CRLFs, gives the same request */
+    for (uint32_t split = 1; split < length; split++) {
+        conn_init(&conn);
+        CHECK(conn_receive(&conn, head, split) == HTTP_PARSE_INCOMPLETE);
+        CHECK(conn_receive(&conn, head + split, length - split) == HTTP_PARSE_COMPLETE);
+        CHECK(conn.request.method == HTTP_METHOD_GET);
+        CHECK(strcmp(conn.request.path, "/dir/a b.html") == 0);
+        CHECK(conn.request.query.length == 3);
+        CHECK(conn.request.accept_encoding == HTTP_ENCODING_GZIP);
+        CHECK(conn.parser.head_length == length);
+    }
+    
+    /* One byte at a time */
+    conn_init(&conn);
+    http_parse_result_t result = HTTP_PARSE_INCOMPLETE;
+    for (uint32_t i = 0; i < length; i++) {
+        CHECK(result == HTTP_PARSE_INCOMPLETE);
+        result = conn_receive(&conn, head + i, 1);
+    }
+    CHECK(result == HTTP_PARSE_COMPLETE);
+    
+    uint32_t host_length = 0;
+    const char* host = header_value(&conn, HTTP_HEADER_HOST, &host_length);
+    CHECK(host && host_length == 7 && memcmp(host, "example", 7) == 0);
+}
+
+static void test_pipelined(void) {
+    test_conn_t conn;
+    
+    CHECK(parse(&conn, "GET /one HTTP/1.1\r\n\r\n"
+                       "HEAD /two HTTP/1.1\r\nConnection: close\r\n\r\n"
+                       "GET /th") == HTTP_PARSE_COMPLETE);
+    CHECK(strcmp(conn.request.path, "/one") == 0);
+    CHECK(conn.request.keep_alive);
+    
+    CHECK(conn_next(&conn) == HTTP_PARSE_COMPLETE);
+    CHECK(conn.request.method == HTTP_METHOD_HEAD);
+    CHECK(strcmp(conn.request.path, "/two") == 0);
+    CHECK(!conn.request.keep_alive);
+    
+    /* The third request is still arriving */
+    CHECK(conn_next(&conn) == HTTP_PARSE_INCOMPLETE);
+    CHECK(conn_receive(&conn, "ree HTTP/1.0\r\n\r\n", 16) == HTTP_PARSE_COMPLETE);
+    CHECK(strcmp(conn.request.path, "/three") == 0);
+    CHECK(!conn.request.keep_alive);
+}
+
+static void test_content_length(void) {
+    test_conn_t conn;
+    
+    CHECK(parse(&conn, "POST / HTTP/1.1\r\nContent-Length: 42\r\n\r\n") == HTTP_PARSE_COMPLETE);
+    CHECK(conn.request.body_length == 42);
+    
+    /* Repeated with the same value is accepted, conflicting values are not */
+    CHECK(parse(&conn, "POST / HTTP/1.1\r\nContent-Length: 42\r\nContent-Length: 42\r\n\r\n") ==
+          HTTP_PARSE_COMPLETE);
+    CHECK(conn.request.body_length == 42);
+    CHECK(parse(&conn, "POST / HTTP/1.1\r\nContent-Length: 42\r\nContent-Length: 43\r\n\r\n") ==
+          HTTP_PARSE_ERROR);
+    CHECK(parse(&conn, "POST / HTTP/1.1\r\nContent-Length: 42\r\ncontent-length: 0\r\n\r\n") ==
+          HTTP_PARSE_ERROR);
+    
+    CHECK(parse(&conn, "POST / HTTP/1.1\r\nContent-Length: -1\r\n\r\n") == HTTP_PARSE_ERROR);
+    CHECK(parse(&conn, "POST / HTTP/1.1\r\nContent-Length: 4 2\r\n\r\n") == HTTP_PARSE_ERROR);
+    CHECK(parse(&conn, "POST / HTTP/1.1\r\nContent-Length:\r\n\r\n") == HTTP_PARSE_ERROR);
+    CHECK(parse(&conn, "POST / HTTP/1.1\r\nContent-Length: 1234567890123456789\r\n\r\n") ==
+          HTTP_PARSE_ERROR);
+}
+
+static void test_transfer_encoding(void) {
+    test_conn_t conn;
+    
+    /* Bodies are framed by Content-Length only */
+    CHECK(parse(&conn, "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n") == HTTP_PARSE_ERROR);
+    CHECK(parse(&conn, "POST / HTTP/1.1\r\nContent-Length: 5\r\nTransfer-Encoding: chunked\r\n\r\n") ==
+          HTTP_PARSE_ERROR);
+    CHECK(parse(&conn, "POST / HTTP/1.1\r\nTRANSFER-ENCODING: identity\r\n\r\n") == HTTP_PARSE_ERROR);
+}
+
+static void test_target(void) {
+    test_conn_t conn;
+    
+    CHECK(parse(&conn, "GET /a/..b/c.. HTTP/1.1\r\n\r\n") == HTTP_PARSE_COMPLETE);
+    CHECK(strcmp(conn.request.path, "/a/..b/c..") == 0);
+    
+    /* ".." segments, encoded or not */
+    CHECK(parse(&conn, "GET /../etc/passwd HTTP/1.1\r\n\r\n") == HTTP_PARSE_ERROR);
+    CHECK(parse(&conn, "GET /a/.. HTTP/1.1\r\n\r\n") == HTTP_PARSE_ERROR);
+    CHECK(parse(&conn, "GET /%2e%2e/etc/passwd HTTP/1.1\r\n\r\n") == HTTP_PARSE_ERROR);
+    CHECK(parse(&conn, "GET /a/.%2E HTTP/1.1\r\n\r\n") == HTTP_PARSE_ERROR);
+    CHECK(parse(&conn, "GET /a%2f..%2fb HTTP/1.1\r\n\r\n") == HTTP_PARSE_ERROR);
+    
+    /* Control bytes, encoded or not, and bad escapes */
+    CHECK(parse(&conn, "GET /a%00.html HTTP/1.1\r\n\r\n") == HTTP_PARSE_ERROR);
+    CHECK(parse(&conn, "GET /a%0d%0aX:y HTTP/1.1\r\n\r\n") == HTTP_PARSE_ERROR);
+    CHECK(parse(&conn, "GET /a\x01 HTTP/1.1\r\n\r\n") == HTTP_PARSE_ERROR);
+    CHECK(parse(&conn, "GET /a%7f HTTP/1.1\r\n\r\n") == HTTP_PARSE_ERROR);
+    CHECK(parse(&conn, "GET /a%2 HTTP/1.1\r\n\r\n") == HTTP_PARSE_ERROR);
+    CHECK(parse(&conn, "GET /a%zz HTTP/1.1\r\n\r\n") == HTTP_PARSE_ERROR);
+    
+    /* A raw NUL in the target is a control byte too */
+    test_conn_t raw;
+    conn_init(&raw);
+    CHECK(conn_receive(&raw, "GET /a\0b HTTP/1.1\r\n\r\n", 22) == HTTP_PARSE_ERROR);
+}
+
+static void test_oversized(void) {
+    test_conn_t conn;
+    char head[BUFFER_CAPACITY + 64];
+    
+    /* A head still incomplete once it fills the buffer is answered with
+       431 Request Header Fields Too Large */
+    int length = snprintf(head, sizeof(head), "GET / HTTP/1.1\r\nCookie: ");
+    memset(head + length, 'a', sizeof(head) - (size_t)length);
+    conn_init(&conn);
+    CHECK(conn_receive(&conn, head, BUFFER_CAPACITY - 1) == HTTP_PARSE_INCOMPLETE);
+    CHECK(conn_receive(&conn, head + BUFFER_CAPACITY - 1, 1) == HTTP_PARSE_TOO_LARGE);
+    
+    /* So is one with more headers than a request holds */
+    length = snprintf(head, sizeof(head), "GET / HTTP/1.1\r\n");
+    for (int i = 0; i <= HTTP_MAX_HEADERS; i++) {
+        length += snprintf(head + length, sizeof(head) - (size_t)length, "a:\r\n");
+    }
+    snprintf(head + length, sizeof(head) - (size_t)length, "\r\n");
+    CHECK(parse(&conn, head) == HTTP_PARSE_TOO_LARGE);
+    
+    /* A head that fits exactly is complete */
+    length = snprintf(head, sizeof(head), "GET / HTTP/1.1\r\nCookie: ");
+    memset(head + length, 'a', BUFFER_CAPACITY - 4 - (size_t)length);
+    memcpy(head + BUFFER_CAPACITY - 4, "\r\n\r\n", 4);
+    conn_init(&conn);
+    CHECK(conn_receive(&conn, head, BUFFER_CAPACITY) == HTTP_PARSE_COMPLETE);
+}
+
+int main(void) {
+    struct {
+        const char* name;
+        void (*run)(void);
+    } tests[] = {
+        { "split head", test_split_head },
+        { "pipelined requests", test_pipelined },
+        { "Content-Length", test_content_length },
+        { "Transfer-Encoding", test_transfer_encoding },
+        { "request target", test_target },
+        { "oversized head", test_oversized }
+    };
+    
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        int before = failures;
+        tests[i].run();
+        printf("%s: %s\n", failures == before ? "ok" : "FAILED", tests[i].name);
+    }
+    
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,740 @@
+/**
+ * NexOS Web Server - Static Asset Cache
+ *
+ * This file implements the per-worker static asset cache. Assets are
+ * reference counted: the cache holds one reference while the asset is
+ * cached and every response sending it holds another, so an asset that is
+ * evicted or invalidated mid-response stays valid until it is released.
+ *
+ * Dynamic compression uses zlib (HAVE_ZLIB) and the brotli encoder
+ * (HAVE_BROTLI) when built with them; precompressed siblings are served
+ * either way.
+ */
+
+#define _GNU_SOURCE
+#include "asset_cache.h"
+#include "../io/io.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+/* Directory changes that invalidate cached files */
+#define WATCH_EVENTS (IN_CREATE | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | \
+                      IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF)
+
+/**
+ * Hash a cache key (FNV-1a)
+ */
+static uint32_t hash_key(const char* key) {
+    uint32_t hash = 2166136261u;
+    
+    while (*key) {
+        hash ^= (unsigned char)*key++;
+        hash *= 16777619u;
+    }
+    
+    return hash;
+}
+
+/* Sibling file suffixes and Content-Encoding values per variant */
+static const struct {
+    const char* suffix;
+    const char* etag_suffix;
+    const char* coding;
+    uint32_t encoding;
+} variant_info[ASSET_VARIANT_COUNT] = {
+    [ASSET_VARIANT_IDENTITY] = { "", "", NULL, HTTP_ENCODING_IDENTITY },
+    [ASSET_VARIANT_GZIP] = { ".gz", "-gz", "gzip", HTTP_ENCODING_GZIP },
+    [ASSET_VARIANT_BROTLI] = { ".br", "-br", "br", HTTP_ENCODING_BROTLI }
+};
+
+/**
+ * Get the memory charged to the cache for an asset
+ */
+static size_t asset_cost(const asset_t* asset) {
+    size_t cost = sizeof(asset_t) + strlen(asset->key) + strlen(asset->file_path) + 2;
+    
+    for (int i = 0; i < ASSET_VARIANT_COUNT; i++) {
+        if (asset->variants[i].data) {
+            cost += asset->variants[i].size + asset->variants[i].headers_length;
+        }
+    }
+    
+    return cost;
+}
+
+/**
+ * Free an asset
+ */
+static void free_asset(asset_t* asset) {
+    for (int i = 0; i < ASSET_VARIANT_COUNT; i++) {
+        free(asset->variants[i].data);
+        free(asset->variants[i].headers);
+    }
+    free(asset->key);
+    free(asset->file_path);
+    free(asset);
+}
+
+/**
+ * Read size bytes of an open file into a new buffer
+ *
+ * Goes through the I/O subsystem's file layer, which maps large files and
+ * reads them ahead.
+ */
+static char* read_file(int fd, size_t size) {
+    file_t* file;
+    if (io_attach_file(fd, O_RDONLY, &file) != ERROR_NONE) {
+        return NULL;
+    }
+    
+    char* data = malloc(size > 0 ? size : 1);
+    size_t total = 0;
+    while (data && total < size) {
+        size_t chunk = size - total < UINT32_MAX ? size - total : UINT32_MAX;
+        uint32_t n;
+        if (io_read(file, data + total, (uint32_t)chunk, &n) != ERROR_NONE || n == 0) {
+            free(data);
+            data = NULL;
+            break;
+        }
+        total += n;
+    }
+    
+    io_close(file);
+    return data;
+}
+
+/**
+ * Load a precompressed sibling (file_path + suffix) that is at least as new as the file
+ */
+static char* load_sibling(const char* file_path, const char* suffix, const struct stat* st,
+                          size_t max_size, size_t* size) {
+    char path[4096];
+    if ((size_t)snprintf(path, sizeof(path), "%s%s", file_path, suffix) >= sizeof(path)) {
+        return NULL;
+    }
+    
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    
+    char* data = NULL;
+    struct stat sibling;
+    if (fstat(fd, &sibling) == 0 && S_ISREG(sibling.st_mode) && sibling.st_mtime >= st->st_mtime &&
+        (size_t)sibling.st_size <= max_size) {
+        *size = (size_t)sibling.st_size;
+        data = read_file(fd, *size);
+    }
+    
+    close(fd);
+    return data;
+}
+
+/**
+ * Compress data into a variant's encoding
+ */
+static char* compress_variant(asset_variant_id_t id, const char* data, size_t size, size_t* compressed_size) {
+#ifdef HAVE_ZLIB
+    if (id == ASSET_VARIANT_GZIP) {
+        z_stream stream;
+        memset(&stream, 0, sizeof(stream));
+    
+        /* Window bits + 16 selects the gzip wrapper */
+        if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+            return NULL;
+        }
+    
+        size_t bound = deflateBound(&stream, (uLong)size);
+        char* out = malloc(bound);
+        if (!out) {
+            deflateEnd(&stream);
+            return NULL;
+        }
+    
+        stream.next_in = (Bytef*)data;
+        stream.avail_in = (uInt)size;
+        stream.next_out = (Bytef*)out;
+        stream.avail_out = (uInt)bound;
+        int result = deflate(&stream, Z_FINISH);
+        *compressed_size = stream.total_out;
+        deflateEnd(&stream);
+    
+        if (result != Z_STREAM_END) {
+            free(out);
+            return NULL;
+        }
+        return out;
+    }
+#endif
+#ifdef HAVE_BROTLI
+    if (id == ASSET_VARIANT_BROTLI) {
+        size_t bound = BrotliEncoderMaxCompressedSize(size);
+        char* out = bound ? malloc(bound) : NULL;
+        if (!out) {
+            return NULL;
+        }
+    
+        /* Quality 9 keeps the one-off compression cost low for the worker */
+        *compressed_size = bound;
+        if (!BrotliEncoderCompress(9, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, size,
+                                   (const uint8_t*)data, compressed_size, (uint8_t*)out)) {
+            free(out);
+            return NULL;
+        }
+        return out;
+    }
+#endif
+    (void)id;
+    (void)data;
+    (void)size;
+    (void)compressed_size;
+    return NULL;
+}
+
+/**
+ * Pre-render a variant's validator and content headers
+ */
+static bool render_variant(asset_variant_t* variant, asset_variant_id_t id, const char* base_etag,
+                           time_t mtime, const char* mime_type, bool vary) {
+    char etag[64];
+    char date[64];
+    size_t etag_length = (size_t)snprintf(etag, sizeof(etag), "%s", base_etag);
+    asset_format_http_date(date, sizeof(date), mtime);
+    
+    /* Each representation needs its own entity tag */
+    if (variant_info[id].etag_suffix[0] && etag_length > 0) {
+        etag_length += (size_t)snprintf(etag + etag_length - 1, sizeof(etag) - etag_length + 1,
+                                        "%s\"", variant_info[id].etag_suffix) - 1;
+    }
+    
+    size_t capacity = etag_length + strlen(date) + strlen(mime_type) + 192;
+    variant->headers = malloc(capacity);
+    if (!variant->headers) {
+        return false;
+    }
+    
+    int validators = snprintf(variant->headers, capacity, "ETag: %s\r\nLast-Modified: %s\r\n%s",
+                              etag, date, vary ? "Vary: Accept-Encoding\r\n" : "");
+    int length = 0;
+    if (variant_info[id].coding) {
+        length = snprintf(variant->headers + validators, capacity - (size_t)validators,
+                          "Content-Encoding: %s\r\n", variant_info[id].coding);
+    }
+    length += snprintf(variant->headers + validators + length, capacity - (size_t)(validators + length),
+                       "Content-Type: %s\r\nContent-Length: %zu\r\nAccept-Ranges: bytes\r\n",
+                       mime_type, variant->size);
+    
+    variant->validators_length = (size_t)validators;
+    variant->headers_length = (size_t)(validators + length);
+    variant->etag = variant->headers + 6;
+    variant->etag_length = etag_length;
+    return true;
+}
+
+/**
+ * Unlink an asset from the LRU list
+ */
+static void lru_unlink(asset_cache_t* cache, asset_t* asset) {
+    if (asset->lru_prev) {
+        asset->lru_prev->lru_next = asset->lru_next;
+    } else {
+        cache->lru_head = asset->lru_next;
+    }
+    if (asset->lru_next) {
+        asset->lru_next->lru_prev = asset->lru_prev;
+    } else {
+        cache->lru_tail = asset->lru_prev;
+    }
+    asset->lru_prev = NULL;
+    asset->lru_next = NULL;
+}
+
+/**
+ * Insert an asset at the head of the LRU list
+ */
+static void lru_push(asset_cache_t* cache, asset_t* asset) {
+    asset->lru_prev = NULL;
+    asset->lru_next = cache->lru_head;
+    if (cache->lru_head) {
+        cache->lru_head->lru_prev = asset;
+    } else {
+        cache->lru_tail = asset;
+    }
+    cache->lru_head = asset;
+}
+
+/**
+ * Remove an asset from the cache and drop the cache's reference
+ */
+static void remove_asset(asset_cache_t* cache, asset_t* asset) {
+    asset_t** link = &cache->buckets[asset->hash & (ASSET_CACHE_BUCKETS - 1)];
+    while (*link != asset) {
+        link = &(*link)->bucket_next;
+    }
+    *link = asset->bucket_next;
+    
+    lru_unlink(cache, asset);
+    cache->used -= asset_cost(asset);
+    asset->cached = false;
+    asset_cache_release(asset);
+}
+
+/**
+ * Check whether a changed file name is an asset's file or one of its precompressed siblings
+ */
+static bool name_matches(const asset_t* asset, const char* name) {
+    /* Any change inside a directory alters its listing */
+    if (asset->directory) {
+        return true;
+    }
+    
+    size_t length = strlen(asset->name);
+    
+    if (strncmp(asset->name, name, length) != 0) {
+        return false;
+    }
+    
+    for (int i = 0; i < ASSET_VARIANT_COUNT; i++) {
+        if (strcmp(name + length, variant_info[i].suffix) == 0) {
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+/**
+ * Remove every cached asset matching a watch (and name, if given)
+ */
+static void invalidate(asset_cache_t* cache, int watch, const char* name) {
+    asset_t* asset = cache->lru_head;
+    
+    while (asset) {
+        asset_t* next = asset->lru_next;
+        if (watch < 0 || (asset->watch == watch && (!name || name_matches(asset, name)))) {
+            remove_asset(cache, asset);
+        }
+        asset = next;
+    }
+}
+
+/**
+ * Initialize an asset cache
+ */
+error_code_t asset_cache_init(asset_cache_t* cache, size_t capacity) {
+    if (!cache) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    memset(cache, 0, sizeof(asset_cache_t));
+    cache->capacity = capacity;
+    cache->max_asset_size = capacity / 4 < ASSET_MAX_SIZE ? capacity / 4 : ASSET_MAX_SIZE;
+    cache->notify_fd = -1;
+    
+    if (capacity > 0) {
+        /* Without inotify, assets are revalidated by mtime once per second */
+        cache->notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    }
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Destroy an asset cache
+ *
+ * Assets still referenced by responses are freed when they are released.
+ */
+void asset_cache_destroy(asset_cache_t* cache) {
+    if (!cache) {
+        return;
+    }
+    
+    invalidate(cache, -1, NULL);
+    
+    if (cache->notify_fd >= 0) {
+        close(cache->notify_fd);
+        cache->notify_fd = -1;
+    }
+}
+
+/**
+ * Look up a cached asset
+ *
+ * Returns a referenced asset, to be released with asset_cache_release, or
+ * NULL on a miss.
+ */
+asset_t* asset_cache_lookup(asset_cache_t* cache, const char* key, time_t now) {
+    if (!cache || cache->capacity == 0) {
+        return NULL;
+    }
+    
+    uint32_t hash = hash_key(key);
+    asset_t* asset = cache->buckets[hash & (ASSET_CACHE_BUCKETS - 1)];
+    while (asset && (asset->hash != hash || strcmp(asset->key, key) != 0)) {
+        asset = asset->bucket_next;
+    }
+    
+    if (!asset) {
+        metrics_add(&cache->misses, 1);
+        return NULL;
+    }
+    
+    /* Fall back to mtime checks when changes are not reported by inotify */
+    if (cache->notify_fd < 0 && asset->checked != now) {
+        /* Listings depend on every entry, so they are simply rebuilt */
+        struct stat st;
+        if (asset->directory || stat(asset->file_path, &st) != 0 || st.st_mtime != asset->mtime ||
+            (size_t)st.st_size != asset->size) {
+            remove_asset(cache, asset);
+            metrics_add(&cache->misses, 1);
+            return NULL;
+        }
+        asset->checked = now;
+    }
+    
+    if (cache->lru_head != asset) {
+        lru_unlink(cache, asset);
+        lru_push(cache, asset);
+    }
+    
+    asset->refs++;
+    metrics_add(&cache->hits, 1);
+    return asset;
+}
+
+/**
+ * Allocate an asset holding the caller's reference and the cache's
+ */
+static asset_t* new_asset(asset_cache_t* cache, const char* key, const char* file_path) {
+    asset_t* asset = calloc(1, sizeof(asset_t));
+    if (!asset) {
+        return NULL;
+    }
+    asset->key = strdup(key);
+    asset->file_path = strdup(file_path);
+    asset->watch = -1;
+    asset->cache = cache;
+    asset->refs = 2;                   /* Cache and caller */
+    if (!asset->key || !asset->file_path) {
+        free_asset(asset);
+        return NULL;
+    }
+    
+    const char* slash = strrchr(asset->file_path, '/');
+    asset->name = slash ? slash + 1 : asset->file_path;
+    return asset;
+}
+
+/**
+ * Encode, render and link an asset whose identity data is loaded
+ *
+ * Returns the asset, or NULL (after freeing it) if it cannot be cached.
+ */
+static asset_t* publish_asset(asset_cache_t* cache, asset_t* asset, const char* mime_type,
+                              const char* etag, time_t mtime, const struct stat* st) {
+    asset_variant_t* identity = &asset->variants[ASSET_VARIANT_IDENTITY];
+    
+    /* Encoded variants: precompressed siblings first, otherwise compress once now */
+    bool compressible = asset_is_compressible(mime_type) && asset->size >= ASSET_COMPRESS_MIN;
+    for (int i = ASSET_VARIANT_GZIP; compressible && i < ASSET_VARIANT_COUNT; i++) {
+        asset_variant_t* variant = &asset->variants[i];
+        if (!asset->directory) {
+            variant->data = load_sibling(asset->file_path, variant_info[i].suffix, st,
+                                         cache->max_asset_size, &variant->size);
+        }
+        if (!variant->data) {
+            variant->data = compress_variant((asset_variant_id_t)i, identity->data, asset->size,
+                                             &variant->size);
+        }
+    
+        /* Keep only variants that actually save bytes */
+        if (variant->data && variant->size >= asset->size) {
+            free(variant->data);
+            variant->data = NULL;
+        }
+    }
+    
+    /* Responses vary by Accept-Encoding whenever an encoded variant exists */
+    bool vary = asset->variants[ASSET_VARIANT_GZIP].data || asset->variants[ASSET_VARIANT_BROTLI].data;
+    for (int i = 0; i < ASSET_VARIANT_COUNT; i++) {
+        asset_variant_t* variant = &asset->variants[i];
+        if (variant->data && !render_variant(variant, (asset_variant_id_t)i, etag, mtime, mime_type, vary)) {
+            free_asset(asset);
+            return NULL;
+        }
+    }
+    
+    char date[64];
+    asset->last_modified = identity->etag + identity->etag_length + 17;
+    asset->last_modified_length = asset_format_http_date(date, sizeof(date), mtime);
+    asset->mtime = mtime;
+    asset->mime_type = mime_type;
+    asset->hash = hash_key(asset->key);
+    
+    /* Make room, evicting least recently used assets */
+    size_t cost = asset_cost(asset);
+    if (cost > cache->capacity) {
+        free_asset(asset);
+        return NULL;
+    }
+    while (cache->used + cost > cache->capacity && cache->lru_tail) {
+        remove_asset(cache, cache->lru_tail);
+    }
+    
+    /* Replace an existing entry for the key */
+    asset_t** bucket = &cache->buckets[asset->hash & (ASSET_CACHE_BUCKETS - 1)];
+    for (asset_t* existing = *bucket; existing; existing = existing->bucket_next) {
+        if (existing->hash == asset->hash && strcmp(existing->key, asset->key) == 0) {
+            remove_asset(cache, existing);
+            break;
+        }
+    }
+    
+    asset->bucket_next = *bucket;
+    *bucket = asset;
+    lru_push(cache, asset);
+    asset->cached = true;
+    cache->used += cost;
+    
+    return asset;
+}
+
+/**
+ * Read an open file into the cache
+ *
+ * st is the caller's view of the file; files that are too large, or that
+ * changed since, are not cached. Returns a referenced asset or NULL.
+ */
+asset_t* asset_cache_insert(asset_cache_t* cache, const char* key, const char* file_path,
+                            const char* mime_type, int fd, const struct stat* st) {
+    if (!cache || cache->capacity == 0 || !S_ISREG(st->st_mode) ||
+        (size_t)st->st_size > cache->max_asset_size) {
+        return NULL;
+    }
+    
+    asset_t* asset = new_asset(cache, key, file_path);
+    if (!asset) {
+        return NULL;
+    }
+    
+    /* Watch the directory before reading so no change can be missed */
+    if (cache->notify_fd >= 0) {
+        char* slash = strrchr(asset->file_path, '/');
+        if (slash) *slash = '\0';
+        asset->watch = inotify_add_watch(cache->notify_fd, slash ? asset->file_path : ".", WATCH_EVENTS);
+        if (slash) *slash = '/';
+        if (asset->watch < 0) {
+            free_asset(asset);
+            return NULL;
+        }
+    }
+    
+    struct stat current;
+    if (fstat(fd, &current) != 0 || current.st_mtime != st->st_mtime || current.st_size != st->st_size) {
+        free_asset(asset);
+        return NULL;
+    }
+    
+    /* Read file contents */
+    asset->size = (size_t)current.st_size;
+    asset_variant_t* identity = &asset->variants[ASSET_VARIANT_IDENTITY];
+    identity->size = asset->size;
+    identity->data = read_file(fd, asset->size);
+    if (!identity->data) {
+        free_asset(asset);
+        return NULL;
+    }
+    
+    char etag[64];
+    asset_format_etag(etag, sizeof(etag), &current);
+    return publish_asset(cache, asset, mime_type, etag, current.st_mtime, &current);
+}
+
+/**
+ * Watch a directory before reading it for a listing
+ *
+ * Returns the watch to pass to asset_cache_insert_listing, or -1 when
+ * listings are not invalidated through inotify.
+ */
+int asset_cache_watch_directory(asset_cache_t* cache, const char* dir_path) {
+    if (!cache || cache->capacity == 0 || cache->notify_fd < 0) {
+        return -1;
+    }
+    
+    return inotify_add_watch(cache->notify_fd, dir_path, WATCH_EVENTS);
+}
+
+/**
+ * Cache a copy of a rendered directory listing
+ *
+ * watch is the directory watch taken before the directory was read;
+ * modified is the newest modification time among the directory and its
+ * entries. Returns a referenced asset or NULL.
+ */
+asset_t* asset_cache_insert_listing(asset_cache_t* cache, const char* key, const char* dir_path,
+                                    int watch, const char* data, size_t size, time_t modified, time_t now) {
+    if (!cache || cache->capacity == 0 || size > cache->max_asset_size ||
+        (cache->notify_fd >= 0 && watch < 0)) {
+        return NULL;
+    }
+    
+    asset_t* asset = new_asset(cache, key, dir_path);
+    if (!asset) {
+        return NULL;
+    }
+    asset->directory = true;
+    asset->watch = watch;
+    asset->checked = now;
+    asset->size = size;
+    
+    asset_variant_t* identity = &asset->variants[ASSET_VARIANT_IDENTITY];
+    identity->size = size;
+    identity->data = malloc(size > 0 ? size : 1);
+    if (!identity->data) {
+        free_asset(asset);
+        return NULL;
+    }
+    memcpy(identity->data, data, size);
+    
+    /* Entry sizes change without touching the directory, so tag the content itself */
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ull;
+    }
+    char etag[64];
+    snprintf(etag, sizeof(etag), "\"d%llx-%zx\"", (unsigned long long)hash, size);
+    
+    return publish_asset(cache, asset, "text/html", etag, modified, NULL);
+}
+
+/**
+ * Pick the best variant of an asset the client accepts
+ */
+const asset_variant_t* asset_select_variant(const asset_t* asset, uint32_t accept_encoding) {
+    for (int i = ASSET_VARIANT_COUNT - 1; i > ASSET_VARIANT_IDENTITY; i--) {
+        if ((accept_encoding & variant_info[i].encoding) && asset->variants[i].data) {
+            return &asset->variants[i];
+        }
+    }
+    
+    return &asset->variants[ASSET_VARIANT_IDENTITY];
+}
+
+/**
+ * Open the best precompressed sibling of a file the client accepts
+ *
+ * Used for files streamed outside the cache. Returns the open descriptor
+ * and sets sibling and coding, or returns -1 if no usable sibling exists.
+ */
+int asset_open_precompressed(const char* file_path, uint32_t accept_encoding, const struct stat* st,
+                             struct stat* sibling, const char** coding) {
+    for (int i = ASSET_VARIANT_COUNT - 1; i > ASSET_VARIANT_IDENTITY; i--) {
+        if (!(accept_encoding & variant_info[i].encoding)) {
+            continue;
+        }
+    
+        char path[4096];
+        if ((size_t)snprintf(path, sizeof(path), "%s%s", file_path, variant_info[i].suffix) >= sizeof(path)) {
+            continue;
+        }
+    
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+    
+        /* Ignore siblings older than the file they were generated from */
+        if (fstat(fd, sibling) == 0 && S_ISREG(sibling->st_mode) && sibling->st_mtime >= st->st_mtime) {
+            *coding = variant_info[i].coding;
+            return fd;
+        }
+        close(fd);
+    }
+    
+    return -1;
+}
+
+/**
+ * Check whether a MIME type benefits from compression
+ */
+bool asset_is_compressible(const char* mime_type) {
+    return strncmp(mime_type, "text/", 5) == 0 ||
+           strcmp(mime_type, "application/javascript") == 0 ||
+           strcmp(mime_type, "application/json") == 0 ||
+           strcmp(mime_type, "application/xml") == 0 ||
+           strcmp(mime_type, "image/svg+xml") == 0;
+}
+
+/**
+ * Release a reference to an asset
+ */
+void asset_cache_release(asset_t* asset) {
+    if (asset && --asset->refs == 0) {
+        free_asset(asset);
+    }
+}
+
+/**
+ * Process pending inotify events, invalidating changed assets
+ */
+void asset_cache_process_events(asset_cache_t* cache) {
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    
+    if (!cache || cache->notify_fd < 0) {
+        return;
+    }
+    
+    for (;;) {
+        ssize_t length = read(cache->notify_fd, buffer, sizeof(buffer));
+        if (length <= 0) {
+            /* Drained (EAGAIN) */
+            return;
+        }
+    
+        for (char* ptr = buffer; ptr < buffer + length; ) {
+            const struct inotify_event* event = (const struct inotify_event*)ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+    
+            if (event->mask & IN_Q_OVERFLOW) {
+                /* Events were lost; drop everything */
+                invalidate(cache, -1, NULL);
+            } else if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+                /* Directory itself went away */
+                invalidate(cache, event->wd, NULL);
+            } else if (event->len > 0) {
+                invalidate(cache, event->wd, event->name);
+            }
+        }
+    }
+}
+
+/**
+ * Format a strong ETag from a file's inode, size and modification time
+ */
+size_t asset_format_etag(char* buffer, size_t size, const struct stat* st) {
+    int length = snprintf(buffer, size, "\"%lx-%lx-%lx\"",
+                          (unsigned long)st->st_ino, (unsigned long)st->st_size,
+                          (unsigned long)(st->st_mtim.tv_sec * 1000000000L + st->st_mtim.tv_nsec));
+    return length > 0 ? (size_t)length : 0;
+}
+
+/**
+ * Format a time as an IMF-fixdate (RFC 9110)
+ */
+size_t asset_format_http_date(char* buffer, size_t size, time_t time) {
+    struct tm tm;
+    gmtime_r(&time, &tm);
+    return strftime(buffer, size, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
@@ -0,0 +1,107 @@
+/**
+ * NexOS Web Server - Static Asset Cache
+ *
+ * Bounded in-memory cache of static files, keyed by decoded request path.
+ * Each worker owns its own cache, so lookups take no locks. Entries hold the
+ * file contents together with pre-rendered response headers, so a cache hit
+ * is answered without touching the filesystem. Compressible assets also
+ * carry gzip and brotli variants, taken from precompressed .gz/.br siblings
+ * or compressed once on insertion. Rendered directory listings are cached
+ * the same way and dropped on any change inside the directory. Entries are
+ * evicted least recently used first and invalidated through inotify,
+ * falling back to periodic mtime checks where inotify is not available.
+ */
+
+#ifndef NEXOS_ASSET_CACHE_H
+#define NEXOS_ASSET_CACHE_H
+
+#include "webserver.h"
+#include "metrics.h"
+#include <time.h>
+#include <sys/stat.h>
+
+/* Largest file kept in the cache */
+#define ASSET_MAX_SIZE (1024 * 1024)
+
+/* Smallest asset worth compressing */
+#define ASSET_COMPRESS_MIN 256
+
+/* Number of hash buckets (power of two) */
+#define ASSET_CACHE_BUCKETS 1024
+
+struct asset_cache;
+
+/* Asset representations */
+typedef enum {
+    ASSET_VARIANT_IDENTITY,
+    ASSET_VARIANT_GZIP,
+    ASSET_VARIANT_BROTLI,
+    ASSET_VARIANT_COUNT
+} asset_variant_id_t;
+
+/* Encoded representation of an asset */
+typedef struct {
+    char* data;                        /* Encoded contents (NULL if not available) */
+    size_t size;                       /* Encoded size */
+    char* headers;                     /* Pre-rendered validator and content headers */
+    size_t validators_length;          /* Length of the ETag/Last-Modified/Vary prefix of headers */
+    size_t headers_length;             /* Length of headers */
+    const char* etag;                  /* ETag value within headers */
+    size_t etag_length;
+} asset_variant_t;
+
+/* Cached asset */
+typedef struct asset {
+    char* key;                         /* Decoded request path */
+    uint32_t hash;                     /* Hash of key */
+    asset_variant_t variants[ASSET_VARIANT_COUNT];
+    size_t size;                       /* File size */
+    const char* mime_type;             /* Content type (static string) */
+    const char* last_modified;         /* Last-Modified value within the identity headers */
+    size_t last_modified_length;
+    time_t mtime;                      /* File modification time */
+    time_t checked;                    /* Last mtime check (without inotify) */
+    char* file_path;                   /* Filesystem path (for mtime checks) */
+    int watch;                         /* inotify watch of the containing directory */
+    const char* name;                  /* File name within file_path */
+    bool directory;                    /* Rendered listing of the directory at file_path */
+    uint32_t refs;                     /* Cache reference plus responses using the asset */
+    bool cached;                       /* Whether the asset is still in the cache */
+    struct asset_cache* cache;         /* Owning cache */
+    struct asset* bucket_next;         /* Next asset in hash bucket */
+    struct asset* lru_prev;            /* More recently used asset */
+    struct asset* lru_next;            /* Less recently used asset */
+} asset_t;
+
+/* Per-worker asset cache */
+typedef struct asset_cache {
+    asset_t* buckets[ASSET_CACHE_BUCKETS];
+    asset_t* lru_head;                 /* Most recently used asset */
+    asset_t* lru_tail;                 /* Least recently used asset */
+    size_t capacity;                   /* Memory budget in bytes (0 = disabled) */
+    size_t max_asset_size;             /* Largest file accepted */
+    size_t used;                       /* Memory held by cached assets */
+    int notify_fd;                     /* inotify descriptor, or -1 */
+    metrics_counter_t hits;            /* Written by the owning worker only */
+    metrics_counter_t misses;
+} asset_cache_t;
+
+/* Function prototypes */
+error_code_t asset_cache_init(asset_cache_t* cache, size_t capacity);
+void asset_cache_destroy(asset_cache_t* cache);
+asset_t* asset_cache_lookup(asset_cache_t* cache, const char* key, time_t now);
+asset_t* asset_cache_insert(asset_cache_t* cache, const char* key, const char* file_path,
+                            const char* mime_type, int fd, const struct stat* st);
+int asset_cache_watch_directory(asset_cache_t* cache, const char* dir_path);
+asset_t* asset_cache_insert_listing(asset_cache_t* cache, const char* key, const char* dir_path,
+                                    int watch, const char* data, size_t size, time_t modified, time_t now);
+void asset_cache_release(asset_t* asset);
+void asset_cache_process_events(asset_cache_t* cache);
+const asset_variant_t* asset_select_variant(const asset_t* asset, uint32_t accept_encoding);
+int asset_open_precompressed(const char* file_path, uint32_t accept_encoding, const struct stat* st,
+                             struct stat* sibling, const char** coding);
+bool asset_is_compressible(const char* mime_type);
+size_t asset_format_etag(char* buffer, size_t size, const struct stat* st);
+size_t asset_format_http_date(char* buffer, size_t size, time_t time);
+
+#endif /* NEXOS_ASSET_CACHE_H */
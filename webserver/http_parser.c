@@ -0,0 +1,433 @@
+/**
+ * NexOS Web Server - HTTP Request Parser
+ *
+ * This file implements the incremental request head parser. Complete lines
+ * are consumed as they arrive; a partial line is rescanned from its start
+ * on the next call, so each call only needs the bytes received so far.
+ */
+
+#include "http_parser.h"
+#include <string.h>
+
+/* Header name characters (RFC 9110 tchar), lowercased; 0 for invalid characters */
+static const char token_table[256] = {
+    ['!'] = '!', ['#'] = '#', ['$'] = '$', ['%'] = '%', ['&'] = '&', ['\''] = '\'',
+    ['*'] = '*', ['+'] = '+', ['-'] = '-', ['.'] = '.', ['^'] = '^', ['_'] = '_',
+    ['`'] = '`', ['|'] = '|', ['~'] = '~',
+    ['0'] = '0', ['1'] = '1', ['2'] = '2', ['3'] = '3', ['4'] = '4',
+    ['5'] = '5', ['6'] = '6', ['7'] = '7', ['8'] = '8', ['9'] = '9',
+    ['A'] = 'a', ['B'] = 'b', ['C'] = 'c', ['D'] = 'd', ['E'] = 'e', ['F'] = 'f',
+    ['G'] = 'g', ['H'] = 'h', ['I'] = 'i', ['J'] = 'j', ['K'] = 'k', ['L'] = 'l',
+    ['M'] = 'm', ['N'] = 'n', ['O'] = 'o', ['P'] = 'p', ['Q'] = 'q', ['R'] = 'r',
+    ['S'] = 's', ['T'] = 't', ['U'] = 'u', ['V'] = 'v', ['W'] = 'w', ['X'] = 'x',
+    ['Y'] = 'y', ['Z'] = 'z',
+    ['a'] = 'a', ['b'] = 'b', ['c'] = 'c', ['d'] = 'd', ['e'] = 'e', ['f'] = 'f',
+    ['g'] = 'g', ['h'] = 'h', ['i'] = 'i', ['j'] = 'j', ['k'] = 'k', ['l'] = 'l',
+    ['m'] = 'm', ['n'] = 'n', ['o'] = 'o', ['p'] = 'p', ['q'] = 'q', ['r'] = 'r',
+    ['s'] = 's', ['t'] = 't', ['u'] = 'u', ['v'] = 'v', ['w'] = 'w', ['x'] = 'x',
+    ['y'] = 'y', ['z'] = 'z'
+};
+
+/* Well-known headers, matched against lowercased names */
+static const struct {
+    const char* name;
+    uint32_t length;
+    http_header_id_t id;
+} known_headers[] = {
+    { "host", 4, HTTP_HEADER_HOST },
+    { "connection", 10, HTTP_HEADER_CONNECTION },
+    { "content-length", 14, HTTP_HEADER_CONTENT_LENGTH },
+    { "transfer-encoding", 17, HTTP_HEADER_TRANSFER_ENCODING },
+    { "if-none-match", 13, HTTP_HEADER_IF_NONE_MATCH },
+    { "if-modified-since", 17, HTTP_HEADER_IF_MODIFIED_SINCE },
+    { "accept-encoding", 15, HTTP_HEADER_ACCEPT_ENCODING },
+    { "range", 5, HTTP_HEADER_RANGE },
+    { "if-range", 8, HTTP_HEADER_IF_RANGE }
+};
+
+/**
+ * Get the value of a hexadecimal digit, or -1
+ */
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * Compare a view with a lowercase literal, ignoring case
+ */
+static bool view_equals(const char* data, uint32_t length, const char* literal, uint32_t literal_length) {
+    if (length != literal_length) {
+        return false;
+    }
+    
+    for (uint32_t i = 0; i < length; i++) {
+        char c = data[i];
+        if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+        if (c != literal[i]) return false;
+    }
+    
+    return true;
+}
+
+/**
+ * Resolve the request method
+ */
+static http_method_t parse_method(const char* data, uint32_t length) {
+    switch (length) {
+        case 3:
+            if (memcmp(data, "GET", 3) == 0) return HTTP_METHOD_GET;
+            if (memcmp(data, "PUT", 3) == 0) return HTTP_METHOD_PUT;
+            break;
+        case 4:
+            if (memcmp(data, "HEAD", 4) == 0) return HTTP_METHOD_HEAD;
+            if (memcmp(data, "POST", 4) == 0) return HTTP_METHOD_POST;
+            break;
+        case 6:
+            if (memcmp(data, "DELETE", 6) == 0) return HTTP_METHOD_DELETE;
+            break;
+        case 7:
+            if (memcmp(data, "OPTIONS", 7) == 0) return HTTP_METHOD_OPTIONS;
+            break;
+    }
+    
+    return HTTP_METHOD_UNKNOWN;
+}
+
+/**
+ * Decode the request target's path in place and NUL-terminate it
+ *
+ * Rejects control bytes, encoded or not, and ".." segments so the decoded
+ * path can be appended to the webroot and echoed in headers directly.
+ */
+static bool decode_target(char* buffer, uint32_t start, uint32_t end, http_request_t* request) {
+    uint32_t read = start;
+    uint32_t write = start;
+    uint32_t segment = start;
+    
+    while (read < end && buffer[read] != '?') {
+        char c = buffer[read++];
+    
+        if (c == '%') {
+            if (read + 2 > end) return false;
+            int high = hex_value(buffer[read]);
+            int low = hex_value(buffer[read + 1]);
+            if (high < 0 || low < 0) return false;
+            c = (char)(high << 4 | low);
+            read += 2;
+        }
+        if ((unsigned char)c < 0x20 || c == 0x7F) return false;
+    
+        if (c == '/') {
+            /* Reject ".." segments */
+            if (write - segment == 2 && buffer[segment] == '.' && buffer[segment + 1] == '.') {
+                return false;
+            }
+            segment = write + 1;
+        }
+        buffer[write++] = c;
+    }
+    
+    if (write - segment == 2 && buffer[segment] == '.' && buffer[segment + 1] == '.') {
+        return false;
+    }
+    
+    /* Query string is kept as a raw view */
+    if (read < end) {
+        request->query.offset = read + 1;
+        request->query.length = end - read - 1;
+    }
+    
+    /* Decoding only shrinks the path, so the terminator stays within the target */
+    buffer[write] = '\0';
+    request->path = buffer + start;
+    return true;
+}
+
+/**
+ * Parse the request line: method SP request-target SP HTTP-version
+ */
+static http_parse_result_t parse_request_line(char* buffer, uint32_t start, uint32_t end,
+                                              http_request_t* request) {
+    uint32_t method_end = start;
+    while (method_end < end && buffer[method_end] != ' ') method_end++;
+    if (method_end == start || method_end == end) return HTTP_PARSE_ERROR;
+    
+    uint32_t target_start = method_end + 1;
+    uint32_t target_end = target_start;
+    while (target_end < end && buffer[target_end] != ' ') target_end++;
+    if (target_end == end || buffer[target_start] != '/') return HTTP_PARSE_ERROR;
+    
+    /* Version must be exactly "HTTP/1.x" */
+    const char* version = buffer + target_end + 1;
+    if (end - target_end - 1 != 8 || memcmp(version, "HTTP/1.", 7) != 0 ||
+        version[7] < '0' || version[7] > '9') {
+        return HTTP_PARSE_ERROR;
+    }
+    
+    request->method = parse_method(buffer + start, method_end - start);
+    request->version_major = 1;
+    request->version_minor = (uint8_t)(version[7] - '0');
+    
+    /* HTTP/1.1 connections are persistent unless the client asks otherwise */
+    request->keep_alive = request->version_minor >= 1;
+    
+    if (!decode_target(buffer, target_start, target_end, request)) {
+        return HTTP_PARSE_ERROR;
+    }
+    
+    return HTTP_PARSE_INCOMPLETE;
+}
+
+/**
+ * Apply the Connection header's tokens to the request
+ */
+static void parse_connection(const char* value, uint32_t length, http_request_t* request) {
+    uint32_t i = 0;
+    
+    while (i < length) {
+        while (i < length && (value[i] == ' ' || value[i] == '\t' || value[i] == ',')) i++;
+    
+        uint32_t token = i;
+        while (i < length && value[i] != ',' && value[i] != ' ' && value[i] != '\t') i++;
+    
+        if (view_equals(value + token, i - token, "close", 5)) {
+            request->keep_alive = 0;
+        } else if (view_equals(value + token, i - token, "keep-alive", 10)) {
+            request->keep_alive = 1;
+        }
+    }
+}
+
+/**
+ * Apply the Accept-Encoding header's codings to the request
+ *
+ * Codings with a zero quality value are not acceptable; otherwise the
+ * weights are ignored and the server picks its preferred coding.
+ */
+static void parse_accept_encoding(const char* value, uint32_t length, http_request_t* request) {
+    uint32_t i = 0;
+    
+    while (i < length) {
+        while (i < length && (value[i] == ' ' || value[i] == '\t' || value[i] == ',')) i++;
+    
+        uint32_t token = i;
+        while (i < length && value[i] != ',' && value[i] != ';' && value[i] != ' ' && value[i] != '\t') i++;
+        uint32_t token_length = i - token;
+    
+        /* Only the q parameter matters */
+        bool acceptable = true;
+        while (i < length && value[i] != ',') {
+            if (value[i] == '=' && (value[i - 1] == 'q' || value[i - 1] == 'Q')) {
+                i++;
+                acceptable = i < length && value[i] != '0';
+                if (!acceptable && ++i < length && value[i] == '.') {
+                    for (i++; i < length && value[i] >= '0' && value[i] <= '9'; i++) {
+                        if (value[i] != '0') acceptable = true;
+                    }
+                }
+                continue;
+            }
+            i++;
+        }
+    
+        if (!acceptable) {
+            continue;
+        }
+    
+        if (view_equals(value + token, token_length, "gzip", 4) ||
+            view_equals(value + token, token_length, "x-gzip", 6)) {
+            request->accept_encoding |= HTTP_ENCODING_GZIP;
+        } else if (view_equals(value + token, token_length, "br", 2)) {
+            request->accept_encoding |= HTTP_ENCODING_BROTLI;
+        } else if (token_length == 1 && value[token] == '*') {
+            request->accept_encoding |= HTTP_ENCODING_GZIP | HTTP_ENCODING_BROTLI;
+        }
+    }
+}
+
+/**
+ * Parse a Content-Length value into the request's body length
+ */
+static bool parse_content_length(const char* value, uint32_t length, http_request_t* request,
+                                 bool duplicate) {
+    if (length == 0 || length > 18) {
+        return false;
+    }
+    
+    size_t content_length = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        if (value[i] < '0' || value[i] > '9') return false;
+        content_length = content_length * 10 + (size_t)(value[i] - '0');
+    }
+    
+    /* Conflicting lengths make the message boundary ambiguous */
+    if (duplicate && content_length != request->body_length) {
+        return false;
+    }
+    
+    request->body_length = content_length;
+    return true;
+}
+
+/**
+ * Parse a header line: field-name ":" OWS field-value OWS
+ */
+static http_parse_result_t parse_header(char* buffer, uint32_t start, uint32_t end,
+                                        http_request_t* request) {
+    if (request->header_count >= HTTP_MAX_HEADERS) {
+        return HTTP_PARSE_TOO_LARGE;
+    }
+    
+    /* Field name is lowercased in place so later lookups need no case folding */
+    uint32_t name_end = start;
+    while (name_end < end && buffer[name_end] != ':') {
+        char c = token_table[(unsigned char)buffer[name_end]];
+        if (c == 0) return HTTP_PARSE_ERROR;  /* Also rejects obsolete line folding */
+        buffer[name_end++] = c;
+    }
+    if (name_end == start || name_end == end) return HTTP_PARSE_ERROR;
+    
+    /* Trim optional whitespace around the value */
+    uint32_t value_start = name_end + 1;
+    uint32_t value_end = end;
+    while (value_start < value_end && (buffer[value_start] == ' ' || buffer[value_start] == '\t')) value_start++;
+    while (value_end > value_start && (buffer[value_end - 1] == ' ' || buffer[value_end - 1] == '\t')) value_end--;
+    
+    http_header_t* header = &request->headers[request->header_count++];
+    header->name.offset = start;
+    header->name.length = name_end - start;
+    header->value.offset = value_start;
+    header->value.length = value_end - value_start;
+    header->id = HTTP_HEADER_OTHER;
+    
+    for (size_t i = 0; i < sizeof(known_headers) / sizeof(known_headers[0]); i++) {
+        if (known_headers[i].length == header->name.length &&
+            memcmp(known_headers[i].name, buffer + start, header->name.length) == 0) {
+            header->id = known_headers[i].id;
+            break;
+        }
+    }
+    
+    const char* value = buffer + value_start;
+    uint32_t value_length = value_end - value_start;
+    
+    switch (header->id) {
+        case HTTP_HEADER_CONNECTION:
+            parse_connection(value, value_length, request);
+            break;
+        case HTTP_HEADER_ACCEPT_ENCODING:
+            parse_accept_encoding(value, value_length, request);
+            break;
+        case HTTP_HEADER_CONTENT_LENGTH: {
+            /* Look for an earlier Content-Length header */
+            bool duplicate = false;
+            for (int i = 0; i < request->header_count - 1; i++) {
+                if (request->headers[i].id == HTTP_HEADER_CONTENT_LENGTH) {
+                    duplicate = true;
+                    break;
+                }
+            }
+            if (!parse_content_length(value, value_length, request, duplicate)) {
+                return HTTP_PARSE_ERROR;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    
+    return HTTP_PARSE_INCOMPLETE;
+}
+
+/**
+ * Reset a parser and request for a new request
+ */
+void http_parser_init(http_parser_t* parser, http_request_t* request) {
+    parser->state = HTTP_PARSER_REQUEST_LINE;
+    parser->line_start = 0;
+    parser->head_length = 0;
+    
+    request->method = HTTP_METHOD_UNKNOWN;
+    request->head = NULL;
+    request->path = NULL;
+    request->query.offset = 0;
+    request->query.length = 0;
+    request->version_major = 0;
+    request->version_minor = 0;
+    request->header_count = 0;
+    request->accept_encoding = HTTP_ENCODING_IDENTITY;
+    request->body = NULL;
+    request->body_length = 0;
+    request->keep_alive = 0;
+}
+
+/**
+ * Parse the request head received so far
+ *
+ * buffer holds length bytes of the request; capacity is the most the
+ * caller can buffer, so a head that is still incomplete at that size is
+ * rejected. Complete lines are modified in place and must not be moved
+ * between calls. On HTTP_PARSE_COMPLETE, parser->head_length is the
+ * number of bytes taken by the head.
+ */
+http_parse_result_t http_parser_execute(http_parser_t* parser, http_request_t* request,
+                                        char* buffer, uint32_t length, uint32_t capacity) {
+    request->head = buffer;
+    
+    while (parser->state != HTTP_PARSER_DONE) {
+        uint32_t start = parser->line_start;
+        char* newline = start < length ? memchr(buffer + start, '\n', length - start) : NULL;
+        if (!newline) {
+            return length >= capacity ? HTTP_PARSE_TOO_LARGE : HTTP_PARSE_INCOMPLETE;
+        }
+    
+        uint32_t next = (uint32_t)(newline - buffer) + 1;
+        uint32_t end = next - 1;
+        if (end > start && buffer[end - 1] == '\r') {
+            end--;
+        }
+    
+        http_parse_result_t result = HTTP_PARSE_INCOMPLETE;
+        if (parser->state == HTTP_PARSER_REQUEST_LINE) {
+            /* Ignore empty lines ahead of the request line */
+            if (end > start) {
+                result = parse_request_line(buffer, start, end, request);
+                parser->state = HTTP_PARSER_HEADERS;
+            }
+        } else if (end == start) {
+            /* Blank line terminates the head */
+            parser->state = HTTP_PARSER_DONE;
+            parser->head_length = next;
+        } else {
+            result = parse_header(buffer, start, end, request);
+        }
+    
+        if (result != HTTP_PARSE_INCOMPLETE) {
+            return result;
+        }
+        parser->line_start = next;
+    }
+    
+    /* Bodies are framed by Content-Length only */
+    if (http_request_header(request, HTTP_HEADER_TRANSFER_ENCODING)) {
+        return HTTP_PARSE_ERROR;
+    }
+    
+    return HTTP_PARSE_COMPLETE;
+}
+
+/**
+ * Find the first request header with a well-known id
+ */
+const http_header_t* http_request_header(const http_request_t* request, http_header_id_t id) {
+    for (int i = 0; i < request->header_count; i++) {
+        if (request->headers[i].id == id) {
+            return &request->headers[i];
+        }
+    }
+    
+    return NULL;
+}
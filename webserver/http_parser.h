@@ -0,0 +1,43 @@
+/**
+ * NexOS Web Server - HTTP Request Parser
+ *
+ * Incremental parser for HTTP/1.x request heads. The parser works directly
+ * on the connection's receive buffer: headers are recorded as views into
+ * the buffer and the request path is decoded in place, so parsing a request
+ * performs no heap allocation. Parsing can be resumed as more bytes arrive.
+ */
+
+#ifndef NEXOS_HTTP_PARSER_H
+#define NEXOS_HTTP_PARSER_H
+
+#include "webserver.h"
+
+/* Parser states */
+typedef enum {
+    HTTP_PARSER_REQUEST_LINE,
+    HTTP_PARSER_HEADERS,
+    HTTP_PARSER_DONE
+} http_parser_state_t;
+
+/* Parse results */
+typedef enum {
+    HTTP_PARSE_COMPLETE,               /* Request head fully parsed */
+    HTTP_PARSE_INCOMPLETE,             /* More bytes are needed */
+    HTTP_PARSE_ERROR,                  /* Malformed request */
+    HTTP_PARSE_TOO_LARGE               /* Request head exceeds the buffer or header limit */
+} http_parse_result_t;
+
+/* Parser state, kept with the connection between reads */
+typedef struct {
+    http_parser_state_t state;
+    uint32_t line_start;               /* Offset of the line being parsed */
+    uint32_t head_length;              /* Length of the parsed head, including the blank line */
+} http_parser_t;
+
+/* Function prototypes */
+void http_parser_init(http_parser_t* parser, http_request_t* request);
+http_parse_result_t http_parser_execute(http_parser_t* parser, http_request_t* request,
+                                        char* buffer, uint32_t length, uint32_t capacity);
+const http_header_t* http_request_header(const http_request_t* request, http_header_id_t id);
+
+#endif /* NEXOS_HTTP_PARSER_H */
@@ -0,0 +1,97 @@
+/**
+ * NexOS Web Server - Request Metrics
+ *
+ * Histogram bucketing and aggregation for the per-worker metrics.
+ */
+
+#include "metrics.h"
+
+/**
+ * Map a value to its histogram bucket
+ */
+uint32_t metrics_bucket_index(uint64_t value) {
+    if (value < METRICS_SUB_BUCKETS) {
+        return (uint32_t)value;
+    }
+    
+    uint32_t shift = (uint32_t)(63 - __builtin_clzll(value)) - METRICS_SUB_BITS;
+    return ((shift + 1) << METRICS_SUB_BITS) + (uint32_t)((value >> shift) & (METRICS_SUB_BUCKETS - 1));
+}
+
+/**
+ * Get the smallest value mapped to a histogram bucket
+ */
+uint64_t metrics_bucket_lower(uint32_t index) {
+    if (index < METRICS_SUB_BUCKETS) {
+        return index;
+    }
+    
+    uint32_t shift = (index >> METRICS_SUB_BITS) - 1;
+    return ((uint64_t)METRICS_SUB_BUCKETS + (index & (METRICS_SUB_BUCKETS - 1))) << shift;
+}
+
+/**
+ * Record a latency in a histogram owned by the calling thread
+ */
+void metrics_record(metrics_histogram_t* histogram, uint64_t nanoseconds) {
+    metrics_add(&histogram->buckets[metrics_bucket_index(nanoseconds)], 1);
+    metrics_add(&histogram->count, 1);
+    metrics_add(&histogram->sum, nanoseconds);
+}
+
+/**
+ * Add a worker's histogram to a snapshot
+ */
+void metrics_snapshot_add(metrics_histogram_snapshot_t* snapshot, const metrics_histogram_t* histogram) {
+    for (uint32_t i = 0; i < METRICS_BUCKETS; i++) {
+        snapshot->buckets[i] += metrics_read(&histogram->buckets[i]);
+    }
+    snapshot->count += metrics_read(&histogram->count);
+    snapshot->sum += metrics_read(&histogram->sum);
+}
+
+/**
+ * Count recorded values below a limit
+ *
+ * Exact when limit is a bucket boundary, such as any power of two.
+ */
+uint64_t metrics_count_below(const metrics_histogram_snapshot_t* snapshot, uint64_t limit) {
+    uint64_t count = 0;
+    
+    for (uint32_t i = 0; i < METRICS_BUCKETS && metrics_bucket_lower(i) < limit; i++) {
+        count += snapshot->buckets[i];
+    }
+    
+    return count;
+}
+
+/**
+ * Estimate the value below which a fraction of recorded values fall
+ */
+uint64_t metrics_percentile(const metrics_histogram_snapshot_t* snapshot, double fraction) {
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < METRICS_BUCKETS; i++) {
+        total += snapshot->buckets[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    
+    uint64_t target = (uint64_t)((double)total * fraction);
+    if (target >= total) {
+        target = total - 1;
+    }
+    
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < METRICS_BUCKETS; i++) {
+        seen += snapshot->buckets[i];
+        if (seen > target) {
+            /* Midpoint of the bucket */
+            uint64_t lower = metrics_bucket_lower(i);
+            uint64_t upper = i + 1 < METRICS_BUCKETS ? metrics_bucket_lower(i + 1) : lower;
+            return lower + (upper - lower) / 2;
+        }
+    }
+    
+    return 0;
+}
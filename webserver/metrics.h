@@ -0,0 +1,91 @@
+/**
+ * NexOS Web Server - Request Metrics
+ *
+ * Per-worker counters and latency histograms. Each worker is the only
+ * writer of its own metrics, so updates are plain relaxed loads and stores
+ * with no lock or atomic read-modify-write on the request path. Readers on
+ * other threads aggregate all workers with relaxed loads; a snapshot may
+ * be slightly behind but never blocks a worker.
+ *
+ * Latencies are recorded in nanoseconds in log-linear (HDR-style)
+ * histograms: every power of two is split into METRICS_SUB_BUCKETS linear
+ * buckets, bounding the relative error to about 6%.
+ */
+
+#ifndef NEXOS_METRICS_H
+#define NEXOS_METRICS_H
+
+#include "../kernel/kernel.h"
+#include <stdatomic.h>
+#include <stddef.h>
+
+/* Histogram resolution: 2^METRICS_SUB_BITS buckets per power of two */
+#define METRICS_SUB_BITS 4
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BITS)
+#define METRICS_BUCKETS ((64 - METRICS_SUB_BITS + 1) * METRICS_SUB_BUCKETS)
+
+/* Number of HTTP status classes (1xx-5xx, index 0 unused) */
+#define METRICS_STATUS_CLASSES 6
+
+/* Request phases timed separately */
+typedef enum {
+    METRICS_PHASE_PARSE,               /* First request byte seen until the head is parsed */
+    METRICS_PHASE_BUILD,               /* Building the response */
+    METRICS_PHASE_SEND,                /* Writing the response */
+    METRICS_PHASE_TOTAL,               /* First request byte seen until the response is written */
+    METRICS_PHASE_COUNT
+} metrics_phase_t;
+
+/* Counter with a single writing thread */
+typedef _Atomic uint64_t metrics_counter_t;
+
+/* Latency histogram */
+typedef struct {
+    metrics_counter_t buckets[METRICS_BUCKETS];
+    metrics_counter_t count;
+    metrics_counter_t sum;             /* Total nanoseconds */
+} metrics_histogram_t;
+
+/* Metrics owned by one worker */
+typedef struct {
+    metrics_counter_t requests;        /* Responses started */
+    metrics_counter_t errors;          /* Accept, socket and allocation failures */
+    metrics_counter_t bytes_sent;
+    metrics_counter_t bytes_received;
+    metrics_counter_t connections_opened;
+    metrics_counter_t connections_closed;
+    metrics_counter_t responses[METRICS_STATUS_CLASSES];
+    metrics_histogram_t latency[METRICS_PHASE_COUNT];
+} worker_metrics_t;
+
+/* Plain-integer copy of a histogram, summed over workers */
+typedef struct {
+    uint64_t buckets[METRICS_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+} metrics_histogram_snapshot_t;
+
+/**
+ * Add to a counter owned by the calling thread
+ */
+static inline void metrics_add(metrics_counter_t* counter, uint64_t value) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value,
+                          memory_order_relaxed);
+}
+
+/**
+ * Read a counter owned by any thread
+ */
+static inline uint64_t metrics_read(const metrics_counter_t* counter) {
+    return atomic_load_explicit((metrics_counter_t*)counter, memory_order_relaxed);
+}
+
+/* Function prototypes */
+uint32_t metrics_bucket_index(uint64_t value);
+uint64_t metrics_bucket_lower(uint32_t index);
+void metrics_record(metrics_histogram_t* histogram, uint64_t nanoseconds);
+void metrics_snapshot_add(metrics_histogram_snapshot_t* snapshot, const metrics_histogram_t* histogram);
+uint64_t metrics_count_below(const metrics_histogram_snapshot_t* snapshot, uint64_t limit);
+uint64_t metrics_percentile(const metrics_histogram_snapshot_t* snapshot, double fraction);
+
+#endif /* NEXOS_METRICS_H */
@@ -1,6 +1,11 @@
+#define _GNU_SOURCE
 #include "webserver.h"
+#include "http_parser.h"
+#include "asset_cache.h"
+#include "metrics.h"
 #include "../io/io.h"
 #include "../memory/memory.h"
+#include "../scheduler/scheduler.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,33 +15,187 @@
 #include <dirent.h>
 #include <time.h>
 #include <ctype.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <sched.h>
 
 #define BUFFER_SIZE 4096
+#define MAX_EVENTS 256
+#define SENDFILE_CHUNK (1U << 20)
+#define STREAM_QUANTUM (1U << 20)
+#define MAX_VECTORS 8
+#define MAX_DISCARD (64 * 1024)
+#define LISTING_PAGE_SIZE 1000
+#define CONNECTION_STACK_SIZE (64 * 1024)
 #define SERVER_NAME "NexOS WebServer/1.0"
 
+/* Connection states */
+typedef enum {
+    CONNECTION_READING,                /* Waiting for the rest of a request */
+    CONNECTION_PROCESSING,             /* Building the response to a complete request */
+    CONNECTION_WRITING,                /* Waiting for socket space to write the response */
+    CONNECTION_IDLE                    /* Waiting for the next request on a persistent connection */
+} connection_state_t;
+
+/* Directory listing sort keys */
+typedef enum {
+    LISTING_SORT_NAME,
+    LISTING_SORT_SIZE,
+    LISTING_SORT_MTIME
+} listing_sort_t;
+
+/* Directory listing view selected by the query string */
+typedef struct {
+    listing_sort_t sort;
+    bool descending;
+    uint32_t page;                     /* 1-based page of LISTING_PAGE_SIZE entries */
+} listing_view_t;
+
+/* Directory entry collected for a listing */
+typedef struct {
+    const char* name;
+    uint64_t size;
+    time_t mtime;
+    bool directory;
+} listing_entry_t;
+
+/* Growable response text, allocated from the response arena */
+typedef struct {
+    arena_t* arena;
+    char* data;
+    size_t length;
+    size_t capacity;
+    bool failed;
+} text_buffer_t;
+
+/* Client connection */
+typedef struct connection {
+    int fd;                            /* Client socket */
+    connection_state_t state;          /* Position in the request/response cycle */
+    char buffer[BUFFER_SIZE];          /* Request bytes received so far */
+    uint32_t length;                   /* Number of bytes in buffer */
+    http_parser_t parser;              /* Request head parser state */
+    http_request_t request;            /* Request being parsed (views into buffer) */
+    size_t body_remaining;             /* Bytes of request body still to discard */
+    http_response_t response;          /* Response being written */
+    arena_t arena;                     /* Response allocations, reset after each request */
+    char head[BUFFER_SIZE];            /* Serialized status line and headers */
+    size_t head_length;                /* Length of serialized head */
+    size_t head_sent;                  /* Bytes of head already written */
+    uint32_t segment;                  /* Body segment being written */
+    size_t segment_sent;               /* Bytes of that segment already written */
+    bool queued;                       /* Whether the connection is in the write queue */
+    struct connection* queue_prev;     /* Previous connection in the write queue */
+    struct connection* queue_next;     /* Next connection in the write queue */
+    struct worker* worker;             /* Worker owning the connection */
+    uint64_t last_active;              /* Time of last activity (monotonic ms) */
+    wheel_timer_t timer;               /* Idle timeout, armed while the server has one */
+    bool expired;                      /* Idle timeout passed (green) */
+    uint64_t request_start;            /* First byte of the current request seen (monotonic ns, 0 = none) */
+    uint64_t send_start;               /* Response started (monotonic ns) */
+    struct connection* prev;           /* Previous open connection */
+    struct connection* next;           /* Next open connection */
+} connection_t;
+
+/* Event loop worker */
+typedef struct worker {
+    uint32_t id;                       /* Worker index */
+    pthread_t thread;                  /* Worker thread (unused for worker 0) */
+    bool thread_started;               /* Whether thread was created */
+    bool green;                        /* Scheduler threads per connection instead of the event loop */
+    thread_t* acceptor;                /* Accepting thread (green) */
+    thread_t* exited;                  /* Last exited thread, released by the next (green) */
+    uint32_t thread_count;             /* Connection and notify threads running (green) */
+    int server_fd;                     /* Worker's SO_REUSEPORT listening socket */
+    io_reactor_t reactor;              /* Worker's event loop */
+    asset_cache_t cache;               /* Worker's static asset cache */
+    connection_t* connections;         /* Open connections, oldest first */
+    connection_t* last_connection;     /* Most recently opened connection */
+    timer_wheel_t timers;              /* Idle timers of the connections (event loop) */
+    connection_t* queue_head;          /* Connections with response data left to stream */
+    connection_t* queue_tail;
+    uint32_t queue_count;
+    uint32_t connection_count;         /* Number of open connections */
+    uint32_t max_connections;          /* Connection limit for this worker */
+    error_code_t status;               /* Result of the worker's event loop */
+    uint64_t now;                      /* Monotonic time of the current loop iteration (ms) */
+    time_t date_time;                  /* Second the cached Date header was rendered for */
+    char date_header[64];              /* Cached "Date: ...\r\n" header */
+    size_t date_header_length;         /* Length of cached Date header */
+    worker_metrics_t metrics;          /* Written by this worker only */
+} worker_t;
+
 /* Web server state */
 static struct {
     bool initialized;
-    bool running;
+    volatile bool running;
     webserver_config_t config;
-    int server_fd;
-    uint32_t request_count;
-    uint32_t error_count;
-    uint64_t bytes_sent;
-    uint64_t bytes_received;
-} webserver_state = {0};
+    worker_t* workers;
+    uint32_t worker_count;
+    pthread_mutex_t lock;              /* Serializes webserver_stop with worker teardown */
+    thread_t* starter;                 /* Thread running green workers in webserver_start */
+    _Atomic uint32_t acceptors;        /* Green acceptor threads not finished */
+} webserver_state = {
+    .lock = PTHREAD_MUTEX_INITIALIZER
+};
 
 /* Function prototypes */
-static error_code_t handle_client(int client_fd);
-static error_code_t parse_request(int client_fd, http_request_t* request);
-static error_code_t build_response(http_request_t* request, http_response_t* response);
-static error_code_t send_response(int client_fd, http_response_t* response);
-static void free_request(http_request_t* request);
+static error_code_t worker_open(worker_t* worker);
+static void worker_close(worker_t* worker);
+static void* worker_main(void* arg);
+static error_code_t worker_run(worker_t* worker);
+static error_code_t run_green_workers(worker_t* workers, uint32_t worker_count, thread_t* starter);
+static error_code_t spawn_thread(worker_t* worker, void (*entry)(void*), void* arg, thread_t** thread);
+static void release_thread(thread_t* thread);
+static void thread_exiting(worker_t* worker);
+static void acceptor_main(void* arg);
+static void notify_main(void* arg);
+static void connection_main(void* arg);
+static error_code_t wait_socket(connection_t* conn, uint32_t events);
+static uint64_t monotonic_ns(void);
+static uint64_t monotonic_ms(void);
+static int32_t next_timeout(worker_t* worker);
+static void arm_idle_timer(connection_t* conn);
+static void idle_timeout(wheel_timer_t* timer);
+static void touch_connection(connection_t* conn);
+static void accept_connections(worker_t* worker);
+static void handle_connection(connection_t* conn, uint32_t events);
+static void read_request(connection_t* conn);
+static error_code_t process_requests(connection_t* conn);
+static error_code_t process_request(connection_t* conn, http_parse_result_t result);
+static bool finish_request(connection_t* conn);
+static void consume_buffer(connection_t* conn, uint32_t length);
+static void close_connection(connection_t* conn);
+static error_code_t build_response(worker_t* worker, http_request_t* request, http_response_t* response);
+static void serve_path(worker_t* worker, http_request_t* request, http_response_t* response);
+static void serve_metrics(http_response_t* response);
+static void serve_asset(http_request_t* request, http_response_t* response, asset_t* asset);
+static int parse_ranges(const char* value, uint32_t length, uint64_t size,
+                        uint64_t* starts, uint64_t* ends);
+static bool serve_ranges(http_request_t* request, http_response_t* response, const char* data, int fd,
+                         size_t size, const char* mime_type, const char* etag, size_t etag_length,
+                         const char* last_modified, size_t last_modified_length);
+static bool not_modified(const http_request_t* request, const char* etag, size_t etag_length,
+                         const char* last_modified, size_t last_modified_length, time_t mtime);
+static void add_header(http_response_t* response, const char* name, const char* value);
+static void add_content_headers(http_response_t* response);
+static error_code_t send_response(connection_t* conn);
+static error_code_t flush_response(connection_t* conn);
+static void advance_response(connection_t* conn, size_t bytes);
+static void queue_connection(connection_t* conn);
+static void dequeue_connection(connection_t* conn);
+static void run_queue(worker_t* worker);
+static void write_response(connection_t* conn);
+static void drop_body(http_response_t* response);
 static void free_response(http_response_t* response);
-static error_code_t serve_file(const char* path, http_response_t* response);
-static error_code_t serve_directory(const char* path, http_response_t* response);
+static error_code_t serve_file(worker_t* worker, http_request_t* request, const char* path,
+                               http_response_t* response);
+static bool parse_listing_view(const http_request_t* request, listing_view_t* view);
+static error_code_t serve_directory(worker_t* worker, http_request_t* request, const char* path,
+                                    const char* key, const listing_view_t* view,
+                                    http_response_t* response);
 static const char* get_mime_type(const char* path);
-static char* url_decode(const char* str);
 
 /**
  * Initialize web server
@@ -63,6 +222,17 @@ error_code_t webserver_init(webserver_config_t* config) {
     webserver_state.config.webroot = strdup(config->webroot);
     webserver_state.config.max_connections = config->max_connections;
     webserver_state.config.timeout = config->timeout;
+    webserver_state.config.workers = config->workers;
+    webserver_state.config.pin_workers = config->pin_workers;
+    webserver_state.config.cache_size = config->cache_size;
+    webserver_state.config.metrics_path = config->metrics_path && config->metrics_path[0] ?
+                                          strdup(config->metrics_path) : NULL;
+    
+    /* Default to one worker per online CPU */
+    if (webserver_state.config.workers == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        webserver_state.config.workers = cpus > 0 ? (uint32_t)cpus : 1;
+    }
     
     /* Create webroot directory if it doesn't exist */
     struct stat st = {0};
@@ -77,6 +247,14 @@ error_code_t webserver_init(webserver_config_t* config) {
 
 /**
  * Start web server
+ *
+ * Starts the configured number of workers, each with its own listening
+ * socket and event loop. Worker 0 runs on the calling thread; the call
+ * returns once webserver_stop has been called and all workers exited.
+ *
+ * Called on a scheduler thread, the workers run as scheduler threads
+ * instead, serving every connection on a thread of its own (see
+ * run_green_workers).
  */
 error_code_t webserver_start(void) {
     printf("Starting web server on port %d...\n", webserver_state.config.port);
@@ -89,33 +267,77 @@ error_code_t webserver_start(void) {
         return ERROR_NONE;
     }
     
-    /* Create server socket */
-    error_code_t err = io_create_server_socket(webserver_state.config.port, &webserver_state.server_fd);
-    if (err != ERROR_NONE) {
-        return err;
+    uint32_t worker_count = webserver_state.config.workers;
+    worker_t* workers = calloc(worker_count, sizeof(worker_t));
+    if (!workers) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    
+    /* Open listening sockets and event loops up front so failures are reported here */
+    thread_t* starter = scheduler_get_current();
+    uint32_t max_connections = webserver_state.config.max_connections;
+    for (uint32_t i = 0; i < worker_count; i++) {
+        workers[i].id = i;
+        workers[i].green = starter != NULL;
+        workers[i].max_connections = (max_connections + worker_count - 1) / worker_count;
+    
+        error_code_t err = worker_open(&workers[i]);
+        if (err != ERROR_NONE) {
+            for (uint32_t j = 0; j < i; j++) {
+                worker_close(&workers[j]);
+            }
+            free(workers);
+            return err;
+        }
     }
     
+    webserver_state.workers = workers;
+    webserver_state.worker_count = worker_count;
     webserver_state.running = true;
-    printf("Web server started successfully\n");
     
-    /* Main server loop */
-    while (webserver_state.running) {
-        int client_fd;
-        err = io_accept_connection(webserver_state.server_fd, &client_fd);
-        
+    error_code_t err = ERROR_NONE;
+    if (starter) {
+        err = run_green_workers(workers, worker_count, starter);
+    } else {
+        /* Start additional workers on their own threads */
+        for (uint32_t i = 1; i < worker_count; i++) {
+            if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0) {
+                err = ERROR_RESOURCE_BUSY;
+                webserver_stop();
+                break;
+            }
+            workers[i].thread_started = true;
+        }
+    
         if (err == ERROR_NONE) {
-            /* Handle client */
-            handle_client(client_fd);
-        } else if (err == ERROR_TIMEOUT) {
-            /* No new connections, just continue */
-            usleep(1000); /* Sleep for 1ms to avoid busy waiting */
-        } else {
-            /* Error accepting connection */
-            webserver_state.error_count++;
+            printf("Web server started successfully (%u workers)\n", worker_count);
+    
+            /* Run the first worker on this thread */
+            worker_main(&workers[0]);
+        }
+    
+        for (uint32_t i = 1; i < worker_count; i++) {
+            if (workers[i].thread_started) {
+                pthread_join(workers[i].thread, NULL);
+            }
         }
     }
     
-    return ERROR_NONE;
+    /* Tear down workers */
+    pthread_mutex_lock(&webserver_state.lock);
+    for (uint32_t i = 0; i < worker_count; i++) {
+        if (err == ERROR_NONE) {
+            err = workers[i].status;
+        }
+        worker_close(&workers[i]);
+    }
+    webserver_state.workers = NULL;
+    webserver_state.worker_count = 0;
+    webserver_state.running = false;
+    pthread_mutex_unlock(&webserver_state.lock);
+    
+    free(workers);
+    return err;
 }
 
 /**
@@ -128,18 +350,51 @@ error_code_t webserver_stop(void) {
         return ERROR_NONE;
     }
     
-    /* Close server socket */
-    io_close(webserver_state.server_fd);
-    
+    /* Workers close their sockets once they wake up */
+    pthread_mutex_lock(&webserver_state.lock);
     webserver_state.running = false;
+    for (uint32_t i = 0; i < webserver_state.worker_count; i++) {
+        worker_t* worker = &webserver_state.workers[i];
+        if (worker->green) {
+            io_wait_wake(worker->server_fd);
+        } else {
+            io_reactor_wakeup(&worker->reactor);
+        }
+    }
+    pthread_mutex_unlock(&webserver_state.lock);
+    
     printf("Web server stopped successfully\n");
     return ERROR_NONE;
 }
 
+/**
+ * Sum the statistics of all workers
+ *
+ * Only relaxed loads are used, so a running worker can call this without
+ * locks; the workers array must stay alive for the duration of the call.
+ */
+static void collect_stats(webserver_stats_t* stats) {
+    memset(stats, 0, sizeof(webserver_stats_t));
+    
+    for (uint32_t i = 0; i < webserver_state.worker_count; i++) {
+        worker_t* worker = &webserver_state.workers[i];
+        stats->request_count += metrics_read(&worker->metrics.requests);
+        stats->error_count += metrics_read(&worker->metrics.errors);
+        stats->bytes_sent += metrics_read(&worker->metrics.bytes_sent);
+        stats->bytes_received += metrics_read(&worker->metrics.bytes_received);
+        stats->open_connections += metrics_read(&worker->metrics.connections_opened) -
+                                   metrics_read(&worker->metrics.connections_closed);
+        stats->cache_hits += metrics_read(&worker->cache.hits);
+        stats->cache_misses += metrics_read(&worker->cache.misses);
+        stats->completed_count += metrics_read(&worker->metrics.latency[METRICS_PHASE_TOTAL].count);
+        stats->latency_ns += metrics_read(&worker->metrics.latency[METRICS_PHASE_TOTAL].sum);
+    }
+}
+
 /**
  * Get web server statistics
  */
-error_code_t webserver_get_stats(void* stats) {
+error_code_t webserver_get_stats(webserver_stats_t* stats) {
     if (!webserver_state.initialized) {
         return ERROR_NOT_IMPLEMENTED;
     }
@@ -148,18 +403,10 @@ error_code_t webserver_get_stats(void* stats) {
         return ERROR_INVALID_PARAMETER;
     }
     
-    /* Copy statistics */
-    struct {
-        uint32_t request_count;
-        uint32_t error_count;
-        uint64_t bytes_sent;
-        uint64_t bytes_received;
-    } *s = stats;
-    
-    s->request_count = webserver_state.request_count;
-    s->error_count = webserver_state.error_count;
-    s->bytes_sent = webserver_state.bytes_sent;
-    s->bytes_received = webserver_state.bytes_received;
+    /* The lock only keeps the workers from being torn down meanwhile */
+    pthread_mutex_lock(&webserver_state.lock);
+    collect_stats(stats);
+    pthread_mutex_unlock(&webserver_state.lock);
     
     return ERROR_NONE;
 }
@@ -179,498 +426,2138 @@ error_code_t webserver_optimize(void) {
 }
 
 /**
- * Handle client connection
+ * Open a worker's listening socket and, unless it is green, event loop
+ *
+ * Green workers' threads wait on their sockets in io_wait_ready and arm
+ * their timers on the scheduler's CPU, so they need neither a reactor nor
+ * a timer wheel.
  */
-static error_code_t handle_client(int client_fd) {
-    http_request_t request = {0};
-    http_response_t response = {0};
-    
-    /* Parse request */
-    error_code_t err = parse_request(client_fd, &request);
+static error_code_t worker_open(worker_t* worker) {
+    /* SO_REUSEPORT lets the kernel spread incoming connections over the workers */
+    error_code_t err = io_create_server_socket(webserver_state.config.port, &worker->server_fd);
     if (err != ERROR_NONE) {
-        /* Bad request */
-        response.status = HTTP_STATUS_BAD_REQUEST;
-        response.body = strdup("<html><body><h1>400 Bad Request</h1></body></html>");
-        response.body_length = strlen(response.body);
-        send_response(client_fd, &response);
-        free_response(&response);
-        io_close(client_fd);
         return err;
     }
     
-    /* Build response */
-    err = build_response(&request, &response);
+    /* Each worker caches its share of the asset budget */
+    asset_cache_init(&worker->cache, webserver_state.config.cache_size / webserver_state.config.workers);
+    if (worker->green) {
+        return ERROR_NONE;
+    }
+    
+    err = io_reactor_create(&worker->reactor, MAX_EVENTS);
     if (err != ERROR_NONE) {
-        /* Internal server error */
-        response.status = HTTP_STATUS_INTERNAL_SERVER_ERROR;
-        response.body = strdup("<html><body><h1>500 Internal Server Error</h1></body></html>");
-        response.body_length = strlen(response.body);
-        send_response(client_fd, &response);
-        free_response(&response);
-        io_close(client_fd);
+        asset_cache_destroy(&worker->cache);
+        io_close_socket(worker->server_fd);
         return err;
     }
     
-    /* Send response */
-    err = send_response(client_fd, &response);
-    
-    /* Clean up */
-    free_request(&request);
-    free_response(&response);
-    
-    /* Close connection if not keep-alive */
-    if (!request.keep_alive) {
-        io_close(client_fd);
+    err = io_reactor_add(&worker->reactor, worker->server_fd, IO_EVENT_READ, &worker->server_fd);
+    if (err == ERROR_NONE && worker->cache.notify_fd >= 0) {
+        err = io_reactor_add(&worker->reactor, worker->cache.notify_fd, IO_EVENT_READ,
+                             &worker->cache.notify_fd);
+    }
+    if (err != ERROR_NONE) {
+        io_reactor_destroy(&worker->reactor);
+        asset_cache_destroy(&worker->cache);
+        io_close_socket(worker->server_fd);
+        return err;
     }
     
-    /* Update statistics */
-    webserver_state.request_count++;
-    
-    return err;
+    timer_wheel_init(&worker->timers, monotonic_ms());
+    return ERROR_NONE;
 }
 
 /**
- * Parse HTTP request
+ * Close a worker's connections, event loop and listening socket
  */
-static error_code_t parse_request(int client_fd, http_request_t* request) {
-    char buffer[BUFFER_SIZE];
-    uint32_t bytes_read;
-    
-    /* Read request */
-    error_code_t err = io_read(client_fd, buffer, BUFFER_SIZE - 1, &bytes_read);
-    if (err != ERROR_NONE || bytes_read == 0) {
-        return ERROR_INVALID_PARAMETER;
+static void worker_close(worker_t* worker) {
+    while (worker->connections) {
+        close_connection(worker->connections);
     }
     
-    buffer[bytes_read] = '\0';
-    
-    /* Update statistics */
-    webserver_state.bytes_received += bytes_read;
-    
-    /* Parse request line */
-    char* line = strtok(buffer, "\r\n");
-    if (!line) return ERROR_INVALID_PARAMETER;
-    
-    char* method_str = strtok(line, " ");
-    if (!method_str) return ERROR_INVALID_PARAMETER;
-    
-    char* path = strtok(NULL, " ");
-    if (!path) return ERROR_INVALID_PARAMETER;
-    
-    char* version = strtok(NULL, " ");
-    if (!version) return ERROR_INVALID_PARAMETER;
-    
-    /* Parse method */
-    if (strcmp(method_str, "GET") == 0) {
-        request->method = HTTP_METHOD_GET;
-    } else if (strcmp(method_str, "HEAD") == 0) {
-        request->method = HTTP_METHOD_HEAD;
-    } else if (strcmp(method_str, "POST") == 0) {
-        request->method = HTTP_METHOD_POST;
-    } else if (strcmp(method_str, "PUT") == 0) {
-        request->method = HTTP_METHOD_PUT;
-    } else if (strcmp(method_str, "DELETE") == 0) {
-        request->method = HTTP_METHOD_DELETE;
-    } else if (strcmp(method_str, "OPTIONS") == 0) {
-        request->method = HTTP_METHOD_OPTIONS;
-    } else {
-        request->method = HTTP_METHOD_UNKNOWN;
-    }
-    
-    /* Copy path and version */
-    request->path = url_decode(path);
-    request->version = strdup(version);
-    
-    /* Parse headers */
-    while ((line = strtok(NULL, "\r\n")) != NULL && line[0] != '\0') {
-        char* key = strtok(line, ":");
-        char* value = strtok(NULL, "\0");
-        
-        if (key && value) {
-            /* Skip leading whitespace in value */
-            while (*value == ' ') value++;
-            
-            request->headers[request->header_count][0] = strdup(key);
-            request->headers[request->header_count][1] = strdup(value);
-            request->header_count++;
-            
-            /* Check for Connection header */
-            if (strcasecmp(key, "Connection") == 0) {
-                if (strcasecmp(value, "keep-alive") == 0) {
-                    request->keep_alive = 1;
-                }
+    asset_cache_destroy(&worker->cache);
+    if (!worker->green) {
+        io_reactor_destroy(&worker->reactor);
+    }
+    io_close_socket(worker->server_fd);
+}
+
+/**
+ * Worker thread entry point
+ */
+static void* worker_main(void* arg) {
+    worker_t* worker = (worker_t*)arg;
+    
+    /* Optionally pin the worker to its own core of those the process may use */
+    cpu_set_t allowed;
+    if (webserver_state.config.pin_workers && sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        uint32_t index = worker->id % (uint32_t)CPU_COUNT(&allowed);
+        for (uint32_t core = 0; core < CPU_SETSIZE; core++) {
+            if (CPU_ISSET(core, &allowed) && index-- == 0) {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET(core, &set);
+                pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+                break;
             }
         }
-        
-        if (request->header_count >= 100) break;
     }
     
-    /* TODO: Parse request body if needed */
+    worker->status = worker_run(worker);
+    if (worker->status != ERROR_NONE) {
+        /* Bring the other workers down as well */
+        webserver_stop();
+    }
     
-    return ERROR_NONE;
+    return NULL;
 }
 
 /**
- * Build HTTP response
+ * Run a worker's event loop until the server is stopped
  */
-static error_code_t build_response(http_request_t* request, http_response_t* response) {
-    /* Default to 200 OK */
-    response->status = HTTP_STATUS_OK;
+static error_code_t worker_run(worker_t* worker) {
+    io_event_t events[MAX_EVENTS];
     
-    /* Add default headers */
-    response->headers[response->header_count][0] = strdup("Server");
-    response->headers[response->header_count][1] = strdup(SERVER_NAME);
-    response->header_count++;
+    worker->now = monotonic_ms();
     
-    response->headers[response->header_count][0] = strdup("Date");
-    time_t now = time(NULL);
-    char date[100];
-    strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", gmtime(&now));
-    response->headers[response->header_count][1] = strdup(date);
-    response->header_count++;
-    
-    /* Handle Connection header */
-    response->headers[response->header_count][0] = strdup("Connection");
-    if (request->keep_alive) {
-        response->headers[response->header_count][1] = strdup("keep-alive");
-    } else {
-        response->headers[response->header_count][1] = strdup("close");
-    }
-    response->header_count++;
+    while (webserver_state.running) {
+        uint32_t event_count;
+        /* Queued responses continue without waiting */
+        error_code_t err = io_reactor_wait(&worker->reactor, events, MAX_EVENTS,
+                                           worker->queue_head ? 0 : next_timeout(worker), &event_count);
+        if (err != ERROR_NONE) {
+            metrics_add(&worker->metrics.errors, 1);
+            return err;
+        }
     
-    /* Handle different request methods */
-    if (request->method == HTTP_METHOD_GET) {
-        /* Construct full path */
-        char full_path[BUFFER_SIZE];
-        snprintf(full_path, BUFFER_SIZE, "%s%s", webserver_state.config.webroot, request->path);
-        
-        /* Check if path ends with '/' */
-        size_t path_len = strlen(full_path);
-        if (path_len > 0 && full_path[path_len - 1] == '/') {
-            strcat(full_path, "index.html");
-        }
-        
-        /* Check if file exists */
-        struct stat st;
-        if (stat(full_path, &st) == 0) {
-            if (S_ISDIR(st.st_mode)) {
-                /* If it's a directory and doesn't end with '/', redirect */
-                if (request->path[strlen(request->path) - 1] != '/') {
-                    response->status = HTTP_STATUS_MOVED_PERMANENTLY;
-                    char location[BUFFER_SIZE];
-                    snprintf(location, BUFFER_SIZE, "%s/", request->path);
-                    response->headers[response->header_count][0] = strdup("Location");
-                    response->headers[response->header_count][1] = strdup(location);
-                    response->header_count++;
-                    
-                    response->body = strdup("<html><body><h1>301 Moved Permanently</h1></body></html>");
-                    response->body_length = strlen(response->body);
-                } else {
-                    /* Serve directory listing */
-                    serve_directory(full_path, response);
-                }
+        worker->now = monotonic_ms();
+    
+        for (uint32_t i = 0; i < event_count; i++) {
+            if (events[i].data == &worker->server_fd) {
+                accept_connections(worker);
+            } else if (events[i].data == &worker->cache.notify_fd) {
+                asset_cache_process_events(&worker->cache);
             } else {
-                /* Serve file */
-                serve_file(full_path, response);
+                handle_connection((connection_t*)events[i].data, events[i].events);
             }
-        } else {
-            /* File not found */
-            response->status = HTTP_STATUS_NOT_FOUND;
-            response->body = strdup("<html><body><h1>404 Not Found</h1></body></html>");
-            response->body_length = strlen(response->body);
-        }
-    } else if (request->method == HTTP_METHOD_HEAD) {
-        /* Same as GET but without body */
-        char full_path[BUFFER_SIZE];
-        snprintf(full_path, BUFFER_SIZE, "%s%s", webserver_state.config.webroot, request->path);
-        
-        struct stat st;
-        if (stat(full_path, &st) == 0) {
-            /* File exists, set Content-Type and Content-Length but don't send body */
-            response->headers[response->header_count][0] = strdup("Content-Type");
-            response->headers[response->header_count][1] = strdup(get_mime_type(full_path));
-            response->header_count++;
-            
-            char content_length[20];
-            snprintf(content_length, sizeof(content_length), "%ld", (long)st.st_size);
-            response->headers[response->header_count][0] = strdup("Content-Length");
-            response->headers[response->header_count][1] = strdup(content_length);
-            response->header_count++;
-        } else {
-            response->status = HTTP_STATUS_NOT_FOUND;
         }
-    } else {
-        /* Method not supported */
-        response->status = HTTP_STATUS_METHOD_NOT_ALLOWED;
-        response->headers[response->header_count][0] = strdup("Allow");
-        response->headers[response->header_count][1] = strdup("GET, HEAD");
-        response->header_count++;
-        
-        response->body = strdup("<html><body><h1>405 Method Not Allowed</h1></body></html>");
-        response->body_length = strlen(response->body);
-    }
     
-    /* Add Content-Type and Content-Length headers if not already set */
-    if (response->body && response->body_length > 0) {
-        int has_content_type = 0;
-        int has_content_length = 0;
-        
-        for (int i = 0; i < response->header_count; i++) {
-            if (strcasecmp(response->headers[i][0], "Content-Type") == 0) {
-                has_content_type = 1;
-            }
-            if (strcasecmp(response->headers[i][0], "Content-Length") == 0) {
-                has_content_length = 1;
-            }
-        }
-        
-        if (!has_content_type) {
-            response->headers[response->header_count][0] = strdup("Content-Type");
-            response->headers[response->header_count][1] = strdup("text/html");
-            response->header_count++;
-        }
-        
-        if (!has_content_length) {
-            char content_length[20];
-            snprintf(content_length, sizeof(content_length), "%zu", response->body_length);
-            response->headers[response->header_count][0] = strdup("Content-Length");
-            response->headers[response->header_count][1] = strdup(content_length);
-            response->header_count++;
-        }
+        run_queue(worker);
+        timer_wheel_advance(&worker->timers, worker->now);
     }
     
     return ERROR_NONE;
 }
 
 /**
- * Send HTTP response
+ * Run the workers as scheduler threads, with a thread per connection
+ *
+ * Each worker has an acceptor thread, which starts a thread for every
+ * connection it accepts, and a thread following the asset cache's change
+ * notifications. All threads of a worker are bound to one CPU, so they
+ * never run at the same time and share the worker's state without locks;
+ * they park in io_wait_ready whenever their socket has to wait. Returns
+ * once webserver_stop has been called and every thread has exited.
  */
-static error_code_t send_response(int client_fd, http_response_t* response) {
-    char buffer[BUFFER_SIZE];
-    uint32_t bytes_written;
-    
-    /* Status line */
-    const char* status_text;
-    switch (response->status) {
-        case HTTP_STATUS_OK: status_text = "OK"; break;
-        case HTTP_STATUS_CREATED: status_text = "Created"; break;
-        case HTTP_STATUS_ACCEPTED: status_text = "Accepted"; break;
-        case HTTP_STATUS_NO_CONTENT: status_text = "No Content"; break;
-        case HTTP_STATUS_MOVED_PERMANENTLY: status_text = "Moved Permanently"; break;
-        case HTTP_STATUS_FOUND: status_text = "Found"; break;
-        case HTTP_STATUS_NOT_MODIFIED: status_text = "Not Modified"; break;
-        case HTTP_STATUS_BAD_REQUEST: status_text = "Bad Request"; break;
-        case HTTP_STATUS_UNAUTHORIZED: status_text = "Unauthorized"; break;
-        case HTTP_STATUS_FORBIDDEN: status_text = "Forbidden"; break;
-        case HTTP_STATUS_NOT_FOUND: status_text = "Not Found"; break;
-        case HTTP_STATUS_METHOD_NOT_ALLOWED: status_text = "Method Not Allowed"; break;
-        case HTTP_STATUS_INTERNAL_SERVER_ERROR: status_text = "Internal Server Error"; break;
-        case HTTP_STATUS_NOT_IMPLEMENTED: status_text = "Not Implemented"; break;
-        case HTTP_STATUS_BAD_GATEWAY: status_text = "Bad Gateway"; break;
-        case HTTP_STATUS_SERVICE_UNAVAILABLE: status_text = "Service Unavailable"; break;
-        default: status_text = "Unknown";
-    }
-    
-    int len = snprintf(buffer, BUFFER_SIZE, "HTTP/1.1 %d %s\r\n", response->status, status_text);
-    io_write(client_fd, buffer, len, &bytes_written);
-    webserver_state.bytes_sent += bytes_written;
-    
-    /* Headers */
-    for (int i = 0; i < response->header_count; i++) {
-        len = snprintf(buffer, BUFFER_SIZE, "%s: %s\r\n", response->headers[i][0], response->headers[i][1]);
-        io_write(client_fd, buffer, len, &bytes_written);
-        webserver_state.bytes_sent += bytes_written;
+static error_code_t run_green_workers(worker_t* workers, uint32_t worker_count, thread_t* starter) {
+    error_code_t err = ERROR_NONE;
+    
+    webserver_state.starter = starter;
+    for (uint32_t i = 0; i < worker_count; i++) {
+        atomic_fetch_add_explicit(&webserver_state.acceptors, 1, memory_order_relaxed);
+        err = spawn_thread(&workers[i], acceptor_main, &workers[i], &workers[i].acceptor);
+        if (err != ERROR_NONE) {
+            atomic_fetch_sub_explicit(&webserver_state.acceptors, 1, memory_order_relaxed);
+            webserver_stop();
+            break;
+        }
     }
     
-    /* End of headers */
-    io_write(client_fd, "\r\n", 2, &bytes_written);
-    webserver_state.bytes_sent += bytes_written;
+    if (err == ERROR_NONE) {
+        printf("Web server started successfully (%u workers, a thread per connection)\n", worker_count);
+    }
     
-    /* Body */
-    if (response->body && response->body_length > 0) {
-        io_write(client_fd, response->body, response->body_length, &bytes_written);
-        webserver_state.bytes_sent += bytes_written;
+    /* The last acceptor to finish unblocks this thread */
+    while (atomic_load_explicit(&webserver_state.acceptors, memory_order_acquire) > 0) {
+        scheduler_block_current();
     }
     
-    return ERROR_NONE;
+    for (uint32_t i = 0; i < worker_count; i++) {
+        if (workers[i].acceptor) {
+            release_thread(workers[i].acceptor);
+            workers[i].acceptor = NULL;
+        }
+    }
+    webserver_state.starter = NULL;
+    return err;
 }
 
 /**
- * Free request resources
+ * Start a scheduler thread bound to a worker's CPU
+ *
+ * The thread takes the process and priority of the thread that started
+ * the server.
  */
-static void free_request(http_request_t* request) {
-    if (request->path) free(request->path);
-    if (request->version) free(request->version);
-    
-    for (int i = 0; i < request->header_count; i++) {
-        if (request->headers[i][0]) free(request->headers[i][0]);
-        if (request->headers[i][1]) free(request->headers[i][1]);
+static error_code_t spawn_thread(worker_t* worker, void (*entry)(void*), void* arg, thread_t** thread) {
+    process_t* process = process_find(webserver_state.starter->pid);
+    if (!process) {
+        return ERROR_INVALID_PARAMETER;
     }
     
-    if (request->body) free(request->body);
-    
-    memset(request, 0, sizeof(http_request_t));
+    return thread_create_on(thread, process, entry, arg, webserver_state.starter->priority,
+                            CONNECTION_STACK_SIZE, worker->id);
 }
 
 /**
- * Free response resources
+ * Release an exited thread
  */
-static void free_response(http_response_t* response) {
-    for (int i = 0; i < response->header_count; i++) {
-        if (response->headers[i][0]) free(response->headers[i][0]);
-        if (response->headers[i][1]) free(response->headers[i][1]);
+static void release_thread(thread_t* thread) {
+    /* It may still be switching out on another CPU */
+    while (thread_terminate(thread->tid) == ERROR_RESOURCE_BUSY) {
+        scheduler_yield();
     }
-    
-    if (response->body) free(response->body);
-    
-    memset(response, 0, sizeof(http_response_t));
 }
 
 /**
- * Serve a file
+ * Leave a connection or notify thread's last steps to the worker
+ *
+ * Called last on the thread. The thread that exited before has switched
+ * out for good by now, as both ran on the worker's CPU, so it is
+ * released; this one is left for the next thread to exit, or for the
+ * acceptor.
  */
-static error_code_t serve_file(const char* path, http_response_t* response) {
-    FILE* file = fopen(path, "rb");
-    if (!file) {
-        response->status = HTTP_STATUS_NOT_FOUND;
-        response->body = strdup("<html><body><h1>404 Not Found</h1></body></html>");
-        response->body_length = strlen(response->body);
-        return ERROR_INVALID_PARAMETER;
+static void thread_exiting(worker_t* worker) {
+    if (worker->exited) {
+        release_thread(worker->exited);
     }
+    worker->exited = scheduler_get_current();
     
-    /* Get file size */
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
-    
-    /* Allocate memory for file content */
-    response->body = malloc(file_size);
-    if (!response->body) {
-        fclose(file);
-        response->status = HTTP_STATUS_INTERNAL_SERVER_ERROR;
-        response->body = strdup("<html><body><h1>500 Internal Server Error</h1></body></html>");
-        response->body_length = strlen(response->body);
-        return ERROR_MEMORY_ALLOCATION;
+    if (--worker->thread_count == 0 && !webserver_state.running) {
+        scheduler_unblock(worker->acceptor);
+    }
+}
+
+/**
+ * Acceptor thread of a green worker
+ */
+static void acceptor_main(void* arg) {
+    worker_t* worker = arg;
+    
+    if (worker->cache.notify_fd >= 0) {
+        thread_t* notify;
+        if (spawn_thread(worker, notify_main, worker, &notify) == ERROR_NONE) {
+            worker->thread_count++;
+        }
     }
     
-    /* Read file content */
-    response->body_length = fread(response->body, 1, file_size, file);
-    fclose(file);
+    while (webserver_state.running) {
+        worker->now = monotonic_ms();
+        accept_connections(worker);
+        if (webserver_state.running) {
+            io_wait_ready(worker->server_fd, IO_EVENT_READ);
+        }
+    }
     
-    /* Set Content-Type header */
-    response->headers[response->header_count][0] = strdup("Content-Type");
-    response->headers[response->header_count][1] = strdup(get_mime_type(path));
-    response->header_count++;
+    /* Every thread closes its own connection once woken */
+    for (connection_t* conn = worker->connections; conn; conn = conn->next) {
+        io_wait_wake(conn->fd);
+    }
+    if (worker->cache.notify_fd >= 0) {
+        io_wait_wake(worker->cache.notify_fd);
+    }
+    while (worker->thread_count > 0) {
+        scheduler_block_current();
+    }
+    if (worker->exited) {
+        release_thread(worker->exited);
+        worker->exited = NULL;
+    }
     
-    return ERROR_NONE;
+    if (atomic_fetch_sub_explicit(&webserver_state.acceptors, 1, memory_order_acq_rel) == 1) {
+        scheduler_unblock(webserver_state.starter);
+    }
 }
 
 /**
- * Serve a directory listing
+ * Asset cache notification thread of a green worker
  */
-static error_code_t serve_directory(const char* path, http_response_t* response) {
-    DIR* dir = opendir(path);
-    if (!dir) {
-        response->status = HTTP_STATUS_INTERNAL_SERVER_ERROR;
-        response->body = strdup("<html><body><h1>500 Internal Server Error</h1></body></html>");
-        response->body_length = strlen(response->body);
-        return ERROR_INVALID_PARAMETER;
-    }
+static void notify_main(void* arg) {
+    worker_t* worker = arg;
     
-    /* Build HTML directory listing */
-    char* html = malloc(BUFFER_SIZE * 16);
-    if (!html) {
-        closedir(dir);
-        response->status = HTTP_STATUS_INTERNAL_SERVER_ERROR;
-        response->body = strdup("<html><body><h1>500 Internal Server Error</h1></body></html>");
-        response->body_length = strlen(response->body);
-        return ERROR_MEMORY_ALLOCATION;
+    while (webserver_state.running) {
+        asset_cache_process_events(&worker->cache);
+        io_wait_ready(worker->cache.notify_fd, IO_EVENT_READ);
     }
     
-    int len = sprintf(html, "<html><head><title>Directory Listing</title></head><body><h1>Directory Listing</h1><ul>");
+    thread_exiting(worker);
+}
+
+/**
+ * Connection thread of a green worker
+ *
+ * The event loop's steps written straight: read what has arrived, answer
+ * the complete requests, and park whenever the socket has no data or no
+ * space left.
+ */
+static void connection_main(void* arg) {
+    connection_t* conn = arg;
+    worker_t* worker = conn->worker;
+    
+    for (;;) {
+        bool closed = false;
+    
+        if (conn->length < BUFFER_SIZE) {
+            uint32_t bytes_read;
+            error_code_t err = io_read_socket(conn->fd, conn->buffer + conn->length,
+                                              BUFFER_SIZE - conn->length, &bytes_read);
+            if (err == ERROR_TIMEOUT) {
+                if (wait_socket(conn, IO_EVENT_READ) != ERROR_NONE) {
+                    break;
+                }
+                continue;
+            }
     
-    struct dirent* entry;
-    while ((entry = readdir(dir)) != NULL) {
-        if (entry->d_name[0] == '.') continue;  /* Skip hidden files */
-        
-        char full_path[BUFFER_SIZE];
-        snprintf(full_path, BUFFER_SIZE, "%s/%s", path, entry->d_name);
-        
-        struct stat st;
-        if (stat(full_path, &st) == 0) {
-            if (S_ISDIR(st.st_mode)) {
-                len += sprintf(html + len, "<li><a href=\"%s/\">%s/</a></li>", entry->d_name, entry->d_name);
+            if (err != ERROR_NONE || bytes_read == 0) {
+                /* Peer closed the connection or read failed */
+                closed = true;
             } else {
-                len += sprintf(html + len, "<li><a href=\"%s\">%s</a> (%ld bytes)</li>", 
-                              entry->d_name, entry->d_name, (long)st.st_size);
+                conn->length += bytes_read;
+                metrics_add(&worker->metrics.bytes_received, bytes_read);
+                touch_connection(conn);
+                if (conn->request_start == 0) {
+                    conn->request_start = monotonic_ns();
+                }
             }
         }
-    }
     
-    len += sprintf(html + len, "</ul></body></html>");
-    closedir(dir);
+        error_code_t err = process_requests(conn);
+        while (err == ERROR_TIMEOUT) {
+            /* Park until the socket has space for more of the response */
+            err = wait_socket(conn, IO_EVENT_WRITE);
+            if (err == ERROR_NONE) {
+                err = flush_response(conn);
+            }
+            if (err == ERROR_NONE) {
+                err = finish_request(conn) ? process_requests(conn) : ERROR_RESOURCE_BUSY;
+            }
+        }
+    
+        if (err != ERROR_NONE || closed) {
+            break;
+        }
+    }
     
-    response->body = html;
-    response->body_length = len;
+    close_connection(conn);
+    thread_exiting(worker);
+}
+
+/**
+ * Park a connection's thread until its socket may be ready
+ *
+ * Fails once the server is stopping or the connection has been idle for
+ * too long, so the thread closes the connection.
+ */
+static error_code_t wait_socket(connection_t* conn, uint32_t events) {
+    if (!webserver_state.running || conn->expired) {
+        return ERROR_RESOURCE_BUSY;
+    }
     
-    /* Set Content-Type header */
-    response->headers[response->header_count][0] = strdup("Content-Type");
-    response->headers[response->header_count][1] = strdup("text/html");
-    response->header_count++;
+    error_code_t err = io_wait_ready(conn->fd, events);
+    conn->worker->now = monotonic_ms();
     
-    return ERROR_NONE;
+    return err == ERROR_NONE && webserver_state.running && !conn->expired ? ERROR_NONE : ERROR_RESOURCE_BUSY;
 }
 
 /**
- * Get MIME type based on file extension
+ * Get a monotonic timestamp in nanoseconds
  */
-static const char* get_mime_type(const char* path) {
-    const char* ext = strrchr(path, '.');
-    if (!ext) return "application/octet-stream";
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Get monotonic time in milliseconds
+ */
+static uint64_t monotonic_ms(void) {
+    return monotonic_ns() / 1000000;
+}
+
+/**
+ * Get the reactor timeout until the worker's next timer is due
+ */
+static int32_t next_timeout(worker_t* worker) {
+    uint64_t next = timer_wheel_next(&worker->timers);
     
-    ext++;  /* Skip the dot */
+    if (next == UINT64_MAX) {
+        return -1;
+    }
+    if (next <= worker->now) {
+        return 0;
+    }
+    return next - worker->now > INT32_MAX ? INT32_MAX : (int32_t)(next - worker->now);
+}
+
+/**
+ * Arm a connection's idle timer for a timeout after its last activity
+ *
+ * Event loop connections use the worker's wheel, green ones the timers of
+ * the worker's CPU, which their threads are bound to.
+ */
+static void arm_idle_timer(connection_t* conn) {
+    uint64_t expires = conn->last_active + webserver_state.config.timeout;
     
-    if (strcasecmp(ext, "html") == 0 || strcasecmp(ext, "htm") == 0) return "text/html";
-    if (strcasecmp(ext, "txt") == 0) return "text/plain";
-    if (strcasecmp(ext, "css") == 0) return "text/css";
-    if (strcasecmp(ext, "js") == 0) return "application/javascript";
-    if (strcasecmp(ext, "json") == 0) return "application/json";
-    if (strcasecmp(ext, "xml") == 0) return "application/xml";
-    if (strcasecmp(ext, "jpg") == 0 || strcasecmp(ext, "jpeg") == 0) return "image/jpeg";
-    if (strcasecmp(ext, "png") == 0) return "image/png";
-    if (strcasecmp(ext, "gif") == 0) return "image/gif";
-    if (strcasecmp(ext, "svg") == 0) return "image/svg+xml";
-    if (strcasecmp(ext, "ico") == 0) return "image/x-icon";
-    if (strcasecmp(ext, "pdf") == 0) return "application/pdf";
-    if (strcasecmp(ext, "zip") == 0) return "application/zip";
+    if (conn->worker->green) {
+        scheduler_timer_add(&conn->timer, expires);
+    } else {
+        timer_wheel_add(&conn->worker->timers, &conn->timer, expires);
+    }
+}
+
+/**
+ * Close a connection that has been idle for the configured timeout
+ *
+ * Activity only moves last_active, so a timer finding the connection
+ * active since it was armed just arms itself again for the rest of the
+ * timeout: a busy connection costs one timer operation per timeout
+ * rather than one per read or write. A green connection is closed by its
+ * own thread, which is woken for it.
+ */
+static void idle_timeout(wheel_timer_t* timer) {
+    connection_t* conn = timer->arg;
+    worker_t* worker = conn->worker;
+    uint64_t now = worker->green ? monotonic_ms() : worker->now;
+    
+    if (now - conn->last_active < webserver_state.config.timeout) {
+        arm_idle_timer(conn);
+        return;
+    }
     
-    return "application/octet-stream";
+    if (worker->green) {
+        conn->expired = true;
+        io_wait_wake(conn->fd);
+        return;
+    }
+    close_connection(conn);
+}
+
+/**
+ * Record activity on a connection, which pushes back its idle timeout
+ */
+static void touch_connection(connection_t* conn) {
+    conn->last_active = conn->worker->now;
 }
 
 /**
- * URL decode
+ * Accept all pending connections on the listening socket
  */
-static char* url_decode(const char* str) {
-    if (!str) return NULL;
+static void accept_connections(worker_t* worker) {
+    for (;;) {
+        int client_fd;
+        error_code_t err = io_accept_connection(worker->server_fd, &client_fd);
+    
+        if (err == ERROR_TIMEOUT) {
+            /* Accept queue drained */
+            return;
+        }
     
-    char* decoded = malloc(strlen(str) + 1);
-    if (!decoded) return NULL;
+        if (err != ERROR_NONE) {
+            metrics_add(&worker->metrics.errors, 1);
+            return;
+        }
+    
+        /* Enforce connection limit */
+        if (worker->max_connections > 0 && worker->connection_count >= worker->max_connections) {
+            io_close_socket(client_fd);
+            metrics_add(&worker->metrics.errors, 1);
+            continue;
+        }
     
-    char* ptr = decoded;
+        connection_t* conn = calloc(1, sizeof(connection_t));
+        if (!conn) {
+            io_close_socket(client_fd);
+            metrics_add(&worker->metrics.errors, 1);
+            continue;
+        }
+        conn->fd = client_fd;
+        conn->worker = worker;
+        wheel_timer_init(&conn->timer, idle_timeout, conn);
+        http_parser_init(&conn->parser, &conn->request);
+        arena_init(&conn->arena, ARENA_BLOCK_SIZE);
+        conn->response.arena = &conn->arena;
+    
+        /* Edge-triggered: both directions are registered once for the connection lifetime;
+           green workers start the connection's thread instead */
+        thread_t* thread;
+        error_code_t started = worker->green ?
+                               spawn_thread(worker, connection_main, conn, &thread) :
+                               io_reactor_add(&worker->reactor, client_fd, IO_EVENT_READ | IO_EVENT_WRITE, conn);
+        if (started != ERROR_NONE) {
+            io_close_socket(client_fd);
+            free(conn);
+            metrics_add(&worker->metrics.errors, 1);
+            continue;
+        }
+        if (worker->green) {
+            worker->thread_count++;
+        }
     
-    while (*str) {
-        if (*str == '%' && *(str + 1) && *(str + 2)) {
-            char hex[3] = {*(str + 1), *(str + 2), 0};
-            *ptr++ = (char)strtol(hex, NULL, 16);
-            str += 3;
-        } else if (*str == '+') {
-            *ptr++ = ' ';
-            str++;
+        /* Append to open connection list */
+        conn->prev = worker->last_connection;
+        if (conn->prev) {
+            conn->prev->next = conn;
         } else {
-            *ptr++ = *str++;
+            worker->connections = conn;
+        }
+        worker->last_connection = conn;
+        worker->connection_count++;
+        metrics_add(&worker->metrics.connections_opened, 1);
+        conn->last_active = worker->now;
+        if (webserver_state.config.timeout > 0) {
+            arm_idle_timer(conn);
+        }
+    }
+}
+
+/**
+ * Handle readiness events for a client connection
+ */
+static void handle_connection(connection_t* conn, uint32_t events) {
+    if (events & IO_EVENT_ERROR) {
+        close_connection(conn);
+        return;
+    }
+    
+    /* Finish the pending response before reading anything else */
+    if (conn->state == CONNECTION_WRITING) {
+        if (events & IO_EVENT_WRITE) {
+            write_response(conn);
         }
+        return;
     }
     
-    *ptr = '\0';
-    return decoded;
-}
\ No newline at end of file
+    if (events & (IO_EVENT_READ | IO_EVENT_HANGUP)) {
+        read_request(conn);
+    }
+}
+
+/**
+ * Continue writing the pending response, then resume reading requests
+ */
+static void write_response(connection_t* conn) {
+    error_code_t err = flush_response(conn);
+    if (err == ERROR_TIMEOUT) {
+        return;
+    }
+    
+    if (err != ERROR_NONE || !finish_request(conn)) {
+        close_connection(conn);
+        return;
+    }
+    
+    /* Requests that arrived meanwhile produced no new read event */
+    read_request(conn);
+}
+
+/**
+ * Read available request bytes and process all complete requests
+ *
+ * The parser resumes where the previous read left off, so a head split
+ * across several reads is only scanned once. Pipelined requests are
+ * answered in order; reading stops while a response waits for socket space.
+ */
+static void read_request(connection_t* conn) {
+    for (;;) {
+        bool drained = false;
+        bool closed = false;
+    
+        /* Drain the socket (required with edge-triggered readiness) */
+        while (conn->length < BUFFER_SIZE) {
+            uint32_t bytes_read;
+            error_code_t err = io_read_socket(conn->fd, conn->buffer + conn->length,
+                                              BUFFER_SIZE - conn->length, &bytes_read);
+            if (err == ERROR_TIMEOUT) {
+                drained = true;
+                break;
+            }
+    
+            if (err != ERROR_NONE || bytes_read == 0) {
+                /* Peer closed the connection or read failed */
+                closed = true;
+                break;
+            }
+    
+            conn->length += bytes_read;
+            metrics_add(&conn->worker->metrics.bytes_received, bytes_read);
+            touch_connection(conn);
+            if (conn->request_start == 0) {
+                conn->request_start = monotonic_ns();
+            }
+        }
+    
+        error_code_t err = process_requests(conn);
+        if (err == ERROR_TIMEOUT) {
+            /* Reading resumes once the response has been written */
+            return;
+        }
+    
+        if (err != ERROR_NONE || closed) {
+            close_connection(conn);
+            return;
+        }
+    
+        if (drained) {
+            return;
+        }
+    
+        /* Buffer was full; processing made room for more */
+    }
+}
+
+/**
+ * Process the complete requests in the connection buffer
+ *
+ * Returns ERROR_TIMEOUT if a response is waiting for socket space,
+ * ERROR_NONE once the buffer holds no further complete request, and
+ * ERROR_RESOURCE_BUSY if the connection must be closed.
+ */
+static error_code_t process_requests(connection_t* conn) {
+    while (conn->length > 0) {
+        /* Discard the body of the previous request */
+        if (conn->body_remaining > 0) {
+            uint32_t length = conn->body_remaining < conn->length ?
+                              (uint32_t)conn->body_remaining : conn->length;
+            consume_buffer(conn, length);
+            conn->body_remaining -= length;
+            continue;
+        }
+    
+        http_parse_result_t result = http_parser_execute(&conn->parser, &conn->request,
+                                                         conn->buffer, conn->length, BUFFER_SIZE);
+        if (result == HTTP_PARSE_INCOMPLETE) {
+            break;
+        }
+    
+        conn->state = CONNECTION_PROCESSING;
+        error_code_t err = process_request(conn, result);
+        if (err != ERROR_NONE) {
+            return err == ERROR_TIMEOUT ? ERROR_TIMEOUT : ERROR_RESOURCE_BUSY;
+        }
+    
+        if (!finish_request(conn)) {
+            return ERROR_RESOURCE_BUSY;
+        }
+    }
+    
+    conn->state = conn->length > 0 || conn->body_remaining > 0 ? CONNECTION_READING : CONNECTION_IDLE;
+    return ERROR_NONE;
+}
+
+/**
+ * Respond to a parsed request head and start sending the response
+ */
+static error_code_t process_request(connection_t* conn, http_parse_result_t result) {
+    http_request_t* request = &conn->request;
+    http_response_t* response = &conn->response;
+    worker_metrics_t* metrics = &conn->worker->metrics;
+    
+    uint64_t parsed = monotonic_ns();
+    if (conn->request_start == 0) {
+        conn->request_start = parsed;
+    }
+    metrics_record(&metrics->latency[METRICS_PHASE_PARSE], parsed - conn->request_start);
+    
+    if (result == HTTP_PARSE_TOO_LARGE) {
+        /* Request head does not fit in the connection buffer */
+        response->status = HTTP_STATUS_REQUEST_HEADER_FIELDS_TOO_LARGE;
+        response->body = "<html><body><h1>431 Request Header Fields Too Large</h1></body></html>";
+        response->body_length = strlen(response->body);
+        add_content_headers(response);
+    } else if (result != HTTP_PARSE_COMPLETE) {
+        /* Bad request */
+        response->status = HTTP_STATUS_BAD_REQUEST;
+        response->body = "<html><body><h1>400 Bad Request</h1></body></html>";
+        response->body_length = strlen(response->body);
+        add_content_headers(response);
+    } else {
+        /* Request bodies are not used; skip them to reach the next request */
+        conn->body_remaining = request->body_length;
+    
+        /* Build response */
+        error_code_t err = build_response(conn->worker, request, response);
+        if (err != ERROR_NONE || response->failed) {
+            /* Internal server error */
+            free_response(response);
+            response->status = HTTP_STATUS_INTERNAL_SERVER_ERROR;
+            response->body = "<html><body><h1>500 Internal Server Error</h1></body></html>";
+            response->body_length = strlen(response->body);
+            add_content_headers(response);
+        } else {
+            /* Update statistics */
+            metrics_add(&metrics->requests, 1);
+        }
+    
+        /* Large bodies are cheaper to drop with the connection than to read */
+        conn->response.keep_alive = request->keep_alive && conn->body_remaining <= MAX_DISCARD;
+    }
+    
+    conn->send_start = monotonic_ns();
+    metrics_record(&metrics->latency[METRICS_PHASE_BUILD], conn->send_start - parsed);
+    
+    /* Consume the request head; only the response refers to it from now on */
+    consume_buffer(conn, conn->parser.head_length);
+    http_parser_init(&conn->parser, &conn->request);
+    
+    /* Send response; if the socket is full, the rest goes out on the next write event */
+    conn->state = CONNECTION_WRITING;
+    return send_response(conn);
+}
+
+/**
+ * Complete a written response
+ *
+ * Returns false if the connection must be closed instead of reused.
+ */
+static bool finish_request(connection_t* conn) {
+    bool keep_alive = conn->response.keep_alive;
+    worker_metrics_t* metrics = &conn->worker->metrics;
+    
+    uint64_t now = monotonic_ns();
+    uint32_t status_class = (uint32_t)conn->response.status / 100;
+    if (status_class < METRICS_STATUS_CLASSES) {
+        metrics_add(&metrics->responses[status_class], 1);
+    }
+    metrics_record(&metrics->latency[METRICS_PHASE_SEND], now - conn->send_start);
+    metrics_record(&metrics->latency[METRICS_PHASE_TOTAL], now - conn->request_start);
+    
+    /* Pipelined bytes already received start the next request */
+    conn->request_start = conn->length > 0 ? now : 0;
+    
+    free_response(&conn->response);
+    conn->state = CONNECTION_IDLE;
+    
+    return keep_alive && webserver_state.running;
+}
+
+/**
+ * Remove bytes from the front of the connection buffer
+ */
+static void consume_buffer(connection_t* conn, uint32_t length) {
+    if (length >= conn->length) {
+        conn->length = 0;
+        return;
+    }
+    
+    memmove(conn->buffer, conn->buffer + length, conn->length - length);
+    conn->length -= length;
+}
+
+/**
+ * Close a client connection and release its state
+ */
+static void close_connection(connection_t* conn) {
+    worker_t* worker = conn->worker;
+    
+    /* Unlink from open connection list */
+    if (conn->prev) {
+        conn->prev->next = conn->next;
+    } else {
+        worker->connections = conn->next;
+    }
+    if (conn->next) {
+        conn->next->prev = conn->prev;
+    } else {
+        worker->last_connection = conn->prev;
+    }
+    worker->connection_count--;
+    metrics_add(&worker->metrics.connections_closed, 1);
+    dequeue_connection(conn);
+    
+    /* A green connection closes on its own thread, on the CPU holding its timer */
+    if (worker->green) {
+        scheduler_timer_cancel(&conn->timer);
+    } else {
+        timer_wheel_cancel(&conn->timer);
+    }
+    
+    /* Closing the socket also removes it from the reactor */
+    io_close_socket(conn->fd);
+    free_response(&conn->response);
+    arena_destroy(&conn->arena);
+    free(conn);
+}
+
+/**
+ * Build HTTP response
+ */
+static error_code_t build_response(worker_t* worker, http_request_t* request, http_response_t* response) {
+    /* Default to 200 OK */
+    response->status = HTTP_STATUS_OK;
+    
+    /* Server, Date and Connection headers are emitted by send_response */
+    response->keep_alive = request->keep_alive;
+    
+    /* Handle different request methods */
+    if (request->method == HTTP_METHOD_GET || request->method == HTTP_METHOD_HEAD) {
+        const char* metrics_path = webserver_state.config.metrics_path;
+        if (metrics_path && strcmp(request->path, metrics_path) == 0) {
+            serve_metrics(response);
+        } else {
+            serve_path(worker, request, response);
+        }
+    
+        if (request->method == HTTP_METHOD_HEAD) {
+            /* Same as GET but without body */
+            add_content_headers(response);
+            drop_body(response);
+        }
+    } else {
+        /* Method not supported */
+        response->status = HTTP_STATUS_METHOD_NOT_ALLOWED;
+        add_header(response, "Allow", "GET, HEAD");
+    
+        response->body = "<html><body><h1>405 Method Not Allowed</h1></body></html>";
+        response->body_length = strlen(response->body);
+    }
+    
+    add_content_headers(response);
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Resolve a GET/HEAD request path to a file, listing or redirect
+ */
+static void serve_path(worker_t* worker, http_request_t* request, http_response_t* response) {
+    size_t request_length = strlen(request->path);
+    bool directory = request_length > 0 && request->path[request_length - 1] == '/';
+    
+    /* Listings in other than the default view are cached under their own key */
+    listing_view_t view = { LISTING_SORT_NAME, false, 1 };
+    char view_key[BUFFER_SIZE + 64];
+    const char* key = request->path;
+    if (directory && parse_listing_view(request, &view)) {
+        static const char* const sort_names[] = { "name", "size", "mtime" };
+        snprintf(view_key, sizeof(view_key), "%s?sort=%s&order=%s&page=%u", request->path,
+                 sort_names[view.sort], view.descending ? "desc" : "asc", view.page);
+        key = view_key;
+    }
+    
+    /* Cached assets are answered without touching the filesystem */
+    asset_t* asset = asset_cache_lookup(&worker->cache, key, (time_t)(worker->now / 1000));
+    if (asset && asset->directory && !directory) {
+        /* A file name containing '?' matched a listing key */
+        asset_cache_release(asset);
+        asset = NULL;
+    }
+    if (asset) {
+        serve_asset(request, response, asset);
+        return;
+    }
+    
+    /* Construct full path, leaving room for index.html */
+    char full_path[BUFFER_SIZE];
+    size_t path_len = (size_t)snprintf(full_path, sizeof(full_path), "%s%s",
+                                       webserver_state.config.webroot, request->path);
+    if (path_len + sizeof("index.html") > sizeof(full_path)) {
+        response->status = HTTP_STATUS_NOT_FOUND;
+        response->body = "<html><body><h1>404 Not Found</h1></body></html>";
+        response->body_length = strlen(response->body);
+        return;
+    }
+    
+    /* Directories are served by their index.html, or listed if they have none */
+    if (directory) {
+        strcpy(full_path + path_len, "index.html");
+    }
+    
+    /* Check if file exists */
+    struct stat st;
+    if (stat(full_path, &st) == 0 && !(directory && S_ISDIR(st.st_mode))) {
+        if (S_ISDIR(st.st_mode)) {
+            /* Directories are only served with a trailing '/' */
+            response->status = HTTP_STATUS_MOVED_PERMANENTLY;
+            char location[BUFFER_SIZE];
+            snprintf(location, BUFFER_SIZE, "%s/", request->path);
+            add_header(response, "Location", location);
+    
+            response->body = "<html><body><h1>301 Moved Permanently</h1></body></html>";
+            response->body_length = strlen(response->body);
+        } else {
+            /* Serve file */
+            serve_file(worker, request, full_path, response);
+        }
+    } else if (directory) {
+        /* Serve directory listing */
+        full_path[path_len] = '\0';
+        serve_directory(worker, request, full_path, key, &view, response);
+    } else {
+        /* File not found */
+        response->status = HTTP_STATUS_NOT_FOUND;
+        response->body = "<html><body><h1>404 Not Found</h1></body></html>";
+        response->body_length = strlen(response->body);
+    }
+}
+
+/**
+ * Answer a request from a cached asset
+ *
+ * Takes over the caller's reference to the asset.
+ */
+static void serve_asset(http_request_t* request, http_response_t* response, asset_t* asset) {
+    /* Ranges always refer to the identity representation */
+    bool ranged = http_request_header(request, HTTP_HEADER_RANGE) != NULL;
+    const asset_variant_t* variant = ranged ? &asset->variants[ASSET_VARIANT_IDENTITY] :
+                                     asset_select_variant(asset, request->accept_encoding);
+    
+    response->asset = asset;
+    response->raw_headers = variant->headers;
+    
+    if (not_modified(request, variant->etag, variant->etag_length,
+                     asset->last_modified, asset->last_modified_length, asset->mtime)) {
+        /* Only the validators (and Vary) are repeated in a 304 */
+        response->status = HTTP_STATUS_NOT_MODIFIED;
+        response->raw_headers_length = variant->validators_length;
+        return;
+    }
+    
+    if (ranged && serve_ranges(request, response, variant->data, -1, variant->size, asset->mime_type,
+                               variant->etag, variant->etag_length,
+                               asset->last_modified, asset->last_modified_length)) {
+        response->raw_headers_length = variant->validators_length;
+        return;
+    }
+    
+    response->raw_headers_length = variant->headers_length;
+    response->body = variant->data;
+    response->body_length = variant->size;
+}
+
+/**
+ * Parse a Range header value against a representation of the given size
+ *
+ * Returns the number of satisfiable ranges, 0 if the header is to be
+ * ignored (invalid, too many or overlapping ranges) and -1 if no range
+ * is satisfiable. Ends are inclusive.
+ */
+static int parse_ranges(const char* value, uint32_t length, uint64_t size,
+                        uint64_t* starts, uint64_t* ends) {
+    if (length < 6 || strncasecmp(value, "bytes=", 6) != 0) {
+        return 0;
+    }
+    
+    int count = 0;
+    bool any = false;
+    uint32_t i = 6;
+    
+    while (i < length) {
+        while (i < length && (value[i] == ' ' || value[i] == '\t' || value[i] == ',')) i++;
+        if (i == length) {
+            break;
+        }
+    
+        /* first-pos "-" [ last-pos ] or "-" suffix-length */
+        uint64_t first = 0;
+        uint64_t last = 0;
+        int first_digits = 0;
+        int last_digits = 0;
+        while (i < length && value[i] >= '0' && value[i] <= '9' && first_digits < 19) {
+            first = first * 10 + (uint64_t)(value[i++] - '0');
+            first_digits++;
+        }
+        if (i == length || value[i] != '-') {
+            return 0;
+        }
+        i++;
+        while (i < length && value[i] >= '0' && value[i] <= '9' && last_digits < 19) {
+            last = last * 10 + (uint64_t)(value[i++] - '0');
+            last_digits++;
+        }
+        while (i < length && (value[i] == ' ' || value[i] == '\t')) i++;
+        if ((i < length && value[i] != ',') || (first_digits == 0 && last_digits == 0) ||
+            (first_digits > 0 && last_digits > 0 && last < first)) {
+            return 0;
+        }
+        any = true;
+    
+        uint64_t start;
+        uint64_t end;
+        if (first_digits == 0) {
+            /* Suffix range: the final bytes */
+            if (last == 0 || size == 0) {
+                continue;
+            }
+            start = last < size ? size - last : 0;
+            end = size - 1;
+        } else {
+            if (first >= size) {
+                continue;
+            }
+            start = first;
+            end = last_digits == 0 || last >= size ? size - 1 : last;
+        }
+    
+        if (count == HTTP_MAX_RANGES) {
+            return 0;
+        }
+    
+        /* Overlapping ranges are answered with the full representation */
+        for (int j = 0; j < count; j++) {
+            if (start <= ends[j] && starts[j] <= end) {
+                return 0;
+            }
+        }
+    
+        starts[count] = start;
+        ends[count] = end;
+        count++;
+    }
+    
+    if (!any) {
+        return 0;
+    }
+    
+    return count > 0 ? count : -1;
+}
+
+/**
+ * Answer a Range request with 206 Partial Content (or 416)
+ *
+ * The representation is data when it is in memory, otherwise it is
+ * streamed from fd. Returns false if the full representation should be
+ * sent instead; on true, a file descriptor passed in belongs to the
+ * response.
+ */
+static bool serve_ranges(http_request_t* request, http_response_t* response, const char* data, int fd,
+                         size_t size, const char* mime_type, const char* etag, size_t etag_length,
+                         const char* last_modified, size_t last_modified_length) {
+    const http_header_t* range = http_request_header(request, HTTP_HEADER_RANGE);
+    if (!range || request->method != HTTP_METHOD_GET) {
+        return false;
+    }
+    
+    /* If-Range: the range only applies while the client's validator still matches */
+    const http_header_t* if_range = http_request_header(request, HTTP_HEADER_IF_RANGE);
+    if (if_range) {
+        const char* value = request->head + if_range->value.offset;
+        uint32_t length = if_range->value.length;
+        if (!(length == etag_length && memcmp(value, etag, length) == 0) &&
+            !(length == last_modified_length && memcmp(value, last_modified, length) == 0)) {
+            return false;
+        }
+    }
+    
+    uint64_t starts[HTTP_MAX_RANGES];
+    uint64_t ends[HTTP_MAX_RANGES];
+    int count = parse_ranges(request->head + range->value.offset, range->value.length,
+                             size, starts, ends);
+    if (count == 0) {
+        return false;
+    }
+    
+    char value[128];
+    if (count < 0) {
+        response->status = HTTP_STATUS_RANGE_NOT_SATISFIABLE;
+        snprintf(value, sizeof(value), "bytes */%zu", size);
+        add_header(response, "Content-Range", value);
+    
+        /* No body: an asset response does not own one */
+        add_header(response, "Content-Length", "0");
+    
+        if (fd >= 0) {
+            close(fd);
+        }
+        return true;
+    }
+    
+    if (count == 1) {
+        /* Single part: Content-Range describes the body */
+        snprintf(value, sizeof(value), "bytes %llu-%llu/%zu",
+                 (unsigned long long)starts[0], (unsigned long long)ends[0], size);
+        add_header(response, "Content-Range", value);
+        add_header(response, "Content-Type", mime_type);
+    
+        response->segments[0].data = data ? data + starts[0] : NULL;
+        response->segments[0].offset = starts[0];
+        response->segments[0].length = (size_t)(ends[0] - starts[0] + 1);
+        response->segment_count = 1;
+        response->body_length = response->segments[0].length;
+    } else {
+        /* Multipart: each part carries its own Content-Type and Content-Range */
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        char boundary[40];
+        snprintf(boundary, sizeof(boundary), "nexos%016llx",
+                 (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec);
+    
+        size_t capacity = (size_t)(count + 1) * (strlen(boundary) + strlen(mime_type) + 160);
+        char* parts = arena_alloc(response->arena, capacity);
+        if (!parts) {
+            return false;
+        }
+    
+        size_t used = 0;
+        response->body_length = 0;
+        for (int i = 0; i <= count; i++) {
+            int length;
+            if (i < count) {
+                length = snprintf(parts + used, capacity - used,
+                                  "%s--%s\r\nContent-Type: %s\r\nContent-Range: bytes %llu-%llu/%zu\r\n\r\n",
+                                  i == 0 ? "" : "\r\n", boundary, mime_type,
+                                  (unsigned long long)starts[i], (unsigned long long)ends[i], size);
+            } else {
+                length = snprintf(parts + used, capacity - used, "\r\n--%s--\r\n", boundary);
+            }
+    
+            http_segment_t* part = &response->segments[response->segment_count++];
+            part->data = parts + used;
+            part->offset = 0;
+            part->length = (size_t)length;
+            used += (size_t)length;
+            response->body_length += part->length;
+    
+            if (i < count) {
+                http_segment_t* segment = &response->segments[response->segment_count++];
+                segment->data = data ? data + starts[i] : NULL;
+                segment->offset = starts[i];
+                segment->length = (size_t)(ends[i] - starts[i] + 1);
+                response->body_length += segment->length;
+            }
+        }
+    
+        snprintf(value, sizeof(value), "multipart/byteranges; boundary=%s", boundary);
+        add_header(response, "Content-Type", value);
+    }
+    
+    snprintf(value, sizeof(value), "%zu", response->body_length);
+    add_header(response, "Content-Length", value);
+    
+    response->status = HTTP_STATUS_PARTIAL_CONTENT;
+    if (fd >= 0) {
+        response->body_is_file = true;
+        response->body_fd = fd;
+    }
+    
+    return true;
+}
+
+/**
+ * Check a request's conditional headers against a resource's validators
+ *
+ * If-None-Match takes precedence over If-Modified-Since (RFC 9110 13.2.2).
+ */
+static bool not_modified(const http_request_t* request, const char* etag, size_t etag_length,
+                         const char* last_modified, size_t last_modified_length, time_t mtime) {
+    const http_header_t* header = http_request_header(request, HTTP_HEADER_IF_NONE_MATCH);
+    if (header) {
+        const char* value = request->head + header->value.offset;
+        uint32_t length = header->value.length;
+        uint32_t i = 0;
+    
+        /* Weak comparison over the comma-separated list */
+        while (i < length) {
+            while (i < length && (value[i] == ' ' || value[i] == '\t' || value[i] == ',')) i++;
+            if (i + 2 <= length && value[i] == 'W' && value[i + 1] == '/') i += 2;
+    
+            uint32_t start = i;
+            while (i < length && value[i] != ',' && value[i] != ' ' && value[i] != '\t') i++;
+    
+            if ((i - start == 1 && value[start] == '*') ||
+                (i - start == etag_length && memcmp(value + start, etag, etag_length) == 0)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    header = http_request_header(request, HTTP_HEADER_IF_MODIFIED_SINCE);
+    if (header) {
+        const char* value = request->head + header->value.offset;
+        uint32_t length = header->value.length;
+    
+        /* Clients usually echo Last-Modified verbatim */
+        if (length == last_modified_length && memcmp(value, last_modified, length) == 0) {
+            return true;
+        }
+    
+        char date[64];
+        struct tm tm = {0};
+        if (length < sizeof(date)) {
+            memcpy(date, value, length);
+            date[length] = '\0';
+            char* end = strptime(date, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+            if (end && *end == '\0') {
+                return mtime <= timegm(&tm);
+            }
+        }
+    }
+    
+    return false;
+}
+
+/**
+ * Append a header to a response
+ *
+ * The name must be a static string; the value is copied into the response
+ * arena. Allocation failures mark the response as failed.
+ */
+static void add_header(http_response_t* response, const char* name, const char* value) {
+    if (response->header_count == response->header_capacity) {
+        uint16_t capacity = response->header_capacity ? response->header_capacity * 2 : 16;
+        http_response_header_t* headers = arena_alloc(response->arena, capacity * sizeof(http_response_header_t));
+        if (!headers) {
+            response->failed = true;
+            return;
+        }
+    
+        /* The old vector stays in the arena until the response is freed */
+        if (response->header_count > 0) {
+            memcpy(headers, response->headers, response->header_count * sizeof(http_response_header_t));
+        }
+        response->headers = headers;
+        response->header_capacity = capacity;
+    }
+    
+    size_t value_length = strlen(value);
+    char* copy = arena_strndup(response->arena, value, value_length);
+    if (!copy) {
+        response->failed = true;
+        return;
+    }
+    
+    http_response_header_t* header = &response->headers[response->header_count++];
+    header->name = name;
+    header->name_length = (uint16_t)strlen(name);
+    header->value = copy;
+    header->value_length = (uint16_t)value_length;
+}
+
+/**
+ * Add Content-Type and Content-Length headers to a response with a body if not already set
+ */
+static void add_content_headers(http_response_t* response) {
+    /* Pre-rendered headers already describe the body */
+    if (response->raw_headers) {
+        return;
+    }
+    
+    if (response->body_is_file || (response->body && response->body_length > 0)) {
+        int has_content_type = 0;
+        int has_content_length = 0;
+    
+        for (int i = 0; i < response->header_count; i++) {
+            if (strcasecmp(response->headers[i].name, "Content-Type") == 0) {
+                has_content_type = 1;
+            }
+            if (strcasecmp(response->headers[i].name, "Content-Length") == 0) {
+                has_content_length = 1;
+            }
+        }
+    
+        if (!has_content_type) {
+            add_header(response, "Content-Type", "text/html");
+        }
+    
+        if (!has_content_length) {
+            char content_length[20];
+            snprintf(content_length, sizeof(content_length), "%zu", response->body_length);
+            add_header(response, "Content-Length", content_length);
+        }
+    }
+}
+
+/**
+ * Get the pre-rendered status line for a status code
+ */
+static const char* get_status_line(http_status_t status, size_t* length) {
+    const char* line;
+    switch (status) {
+        case HTTP_STATUS_OK: line = "HTTP/1.1 200 OK\r\n"; break;
+        case HTTP_STATUS_CREATED: line = "HTTP/1.1 201 Created\r\n"; break;
+        case HTTP_STATUS_ACCEPTED: line = "HTTP/1.1 202 Accepted\r\n"; break;
+        case HTTP_STATUS_NO_CONTENT: line = "HTTP/1.1 204 No Content\r\n"; break;
+        case HTTP_STATUS_PARTIAL_CONTENT: line = "HTTP/1.1 206 Partial Content\r\n"; break;
+        case HTTP_STATUS_MOVED_PERMANENTLY: line = "HTTP/1.1 301 Moved Permanently\r\n"; break;
+        case HTTP_STATUS_FOUND: line = "HTTP/1.1 302 Found\r\n"; break;
+        case HTTP_STATUS_NOT_MODIFIED: line = "HTTP/1.1 304 Not Modified\r\n"; break;
+        case HTTP_STATUS_BAD_REQUEST: line = "HTTP/1.1 400 Bad Request\r\n"; break;
+        case HTTP_STATUS_UNAUTHORIZED: line = "HTTP/1.1 401 Unauthorized\r\n"; break;
+        case HTTP_STATUS_FORBIDDEN: line = "HTTP/1.1 403 Forbidden\r\n"; break;
+        case HTTP_STATUS_NOT_FOUND: line = "HTTP/1.1 404 Not Found\r\n"; break;
+        case HTTP_STATUS_METHOD_NOT_ALLOWED: line = "HTTP/1.1 405 Method Not Allowed\r\n"; break;
+        case HTTP_STATUS_RANGE_NOT_SATISFIABLE: line = "HTTP/1.1 416 Range Not Satisfiable\r\n"; break;
+        case HTTP_STATUS_REQUEST_HEADER_FIELDS_TOO_LARGE: line = "HTTP/1.1 431 Request Header Fields Too Large\r\n"; break;
+        case HTTP_STATUS_INTERNAL_SERVER_ERROR: line = "HTTP/1.1 500 Internal Server Error\r\n"; break;
+        case HTTP_STATUS_NOT_IMPLEMENTED: line = "HTTP/1.1 501 Not Implemented\r\n"; break;
+        case HTTP_STATUS_BAD_GATEWAY: line = "HTTP/1.1 502 Bad Gateway\r\n"; break;
+        case HTTP_STATUS_SERVICE_UNAVAILABLE: line = "HTTP/1.1 503 Service Unavailable\r\n"; break;
+        default: line = "HTTP/1.1 500 Unknown\r\n";
+    }
+    
+    *length = strlen(line);
+    return line;
+}
+
+/**
+ * Get the worker's Date header, re-rendering it at most once per second
+ */
+static const char* get_date_header(worker_t* worker, size_t* length) {
+    time_t now = time(NULL);
+    
+    if (now != worker->date_time) {
+        struct tm tm;
+        gmtime_r(&now, &tm);
+        worker->date_header_length = strftime(worker->date_header, sizeof(worker->date_header),
+                                              "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm);
+        worker->date_time = now;
+    }
+    
+    *length = worker->date_header_length;
+    return worker->date_header;
+}
+
+/**
+ * Append bytes to the connection's response head
+ */
+static bool append_head(connection_t* conn, size_t* len, const char* data, size_t length) {
+    if (*len + length >= BUFFER_SIZE) {
+        return false;
+    }
+    
+    memcpy(conn->head + *len, data, length);
+    *len += length;
+    return true;
+}
+
+/**
+ * Serialize the response head and start writing the response
+ */
+static error_code_t send_response(connection_t* conn) {
+    static const char server_header[] = "Server: " SERVER_NAME "\r\n";
+    static const char keep_alive_header[] = "Connection: keep-alive\r\n";
+    static const char close_header[] = "Connection: close\r\n";
+    
+    http_response_t* response = &conn->response;
+    size_t len = 0;
+    size_t length;
+    bool fits = true;
+    
+    /* Status line and fixed headers */
+    const char* status_line = get_status_line(response->status, &length);
+    fits = fits && append_head(conn, &len, status_line, length);
+    fits = fits && append_head(conn, &len, server_header, sizeof(server_header) - 1);
+    
+    const char* date_header = get_date_header(conn->worker, &length);
+    fits = fits && append_head(conn, &len, date_header, length);
+    
+    if (response->keep_alive) {
+        fits = fits && append_head(conn, &len, keep_alive_header, sizeof(keep_alive_header) - 1);
+    } else {
+        fits = fits && append_head(conn, &len, close_header, sizeof(close_header) - 1);
+    }
+    
+    /* Response-specific headers */
+    if (response->raw_headers) {
+        fits = fits && append_head(conn, &len, response->raw_headers, response->raw_headers_length);
+    }
+    for (int i = 0; fits && i < response->header_count; i++) {
+        const http_response_header_t* header = &response->headers[i];
+        fits = append_head(conn, &len, header->name, header->name_length) &&
+               append_head(conn, &len, ": ", 2) &&
+               append_head(conn, &len, header->value, header->value_length) &&
+               append_head(conn, &len, "\r\n", 2);
+    }
+    
+    /* End of headers */
+    fits = fits && append_head(conn, &len, "\r\n", 2);
+    
+    if (!fits) {
+        /* Head does not fit in the connection buffer */
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    conn->head_length = len;
+    conn->head_sent = 0;
+    
+    /* Without explicit segments the body is sent whole */
+    if (response->segment_count == 0 && response->body_length > 0) {
+        response->segments[0].data = response->body_is_file ? NULL : response->body;
+        response->segments[0].offset = 0;
+        response->segments[0].length = response->body_length;
+        response->segment_count = 1;
+    }
+    conn->segment = 0;
+    conn->segment_sent = 0;
+    advance_response(conn, 0);
+    
+    return flush_response(conn);
+}
+
+/**
+ * Write as much of the pending response as the socket accepts
+ *
+ * The head and in-memory segments go out in gather writes; file segments
+ * follow via sendfile, with the head held back so both share segments.
+ * File data is sent at most STREAM_QUANTUM bytes per call so one fast
+ * download cannot starve the worker's other connections; the connection
+ * is then queued to continue on the next loop iteration (green workers
+ * yield to the other connection threads instead).
+ * Returns ERROR_TIMEOUT if the response must wait, ERROR_NONE once it is
+ * fully written.
+ */
+static error_code_t flush_response(connection_t* conn) {
+    http_response_t* response = &conn->response;
+    size_t budget = STREAM_QUANTUM;
+    uint32_t bytes_written;
+    
+    for (;;) {
+        io_vector_t vectors[MAX_VECTORS];
+        uint32_t count = 0;
+    
+        /* Status line, headers and the memory segments that follow them */
+        if (conn->head_sent < conn->head_length) {
+            vectors[count].base = conn->head + conn->head_sent;
+            vectors[count].length = conn->head_length - conn->head_sent;
+            count++;
+        }
+    
+        uint32_t next = conn->segment;
+        for (; next < response->segment_count && count < MAX_VECTORS; next++) {
+            const http_segment_t* segment = &response->segments[next];
+            if (!segment->data) {
+                break;
+            }
+    
+            size_t skip = next == conn->segment ? conn->segment_sent : 0;
+            if (segment->length > skip) {
+                vectors[count].base = segment->data + skip;
+                vectors[count].length = segment->length - skip;
+                count++;
+            }
+        }
+    
+        if (count > 0) {
+            error_code_t err = io_writev(conn->fd, vectors, count,
+                                         next < response->segment_count ? IO_WRITE_MORE : 0,
+                                         &bytes_written);
+            if (err != ERROR_NONE) {
+                return err;
+            }
+            metrics_add(&conn->worker->metrics.bytes_sent, bytes_written);
+            touch_connection(conn);
+            advance_response(conn, bytes_written);
+            continue;
+        }
+    
+        if (conn->segment >= response->segment_count) {
+            break;
+        }
+    
+        /* File segment: let the kernel copy straight from the page cache */
+        if (budget == 0) {
+            if (conn->worker->green) {
+                /* The worker's other connections run meanwhile */
+                scheduler_yield();
+                if (!webserver_state.running) {
+                    return ERROR_RESOURCE_BUSY;
+                }
+                conn->worker->now = monotonic_ms();
+                budget = STREAM_QUANTUM;
+                continue;
+            }
+            queue_connection(conn);
+            return ERROR_TIMEOUT;
+        }
+    
+        const http_segment_t* segment = &response->segments[conn->segment];
+        uint64_t offset = segment->offset + conn->segment_sent;
+        size_t remaining = segment->length - conn->segment_sent;
+        if (remaining > budget) {
+            remaining = budget;
+        }
+    
+        error_code_t err = io_sendfile(conn->fd, response->body_fd, &offset,
+                                       remaining > SENDFILE_CHUNK ? SENDFILE_CHUNK : (uint32_t)remaining,
+                                       &bytes_written);
+        if (err != ERROR_NONE) {
+            return err;
+        }
+        metrics_add(&conn->worker->metrics.bytes_sent, bytes_written);
+        touch_connection(conn);
+        advance_response(conn, bytes_written);
+        budget -= bytes_written;
+    }
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Account written bytes to the response head first, then the body segments
+ */
+static void advance_response(connection_t* conn, size_t bytes) {
+    http_response_t* response = &conn->response;
+    
+    size_t head_part = conn->head_length - conn->head_sent;
+    if (head_part > bytes) {
+        head_part = bytes;
+    }
+    conn->head_sent += head_part;
+    bytes -= head_part;
+    
+    while (conn->segment < response->segment_count) {
+        size_t left = response->segments[conn->segment].length - conn->segment_sent;
+        if (bytes < left) {
+            conn->segment_sent += bytes;
+            break;
+        }
+    
+        /* Segment complete (empty segments are skipped here too) */
+        bytes -= left;
+        conn->segment++;
+        conn->segment_sent = 0;
+    }
+}
+
+/**
+ * Queue a connection to continue writing on the next loop iteration
+ */
+static void queue_connection(connection_t* conn) {
+    worker_t* worker = conn->worker;
+    
+    if (conn->queued) {
+        return;
+    }
+    
+    conn->queued = true;
+    conn->queue_next = NULL;
+    conn->queue_prev = worker->queue_tail;
+    if (worker->queue_tail) {
+        worker->queue_tail->queue_next = conn;
+    } else {
+        worker->queue_head = conn;
+    }
+    worker->queue_tail = conn;
+    worker->queue_count++;
+}
+
+/**
+ * Remove a connection from the write queue
+ */
+static void dequeue_connection(connection_t* conn) {
+    worker_t* worker = conn->worker;
+    
+    if (!conn->queued) {
+        return;
+    }
+    
+    if (conn->queue_prev) {
+        conn->queue_prev->queue_next = conn->queue_next;
+    } else {
+        worker->queue_head = conn->queue_next;
+    }
+    if (conn->queue_next) {
+        conn->queue_next->queue_prev = conn->queue_prev;
+    } else {
+        worker->queue_tail = conn->queue_prev;
+    }
+    conn->queued = false;
+    worker->queue_count--;
+}
+
+/**
+ * Continue the responses queued by flush_response
+ *
+ * Only connections queued before the call are processed, so connections
+ * that queue themselves again wait for the next iteration.
+ */
+static void run_queue(worker_t* worker) {
+    uint32_t count = worker->queue_count;
+    
+    while (count-- > 0 && worker->queue_head) {
+        connection_t* conn = worker->queue_head;
+        dequeue_connection(conn);
+        write_response(conn);
+    }
+}
+
+/**
+ * Free response resources
+ */
+static void free_response(http_response_t* response) {
+    if (response->asset) {
+        asset_cache_release(response->asset);
+    }
+    if (response->body_is_file) close(response->body_fd);
+    
+    /* Headers, generated bodies and multipart delimiters all live in the arena */
+    arena_t* arena = response->arena;
+    arena_reset(arena);
+    memset(response, 0, sizeof(http_response_t));
+    response->arena = arena;
+}
+
+/**
+ * Drop a response's body, keeping the headers that describe it
+ */
+static void drop_body(http_response_t* response) {
+    if (response->body_is_file) {
+        close(response->body_fd);
+        response->body_is_file = false;
+    }
+    
+    response->segment_count = 0;
+    response->body = NULL;
+    response->body_length = 0;
+}
+
+/**
+ * Serve a file
+ *
+ * Small files are read into the worker's asset cache. Otherwise the file
+ * is not read here; the open descriptor becomes the response body and is
+ * streamed with sendfile when the response is written.
+ */
+static error_code_t serve_file(worker_t* worker, http_request_t* request, const char* path,
+                               http_response_t* response) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        response->status = HTTP_STATUS_NOT_FOUND;
+        response->body = "<html><body><h1>404 Not Found</h1></body></html>";
+        response->body_length = strlen(response->body);
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    /* Get file size */
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        response->status = HTTP_STATUS_INTERNAL_SERVER_ERROR;
+        response->body = "<html><body><h1>500 Internal Server Error</h1></body></html>";
+        response->body_length = strlen(response->body);
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    const char* mime_type = get_mime_type(path);
+    asset_t* asset = asset_cache_insert(&worker->cache, request->path, path, mime_type, fd, &st);
+    if (asset) {
+        close(fd);
+        serve_asset(request, response, asset);
+        return ERROR_NONE;
+    }
+    
+    /* Stream a precompressed sibling if the client accepts one */
+    bool compressible = asset_is_compressible(mime_type);
+    bool ranged = http_request_header(request, HTTP_HEADER_RANGE) != NULL;
+    bool encoded = false;
+    if (compressible && !ranged && request->accept_encoding != HTTP_ENCODING_IDENTITY) {
+        struct stat sibling;
+        const char* coding;
+        int sibling_fd = asset_open_precompressed(path, request->accept_encoding, &st, &sibling, &coding);
+        if (sibling_fd >= 0) {
+            close(fd);
+            fd = sibling_fd;
+            st = sibling;
+            encoded = true;
+    
+            add_header(response, "Content-Encoding", coding);
+        }
+    }
+    
+    if (compressible) {
+        add_header(response, "Vary", "Accept-Encoding");
+    }
+    
+    /* Validators (a sibling's inode gives it a distinct ETag) */
+    char etag[64];
+    char last_modified[64];
+    size_t etag_length = asset_format_etag(etag, sizeof(etag), &st);
+    size_t last_modified_length = asset_format_http_date(last_modified, sizeof(last_modified), st.st_mtime);
+    
+    add_header(response, "ETag", etag);
+    add_header(response, "Last-Modified", last_modified);
+    
+    if (not_modified(request, etag, etag_length, last_modified, last_modified_length, st.st_mtime)) {
+        close(fd);
+        response->status = HTTP_STATUS_NOT_MODIFIED;
+        return ERROR_NONE;
+    }
+    
+    if (!encoded) {
+        add_header(response, "Accept-Ranges", "bytes");
+    
+        if (serve_ranges(request, response, NULL, fd, (size_t)st.st_size, mime_type,
+                         etag, etag_length, last_modified, last_modified_length)) {
+            return ERROR_NONE;
+        }
+    }
+    
+    response->body_is_file = true;
+    response->body_fd = fd;
+    response->body_length = (size_t)st.st_size;
+    
+    /* Set Content-Type header */
+    add_header(response, "Content-Type", mime_type);
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Select a listing view from "sort", "order" and "page" query parameters
+ *
+ * Returns true if the view differs from the default (by name, ascending,
+ * first page).
+ */
+static bool parse_listing_view(const http_request_t* request, listing_view_t* view) {
+    const char* query = request->head + request->query.offset;
+    uint32_t length = request->query.length;
+    uint32_t i = 0;
+    
+    while (i < length) {
+        uint32_t start = i;
+        while (i < length && query[i] != '&') i++;
+    
+        const char* param = query + start;
+        uint32_t param_length = i - start;
+        i++;
+    
+        if (param_length == 9 && memcmp(param, "sort=name", 9) == 0) {
+            view->sort = LISTING_SORT_NAME;
+        } else if (param_length == 9 && memcmp(param, "sort=size", 9) == 0) {
+            view->sort = LISTING_SORT_SIZE;
+        } else if (param_length == 10 && memcmp(param, "sort=mtime", 10) == 0) {
+            view->sort = LISTING_SORT_MTIME;
+        } else if (param_length == 9 && memcmp(param, "order=asc", 9) == 0) {
+            view->descending = false;
+        } else if (param_length == 10 && memcmp(param, "order=desc", 10) == 0) {
+            view->descending = true;
+        } else if (param_length > 5 && param_length < 15 && memcmp(param, "page=", 5) == 0) {
+            uint32_t page = 0;
+            for (uint32_t j = 5; j < param_length && isdigit((unsigned char)param[j]); j++) {
+                page = page * 10 + (uint32_t)(param[j] - '0');
+            }
+            view->page = page > 0 ? page : 1;
+        }
+    }
+    
+    return view->sort != LISTING_SORT_NAME || view->descending || view->page != 1;
+}
+
+/**
+ * Order listing entries: directories first, then by the view's key
+ */
+static int compare_entries(const void* a, const void* b, void* arg) {
+    const listing_entry_t* left = a;
+    const listing_entry_t* right = b;
+    const listing_view_t* view = arg;
+    
+    if (left->directory != right->directory) {
+        return left->directory ? -1 : 1;
+    }
+    
+    int result = 0;
+    if (!left->directory && view->sort == LISTING_SORT_SIZE) {
+        result = (left->size > right->size) - (left->size < right->size);
+    } else if (!left->directory && view->sort == LISTING_SORT_MTIME) {
+        result = (left->mtime > right->mtime) - (left->mtime < right->mtime);
+    }
+    if (result == 0) {
+        result = strcmp(left->name, right->name);
+    }
+    
+    return view->descending ? -result : result;
+}
+
+/**
+ * Make room for extra bytes (plus a terminator) in a text buffer
+ *
+ * Outgrown space stays in the arena until the response is freed.
+ */
+static bool text_reserve(text_buffer_t* buffer, size_t extra) {
+    if (buffer->failed) {
+        return false;
+    }
+    if (buffer->length + extra < buffer->capacity) {
+        return true;
+    }
+    
+    size_t capacity = buffer->capacity ? buffer->capacity : BUFFER_SIZE;
+    while (buffer->length + extra >= capacity) {
+        capacity *= 2;
+    }
+    
+    char* data = arena_alloc(buffer->arena, capacity);
+    if (!data) {
+        buffer->failed = true;
+        return false;
+    }
+    if (buffer->length > 0) {
+        memcpy(data, buffer->data, buffer->length);
+    }
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return true;
+}
+
+/**
+ * Append formatted text to a text buffer
+ */
+static void text_printf(text_buffer_t* buffer, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    
+    if (length < 0 || !text_reserve(buffer, (size_t)length)) {
+        return;
+    }
+    
+    va_start(args, format);
+    vsnprintf(buffer->data + buffer->length, buffer->capacity - buffer->length, format, args);
+    va_end(args);
+    buffer->length += (size_t)length;
+}
+
+/**
+ * Append a name, escaped for HTML text or percent-encoded for a URL path
+ */
+static void listing_append_name(text_buffer_t* buffer, const char* name, bool url) {
+    static const char hex[] = "0123456789ABCDEF";
+    
+    /* Worst case: every byte becomes a 6-character entity or 3-character escape */
+    if (!text_reserve(buffer, strlen(name) * 6)) {
+        return;
+    }
+    
+    char* out = buffer->data + buffer->length;
+    for (const unsigned char* c = (const unsigned char*)name; *c; c++) {
+        if (url) {
+            if (isalnum(*c) || strchr("-._~/", *c)) {
+                *out++ = (char)*c;
+            } else {
+                *out++ = '%';
+                *out++ = hex[*c >> 4];
+                *out++ = hex[*c & 15];
+            }
+        } else if (*c == '<') {
+            memcpy(out, "&lt;", 4);
+            out += 4;
+        } else if (*c == '>') {
+            memcpy(out, "&gt;", 4);
+            out += 4;
+        } else if (*c == '&') {
+            memcpy(out, "&amp;", 5);
+            out += 5;
+        } else if (*c == '"') {
+            memcpy(out, "&quot;", 6);
+            out += 6;
+        } else {
+            *out++ = (char)*c;
+        }
+    }
+    buffer->length = (size_t)(out - buffer->data);
+}
+
+/**
+ * Render a sortable column heading; the active column toggles its order
+ */
+static void listing_heading(text_buffer_t* buffer, const listing_view_t* view,
+                            listing_sort_t sort, const char* param, const char* title) {
+    bool descending = view->sort == sort && !view->descending;
+    text_printf(buffer, "<th><a href=\"?sort=%s&amp;order=%s\">%s</a></th>",
+                   param, descending ? "desc" : "asc", title);
+}
+
+/**
+ * Serve a directory listing
+ *
+ * Listings are rendered once per view and cached in the worker's asset
+ * cache until anything in the directory changes, so repeated requests
+ * cost no readdir or stat calls.
+ */
+static error_code_t serve_directory(worker_t* worker, http_request_t* request, const char* path,
+                                    const char* key, const listing_view_t* view,
+                                    http_response_t* response) {
+    static const char* const sort_params[] = { "name", "size", "mtime" };
+    
+    /* Watch first so changes made while reading invalidate the listing */
+    int watch = asset_cache_watch_directory(&worker->cache, path);
+    
+    DIR* dir = opendir(path);
+    if (!dir) {
+        if (errno == ENOENT || errno == ENOTDIR) {
+            response->status = HTTP_STATUS_NOT_FOUND;
+            response->body = "<html><body><h1>404 Not Found</h1></body></html>";
+        } else {
+            response->status = HTTP_STATUS_INTERNAL_SERVER_ERROR;
+            response->body = "<html><body><h1>500 Internal Server Error</h1></body></html>";
+        }
+        response->body_length = strlen(response->body);
+        return ERROR_INVALID_PARAMETER;
+    }
+    
+    /* Collect entries; names live in a scratch arena freed after rendering */
+    struct stat dir_st;
+    time_t modified = fstat(dirfd(dir), &dir_st) == 0 ? dir_st.st_mtime : 0;
+    arena_t names;
+    arena_init(&names, ARENA_BLOCK_SIZE * 4);
+    listing_entry_t* entries = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    bool failed = false;
+    
+    struct dirent* entry;
+    while (!failed && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;  /* Skip hidden files */
+    
+        struct stat st;
+        if (fstatat(dirfd(dir), entry->d_name, &st, 0) != 0) {
+            continue;
+        }
+    
+        if (count == capacity) {
+            size_t grown = capacity ? capacity * 2 : 64;
+            listing_entry_t* resized = realloc(entries, grown * sizeof(listing_entry_t));
+            if (!resized) {
+                failed = true;
+                break;
+            }
+            entries = resized;
+            capacity = grown;
+        }
+    
+        listing_entry_t* item = &entries[count];
+        item->name = arena_strndup(&names, entry->d_name, strlen(entry->d_name));
+        item->size = (uint64_t)st.st_size;
+        item->mtime = st.st_mtime;
+        item->directory = S_ISDIR(st.st_mode);
+        failed = !item->name;
+        count++;
+    
+        /* Subdirectory mtimes are not shown, since changes below them are not watched */
+        if (!item->directory && st.st_mtime > modified) {
+            modified = st.st_mtime;
+        }
+    }
+    closedir(dir);
+    
+    if (failed) {
+        free(entries);
+        arena_destroy(&names);
+        response->status = HTTP_STATUS_INTERNAL_SERVER_ERROR;
+        response->body = "<html><body><h1>500 Internal Server Error</h1></body></html>";
+        response->body_length = strlen(response->body);
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    
+    qsort_r(entries, count, sizeof(listing_entry_t), compare_entries, (void*)view);
+    
+    uint32_t pages = count > 0 ? (uint32_t)((count + LISTING_PAGE_SIZE - 1) / LISTING_PAGE_SIZE) : 1;
+    uint32_t page = view->page < pages ? view->page : pages;
+    size_t first = (size_t)(page - 1) * LISTING_PAGE_SIZE;
+    size_t last = first + LISTING_PAGE_SIZE < count ? first + LISTING_PAGE_SIZE : count;
+    
+    /* Build HTML directory listing */
+    text_buffer_t html = { .arena = response->arena };
+    text_printf(&html, "<html><head><title>Index of ");
+    listing_append_name(&html, request->path, false);
+    text_printf(&html, "</title></head><body><h1>Index of ");
+    listing_append_name(&html, request->path, false);
+    text_printf(&html, "</h1><table><tr>");
+    listing_heading(&html, view, LISTING_SORT_NAME, "name", "Name");
+    listing_heading(&html, view, LISTING_SORT_SIZE, "size", "Size");
+    listing_heading(&html, view, LISTING_SORT_MTIME, "mtime", "Modified");
+    text_printf(&html, "</tr>");
+    if (strcmp(request->path, "/") != 0) {
+        text_printf(&html, "<tr><td><a href=\"../\">../</a></td><td>-</td><td>-</td></tr>");
+    }
+    
+    for (size_t i = first; i < last; i++) {
+        const listing_entry_t* item = &entries[i];
+        const char* suffix = item->directory ? "/" : "";
+    
+        text_printf(&html, "<tr><td><a href=\"");
+        listing_append_name(&html, item->name, true);
+        text_printf(&html, "%s\">", suffix);
+        listing_append_name(&html, item->name, false);
+        if (item->directory) {
+            text_printf(&html, "/</a></td><td>-</td><td>-</td></tr>");
+        } else {
+            struct tm tm;
+            char date[32];
+            gmtime_r(&item->mtime, &tm);
+            strftime(date, sizeof(date), "%Y-%m-%d %H:%M", &tm);
+            text_printf(&html, "</a></td><td>%llu</td><td>%s</td></tr>",
+                           (unsigned long long)item->size, date);
+        }
+    }
+    text_printf(&html, "</table>");
+    
+    if (pages > 1) {
+        text_printf(&html, "<p>Page %u of %u", page, pages);
+        for (int step = -1; step <= 1; step += 2) {
+            uint32_t target = page + (uint32_t)step;
+            if (target >= 1 && target <= pages) {
+                text_printf(&html, " <a href=\"?sort=%s&amp;order=%s&amp;page=%u\">%s</a>",
+                               sort_params[view->sort], view->descending ? "desc" : "asc", target,
+                               step < 0 ? "previous" : "next");
+            }
+        }
+        text_printf(&html, "</p>");
+    }
+    text_printf(&html, "</body></html>");
+    
+    free(entries);
+    arena_destroy(&names);
+    
+    if (html.failed) {
+        response->status = HTTP_STATUS_INTERNAL_SERVER_ERROR;
+        response->body = "<html><body><h1>500 Internal Server Error</h1></body></html>";
+        response->body_length = strlen(response->body);
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    
+    asset_t* asset = asset_cache_insert_listing(&worker->cache, key, path, watch, html.data, html.length,
+                                                modified, (time_t)(worker->now / 1000));
+    if (asset) {
+        serve_asset(request, response, asset);
+        return ERROR_NONE;
+    }
+    
+    response->body = html.data;
+    response->body_length = html.length;
+    
+    /* Set Content-Type header */
+    add_header(response, "Content-Type", "text/html");
+    
+    return ERROR_NONE;
+}
+
+/**
+ * Serve all workers' metrics in the Prometheus text exposition format
+ *
+ * Runs on the requesting worker and reads the other workers' metrics
+ * with relaxed loads only, so scraping never blocks request processing.
+ */
+static void serve_metrics(http_response_t* response) {
+    static const char* const phases[METRICS_PHASE_COUNT] = { "parse", "build", "send", "total" };
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    
+    webserver_stats_t stats;
+    collect_stats(&stats);
+    
+    uint64_t responses[METRICS_STATUS_CLASSES] = { 0 };
+    metrics_histogram_snapshot_t* latency = arena_alloc(response->arena,
+                                                        sizeof(metrics_histogram_snapshot_t) * METRICS_PHASE_COUNT);
+    if (!latency) {
+        response->failed = true;
+        return;
+    }
+    memset(latency, 0, sizeof(metrics_histogram_snapshot_t) * METRICS_PHASE_COUNT);
+    
+    for (uint32_t i = 0; i < webserver_state.worker_count; i++) {
+        const worker_metrics_t* metrics = &webserver_state.workers[i].metrics;
+        for (int j = 1; j < METRICS_STATUS_CLASSES; j++) {
+            responses[j] += metrics_read(&metrics->responses[j]);
+        }
+        for (int phase = 0; phase < METRICS_PHASE_COUNT; phase++) {
+            metrics_snapshot_add(&latency[phase], &metrics->latency[phase]);
+        }
+    }
+    
+    text_buffer_t text = { .arena = response->arena };
+    text_printf(&text, "# HELP nexos_http_requests_total Requests answered.\n"
+                       "# TYPE nexos_http_requests_total counter\n"
+                       "nexos_http_requests_total %llu\n", (unsigned long long)stats.request_count);
+    text_printf(&text, "# HELP nexos_http_responses_total Responses by status class.\n"
+                       "# TYPE nexos_http_responses_total counter\n");
+    for (int i = 1; i < METRICS_STATUS_CLASSES; i++) {
+        text_printf(&text, "nexos_http_responses_total{code=\"%dxx\"} %llu\n", i,
+                    (unsigned long long)responses[i]);
+    }
+    text_printf(&text, "# HELP nexos_http_errors_total Accept, socket and allocation failures.\n"
+                       "# TYPE nexos_http_errors_total counter\n"
+                       "nexos_http_errors_total %llu\n", (unsigned long long)stats.error_count);
+    text_printf(&text, "# HELP nexos_http_sent_bytes_total Response bytes written.\n"
+                       "# TYPE nexos_http_sent_bytes_total counter\n"
+                       "nexos_http_sent_bytes_total %llu\n", (unsigned long long)stats.bytes_sent);
+    text_printf(&text, "# HELP nexos_http_received_bytes_total Request bytes read.\n"
+                       "# TYPE nexos_http_received_bytes_total counter\n"
+                       "nexos_http_received_bytes_total %llu\n", (unsigned long long)stats.bytes_received);
+    text_printf(&text, "# HELP nexos_http_open_connections Client connections currently open.\n"
+                       "# TYPE nexos_http_open_connections gauge\n"
+                       "nexos_http_open_connections %llu\n", (unsigned long long)stats.open_connections);
+    text_printf(&text, "# HELP nexos_asset_cache_hits_total Requests answered from the asset cache.\n"
+                       "# TYPE nexos_asset_cache_hits_total counter\n"
+                       "nexos_asset_cache_hits_total %llu\n", (unsigned long long)stats.cache_hits);
+    text_printf(&text, "# HELP nexos_asset_cache_misses_total Asset cache lookups that missed.\n"
+                       "# TYPE nexos_asset_cache_misses_total counter\n"
+                       "nexos_asset_cache_misses_total %llu\n", (unsigned long long)stats.cache_misses);
+    text_printf(&text, "# HELP nexos_workers Event loop workers.\n"
+                       "# TYPE nexos_workers gauge\n"
+                       "nexos_workers %u\n", webserver_state.worker_count);
+    
+    /* Histogram buckets at powers of two from about 1us to 17s */
+    text_printf(&text, "# HELP nexos_http_request_duration_seconds Request latency by phase.\n"
+                       "# TYPE nexos_http_request_duration_seconds histogram\n");
+    for (int phase = 0; phase < METRICS_PHASE_COUNT; phase++) {
+        for (int bit = 10; bit <= 34; bit++) {
+            text_printf(&text, "nexos_http_request_duration_seconds_bucket{phase=\"%s\",le=\"%.9g\"} %llu\n",
+                        phases[phase], (double)(1ULL << bit) / 1e9,
+                        (unsigned long long)metrics_count_below(&latency[phase], 1ULL << bit));
+        }
+        text_printf(&text, "nexos_http_request_duration_seconds_bucket{phase=\"%s\",le=\"+Inf\"} %llu\n"
+                           "nexos_http_request_duration_seconds_sum{phase=\"%s\"} %.9f\n"
+                           "nexos_http_request_duration_seconds_count{phase=\"%s\"} %llu\n",
+                    phases[phase], (unsigned long long)latency[phase].count,
+                    phases[phase], (double)latency[phase].sum / 1e9,
+                    phases[phase], (unsigned long long)latency[phase].count);
+    }
+    
+    text_printf(&text, "# HELP nexos_http_request_duration_quantile_seconds Estimated latency quantiles by phase.\n"
+                       "# TYPE nexos_http_request_duration_quantile_seconds gauge\n");
+    for (int phase = 0; phase < METRICS_PHASE_COUNT; phase++) {
+        for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+            text_printf(&text, "nexos_http_request_duration_quantile_seconds{phase=\"%s\",quantile=\"%g\"} %.9f\n",
+                        phases[phase], quantiles[i],
+                        (double)metrics_percentile(&latency[phase], quantiles[i]) / 1e9);
+        }
+    }
+    
+    if (text.failed) {
+        response->failed = true;
+        return;
+    }
+    
+    response->body = text.data;
+    response->body_length = text.length;
+    add_header(response, "Content-Type", "text/plain; version=0.0.4");
+    add_header(response, "Cache-Control", "no-store");
+}
+
+/**
+ * Get MIME type based on file extension
+ */
+static const char* get_mime_type(const char* path) {
+    const char* ext = strrchr(path, '.');
+    if (!ext) return "application/octet-stream";
+    
+    ext++;  /* Skip the dot */
+    
+    if (strcasecmp(ext, "html") == 0 || strcasecmp(ext, "htm") == 0) return "text/html";
+    if (strcasecmp(ext, "txt") == 0) return "text/plain";
+    if (strcasecmp(ext, "css") == 0) return "text/css";
+    if (strcasecmp(ext, "js") == 0) return "application/javascript";
+    if (strcasecmp(ext, "json") == 0) return "application/json";
+    if (strcasecmp(ext, "xml") == 0) return "application/xml";
+    if (strcasecmp(ext, "jpg") == 0 || strcasecmp(ext, "jpeg") == 0) return "image/jpeg";
+    if (strcasecmp(ext, "png") == 0) return "image/png";
+    if (strcasecmp(ext, "gif") == 0) return "image/gif";
+    if (strcasecmp(ext, "svg") == 0) return "image/svg+xml";
+    if (strcasecmp(ext, "ico") == 0) return "image/x-icon";
+    if (strcasecmp(ext, "pdf") == 0) return "application/pdf";
+    if (strcasecmp(ext, "zip") == 0) return "application/zip";
+    
+    return "application/octet-stream";
+}
@@ -24,6 +24,7 @@ typedef enum {
     HTTP_STATUS_CREATED = 201,
     HTTP_STATUS_ACCEPTED = 202,
     HTTP_STATUS_NO_CONTENT = 204,
+    HTTP_STATUS_PARTIAL_CONTENT = 206,
     HTTP_STATUS_MOVED_PERMANENTLY = 301,
     HTTP_STATUS_FOUND = 302,
     HTTP_STATUS_NOT_MODIFIED = 304,
@@ -32,31 +33,106 @@ typedef enum {
     HTTP_STATUS_FORBIDDEN = 403,
     HTTP_STATUS_NOT_FOUND = 404,
     HTTP_STATUS_METHOD_NOT_ALLOWED = 405,
+    HTTP_STATUS_RANGE_NOT_SATISFIABLE = 416,
+    HTTP_STATUS_REQUEST_HEADER_FIELDS_TOO_LARGE = 431,
     HTTP_STATUS_INTERNAL_SERVER_ERROR = 500,
     HTTP_STATUS_NOT_IMPLEMENTED = 501,
     HTTP_STATUS_BAD_GATEWAY = 502,
     HTTP_STATUS_SERVICE_UNAVAILABLE = 503
 } http_status_t;
 
+/* Maximum number of request headers */
+#define HTTP_MAX_HEADERS 100
+
+/* Well-known request headers, resolved once while parsing */
+typedef enum {
+    HTTP_HEADER_OTHER,
+    HTTP_HEADER_HOST,
+    HTTP_HEADER_CONNECTION,
+    HTTP_HEADER_CONTENT_LENGTH,
+    HTTP_HEADER_TRANSFER_ENCODING,
+    HTTP_HEADER_IF_NONE_MATCH,
+    HTTP_HEADER_IF_MODIFIED_SINCE,
+    HTTP_HEADER_ACCEPT_ENCODING,
+    HTTP_HEADER_RANGE,
+    HTTP_HEADER_IF_RANGE
+} http_header_id_t;
+
+/* Content codings (bit flags) */
+typedef enum {
+    HTTP_ENCODING_IDENTITY = 0,
+    HTTP_ENCODING_GZIP = 1 << 0,
+    HTTP_ENCODING_BROTLI = 1 << 1
+} http_encoding_t;
+
+/* Byte range within the raw request head */
+typedef struct {
+    uint32_t offset;
+    uint32_t length;
+} http_view_t;
+
+/* Request header (views into the raw request head) */
+typedef struct {
+    http_view_t name;
+    http_view_t value;
+    http_header_id_t id;
+} http_header_t;
+
 /* HTTP request */
 typedef struct {
     http_method_t method;
-    char* path;
-    char* version;
-    char* headers[100][2];
+    const char* head;          /* Raw request head the views refer to */
+    char* path;                /* Decoded path, NUL-terminated inside the head */
+    http_view_t query;         /* Query string (without '?') */
+    uint8_t version_major;
+    uint8_t version_minor;
+    http_header_t headers[HTTP_MAX_HEADERS];
     int header_count;
+    uint32_t accept_encoding;  /* Acceptable HTTP_ENCODING_* codings */
     char* body;
     size_t body_length;
     int keep_alive;
 } http_request_t;
 
+struct asset;
+struct arena;
+
+/* Maximum number of byte ranges served in one response */
+#define HTTP_MAX_RANGES 8
+
+/* Response body segment: bytes in memory, or a range of body_fd if data is NULL */
+typedef struct {
+    const char* data;
+    uint64_t offset;
+    size_t length;
+} http_segment_t;
+
+/* Response header; name is a static string, value lives in the response arena */
+typedef struct {
+    const char* name;
+    const char* value;
+    uint16_t name_length;
+    uint16_t value_length;
+} http_response_header_t;
+
 /* HTTP response */
 typedef struct {
     http_status_t status;
-    char* headers[100][2];
-    int header_count;
-    char* body;
+    struct arena* arena;       /* Per-connection arena holding everything below */
+    http_response_header_t* headers;
+    uint16_t header_count;
+    uint16_t header_capacity;
+    bool failed;               /* An allocation failed while building the response */
+    const char* raw_headers;   /* Pre-rendered header lines sent before headers */
+    size_t raw_headers_length;
+    const char* body;
     size_t body_length;
+    struct asset* asset;       /* Cached asset owning body and raw_headers, if any */
+    bool keep_alive;           /* Whether the connection stays open */
+    bool body_is_file;         /* Body is streamed from body_fd instead of body */
+    int body_fd;               /* Open file streamed as the body */
+    http_segment_t segments[2 * HTTP_MAX_RANGES + 1];  /* Body layout (empty = whole body) */
+    uint32_t segment_count;
 } http_response_t;
 
 /* Web server configuration */
@@ -64,9 +140,26 @@ typedef struct {
     uint16_t port;
     char* webroot;
     uint32_t max_connections;
-    uint32_t timeout;
+    uint32_t timeout;          /* Idle connection timeout in ms (0 = none) */
+    uint32_t workers;          /* Event loop workers (0 = one per CPU) */
+    bool pin_workers;          /* Pin each worker to its own CPU */
+    size_t cache_size;         /* Static asset cache budget in bytes (0 = disabled) */
+    char* metrics_path;        /* Path serving Prometheus metrics (NULL = disabled) */
 } webserver_config_t;
 
+/* Web server statistics, summed over workers */
+typedef struct {
+    uint64_t request_count;
+    uint64_t error_count;
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    uint64_t open_connections;
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+    uint64_t completed_count;  /* Responses fully sent */
+    uint64_t latency_ns;       /* Total latency of the completed responses */
+} webserver_stats_t;
+
 /* Initialize web server */
 error_code_t webserver_init(webserver_config_t* config);
 
@@ -77,7 +170,7 @@ error_code_t webserver_start(void);
 error_code_t webserver_stop(void);
 
 /* Get web server statistics */
-error_code_t webserver_get_stats(void* stats);
+error_code_t webserver_get_stats(webserver_stats_t* stats);
 
 /* Self-optimization interface */
 error_code_t webserver_optimize(void);